@@ -5,11 +5,13 @@
 		private $authMethods;
         private $user;
         private $signature;
+        private $inBatch = false;
+        private $batchResult;
 
         public function __construct()
         {
             $this->methods     = array('createAccount');
-            $this->authMethods = array('login', 'addMachine', 'removeMachine', 'listAllMachines', 'addService', 'removeService', 'listAllServices');
+            $this->authMethods = array('login', 'addMachine', 'removeMachine', 'listAllMachines', 'addService', 'removeService', 'listAllServices', 'syncServices', 'batch', 'waitForChanges');
 
 			foreach($_GET as $k => $v)
 				$_GET[$k] = trim($v);
@@ -74,8 +76,45 @@
 
         public function out($arr)
         {
+            // Inside a batch each call's output is collected instead of sent
+            if($this->inBatch)
+            {
+                $this->batchResult = $arr;
+                throw new Exception('batch result');
+            }
+
+            $json = json_encode($arr);
+
+            // Strong ETag per encoding, either one satisfies If-None-Match since they name the same body
+            $tag  = md5($json);
+            $gzip = function_exists('gzencode') && isset($_SERVER['HTTP_ACCEPT_ENCODING']) && stripos($_SERVER['HTTP_ACCEPT_ENCODING'], 'gzip') !== false;
+            $etag = $gzip ? "\"$tag-gzip\"" : "\"$tag\"";
+
+            header('ETag: ' . $etag);
+            header('Cache-Control: private, must-revalidate');
+            header('Vary: Accept-Encoding');
+
+            if($_SERVER['REQUEST_METHOD'] == 'GET' && isset($_SERVER['HTTP_IF_NONE_MATCH']))
+            {
+                foreach(explode(',', $_SERVER['HTTP_IF_NONE_MATCH']) as $candidate)
+                {
+                    $candidate = trim($candidate);
+                    if($candidate == '*' || $candidate == "\"$tag\"" || $candidate == "\"$tag-gzip\"")
+                    {
+                        header('HTTP/1.1 304 Not Modified');
+                        exit;
+                    }
+                }
+            }
+
             //header('Content-Type: application/json');
-            echo json_encode($arr);
+            if($gzip)
+            {
+                $json = gzencode($json);
+                header('Content-Encoding: gzip');
+            }
+            header('Content-Length: ' . strlen($json));
+            echo $json;
             exit;
         }
 
@@ -144,6 +183,7 @@
 				$cpu->dt_updated = dater();
 				$cpu->update();
 			}
+			$this->bumpVersions(true, false);
 			$this->success();
         }
 
@@ -160,6 +200,7 @@
 				$cpu = new CPU($machine_id);
 				$cpu->delete();
 				$db->query("DELETE FROM hw_services WHERE cpu_id = '{$cpu->id}'");
+				$this->bumpVersions(true, true);
 				$this->success();
 			}
         }
@@ -193,6 +234,7 @@
 				$s->txt_record = $_POST['txt_record'];
 				$s->port       = $_POST['port'];
 				$s->insert();
+				$this->bumpVersions(false, true);
 				$this->success();
 			}
 		}
@@ -210,10 +252,147 @@
 				$type = $db->quote($_POST['type']);
 				$name = $db->quote($_POST['name']);
 				$db->query("DELETE FROM hw_services WHERE cpu_id = '$machine_id' AND `type` = $type AND `name` = $name");
+				$this->bumpVersions(false, true);
 				$this->success();
 			}
 		}
 		
+		// Applies a batch of service changes for one machine in a single request.
+		// "added" and "removed" are JSON arrays of {type, name[, txt_record, port]} with base64 type/name,
+		// exactly as addService and removeService take them. Re-adding an existing service replaces its row.
+		public function syncServices()
+		{
+			$this->requirePost('hostname');
+
+			$db = Database::getDatabase();
+			$machine_id = $db->getValue('SELECT id FROM hw_cpus WHERE hostname = ' . $db->quote($_POST['hostname']) . ' AND user_id = ' . $this->user->id);
+			if($machine_id === false)
+				$this->error('machine does not exist');
+
+			$added   = isset($_POST['added']) ? json_decode($_POST['added'], true) : array();
+			$removed = isset($_POST['removed']) ? json_decode($_POST['removed'], true) : array();
+			if(!is_array($added) || !is_array($removed))
+				$this->error('added and removed must be JSON arrays');
+
+			foreach(array_merge($removed, $added) as $s)
+			{
+				if(!isset($s['type']) || !isset($s['name'])) continue;
+				$type = $db->quote($s['type']);
+				$name = $db->quote($s['name']);
+				$db->query("DELETE FROM hw_services WHERE cpu_id = '$machine_id' AND `type` = $type AND `name` = $name");
+			}
+
+			$dt = dater();
+			foreach($added as $a)
+			{
+				if(!isset($a['type']) || !isset($a['name']) || !isset($a['port'])) continue;
+				$s = new Service();
+				$s->cpu_id     = $machine_id;
+				$s->dt         = $dt;
+				$s->type       = $a['type'];
+				$s->name       = $a['name'];
+				$s->txt_record = isset($a['txt_record']) ? $a['txt_record'] : '';
+				$s->port       = $a['port'];
+				$s->insert();
+			}
+
+			$this->bumpVersions(false, true);
+			$this->success();
+		}
+
+		// Runs several methods in one authenticated request.
+		// "calls" is a JSON array of {method, params}; params stand in for the GET and POST
+		// values the method normally reads. Results come back in the same order.
+		public function batch()
+		{
+			$this->requirePost('calls');
+
+			$calls = json_decode($_POST['calls'], true);
+			if(!is_array($calls))
+				$this->error('calls must be a JSON array');
+
+			$get = $_GET;
+			$results = array();
+			foreach($calls as $call)
+			{
+				$method = isset($call['method']) ? $call['method'] : '';
+				$params = (isset($call['params']) && is_array($call['params'])) ? $call['params'] : array();
+				if($method == 'batch' || $method == 'waitForChanges' || !in_array($method, $this->authMethods, true))
+				{
+					$results[] = array('error' => 'method not found');
+					continue;
+				}
+
+				$_POST = $params;
+				$_GET  = $get;
+				foreach($params as $k => $v)
+					$_GET[$k] = is_string($v) ? trim($v) : $v;
+				$_GET['method'] = $method;
+
+				$this->inBatch = true;
+				$this->batchResult = null;
+				try
+				{
+					$this->$method();
+				}
+				catch(Exception $e)
+				{
+					if(is_null($this->batchResult))
+						$this->batchResult = array('error' => $e->getMessage());
+				}
+				$this->inBatch = false;
+				$results[] = $this->batchResult;
+			}
+
+			$this->out(array('results' => $results));
+		}
+
+		// Long poll for changes to the user's machines and services. Holds the request open until
+		// the versions differ from the "since" token an earlier call returned, or "timeout" seconds pass.
+		// Without "since" it answers straight away, with the token to send next time.
+		public function waitForChanges()
+		{
+			$timeout = isset($_GET['timeout']) ? min(max(intval($_GET['timeout']), 0), 30) : 25;
+			$since   = isset($_GET['since']) ? explode('.', $_GET['since']) : array();
+			set_time_limit($timeout + 15);
+
+			$deadline = microtime(true) + $timeout;
+			while(true)
+			{
+				list($machines, $services) = $this->changeTokens();
+				$machinesChanged = count($since) == 2 && $since[0] != $machines;
+				$servicesChanged = count($since) == 2 && $since[1] != $services;
+				if($machinesChanged || $servicesChanged || count($since) != 2 || microtime(true) >= $deadline)
+					break;
+
+				// One primary key lookup a second per waiting client
+				sleep(1);
+			}
+
+			$this->out(array('token' => "$machines.$services", 'machinesChanged' => $machinesChanged, 'servicesChanged' => $servicesChanged));
+		}
+
+		// The user's machine and service versions, which every write to those rows bumps. Needs:
+		// ALTER TABLE hw_users ADD machines_version INT UNSIGNED NOT NULL DEFAULT 0, ADD services_version INT UNSIGNED NOT NULL DEFAULT 0;
+		// They stay out of the User object so its update() can't write back a stale count.
+		private function changeTokens()
+		{
+			$db = Database::getDatabase();
+			$row = $db->getRow('SELECT machines_version, services_version FROM hw_users WHERE id = ' . $this->user->id);
+			return array($row['machines_version'], $row['services_version']);
+		}
+
+		private function bumpVersions($machines, $services)
+		{
+			$set = array();
+			if($machines) $set[] = 'machines_version = machines_version + 1';
+			if($services) $set[] = 'services_version = services_version + 1';
+			if(count($set) == 0) return;
+
+			$db = Database::getDatabase();
+			$db->query('UPDATE hw_users SET ' . implode(', ', $set) . ' WHERE id = ' . $this->user->id);
+		}
+
 		public function listAllServices()
 		{
 			$this->requireGet('hostname');
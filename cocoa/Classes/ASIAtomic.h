@@ -0,0 +1,28 @@
+//
+//  ASIAtomic.h
+//  asi-http-request
+//
+
+#import <libkern/OSAtomic.h>
+
+// 64 bit loads and stores aren't atomic on 32 bit Macs, so they go through OSAtomic too
+
+static inline int64_t ASIAtomicLoad64(volatile int64_t *value)
+{
+	return OSAtomicAdd64Barrier(0, value);
+}
+
+// Returns the value that was replaced
+static inline int64_t ASIAtomicSwap64(volatile int64_t *value, int64_t newValue)
+{
+	int64_t oldValue;
+	do {
+		oldValue = *value;
+	} while (!OSAtomicCompareAndSwap64Barrier(oldValue, newValue, value));
+	return oldValue;
+}
+
+static inline void ASIAtomicStore64(volatile int64_t *value, int64_t newValue)
+{
+	ASIAtomicSwap64(value, newValue);
+}
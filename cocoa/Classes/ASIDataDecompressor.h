@@ -0,0 +1,37 @@
+//
+//  ASIDataDecompressor.h
+//  asi-http-request
+//
+
+#import <Foundation/Foundation.h>
+#import <zlib.h>
+
+// Inflates a gzip or deflate stream a piece at a time, so ASIHTTPRequest can uncompress a response as it arrives
+// Give it each piece of compressed data with setInput:length:, then call inflateIntoBuffer:length:error: until hasPendingOutput returns NO
+
+@interface ASIDataDecompressor : NSObject {
+	z_stream zStream;
+	BOOL streamReady;
+	
+	// YES when the last inflate filled the buffer it was given, so zlib may be holding more output for us
+	BOOL outputMayBePending;
+	
+	// YES once we've seen the end of the compressed stream
+	BOOL finished;
+}
++ (id)decompressor;
+
+// The bytes must stay valid until hasPendingOutput returns NO
+- (void)setInput:(const void *)bytes length:(NSUInteger)length;
+
+// YES while there is input left to inflate, or output zlib hasn't handed over yet
+- (BOOL)hasPendingOutput;
+
+// Inflates as much as fits into the buffer, returning the number of bytes written, or -1 if the data is corrupt
+- (NSInteger)inflateIntoBuffer:(void *)buffer length:(NSUInteger)length error:(NSError **)err;
+
+// Frees zlib's state, called automatically when the stream ends
+- (void)closeStream;
+
+@property (assign, readonly) BOOL finished;
+@end
@@ -0,0 +1,99 @@
+//
+//  ASIDataDecompressor.m
+//  asi-http-request
+//
+
+#import "ASIDataDecompressor.h"
+#import "ASIHTTPRequest.h"
+
+@interface ASIDataDecompressor ()
+- (BOOL)setupStream;
+@end
+
+@implementation ASIDataDecompressor
+
++ (id)decompressor
+{
+	ASIDataDecompressor *decompressor = [[[self alloc] init] autorelease];
+	if (![decompressor setupStream]) {
+		return nil;
+	}
+	return decompressor;
+}
+
+- (void)dealloc
+{
+	[self closeStream];
+	[super dealloc];
+}
+
+- (void)finalize
+{
+	[self closeStream];
+	[super finalize];
+}
+
+- (BOOL)setupStream
+{
+	zStream.zalloc = Z_NULL;
+	zStream.zfree = Z_NULL;
+	zStream.opaque = Z_NULL;
+	zStream.avail_in = 0;
+	zStream.next_in = Z_NULL;
+	
+	// +32 tells zlib to work out whether it's looking at gzip or zlib headers
+	streamReady = (inflateInit2(&zStream, (15+32)) == Z_OK);
+	return streamReady;
+}
+
+- (void)closeStream
+{
+	if (streamReady) {
+		inflateEnd(&zStream);
+		streamReady = NO;
+	}
+}
+
+- (void)setInput:(const void *)bytes length:(NSUInteger)length
+{
+	zStream.next_in = (Bytef *)bytes;
+	zStream.avail_in = (uInt)length;
+}
+
+- (BOOL)hasPendingOutput
+{
+	return streamReady && !finished && (zStream.avail_in > 0 || outputMayBePending);
+}
+
+- (NSInteger)inflateIntoBuffer:(void *)buffer length:(NSUInteger)length error:(NSError **)err
+{
+	if (!streamReady || finished) {
+		return 0;
+	}
+	zStream.next_out = (Bytef *)buffer;
+	zStream.avail_out = (uInt)length;
+	
+	int status = inflate(&zStream, Z_NO_FLUSH);
+	NSInteger inflated = length - zStream.avail_out;
+	outputMayBePending = (zStream.avail_out == 0);
+	
+	if (status == Z_STREAM_END) {
+		finished = YES;
+		[self closeStream];
+		
+	// Z_BUF_ERROR only means zlib couldn't make progress with what it had, more input will sort that out
+	} else if (status == Z_BUF_ERROR) {
+		outputMayBePending = NO;
+		
+	} else if (status != Z_OK) {
+		if (err) {
+			*err = [NSError errorWithDomain:NetworkRequestErrorDomain code:ASICompressionError userInfo:[NSDictionary dictionaryWithObjectsAndKeys:[NSString stringWithFormat:@"Decompression of the response failed with code %d",status],NSLocalizedDescriptionKey,nil]];
+		}
+		[self closeStream];
+		return -1;
+	}
+	return inflated;
+}
+
+@synthesize finished;
+@end
@@ -7,6 +7,7 @@
 //
 
 #import "ASIFormDataRequest.h"
+#import "ASIPostBodySegmentList.h"
 
 
 // Private stuff
@@ -143,7 +144,8 @@
 		[super buildPostBody];
 		return;
 	}	
-	if ([[self fileData] count] > 0) {
+	// Multipart bodies are sent straight from their parts, unless they have to be gzipped as a whole first
+	if ([[self fileData] count] > 0 && [self shouldCompressRequestBody]) {
 		[self setShouldStreamPostDataFromDisk:YES];
 	}
 	
@@ -175,7 +177,14 @@
 	
 	[self addRequestHeader:@"Content-Type" value:[NSString stringWithFormat:@"multipart/form-data; charset=%@; boundary=%@", charset, stringBoundary]];
 	
-	[self appendPostString:[NSString stringWithFormat:@"--%@\r\n",stringBoundary]];
+	// Keep the parts as segments, so headers go into small buffers and data and files are sent from where they are
+	if (![self shouldCompressRequestBody]) {
+		[self setPostBodySegments:[ASIPostBodySegmentList segmentList]];
+	}
+	
+	[self appendPostString:@"--"];
+	[self appendPostString:stringBoundary];
+	[self appendPostString:@"\r\n"];
 	
 	// Adds post data
 	NSString *endItemBoundary = [NSString stringWithFormat:@"\r\n--%@\r\n",stringBoundary];
@@ -183,7 +192,9 @@
 	NSString *key;
 	NSUInteger i=0;
 	while (key = [e nextObject]) {
-		[self appendPostString:[NSString stringWithFormat:@"Content-Disposition: form-data; name=\"%@\"\r\n\r\n",key]];
+		[self appendPostString:@"Content-Disposition: form-data; name=\""];
+		[self appendPostString:key];
+		[self appendPostString:@"\"\r\n\r\n"];
 		[self appendPostString:[[self postData] objectForKey:key]];
 		i++;
 		if (i != [[self postData] count] || [[self fileData] count] > 0) { //Only add the boundary if this is not the last item in the post body
@@ -200,8 +211,15 @@
 		NSString *contentType = [fileInfo objectForKey:@"contentType"];
 		NSString *fileName = [fileInfo objectForKey:@"fileName"];
 		
-		[self appendPostString:[NSString stringWithFormat:@"Content-Disposition: form-data; name=\"%@\"; filename=\"%@\"\r\n", key, fileName]];
-		[self appendPostString:[NSString stringWithFormat:@"Content-Type: %@; charset=%@\r\n\r\n", contentType, charset]];
+		[self appendPostString:@"Content-Disposition: form-data; name=\""];
+		[self appendPostString:key];
+		[self appendPostString:@"\"; filename=\""];
+		[self appendPostString:fileName];
+		[self appendPostString:@"\"\r\nContent-Type: "];
+		[self appendPostString:contentType];
+		[self appendPostString:@"; charset="];
+		[self appendPostString:charset];
+		[self appendPostString:@"\r\n\r\n"];
 		
 		if ([file isKindOfClass:[NSString class]]) {
 			[self appendPostDataFromFile:file];
@@ -215,7 +233,9 @@
 		}
 	}
 	
-	[self appendPostString:[NSString stringWithFormat:@"\r\n--%@--\r\n",stringBoundary]];
+	[self appendPostString:@"\r\n--"];
+	[self appendPostString:stringBoundary];
+	[self appendPostString:@"--\r\n"];
 	
 #if ASIHTTPREQUEST_DEBUG
 	[self addToDebugBody:@"==== End of multipart/form-data body ====\r\n"];
@@ -261,6 +281,11 @@
 #if ASIHTTPREQUEST_DEBUG
 	[self addToDebugBody:string];
 #endif
+	// Encoded straight into the segment list's header buffer, no intermediate NSData
+	if ([self postBodySegments]) {
+		[[self postBodySegments] appendString:string encoding:[self stringEncoding]];
+		return;
+	}
 	[super appendPostData:[string dataUsingEncoding:[self stringEncoding]]];
 }
 
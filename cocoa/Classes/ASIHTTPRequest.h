@@ -33,7 +33,8 @@ typedef enum _ASINetworkErrorType {
     ASIInternalErrorWhileApplyingCredentialsType  = 7,
 	ASIFileManagementError = 8,
 	ASITooMuchRedirectionErrorType = 9,
-	ASIUnhandledExceptionError = 10
+	ASIUnhandledExceptionError = 10,
+	ASICompressionError = 11
 	
 } ASINetworkErrorType;
 
@@ -45,6 +46,15 @@ extern NSString* const NetworkRequestErrorDomain;
 // This number is not official, as far as I know there is no officially documented bandwidth limit
 extern unsigned long const ASIWWANBandwidthThrottleAmount;
 
+@class ASIDataDecompressor;
+@class ASIPostBodySegmentList;
+@class ASIHTTPRequest;
+
+// Takes the body of a response as it arrives, see responseDataConsumer
+@protocol ASIHTTPRequestDataConsumer
+- (void)request:(ASIHTTPRequest *)request didReceiveBytes:(const void *)bytes length:(NSUInteger)length;
+@end
+
 @interface ASIHTTPRequest : NSOperation {
 	
 	// The url for this operation, should include GET params in the query string where appropriate
@@ -85,6 +95,11 @@ extern unsigned long const ASIWWANBandwidthThrottleAmount;
 	// Used for reading from the post body when sending the request
 	NSInputStream *postBodyReadStream;
 	
+	// When set, the request body is sent straight from these segments, and appendPostData: and appendPostDataFromFile: add to them rather than copying
+	// Data appended this way is referenced, not copied, and must not be changed until the request has finished
+	// Used by ASIFormDataRequest for multipart bodies. Segmented bodies aren't compressed, even when shouldCompressRequestBody is YES
+	ASIPostBodySegmentList *postBodySegments;
+	
 	// Dictionary for custom HTTP request headers
 	NSMutableDictionary *requestHeaders;
 	
@@ -112,6 +127,10 @@ extern unsigned long const ASIWWANBandwidthThrottleAmount;
 	// If allowCompressedResponse is true, requests will inform the server they can accept compressed data, and will automatically decompress gzipped responses. Default is true.
 	BOOL allowCompressedResponse;
 	
+	// When false (the default), compressed responses are inflated as they arrive, straight into memory or the download file
+	// When true, they are stored compressed and inflated in one go by responseData, or by a second pass over the file
+	BOOL shouldWaitToInflateCompressedResponses;
+	
 	// If shouldCompressRequestBody is true, the request body will be gzipped. Default is false.
 	// You will probably need to enable this feature on your webserver to make this work. Tested with apache only.
 	BOOL shouldCompressRequestBody;
@@ -156,7 +175,7 @@ extern unsigned long const ASIWWANBandwidthThrottleAmount;
 	// Whether we've seen the headers of the response yet
     BOOL haveExaminedHeaders;
 	
-	// Data we receive will be stored here. Data may be compressed unless allowCompressedResponse is false - you should use [request responseData] instead in most cases
+	// Data we receive will be stored here. Data may be compressed if shouldWaitToInflateCompressedResponses is true - you should use [request responseData] instead in most cases
 	NSMutableData *rawResponseData;
 	
 	// Used for sending and receiving data
@@ -243,8 +262,18 @@ extern unsigned long const ASIWWANBandwidthThrottleAmount;
 	// Called on the delegate when the request fails
 	SEL didFailSelector;
 	
-	// Used for recording when something last happened during the request, we will compare this value with the current date to time out requests when appropriate
-	NSDate *lastActivityTime;
+	// If set, the body (after any decompression) is handed to this object piece by piece as it arrives, on the thread the request runs on
+	// It isn't kept in rawResponseData, so responseData will be empty unless you're also downloading to a file
+	id <ASIHTTPRequestDataConsumer> responseDataConsumer;
+	
+	// Used for recording when something last happened during the request (an absolute time, 0 while waiting for credentials), we will compare this value with the current time to time out requests when appropriate
+	NSTimeInterval lastActivityTime;
+	
+	// When the last attempt opened its stream, had a connection, saw the first bytes of the response and reached its end (absolute times, 0 until reached)
+	NSTimeInterval streamOpenedTime;
+	NSTimeInterval connectedTime;
+	NSTimeInterval firstByteTime;
+	NSTimeInterval completedTime;
 	
 	// Number of seconds to wait before timing out - default is 10
 	NSTimeInterval timeOutSeconds;
@@ -315,6 +344,54 @@ extern unsigned long const ASIWWANBandwidthThrottleAmount;
 	// This only affects credentials stored in the session cache when useSessionPersistance is YES. Credentials from the keychain are never presented unless the server asks for them
 	// Default is YES
 	BOOL shouldPresentCredentialsBeforeChallenge;
+	
+	// When YES, a finished request leaves its connection open so the next request to the same server can use it instead of connecting again
+	// Only GET and HEAD requests use an idle connection, as they are retried on a new one if the server has closed it; POST and the rest always connect afresh
+	// Default is YES
+	BOOL shouldAttemptPersistentConnection;
+	
+	// Number of seconds an idle connection is kept open after this request finishes with it. A shorter timeout in the server's Keep-Alive header wins
+	// Default is 60
+	NSTimeInterval persistentConnectionTimeoutSeconds;
+	
+	// Set when reading the response headers, YES when the server will leave the connection open once the response is complete
+	BOOL connectionCanBeReused;
+	
+	// YES when this request is running on a connection left open by an earlier request
+	BOOL didReuseConnection;
+	
+	// Number of times this request was restarted because the server closed the reused connection it picked up
+	int retryCount;
+	
+	// Details of the pooled connection this request is using (id, host, port and scheme)
+	NSMutableDictionary *connectionInfo;
+	
+	// NSOperation state when running on the network thread, see isExecuting and isFinished
+	BOOL executing;
+	BOOL finished;
+	
+	// The tick of the timeout wheel this request is filed under, or 0 when it isn't in the wheel
+	unsigned long long timeoutTick;
+	
+	// YES while our stream is unscheduled because all requests together have used up the bandwidth allowance
+	BOOL readStreamIsPausedForBandwidth;
+	
+	// Pooled chunks holding a response that came without a Content-Length, and how much of the last one is used
+	// They are copied into rawResponseData when the response is complete
+	NSMutableArray *responseChunks;
+	NSUInteger lastResponseChunkLength;
+	
+	// Set when the first bytes of the body arrive, once we've decided where they should go
+	BOOL didPrepareResponseStorage;
+	
+	// YES when rawResponseData was allocated at the size given by the Content-Length
+	BOOL didPresizeResponseData;
+	
+	// Inflates a compressed response as it arrives
+	ASIDataDecompressor *responseDecompressor;
+	
+	// Number of buffers allocated to receive the response body
+	unsigned int responseAllocationCount;
 }
 
 #pragma mark init / dealloc
@@ -357,12 +434,20 @@ extern unsigned long const ASIWWANBandwidthThrottleAmount;
 #pragma mark running a request
 
 // Run a request asynchronously by adding it to the global queue
-// (Use [request start] for a synchronous request)
+// Requests are concurrent operations that run on the network thread, so [request start] returns straight away
 - (void)startAsynchronous;
 
+// The thread every request's stream is scheduled on. Stream events, timeouts and progress updates for all requests are handled here
++ (NSThread *)networkThread;
+
+// When YES, each request runs a run loop of its own on its operation queue thread instead, checking for timeouts every quarter of a second
+// Only change this while no requests are running. It's kept for comparing the two, see HWHTTPCoreBenchmark
++ (BOOL)usesRequestThreads;
++ (void)setUsesRequestThreads:(BOOL)flag;
+
 #pragma mark request logic
 
-// Main request loop is in here
+// Starts the stream and hands the request over to stream events and the timeout wheel
 - (void)loadRequest;
 
 // Start the read stream. Called by loadRequest, and again to restart the request when authentication is needed
@@ -531,6 +616,18 @@ extern unsigned long const ASIWWANBandwidthThrottleAmount;
 // Only works on Mac OS, will always return 'application/octet-stream' on iPhone
 + (NSString *)mimeTypeForFileAtPath:(NSString *)path;
 
+#pragma mark persistent connections
+
+// Closes idle connections that have passed their timeout. Called before every request, you shouldn't need to call this yourself
++ (void)expirePersistentConnections;
+
+// Closes every idle connection, eg after the network configuration changed
++ (void)closePersistentConnections;
+
+// Number of connections opened so far, and number of requests that ran on a connection left open by an earlier request
++ (unsigned long)persistentConnectionsCreated;
++ (unsigned long)persistentConnectionsReused;
+
 #pragma mark bandwidth measurement / throttling
 
 // The maximum number of bytes ALL requests can send / receive in a second
@@ -538,7 +635,7 @@ extern unsigned long const ASIWWANBandwidthThrottleAmount;
 + (unsigned long)maxBandwidthPerSecond;
 + (void)setMaxBandwidthPerSecond:(unsigned long)bytes;
 
-// Get a rough average (for the last 5 seconds) of how much bandwidth is being used, in bytes
+// Get a rough average (for the last 5 seconds, weighted towards the latest) of how much bandwidth is being used, in bytes
 + (unsigned long)averageBandwidthUsedPerSecond;
 
 // Will return YES is bandwidth throttling is currently in use
@@ -560,7 +657,7 @@ extern unsigned long const ASIWWANBandwidthThrottleAmount;
 + (void)reachabilityChanged:(NSNotification *)note;
 #endif
 
-// Returns the maximum amount of data we can read as part of the current measurement period, and sleeps this thread if our allowance is used up
+// Returns how much of a request body can be sent right now without going over the limit, 0 when the allowance is used up
 + (unsigned long)maxUploadReadLength;
 
 #pragma mark miscellany 
@@ -597,6 +694,7 @@ extern unsigned long const ASIWWANBandwidthThrottleAmount;
 @property (assign) SEL didStartSelector;
 @property (assign) SEL didFinishSelector;
 @property (assign) SEL didFailSelector;
+@property (retain) id <ASIHTTPRequestDataConsumer> responseDataConsumer;
 @property (retain,readonly) NSString *authenticationRealm;
 @property (retain,readonly) NSString *proxyAuthenticationRealm;
 @property (retain) NSError *error;
@@ -620,13 +718,22 @@ extern unsigned long const ASIWWANBandwidthThrottleAmount;
 @property (retain) ASIHTTPRequest *mainRequest;
 @property (assign) BOOL showAccurateProgress;
 @property (assign,readonly) unsigned long long totalBytesRead;
+@property (assign,readonly) unsigned int responseAllocationCount;
+
+// How long the last attempt spent in each phase, 0 for a phase it didn't reach
+// CFNetwork resolves the host name as part of connecting, so the lookup is included in connectDuration, which is 0 when an open connection was reused
+@property (assign,readonly) NSTimeInterval connectDuration;
+@property (assign,readonly) NSTimeInterval firstByteDuration;
+@property (assign,readonly) NSTimeInterval downloadDuration;
 @property (assign,readonly) unsigned long long totalBytesSent;
 @property (assign) NSStringEncoding defaultResponseEncoding;
 @property (assign,readonly) NSStringEncoding responseEncoding;
 @property (assign) BOOL allowCompressedResponse;
+@property (assign) BOOL shouldWaitToInflateCompressedResponses;
 @property (assign) BOOL allowResumeForFileDownloads;
 @property (retain) NSDictionary *userInfo;
 @property (retain) NSString *postBodyFilePath;
+@property (retain) ASIPostBodySegmentList *postBodySegments;
 @property (assign) BOOL shouldStreamPostDataFromDisk;
 @property (assign) BOOL didCreateTemporaryPostDataFile;
 @property (assign) BOOL useHTTPVersionOne;
@@ -646,4 +753,9 @@ extern unsigned long const ASIWWANBandwidthThrottleAmount;
 @property (assign, readonly) int proxyAuthenticationRetryCount;
 @property (assign) BOOL haveBuiltRequestHeaders;
 @property (assign, nonatomic) BOOL haveBuiltPostBody;
+@property (assign) BOOL shouldAttemptPersistentConnection;
+@property (assign) NSTimeInterval persistentConnectionTimeoutSeconds;
+@property (assign, readonly) BOOL connectionCanBeReused;
+@property (assign, readonly) BOOL didReuseConnection;
+@property (assign, readonly) int retryCount;
 @end
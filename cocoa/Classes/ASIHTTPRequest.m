@@ -12,6 +12,7 @@
 
 #import "ASIHTTPRequest.h"
 #import <zlib.h>
+#import "ASIAtomic.h"
 #if TARGET_OS_IPHONE
 #import "Reachability.h"
 #import "ASIAuthenticationDialog.h"
@@ -19,6 +20,9 @@
 #import <SystemConfiguration/SystemConfiguration.h>
 #endif
 #import "ASIInputStream.h"
+#import "ASIPostBodySegmentList.h"
+#import "ASIDataDecompressor.h"
+#import "ASINetworkQueue.h"
 
 
 // We use our own custom run loop mode as CoreAnimation seems to want to hijack our threads otherwise
@@ -54,20 +58,63 @@ static NSError *ASIAuthenticationError;
 static NSError *ASIUnableToCreateRequestError;
 static NSError *ASITooMuchRedirectionError;
 
-static NSMutableArray *bandwidthUsageTracker = nil;
-static unsigned long averageBandwidthUsedPerSecond = 0;
+// Bandwidth measurement and throttling don't take any locks, as every read and write goes through them
+// Counters are updated with atomic operations, and anything else is only written by whichever thread wins a compare-and-swap
 
-// Records how much bandwidth all requests combined have used in the last second
-static unsigned long bandwidthUsedInLastSecond = 0; 
+// Records how much bandwidth all requests combined have used in the current second
+static volatile int64_t bandwidthUsedInCurrentPeriod = 0;
 
-// A date one second in the future from the time it was created
-static NSDate *bandwidthMeasurementDate = nil;
+// The second (since the reference date) that bandwidthUsedInCurrentPeriod is for
+static volatile int64_t bandwidthPeriod = 0;
 
-// Since throttling variables are shared among all requests, we'll use a lock to mediate access
-static NSLock *bandwidthThrottlingLock = nil;
+// Bytes used in each of the last few seconds, oldest first from bandwidthHistoryCount
+// Written by the thread that closes each second, see recordBandwidthUsage
+#define ASIBandwidthHistoryLength 5
+static unsigned long bandwidthHistory[ASIBandwidthHistoryLength];
+
+// Slots ever written to bandwidthHistory. Threads claim their slots by adding to it atomically, so the
+// threads closing two seconds in quick succession can't write to the same slot
+static volatile int64_t bandwidthHistoryCount = 0;
+
+// Weight of the latest second in averageBandwidthUsedPerSecond
+static const double ASIBandwidthAverageWeight = 0.5;
 
 // the maximum number of bytes that can be transmitted in one second
-static unsigned long maxBandwidthPerSecond = 0;
+static volatile unsigned long maxBandwidthPerSecond = 0;
+
+// Throttling uses a token bucket holding up to a second's worth of bytes
+// Every byte sent or received takes a token, and the request that takes the bucket below zero waits for it to refill, see measureBandwidthUsage and pauseForBandwidth
+static volatile int64_t bandwidthTokens = 0;
+
+// When the bucket was last refilled, in microseconds since the reference date
+static volatile int64_t bandwidthTokensRefilledAt = 0;
+
+// Requests whose streams are unscheduled until the bucket refills. Only the network thread touches this
+static NSMutableSet *throttledRequests = nil;
+
+// Adds tokens for the time since the last refill, up to a second's worth
+static void ASIRefillBandwidthTokens(void)
+{
+	int64_t limit = maxBandwidthPerSecond;
+	if (!limit) {
+		return;
+	}
+	int64_t now = (int64_t)(CFAbsoluteTimeGetCurrent()*1000000);
+	int64_t refilledAt = ASIAtomicLoad64(&bandwidthTokensRefilledAt);
+	int64_t elapsed = now-refilledAt;
+	
+	// Somebody else has just done it
+	if (elapsed <= 0 || !OSAtomicCompareAndSwap64Barrier(refilledAt, now, &bandwidthTokensRefilledAt)) {
+		return;
+	}
+	if (elapsed > 1000000) {
+		elapsed = 1000000;
+	}
+	int64_t tokens = OSAtomicAdd64Barrier(elapsed*limit/1000000, &bandwidthTokens);
+	while (tokens > limit && !OSAtomicCompareAndSwap64Barrier(tokens, limit, &bandwidthTokens)) {
+		tokens = ASIAtomicLoad64(&bandwidthTokens);
+	}
+}
 
 // A default figure for throttling bandwidth on mobile devices
 unsigned long const ASIWWANBandwidthThrottleAmount = 14800;
@@ -76,11 +123,11 @@ unsigned long const ASIWWANBandwidthThrottleAmount = 14800;
 // YES when bandwidth throttling is active
 // This flag does not denote whether throttling is turned on - rather whether it is currently in use
 // It will be set to NO when throttling was turned on with setShouldThrottleBandwidthForWWAN, but a WI-FI connection is active
-static BOOL isBandwidthThrottled = NO;
+static volatile BOOL isBandwidthThrottled = NO;
 
 // When YES, bandwidth will be automatically throttled when using WWAN (3G/Edge/GPRS)
 // Wifi will not be throttled
-static BOOL shouldThrottleBandwithForWWANOnly = NO;
+static volatile BOOL shouldThrottleBandwithForWWANOnly = NO;
 #endif
 
 // Mediates access to the session cookies so requests
@@ -95,6 +142,54 @@ static NSRecursiveLock *delegateAuthenticationLock = nil;
 
 static NSOperationQueue *sharedRequestQueue = nil;
 
+// Connections kept open for reuse, and connections in use by a request that may be kept open when it finishes
+// Each entry is a dictionary with the connection id, host, port and scheme. Idle connections also have the stream that last used them and the date they expire
+static NSMutableArray *persistentConnectionsPool = nil;
+
+// Mediates access to the pool and the counters below
+static NSRecursiveLock *connectionsLock = nil;
+
+// Used to tag the streams of each connection, see configurePersistentConnection
+static unsigned long nextConnectionNumberToCreate = 0;
+
+static unsigned long persistentConnectionsCreated = 0;
+static unsigned long persistentConnectionsReused = 0;
+
+// The most idle connections we'll keep open to a single server
+static const NSUInteger ASIMaxIdleConnectionsPerHost = 4;
+
+// All requests schedule their streams on this thread's run loop, see +networkThread
+static NSThread *networkThread = nil;
+static CFRunLoopRef networkRunLoop = NULL;
+
+// When YES, requests run a run loop each on their operation queue thread instead, see +setUsesRequestThreads:
+static BOOL usesRequestThreads = NO;
+
+// Timeouts are kept in a wheel of slots a quarter of a second apart, which the network thread moves through on a timer
+// A request is filed in the slot its timeout falls due in. When the slot comes round, a request that has seen activity since is moved on to a later slot instead of timing out
+// Only the network thread touches the wheel
+static const NSTimeInterval ASITimeoutWheelTickInterval = 0.25;
+static const NSUInteger ASITimeoutWheelSlots = 64;
+static NSMutableArray *timeoutWheel = nil;
+static unsigned long long timeoutWheelTick = 0;
+static NSUInteger timeoutWheelCount = 0;
+static NSTimer *timeoutWheelTimer = nil;
+
+// Running requests that are polled on each tick of the wheel, as there's no stream event for the request body going out, and progress delegates are only updated once a tick
+static NSMutableSet *progressRequests = nil;
+
+// Responses without a Content-Length are read into chunks of this size, which go back to a shared pool when the request is done with them
+#define ASIResponseChunkSize 65536
+static const NSUInteger ASIMaxPooledResponseChunks = 32;
+static NSMutableArray *responseChunkPool = nil;
+static OSSpinLock responseChunkPoolLock = OS_SPINLOCK_INIT;
+
+// Largest read we make when the response is going straight into a buffer sized from its Content-Length
+static const CFIndex ASIMaxReadLength = 262144;
+
+// Content-Length beyond which we don't trust the server enough to allocate the whole response up front
+static const unsigned long long ASIMaxPresizedResponseLength = 32 * 1024 * 1024;
+
 static BOOL isiPhoneOS2;
 
 // Private stuff
@@ -105,13 +200,40 @@ static BOOL isiPhoneOS2;
 - (BOOL)askDelegateForProxyCredentials;
 + (void)measureBandwidthUsage;
 + (void)recordBandwidthUsage;
++ (void)performBandwidthThrottling;
+- (void)pauseForBandwidth;
+- (CFReadStreamRef)configurePersistentConnection;
+- (void)returnPersistentConnection;
+- (void)removePersistentConnection;
+- (CFRunLoopRef)streamRunLoop;
+- (void)performSelectorOnNetworkThread:(SEL)selector;
+- (void)markAsFinished;
+- (void)runRequestLoop;
+- (void)followRedirect;
+- (void)updateProgressFromStream;
+- (BOOL)hasTimedOutAt:(NSTimeInterval)now;
+- (void)checkTimeoutAt:(NSTimeInterval)now;
+- (void)scheduleTimeout;
+- (void)unscheduleTimeout;
+- (void)handleAuthenticationChallenge;
+- (void)applyCredentialsOnAuthenticationThread;
++ (void)runNetworkThread:(NSConditionLock *)ready;
++ (void)advanceTimeoutWheel:(NSTimer *)timer;
+- (NSMutableData *)takeResponseChunk;
+- (void)returnResponseChunk:(NSMutableData *)chunk;
+- (void)collectResponseChunks;
+- (void)discardResponseChunks;
+- (UInt8 *)responseChunkSpace:(NSUInteger *)space;
+- (void)writeDownloadedBytes:(const void *)bytes length:(NSUInteger)length;
+- (void)deliverResponseBytes:(const void *)bytes length:(NSUInteger)length;
+- (BOOL)inflateReceivedBytes:(const UInt8 *)bytes length:(NSUInteger)length;
 
 @property (assign) BOOL complete;
 @property (retain) NSDictionary *responseHeaders;
 @property (retain) NSArray *responseCookies;
 @property (assign) int responseStatusCode;
 @property (retain) NSMutableData *rawResponseData;
-@property (retain, nonatomic) NSDate *lastActivityTime;
+@property (assign, nonatomic) NSTimeInterval lastActivityTime;
 @property (assign) unsigned long long contentLength;
 @property (assign) unsigned long long partialDownloadSize;
 @property (assign, nonatomic) unsigned long long uploadBufferSize;
@@ -135,6 +257,13 @@ static BOOL isiPhoneOS2;
 @property (retain) NSString *authenticationRealm;
 @property (retain) NSString *proxyAuthenticationRealm;
 @property (retain) NSString *responseStatusMessage;
+@property (assign) BOOL connectionCanBeReused;
+@property (assign) BOOL didReuseConnection;
+@property (assign) int retryCount;
+@property (retain) NSMutableDictionary *connectionInfo;
+@property (retain, nonatomic) NSMutableArray *responseChunks;
+@property (assign) unsigned int responseAllocationCount;
+@property (retain, nonatomic) ASIDataDecompressor *responseDecompressor;
 @end
 
 
@@ -146,11 +275,14 @@ static BOOL isiPhoneOS2;
 {
 	if (self == [ASIHTTPRequest class]) {
 		progressLock = [[NSRecursiveLock alloc] init];
-		bandwidthThrottlingLock = [[NSLock alloc] init];
 		sessionCookiesLock = [[NSRecursiveLock alloc] init];
 		sessionCredentialsLock = [[NSRecursiveLock alloc] init];
 		delegateAuthenticationLock = [[NSRecursiveLock alloc] init];
-		bandwidthUsageTracker = [[NSMutableArray alloc] initWithCapacity:5];
+		connectionsLock = [[NSRecursiveLock alloc] init];
+		persistentConnectionsPool = [[NSMutableArray alloc] init];
+		progressRequests = [[NSMutableSet alloc] init];
+		throttledRequests = [[NSMutableSet alloc] init];
+		responseChunkPool = [[NSMutableArray alloc] init];
 		ASIRequestTimedOutError = [[NSError errorWithDomain:NetworkRequestErrorDomain code:ASIRequestTimedOutErrorType userInfo:[NSDictionary dictionaryWithObjectsAndKeys:@"The request timed out",NSLocalizedDescriptionKey,nil]] retain];	
 		ASIAuthenticationError = [[NSError errorWithDomain:NetworkRequestErrorDomain code:ASIAuthenticationErrorType userInfo:[NSDictionary dictionaryWithObjectsAndKeys:@"Authentication needed",NSLocalizedDescriptionKey,nil]] retain];
 		ASIRequestCancelledError = [[NSError errorWithDomain:NetworkRequestErrorDomain code:ASIRequestCancelledErrorType userInfo:[NSDictionary dictionaryWithObjectsAndKeys:@"The request was cancelled",NSLocalizedDescriptionKey,nil]] retain];
@@ -184,6 +316,8 @@ static BOOL isiPhoneOS2;
 	[self setUseSessionPersistance:YES];
 	[self setUseCookiePersistance:YES];
 	[self setValidatesSecureCertificate:YES];
+	[self setShouldAttemptPersistentConnection:YES];
+	[self setPersistentConnectionTimeoutSeconds:60];
 	[self setRequestCookies:[[[NSMutableArray alloc] init] autorelease]];
 	[self setDidStartSelector:@selector(requestStarted:)];
 	[self setDidFinishSelector:@selector(requestFinished:)];
@@ -236,9 +370,11 @@ static BOOL isiPhoneOS2;
 	[proxyCredentials release];
 	[url release];
 	[authenticationLock release];
-	[lastActivityTime release];
 	[responseCookies release];
 	[rawResponseData release];
+	[responseChunks release];
+	[responseDecompressor release];
+	[responseDataConsumer release];
 	[responseHeaders release];
 	[requestMethod release];
 	[cancelledLock release];
@@ -246,8 +382,10 @@ static BOOL isiPhoneOS2;
 	[compressedPostBodyFilePath release];
 	[postBodyWriteStream release];
 	[postBodyReadStream release];
+	[postBodySegments release];
 	[PACurl release];
 	[responseStatusMessage release];
+	[connectionInfo release];
 	[super dealloc];
 }
 
@@ -270,8 +408,12 @@ static BOOL isiPhoneOS2;
 		return;
 	}
 	
+	// Are we sending the request body straight from its segments
+	if ([self postBodySegments]) {
+		[self setPostLength:[[self postBodySegments] length]];
+		
 	// Are we submitting the request body from a file on disk
-	if ([self postBodyFilePath]) {
+	} else if ([self postBodyFilePath]) {
 		
 		// If we were writing to the post body via appendPostData or appendPostDataFromFile, close the write stream
 		if ([self postBodyWriteStream]) {
@@ -334,6 +476,10 @@ static BOOL isiPhoneOS2;
 
 - (void)appendPostData:(NSData *)data
 {
+	if ([self postBodySegments]) {
+		[[self postBodySegments] appendData:data];
+		return;
+	}
 	[self setupPostBody];
 	if ([data length] == 0) {
 		return;
@@ -347,6 +493,13 @@ static BOOL isiPhoneOS2;
 
 - (void)appendPostDataFromFile:(NSString *)file
 {
+	if ([self postBodySegments]) {
+		NSError *err = nil;
+		if (![[self postBodySegments] appendFileAtPath:file error:&err]) {
+			[self failWithError:err];
+		}
+		return;
+	}
 	[self setupPostBody];
 	NSInputStream *stream = [[[NSInputStream alloc] initWithFileAtPath:file] autorelease];
 	[stream open];
@@ -383,9 +536,49 @@ static BOOL isiPhoneOS2;
 
 #pragma mark get information about this request
 
+- (BOOL)isConcurrent
+{
+	return !usesRequestThreads;
+}
+
+- (BOOL)isExecuting
+{
+	if (usesRequestThreads) {
+		return [super isExecuting];
+	}
+	return executing;
+}
+
 - (BOOL)isFinished 
 {
-	return [self complete];
+	if (usesRequestThreads) {
+		return [self complete];
+	}
+	return finished;
+}
+
+// Tells the queue we're done as soon as the request finishes or fails, so the next request can start right away
+- (void)markAsFinished
+{
+	if (usesRequestThreads) {
+		return;
+	}
+	[[self cancelledLock] lock];
+	if (!finished) {
+		[self willChangeValueForKey:@"isExecuting"];
+		[self willChangeValueForKey:@"isFinished"];
+		executing = NO;
+		finished = YES;
+		[self didChangeValueForKey:@"isExecuting"];
+		[self didChangeValueForKey:@"isFinished"];
+	}
+	[[self cancelledLock] unlock];
+	
+	// Requests cancelled from another thread are dropped from the wheel when their slot comes round
+	if ([NSThread currentThread] == networkThread) {
+		[self unscheduleTimeout];
+		[progressRequests removeObject:self];
+	}
 }
 
 
@@ -400,7 +593,13 @@ static BOOL isiPhoneOS2;
 	
 	[self failWithError:ASIRequestCancelledError];
 	[self setComplete:YES];
-	[self cancelLoad];
+	
+	// The stream belongs to the network thread, so it has to be closed there
+	if (usesRequestThreads || !networkThread || [NSThread currentThread] == networkThread) {
+		[self cancelLoad];
+	} else {
+		[self performSelectorOnNetworkThread:@selector(cancelLoad)];
+	}
 	[[self cancelledLock] unlock];
 	
 	// Must tell the operation to cancel after we unlock, as this request might be dealloced and then NSLock will log an error
@@ -429,7 +628,7 @@ static BOOL isiPhoneOS2;
 
 - (NSData *)responseData
 {	
-	if ([self isResponseCompressed]) {
+	if ([self isResponseCompressed] && ![self responseDecompressor]) {
 		return [ASIHTTPRequest uncompressZippedData:[self rawResponseData]];
 	} else {
 		return [self rawResponseData];
@@ -439,18 +638,100 @@ static BOOL isiPhoneOS2;
 #pragma mark running a request
 
 // Run a request asynchronously by adding it to the global queue
-// (Use [request start] for a synchronous request)
 - (void)startAsynchronous
 {
 	[[ASIHTTPRequest sharedRequestQueue] addOperation:self];
 }
 
+// Hands the request over to the network thread, so the queue's thread is free again straight away
+- (void)start
+{
+	if (usesRequestThreads) {
+		[super start];
+		return;
+	}
+	[[self cancelledLock] lock];
+	if ([self isCancelled] || finished) {
+		[[self cancelledLock] unlock];
+		[self markAsFinished];
+		return;
+	}
+	[self willChangeValueForKey:@"isExecuting"];
+	executing = YES;
+	[self didChangeValueForKey:@"isExecuting"];
+	[[self cancelledLock] unlock];
+	
+	[self performSelectorOnNetworkThread:@selector(main)];
+}
+
++ (NSThread *)networkThread
+{
+	@synchronized(self) {
+		if (!networkThread) {
+			NSConditionLock *ready = [[[NSConditionLock alloc] initWithCondition:0] autorelease];
+			networkThread = [[NSThread alloc] initWithTarget:self selector:@selector(runNetworkThread:) object:ready];
+			[networkThread setName:@"ASIHTTPRequest network thread"];
+			[networkThread start];
+			
+			// Wait for the run loop, so streams can be scheduled on it as soon as we return
+			[ready lockWhenCondition:1];
+			[ready unlock];
+		}
+	}
+	return networkThread;
+}
+
++ (void)runNetworkThread:(NSConditionLock *)ready
+{
+	NSAutoreleasePool *pool = [[NSAutoreleasePool alloc] init];
+	[ready lock];
+	networkRunLoop = CFRunLoopGetCurrent();
+	
+	// The run loop would return straight away while no streams are scheduled if it had no source of its own
+	[[NSRunLoop currentRunLoop] addPort:[NSMachPort port] forMode:(NSString *)ASIHTTPRequestRunMode];
+	[ready unlockWithCondition:1];
+	[pool release];
+	
+	while (YES) {
+		pool = [[NSAutoreleasePool alloc] init];
+		[[NSRunLoop currentRunLoop] runMode:(NSString *)ASIHTTPRequestRunMode beforeDate:[NSDate distantFuture]];
+		[pool release];
+	}
+}
+
+- (void)performSelectorOnNetworkThread:(SEL)selector
+{
+	[self performSelector:selector onThread:[ASIHTTPRequest networkThread] withObject:nil waitUntilDone:NO modes:[NSArray arrayWithObject:(NSString *)ASIHTTPRequestRunMode]];
+}
+
+// The run loop our stream is scheduled on
+- (CFRunLoopRef)streamRunLoop
+{
+	if (usesRequestThreads) {
+		return CFRunLoopGetCurrent();
+	}
+	return networkRunLoop;
+}
+
++ (BOOL)usesRequestThreads
+{
+	return usesRequestThreads;
+}
+
++ (void)setUsesRequestThreads:(BOOL)flag
+{
+	usesRequestThreads = flag;
+}
+
 
 #pragma mark request logic
 
 // Create the request
 - (void)main
 {
+	if ([self isCancelled]) {
+		return;
+	}
 	
 	NSAutoreleasePool *pool = [[NSAutoreleasePool alloc] init];
 	
@@ -618,7 +899,7 @@ static BOOL isiPhoneOS2;
 	}
 	
 	// Configure a compressed request body
-	if ([self shouldCompressRequestBody]) {
+	if ([self shouldCompressRequestBody] && ![self postBodySegments]) {
 		[self addRequestHeader:@"Content-Encoding" value:@"gzip"];
 	}
 	
@@ -637,6 +918,12 @@ static BOOL isiPhoneOS2;
 
 - (void)startRequest
 {
+	// When restarting after an authentication challenge we're on the thread that asked for credentials, but the stream belongs on the network thread
+	if (!usesRequestThreads && [NSThread currentThread] != networkThread) {
+		[self performSelectorOnNetworkThread:@selector(startRequest)];
+		return;
+	}
+	
 	[[self cancelledLock] lock];
 	
 	if ([self isCancelled]) {
@@ -663,13 +950,27 @@ static BOOL isiPhoneOS2;
 		[self resetDownloadProgress:0];
 	}
 	[self setResponseHeaders:nil];
+	[self setConnectionCanBeReused:NO];
+	readStreamIsPausedForBandwidth = NO;
+	[self discardResponseChunks];
+	[self setResponseDecompressor:nil];
+	didPrepareResponseStorage = NO;
+	didPresizeResponseData = NO;
+	[self setResponseAllocationCount:0];
 	if (![self downloadDestinationPath]) {
 		[self setRawResponseData:[[[NSMutableData alloc] init] autorelease]];
     }
     // Create the stream for the request
 	
+	// Is the request body made up of segments we send from where they are
+	if ([self postBodySegments]) {
+		[self setPostBodyReadStream:[ASIInputStream inputStreamWithSegments:[self postBodySegments]]];
+		if ([self postBodyReadStream]) {
+			readStream = CFReadStreamCreateForStreamedHTTPRequest(kCFAllocatorDefault, request,(CFReadStreamRef)[self postBodyReadStream]);
+		}
+		
 	// Do we need to stream the request body from disk
-	if ([self shouldStreamPostDataFromDisk] && [self postBodyFilePath] && [[NSFileManager defaultManager] fileExistsAtPath:[self postBodyFilePath]]) {
+	} else if ([self shouldStreamPostDataFromDisk] && [self postBodyFilePath] && [[NSFileManager defaultManager] fileExistsAtPath:[self postBodyFilePath]]) {
 		
 		// Are we gzipping the request body?
 		if ([self compressedPostBodyFilePath] && [[NSFileManager defaultManager] fileExistsAtPath:[self compressedPostBodyFilePath]]) {
@@ -774,18 +1075,41 @@ static BOOL isiPhoneOS2;
     }
     
     // Schedule the stream
-    CFReadStreamScheduleWithRunLoop(readStream, CFRunLoopGetCurrent(), ASIHTTPRequestRunMode);
+    CFReadStreamScheduleWithRunLoop(readStream, [self streamRunLoop], ASIHTTPRequestRunMode);
+	
+	// Pick up an idle connection to the same server if there is one
+	CFReadStreamRef oldStream = NULL;
+	if ([self shouldAttemptPersistentConnection]) {
+		oldStream = [self configurePersistentConnection];
+	}
+	
+	streamOpenedTime = CFAbsoluteTimeGetCurrent();
+	connectedTime = oldStream ? streamOpenedTime : 0;
+	firstByteTime = 0;
+	completedTime = 0;
     
     // Start the HTTP connection
     if (!CFReadStreamOpen(readStream)) {
         CFReadStreamSetClient(readStream, 0, NULL, NULL);
-        CFReadStreamUnscheduleFromRunLoop(readStream, CFRunLoopGetCurrent(), ASIHTTPRequestRunMode);
+        CFReadStreamUnscheduleFromRunLoop(readStream, [self streamRunLoop], ASIHTTPRequestRunMode);
         CFRelease(readStream);
         readStream = NULL;
+		if (oldStream) {
+			CFReadStreamClose(oldStream);
+			CFRelease(oldStream);
+		}
+		[self removePersistentConnection];
 		[[self cancelledLock] unlock];
 		[self failWithError:[NSError errorWithDomain:NetworkRequestErrorDomain code:ASIInternalErrorWhileBuildingRequestType userInfo:[NSDictionary dictionaryWithObjectsAndKeys:@"Unable to start HTTP connection",NSLocalizedDescriptionKey,nil]]];
         return;
     }
+	
+	// The stream that last used this connection was kept open until now so that ours could take the connection over
+	// See http://lists.apple.com/archives/Macnetworkprog/2006/Mar/msg00119.html
+	if (oldStream) {
+		CFReadStreamClose(oldStream);
+		CFRelease(oldStream);
+	}
 	[[self cancelledLock] unlock];
 	
 	
@@ -803,15 +1127,29 @@ static BOOL isiPhoneOS2;
 		[self resetUploadProgress:amount];
 	}	
 	// Record when the request started, so we can timeout if nothing happens
-	[self setLastActivityTime:[NSDate date]];	
+	[self setLastActivityTime:CFAbsoluteTimeGetCurrent()];
+	
+	// A queue only needs progress from us while we run when it is showing accurate progress, otherwise it hears from us once we finish
+	if (!usesRequestThreads && ([self postLength] || [self uploadProgressDelegate] || [self downloadProgressDelegate] || ([self showAccurateProgress] && [[self queue] respondsToSelector:@selector(incrementDownloadProgressBy:)]))) {
+		[progressRequests addObject:self];
+	}
 }
 
-// This is the 'main loop' for the request. Basically, it runs the runloop that our network stuff is attached to, and checks to see if we should cancel or timeout
+// Starts the stream. From here on requests on the network thread are driven by stream events and the timeout wheel
 - (void)loadRequest
 {
 	[self startRequest];
 	
+	if (usesRequestThreads) {
+		[self runRequestLoop];
+	} else if (![self complete]) {
+		[self scheduleTimeout];
+	}
+}
 
+// This is the 'main loop' for a request running on its own thread. Basically, it runs the runloop that our network stuff is attached to, and checks to see if we should cancel or timeout
+- (void)runRequestLoop
+{
 	// Wait for the request to finish
 	while (!complete) {
 		
@@ -829,57 +1167,25 @@ static BOOL isiPhoneOS2;
 		// This may take a while, so we'll create a new pool each cycle to stop a giant backlog of autoreleased objects building up
 		NSAutoreleasePool *pool = [[NSAutoreleasePool alloc] init];
 		
-		
-		NSDate *now = [NSDate date];
-		
 		// See if we need to timeout
-		if (lastActivityTime && timeOutSeconds > 0 && [now timeIntervalSinceDate:lastActivityTime] > timeOutSeconds) {
-			
-			// Prevent timeouts before 128KB* has been sent when the size of data to upload is greater than 128KB* (*32KB on iPhone 3.0 SDK)
-			// This is to workaround the fact that kCFStreamPropertyHTTPRequestBytesWrittenCount is the amount written to the buffer, not the amount actually sent
-			// This workaround prevents erroneous timeouts in low bandwidth situations (eg iPhone)
-			if (totalBytesSent || postLength <= uploadBufferSize || (uploadBufferSize > 0 && totalBytesSent > uploadBufferSize)) {
-				[self failWithError:ASIRequestTimedOutError];
-				[self cancelLoad];
-				[self setComplete:YES];
-				[[self cancelledLock] unlock];
-				[pool release];
-				break;
-			}
+		if ([self hasTimedOutAt:CFAbsoluteTimeGetCurrent()]) {
+			[self failWithError:ASIRequestTimedOutError];
+			[self cancelLoad];
+			[self setComplete:YES];
+			[[self cancelledLock] unlock];
+			[pool release];
+			break;
 		}
 		
 		// Do we need to redirect?
 		if ([self needsRedirect]) {
-			[self cancelLoad];
-			[self setNeedsRedirect:NO];
-			[self setRedirectCount:[self redirectCount]+1];
-			if ([self redirectCount] > RedirectionLimit) {
-				// Some naughty / badly coded website is trying to force us into a redirection loop. This is not cool.
-				[self failWithError:ASITooMuchRedirectionError];
-				[self setComplete:YES];
-				[[self cancelledLock] unlock];
-			} else {
-				[[self cancelledLock] unlock];
-				// Go all the way back to the beginning and build the request again, so that we can apply any new cookies
-				
-				[self main];
-			}
+			[[self cancelledLock] unlock];
+			[self followRedirect];
 			[pool release];
 			break;
 		}
-	
 		
-		// Find out if we've sent any more data than last time, and reset the timeout if so
-		if (totalBytesSent > lastBytesSent) {
-			[self setLastActivityTime:[NSDate date]];
-			[self setLastBytesSent:totalBytesSent];
-		}
-
-		// Find out how much data we've uploaded so far
-		[self setTotalBytesSent:[[(NSNumber *)CFReadStreamCopyProperty(readStream, kCFStreamPropertyHTTPRequestBytesWrittenCount) autorelease] unsignedLongLongValue]];
-			
-		
-		[self updateProgressIndicators];
+		[self updateProgressFromStream];
 		
 		// Measure bandwidth used, and throttle if nescessary
 		[ASIHTTPRequest measureBandwidthUsage];
@@ -896,19 +1202,176 @@ static BOOL isiPhoneOS2;
 
 }
 
+- (void)followRedirect
+{
+	[[self cancelledLock] lock];
+	if ([self isCancelled] || [self complete] || ![self needsRedirect]) {
+		[[self cancelledLock] unlock];
+		return;
+	}
+	[self cancelLoad];
+	[self setNeedsRedirect:NO];
+	[self setRedirectCount:[self redirectCount]+1];
+	if ([self redirectCount] > RedirectionLimit) {
+		// Some naughty / badly coded website is trying to force us into a redirection loop. This is not cool.
+		[self failWithError:ASITooMuchRedirectionError];
+		[self setComplete:YES];
+		[[self cancelledLock] unlock];
+		return;
+	}
+	[[self cancelledLock] unlock];
+	
+	// Go all the way back to the beginning and build the request again, so that we can apply any new cookies
+	[self main];
+}
+
+// Stream events don't tell us how much of the request body has gone out, so we ask the stream
+- (void)updateProgressFromStream
+{
+	[[self cancelledLock] lock];
+	if ([self isCancelled] || [self complete]) {
+		[[self cancelledLock] unlock];
+		return;
+	}
+	
+	// The stream is left alone while another thread is finding credentials for it
+	if (readStream && lastActivityTime) {
+		// Find out if we've sent any more data than last time, and reset the timeout if so
+		if (totalBytesSent > lastBytesSent) {
+			[self setLastActivityTime:CFAbsoluteTimeGetCurrent()];
+			[self setLastBytesSent:totalBytesSent];
+		}
+		
+		// Find out how much data we've uploaded so far
+		[self setTotalBytesSent:[[(NSNumber *)CFReadStreamCopyProperty(readStream, kCFStreamPropertyHTTPRequestBytesWrittenCount) autorelease] unsignedLongLongValue]];
+	}
+	
+	[self updateProgressIndicators];
+	[[self cancelledLock] unlock];
+}
+
+#pragma mark timeouts
+
+- (BOOL)hasTimedOutAt:(NSTimeInterval)now
+{
+	if (!lastActivityTime || timeOutSeconds <= 0 || now - lastActivityTime <= timeOutSeconds) {
+		return NO;
+	}
+	
+	// Prevent timeouts before 128KB* has been sent when the size of data to upload is greater than 128KB* (*32KB on iPhone 3.0 SDK)
+	// This is to workaround the fact that kCFStreamPropertyHTTPRequestBytesWrittenCount is the amount written to the buffer, not the amount actually sent
+	// This workaround prevents erroneous timeouts in low bandwidth situations (eg iPhone)
+	return (totalBytesSent || postLength <= uploadBufferSize || (uploadBufferSize > 0 && totalBytesSent > uploadBufferSize));
+}
+
+// Called by the timeout wheel when our slot comes round
+- (void)checkTimeoutAt:(NSTimeInterval)now
+{
+	[[self cancelledLock] lock];
+	if ([self isCancelled] || [self complete]) {
+		[[self cancelledLock] unlock];
+		return;
+	}
+	if ([self hasTimedOutAt:now]) {
+		[self failWithError:ASIRequestTimedOutError];
+		[self cancelLoad];
+		[self setComplete:YES];
+	} else {
+		[self scheduleTimeout];
+	}
+	[[self cancelledLock] unlock];
+}
+
+// Files the request under the tick its timeout falls due in. Requests without a timeout (or waiting for credentials) are looked at once per turn of the wheel
+- (void)scheduleTimeout
+{
+	[self unscheduleTimeout];
+	
+	if (!timeoutWheel) {
+		timeoutWheel = [[NSMutableArray alloc] initWithCapacity:ASITimeoutWheelSlots];
+		NSUInteger i;
+		for (i=0; i<ASITimeoutWheelSlots; i++) {
+			[timeoutWheel addObject:[NSMutableSet set]];
+		}
+	}
+	
+	NSTimeInterval remaining = ASITimeoutWheelTickInterval*ASITimeoutWheelSlots;
+	if (lastActivityTime && timeOutSeconds > 0) {
+		remaining = lastActivityTime+timeOutSeconds-CFAbsoluteTimeGetCurrent();
+	}
+	unsigned long long ticks = 1;
+	if (remaining > ASITimeoutWheelTickInterval) {
+		ticks = (unsigned long long)ceil(remaining/ASITimeoutWheelTickInterval);
+	}
+	timeoutTick = timeoutWheelTick+ticks;
+	[[timeoutWheel objectAtIndex:timeoutTick%ASITimeoutWheelSlots] addObject:self];
+	timeoutWheelCount++;
+	
+	if (!timeoutWheelTimer) {
+		timeoutWheelTimer = [[NSTimer timerWithTimeInterval:ASITimeoutWheelTickInterval target:[ASIHTTPRequest class] selector:@selector(advanceTimeoutWheel:) userInfo:nil repeats:YES] retain];
+		[[NSRunLoop currentRunLoop] addTimer:timeoutWheelTimer forMode:(NSString *)ASIHTTPRequestRunMode];
+	}
+}
+
+- (void)unscheduleTimeout
+{
+	if (timeoutTick) {
+		[[timeoutWheel objectAtIndex:timeoutTick%ASITimeoutWheelSlots] removeObject:self];
+		timeoutTick = 0;
+		timeoutWheelCount--;
+	}
+}
+
++ (void)advanceTimeoutWheel:(NSTimer *)timer
+{
+	NSAutoreleasePool *pool = [[NSAutoreleasePool alloc] init];
+	
+	timeoutWheelTick++;
+	NSTimeInterval now = CFAbsoluteTimeGetCurrent();
+	
+	// Requests filed under a later turn of the wheel stay where they are
+	NSMutableSet *slot = [timeoutWheel objectAtIndex:timeoutWheelTick%ASITimeoutWheelSlots];
+	for (ASIHTTPRequest *theRequest in [[slot copy] autorelease]) {
+		if (theRequest->timeoutTick == timeoutWheelTick) {
+			[theRequest unscheduleTimeout];
+			[theRequest checkTimeoutAt:now];
+		}
+	}
+	
+	for (ASIHTTPRequest *theRequest in [[progressRequests copy] autorelease]) {
+		[theRequest updateProgressFromStream];
+		if ([theRequest isCancelled] || [theRequest complete]) {
+			[progressRequests removeObject:theRequest];
+		}
+	}
+	
+	[self performBandwidthThrottling];
+	
+	// Nothing left to time out, the thread can sleep until the next request starts
+	if (!timeoutWheelCount && ![progressRequests count]) {
+		[timeoutWheelTimer invalidate];
+		[timeoutWheelTimer release];
+		timeoutWheelTimer = nil;
+	}
+	
+	[pool release];
+}
+
 // Cancel loading and clean up. DO NOT USE THIS TO CANCEL REQUESTS - use [request cancel] instead
 - (void)cancelLoad
 {
     if (readStream) {
 		CFReadStreamSetClient(readStream, kCFStreamEventNone, NULL, NULL);
-		CFReadStreamUnscheduleFromRunLoop(readStream, CFRunLoopGetCurrent(), ASIHTTPRequestRunMode);
+		CFReadStreamUnscheduleFromRunLoop(readStream, [self streamRunLoop], ASIHTTPRequestRunMode);
 		CFReadStreamClose(readStream);
 		CFRelease(readStream);
 		readStream = NULL;
     }
+	[self removePersistentConnection];
 	
 	[[self postBodyReadStream] close];
 	
+	[self discardResponseChunks];
     if ([self rawResponseData]) {
 		[self setRawResponseData:nil];
 	
@@ -1062,15 +1525,8 @@ static BOOL isiPhoneOS2;
 	// We will remove this from any progress display, as kCFStreamPropertyHTTPRequestBytesWrittenCount does not tell us how much data has actually be written
 	if (totalBytesSent > 0 && uploadBufferSize == 0 && totalBytesSent != postLength) {
 		[self setUploadBufferSize:totalBytesSent];
-		SEL selector = @selector(setUploadBufferSize:);
-		if ([queue respondsToSelector:selector]) {
-			NSMethodSignature *signature = nil;
-			signature = [[queue class] instanceMethodSignatureForSelector:selector];
-			NSInvocation *invocation = [NSInvocation invocationWithMethodSignature:signature];
-			[invocation setTarget:queue];
-			[invocation setSelector:selector];
-			[invocation setArgument:&totalBytesSent atIndex:2];
-			[invocation invoke];
+		if ([queue respondsToSelector:@selector(setUploadBufferSize:)]) {
+			[queue setUploadBufferSize:totalBytesSent];
 		}
 	}
 	
@@ -1083,8 +1539,8 @@ static BOOL isiPhoneOS2;
 	
 		
 	// Update the progress queue, if we have one
-	SEL selector = @selector(incrementUploadProgressBy:);
-	if ([queue respondsToSelector:selector]) {
+	// The queue only adds the bytes to its counters, it passes them on to its own progress delegates at a rate of its choosing
+	if ([queue respondsToSelector:@selector(incrementUploadProgressBy:)]) {
 		unsigned long long value = 0;
 		if (showAccurateProgress) {
 			if (totalBytesSent == postLength || lastBytesSent > 0) {
@@ -1096,14 +1552,9 @@ static BOOL isiPhoneOS2;
 			value = 1;
 			[self setUpdatedProgress:YES];
 		}
-		
-		NSMethodSignature *signature = nil;
-		signature = [[queue class] instanceMethodSignatureForSelector:selector];
-		NSInvocation *invocation = [NSInvocation invocationWithMethodSignature:signature];
-		[invocation setTarget:queue];
-		[invocation setSelector:selector];
-		[invocation setArgument:&value atIndex:2];
-		[invocation invoke];
+		if (value) {
+			[queue incrementUploadProgressBy:value];
+		}
 	}
 
 	// Update this request's own upload progress delegate
@@ -1129,14 +1580,8 @@ static BOOL isiPhoneOS2;
 	[progressLock lock];	
 	
 	// Reset download progress for this request in the queue
-	SEL selector = @selector(incrementDownloadSizeBy:);
-	if ([queue respondsToSelector:selector]) {
-		NSMethodSignature *signature = [[queue class] instanceMethodSignatureForSelector:selector];
-		NSInvocation *invocation = [NSInvocation invocationWithMethodSignature:signature];
-		[invocation setTarget:queue];
-		[invocation setSelector:selector];
-		[invocation setArgument:&value atIndex:2];
-		[invocation invoke];
+	if ([queue respondsToSelector:@selector(incrementDownloadSizeBy:)]) {
+		[queue incrementDownloadSizeBy:value];
 	}
 	
 	// Request this request's own download progress delegate
@@ -1155,11 +1600,7 @@ static BOOL isiPhoneOS2;
 		unsigned long long bytesReadSoFar = totalBytesRead+partialDownloadSize;
 
 		// We're using a progress queue or compatible controller to handle progress
-		SEL selector = @selector(incrementDownloadProgressBy:);
 		if ([queue respondsToSelector:@selector(incrementDownloadProgressBy:)]) {
-			
-			NSAutoreleasePool *thePool = [[NSAutoreleasePool alloc] init];
-			
 			unsigned long long value = 0;
 			if ([self showAccurateProgress] && [self contentLength]) {
 				value = bytesReadSoFar-[self lastBytesRead];
@@ -1167,16 +1608,9 @@ static BOOL isiPhoneOS2;
 				value = 1;
 				[self setUpdatedProgress:YES];
 			}
-			
-			
-			NSMethodSignature *signature = [[queue class] instanceMethodSignatureForSelector:selector];
-			NSInvocation *invocation = [NSInvocation invocationWithMethodSignature:signature];
-			[invocation setTarget:queue];
-			[invocation setSelector:selector];
-			[invocation setArgument:&value atIndex:2];
-			[invocation invoke];
-			
-			[thePool release];
+			if (value) {
+				[queue incrementDownloadProgressBy:value];
+			}
 		}
 			
 		if (downloadProgressDelegate) {
@@ -1202,17 +1636,9 @@ static BOOL isiPhoneOS2;
 {
 	
 	// We're using a progress queue or compatible controller to handle progress
-	SEL selector = @selector(decrementUploadProgressBy:);
-	if ([queue respondsToSelector:selector]) {
+	if ([queue respondsToSelector:@selector(decrementUploadProgressBy:)]) {
 		unsigned long long value = 0-lastBytesSent;
-		
-		NSMethodSignature *signature = [[queue class] instanceMethodSignatureForSelector:selector];
-		NSInvocation *invocation = [NSInvocation invocationWithMethodSignature:signature];
-		[invocation setTarget:queue];
-		[invocation setSelector:selector];
-		[invocation setArgument:&value atIndex:2];
-		[invocation invoke];
-		
+		[queue decrementUploadProgressBy:value];
 	}
 	
 	if (uploadProgressDelegate) {
@@ -1277,6 +1703,7 @@ static BOOL isiPhoneOS2;
 - (void)requestFinished
 {
 	if ([self error] || [self mainRequest]) {
+		[self markAsFinished];
 		return;
 	}
 	// Let the queue know we are done
@@ -1288,6 +1715,7 @@ static BOOL isiPhoneOS2;
 	if ([self didFinishSelector] && [[self delegate] respondsToSelector:[self didFinishSelector]]) {
 		[[self delegate] performSelectorOnMainThread:[self didFinishSelector] withObject:self waitUntilDone:[NSThread isMainThread]];		
 	}
+	[self markAsFinished];
 }
 
 // Subclasses might override this method to perform error handling in the same thread
@@ -1297,6 +1725,7 @@ static BOOL isiPhoneOS2;
 	[self setComplete:YES];
 	
 	if ([self isCancelled] || [self error]) {
+		[self markAsFinished];
 		return;
 	}
 	
@@ -1323,6 +1752,7 @@ static BOOL isiPhoneOS2;
 			[[self delegate] performSelectorOnMainThread:[self didFailSelector] withObject:self waitUntilDone:[NSThread isMainThread]];	
 		}
 	}
+	[self markAsFinished];
 }
 
 #pragma mark parsing HTTP response headers
@@ -1341,6 +1771,28 @@ static BOOL isiPhoneOS2;
 		CFRelease(headerFields);
 		[self setResponseStatusCode:CFHTTPMessageGetResponseStatusCode(headers)];
 		[self setResponseStatusMessage:[(NSString *)CFHTTPMessageCopyResponseStatusLine(headers) autorelease]];
+		
+		// Work out if the server will leave the connection open once this response is complete
+		// HTTP/1.1 connections stay open unless the server says otherwise, HTTP/1.0 ones only when it asks for it
+		// A response that ends when the connection closes can't be followed by another one on the same connection
+		NSString *connectionHeader = [[[self responseHeaders] objectForKey:@"Connection"] lowercaseString];
+		NSString *httpVersion = [(NSString *)CFHTTPMessageCopyVersion(headers) autorelease];
+		BOOL hasBodyLength = ([[self responseHeaders] objectForKey:@"Content-Length"] || [[[[self responseHeaders] objectForKey:@"Transfer-Encoding"] lowercaseString] isEqualToString:@"chunked"] || [[self requestMethod] isEqualToString:@"HEAD"] || [self responseStatusCode] == 204 || [self responseStatusCode] == 304);
+		if ([connectionHeader isEqualToString:@"close"] || !hasBodyLength) {
+			[self setConnectionCanBeReused:NO];
+		} else {
+			[self setConnectionCanBeReused:([httpVersion isEqualToString:(NSString *)kCFHTTPVersion1_1] || [connectionHeader isEqualToString:@"keep-alive"])];
+		}
+		
+		NSString *keepAliveHeader = [[self responseHeaders] objectForKey:@"Keep-Alive"];
+		if (keepAliveHeader) {
+			int serverTimeout = 0;
+			NSScanner *keepAliveScanner = [NSScanner scannerWithString:keepAliveHeader];
+			[keepAliveScanner scanUpToString:@"timeout=" intoString:NULL];
+			if ([keepAliveScanner scanString:@"timeout=" intoString:NULL] && [keepAliveScanner scanInt:&serverTimeout] && serverTimeout < [self persistentConnectionTimeoutSeconds]) {
+				[self setPersistentConnectionTimeoutSeconds:serverTimeout];
+			}
+		}
 
 		// Is the server response a challenge for credentials?
 		isAuthenticationChallenge = ([self responseStatusCode] == 401);
@@ -1441,6 +1893,7 @@ static BOOL isiPhoneOS2;
 					if ([self responseStatusCode] == 303) {
 						[self setRequestMethod:@"GET"];
 						[self setPostBody:nil];
+						[self setPostBodySegments:nil];
 						[self setPostLength:0];
 						[self setRequestHeaders:nil];
 					}
@@ -1778,7 +2231,7 @@ static BOOL isiPhoneOS2;
 				}
 			}
 			
-			[self setLastActivityTime:nil];
+			[self setLastActivityTime:0];
 			
 			if ([self askDelegateForProxyCredentials]) {
 				[self attemptToApplyProxyCredentialsAndResume];
@@ -1920,6 +2373,29 @@ static BOOL isiPhoneOS2;
 	return NO;
 }
 
+// Finding credentials may mean waiting for the delegate or the user, so on the network thread it's done on a thread of its own rather than holding up every other request
+// The stream stays open so the challenge can be read from it, but won't send us any more events
+- (void)handleAuthenticationChallenge
+{
+	if (usesRequestThreads) {
+		[self attemptToApplyCredentialsAndResume];
+		return;
+	}
+	if (readStream) {
+		CFReadStreamSetClient(readStream, kCFStreamEventNone, NULL, NULL);
+		CFReadStreamUnscheduleFromRunLoop(readStream, [self streamRunLoop], ASIHTTPRequestRunMode);
+	}
+	[self setLastActivityTime:0];
+	[NSThread detachNewThreadSelector:@selector(applyCredentialsOnAuthenticationThread) toTarget:self withObject:nil];
+}
+
+- (void)applyCredentialsOnAuthenticationThread
+{
+	NSAutoreleasePool *pool = [[NSAutoreleasePool alloc] init];
+	[self attemptToApplyCredentialsAndResume];
+	[pool release];
+}
+
 - (void)attemptToApplyCredentialsAndResume
 {
 	if ([self error] || [self isCancelled]) {
@@ -1986,7 +2462,7 @@ static BOOL isiPhoneOS2;
 			
 			
 			
-			[self setLastActivityTime:nil];
+			[self setLastActivityTime:0];
 			
 			if ([self askDelegateForCredentials]) {
 				[self attemptToApplyCredentialsAndResume];
@@ -2083,6 +2559,23 @@ static BOOL isiPhoneOS2;
 }
 
 
+#pragma mark phase timings
+
+- (NSTimeInterval)connectDuration
+{
+	return connectedTime ? connectedTime-streamOpenedTime : 0;
+}
+
+- (NSTimeInterval)firstByteDuration
+{
+	return firstByteTime ? firstByteTime-(connectedTime ? connectedTime : streamOpenedTime) : 0;
+}
+
+- (NSTimeInterval)downloadDuration
+{
+	return completedTime ? completedTime-firstByteTime : 0;
+}
+
 #pragma mark stream status handlers
 
 
@@ -2097,6 +2590,12 @@ static BOOL isiPhoneOS2;
 	
     // Dispatch the stream events.
     switch (type) {
+        case kCFStreamEventOpenCompleted:
+			if (!connectedTime) {
+				connectedTime = CFAbsoluteTimeGetCurrent();
+			}
+            break;
+            
         case kCFStreamEventHasBytesAvailable:
             [self handleBytesAvailable];
             break;
@@ -2115,101 +2614,295 @@ static BOOL isiPhoneOS2;
 	
 	[[self cancelledLock] unlock];
 	
+	// Redirects are followed as soon as we've seen the headers
+	if (!usesRequestThreads && [self needsRedirect]) {
+		[self followRedirect];
+	}
 }
 
 
 - (void)handleBytesAvailable
 {
+	if (!firstByteTime) {
+		firstByteTime = CFAbsoluteTimeGetCurrent();
+	}
 	if (![self responseHeaders]) {
 		if ([self readResponseHeadersReturningAuthenticationFailure]) {
-			[self attemptToApplyCredentialsAndResume];
+			[self handleAuthenticationChallenge];
 			return;
 		}
 	}
 	if ([self needsRedirect]) {
 		return;
 	}
-	long long bufferSize = 2048;
-	if (contentLength > 262144) {
-		bufferSize = 65536;
-	} else if (contentLength > 65536) {
-		bufferSize = 16384;
+	// The first bytes of the body decide where the rest go
+	if (!didPrepareResponseStorage) {
+		didPrepareResponseStorage = YES;
+		
+		// A resumed download has the start of the compressed stream in the file already, so it's inflated in one go at the end
+		if ([self isResponseCompressed] && ![self shouldWaitToInflateCompressedResponses] && !([self downloadDestinationPath] && [self allowResumeForFileDownloads])) {
+			[self setResponseDecompressor:[ASIDataDecompressor decompressor]];
+			
+		} else if (![self downloadDestinationPath] && ![self responseDataConsumer] && contentLength > 0 && contentLength <= ASIMaxPresizedResponseLength) {
+			[self setRawResponseData:[[[NSMutableData alloc] initWithCapacity:(NSUInteger)contentLength] autorelease]];
+			[self setResponseAllocationCount:[self responseAllocationCount]+1];
+			didPresizeResponseData = YES;
+		}
+	}
+	
+	// Work out where this read goes: a pooled scratch chunk when the bytes are going to a file or a consumer or need inflating,
+	// the end of rawResponseData when it was sized from the Content-Length,
+	// or the last of our chunks when we don't know how big the response will be
+	NSMutableData *scratchChunk = nil;
+	UInt8 *buffer;
+	CFIndex bufferSize;
+	NSUInteger dataLength = 0;
+	if ([self downloadDestinationPath] || [self responseDataConsumer] || [self responseDecompressor]) {
+		scratchChunk = [self takeResponseChunk];
+		buffer = [scratchChunk mutableBytes];
+		bufferSize = ASIResponseChunkSize;
+	} else if (didPresizeResponseData) {
+		dataLength = [rawResponseData length];
+		bufferSize = (CFIndex)MIN(ASIMaxReadLength, (long long)contentLength - (long long)dataLength);
+		if (bufferSize <= 0) {
+			// More than the server said it would send, rawResponseData will have to grow
+			bufferSize = ASIResponseChunkSize;
+			[self setResponseAllocationCount:[self responseAllocationCount]+1];
+		}
+		[rawResponseData setLength:dataLength+bufferSize];
+		buffer = (UInt8 *)[rawResponseData mutableBytes]+dataLength;
+	} else {
+		NSUInteger space;
+		buffer = [self responseChunkSpace:&space];
+		bufferSize = space;
 	}
 	
-	// Reduce the buffer size if we're receiving data too quickly when bandwidth throttling is active
+	// Reduce the read size if we're receiving data too quickly when bandwidth throttling is active
 	// This just augments the throttling done in measureBandwidthUsage to reduce the amount we go over the limit
-	
 	if ([[self class] isBandwidthThrottled]) {
-		[bandwidthThrottlingLock lock];
 		if (maxBandwidthPerSecond > 0) {
-			long long maxiumumSize  = (long long)maxBandwidthPerSecond-(long long)bandwidthUsedInLastSecond;
+			ASIRefillBandwidthTokens();
+			long long maxiumumSize = ASIAtomicLoad64(&bandwidthTokens);
 			if (maxiumumSize < 0) {
 				// We aren't supposed to read any more data right now, but we'll read a single byte anyway so the CFNetwork's buffer isn't full
 				bufferSize = 1;
 			} else if (maxiumumSize/4 < bufferSize) {
 				// We were going to fetch more data that we should be allowed, so we'll reduce the size of our read
-				bufferSize = maxiumumSize/4;
+				bufferSize = (CFIndex)(maxiumumSize/4);
 			}
 		}
 		if (bufferSize < 1) {
 			bufferSize = 1;
 		}
-		[bandwidthThrottlingLock unlock];
 	}
 	
+    CFIndex bytesRead = CFReadStreamRead(readStream, buffer, bufferSize);
 	
-	
-    UInt8 buffer[bufferSize];
-    CFIndex bytesRead = CFReadStreamRead(readStream, buffer, sizeof(buffer));
-
+	// Trim the bytes we made room for but didn't get
+	if (!scratchChunk && didPresizeResponseData) {
+		[rawResponseData setLength:dataLength+(bytesRead > 0 ? bytesRead : 0)];
+	}
 	
     // Less than zero is an error
     if (bytesRead < 0) {
+		if (scratchChunk) {
+			[self returnResponseChunk:scratchChunk];
+		}
         [self handleStreamError];
+		return;
 		
 	// If zero bytes were read, wait for the EOF to come.
     } else if (bytesRead) {
 		
 		[self setTotalBytesRead:[self totalBytesRead]+bytesRead];
-		[self setLastActivityTime:[NSDate date]];
+		[self setLastActivityTime:CFAbsoluteTimeGetCurrent()];
 		
 		// For bandwidth measurement / throttling
 		[ASIHTTPRequest incrementBandwidthUsedInLastSecond:bytesRead];
+		if (!usesRequestThreads && [ASIHTTPRequest isBandwidthThrottled] && ASIAtomicLoad64(&bandwidthTokens) <= 0) {
+			[self pauseForBandwidth];
+		}
 		
-		// Are we downloading to a file?
-		if ([self downloadDestinationPath]) {
-			if (![self fileDownloadOutputStream]) {
-				BOOL append = NO;
-				if (![self temporaryFileDownloadPath]) {
-					[self setTemporaryFileDownloadPath:[NSTemporaryDirectory() stringByAppendingPathComponent:[[NSProcessInfo processInfo] globallyUniqueString]]];
-				} else if ([self allowResumeForFileDownloads]) {
-					append = YES;
-				}
-				
-				[self setFileDownloadOutputStream:[[[NSOutputStream alloc] initToFileAtPath:[self temporaryFileDownloadPath] append:append] autorelease]];
-				[[self fileDownloadOutputStream] open];
+		// Inflate the bytes on their way to memory, the file or the consumer
+		if ([self responseDecompressor]) {
+			if (![self inflateReceivedBytes:buffer length:bytesRead]) {
+				[self returnResponseChunk:scratchChunk];
+				return;
 			}
-			[[self fileDownloadOutputStream] write:buffer maxLength:bytesRead];
 			
-		//Otherwise, let's add the data to our in-memory store
-		} else {
-			[rawResponseData appendBytes:buffer length:bytesRead];
+		// Are we downloading to a file, or handing the body to someone else?
+		} else if ([self downloadDestinationPath] || [self responseDataConsumer]) {
+			[self deliverResponseBytes:buffer length:bytesRead];
+			
+		// Otherwise the bytes are already where they belong in memory
+		} else if ([self responseChunks]) {
+			lastResponseChunkLength += bytesRead;
 		}
     }
+	if (scratchChunk) {
+		[self returnResponseChunk:scratchChunk];
+	}
+}
+
+- (void)writeDownloadedBytes:(const void *)bytes length:(NSUInteger)length
+{
+	if (![self fileDownloadOutputStream]) {
+		BOOL append = NO;
+		if (![self temporaryFileDownloadPath]) {
+			[self setTemporaryFileDownloadPath:[NSTemporaryDirectory() stringByAppendingPathComponent:[[NSProcessInfo processInfo] globallyUniqueString]]];
+		} else if ([self allowResumeForFileDownloads]) {
+			append = YES;
+		}
+		
+		[self setFileDownloadOutputStream:[[[NSOutputStream alloc] initToFileAtPath:[self temporaryFileDownloadPath] append:append] autorelease]];
+		[[self fileDownloadOutputStream] open];
+	}
+	[[self fileDownloadOutputStream] write:bytes maxLength:length];
+}
+
+- (void)deliverResponseBytes:(const void *)bytes length:(NSUInteger)length
+{
+	if ([self downloadDestinationPath]) {
+		[self writeDownloadedBytes:bytes length:length];
+	}
+	[[self responseDataConsumer] request:self didReceiveBytes:bytes length:length];
+}
+
+// Inflates bytes of a compressed response, sending the output wherever uncompressed bytes would have gone
+// Returns NO when the data is corrupt, after failing the request
+- (BOOL)inflateReceivedBytes:(const UInt8 *)bytes length:(NSUInteger)length
+{
+	ASIDataDecompressor *decompressor = [self responseDecompressor];
+	[decompressor setInput:bytes length:length];
+	
+	NSError *err = nil;
+	while ([decompressor hasPendingOutput]) {
+		NSInteger inflated;
+		if ([self downloadDestinationPath] || [self responseDataConsumer]) {
+			NSMutableData *outputChunk = [self takeResponseChunk];
+			inflated = [decompressor inflateIntoBuffer:[outputChunk mutableBytes] length:ASIResponseChunkSize error:&err];
+			if (inflated > 0) {
+				[self deliverResponseBytes:[outputChunk bytes] length:inflated];
+			}
+			[self returnResponseChunk:outputChunk];
+		} else {
+			NSUInteger space;
+			UInt8 *output = [self responseChunkSpace:&space];
+			inflated = [decompressor inflateIntoBuffer:output length:space error:&err];
+			if (inflated > 0) {
+				lastResponseChunkLength += inflated;
+			}
+		}
+		if (inflated < 0) {
+			[self cancelLoad];
+			[self failWithError:err];
+			return NO;
+		}
+		
+		// zlib uses up all the input it can unless it runs out of room, so this means it's waiting for more
+		if (inflated == 0) {
+			break;
+		}
+	}
+	return YES;
+}
+
+#pragma mark response storage
+
+// Hands out a spare chunk from the pool, or makes a new one when there are none left
+- (NSMutableData *)takeResponseChunk
+{
+	NSMutableData *chunk = nil;
+	OSSpinLockLock(&responseChunkPoolLock);
+	if ([responseChunkPool count]) {
+		chunk = [[[responseChunkPool lastObject] retain] autorelease];
+		[responseChunkPool removeLastObject];
+	}
+	OSSpinLockUnlock(&responseChunkPoolLock);
+	
+	if (!chunk) {
+		chunk = [NSMutableData dataWithLength:ASIResponseChunkSize];
+		[self setResponseAllocationCount:[self responseAllocationCount]+1];
+	}
+	return chunk;
+}
+
+- (void)returnResponseChunk:(NSMutableData *)chunk
+{
+	OSSpinLockLock(&responseChunkPoolLock);
+	if ([responseChunkPool count] < ASIMaxPooledResponseChunks) {
+		[responseChunkPool addObject:chunk];
+	}
+	OSSpinLockUnlock(&responseChunkPoolLock);
+}
+
+// Copies the chunks of a response that came without a Content-Length into a rawResponseData of exactly the right size
+- (void)collectResponseChunks
+{
+	if (![self responseChunks]) {
+		return;
+	}
+	NSUInteger chunkCount = [[self responseChunks] count];
+	NSUInteger length = chunkCount ? (chunkCount-1)*ASIResponseChunkSize+lastResponseChunkLength : 0;
+	NSMutableData *data = [[[NSMutableData alloc] initWithCapacity:length] autorelease];
+	if (length) {
+		[self setResponseAllocationCount:[self responseAllocationCount]+1];
+	}
+	NSUInteger i;
+	for (i=0; i<chunkCount; i++) {
+		NSMutableData *chunk = [[self responseChunks] objectAtIndex:i];
+		[data appendBytes:[chunk bytes] length:(i == chunkCount-1 ? lastResponseChunkLength : ASIResponseChunkSize)];
+	}
+	[self discardResponseChunks];
+	[self setRawResponseData:data];
+}
+
+// Returns where the next bytes of a response without a Content-Length should go, starting a new chunk if the last one is full
+- (UInt8 *)responseChunkSpace:(NSUInteger *)space
+{
+	if (![self responseChunks]) {
+		[self setResponseChunks:[NSMutableArray array]];
+	}
+	if (![[self responseChunks] count] || lastResponseChunkLength == ASIResponseChunkSize) {
+		[[self responseChunks] addObject:[self takeResponseChunk]];
+		lastResponseChunkLength = 0;
+	}
+	*space = ASIResponseChunkSize-lastResponseChunkLength;
+	return (UInt8 *)[[[self responseChunks] lastObject] mutableBytes]+lastResponseChunkLength;
+}
+
+- (void)discardResponseChunks
+{
+	for (NSMutableData *chunk in [self responseChunks]) {
+		[self returnResponseChunk:chunk];
+	}
+	[self setResponseChunks:nil];
+	lastResponseChunkLength = 0;
 }
 
 - (void)handleStreamComplete
 {	
+	completedTime = CFAbsoluteTimeGetCurrent();
+	if (!firstByteTime) {
+		firstByteTime = completedTime;
+	}
 	//Try to read the headers (if this is a HEAD request handleBytesAvailable may not be called)
 	if (![self responseHeaders]) {
 		if ([self readResponseHeadersReturningAuthenticationFailure]) {
-			[self attemptToApplyCredentialsAndResume];
+			[self handleAuthenticationChallenge];
 			return;
 		}
 	}
 	if ([self needsRedirect]) {
 		return;
 	}
+	// A compressed response that stops before the end of its stream has been cut short
+	if ([self responseDecompressor] && ![[self responseDecompressor] finished]) {
+		[self cancelLoad];
+		[self failWithError:[NSError errorWithDomain:NetworkRequestErrorDomain code:ASICompressionError userInfo:[NSDictionary dictionaryWithObjectsAndKeys:@"The compressed response ended before it was complete",NSLocalizedDescriptionKey,nil]]];
+		return;
+	}
+	[self collectResponseChunks];
 	[progressLock lock];	
 	
 	[self setComplete:YES];
@@ -2217,8 +2910,15 @@ static BOOL isiPhoneOS2;
 	
     if (readStream) {
 		CFReadStreamSetClient(readStream, kCFStreamEventNone, NULL, NULL);
-		CFReadStreamUnscheduleFromRunLoop(readStream, CFRunLoopGetCurrent(), ASIHTTPRequestRunMode);
-		CFReadStreamClose(readStream);
+		CFReadStreamUnscheduleFromRunLoop(readStream, [self streamRunLoop], ASIHTTPRequestRunMode);
+		
+		// Leave the stream open so the next request to this server can take over its connection
+		if ([self connectionInfo] && [self connectionCanBeReused]) {
+			[self returnPersistentConnection];
+		} else {
+			CFReadStreamClose(readStream);
+			[self removePersistentConnection];
+		}
 		CFRelease(readStream);
 		readStream = NULL;
     }
@@ -2236,8 +2936,8 @@ static BOOL isiPhoneOS2;
 	if ([self temporaryFileDownloadPath]) {
 		[[self fileDownloadOutputStream] close];
 		
-		// Decompress the file (if necessary) directly to the destination path
-		if ([self isResponseCompressed]) {
+		// Decompress the file (if it wasn't inflated as it arrived) directly to the destination path
+		if ([self isResponseCompressed] && ![self responseDecompressor]) {
 			int decompressionStatus = [ASIHTTPRequest uncompressZippedDataFromFile:[self temporaryFileDownloadPath] toFile:[self downloadDestinationPath]];
 			if (decompressionStatus != Z_OK) {
 				fileError = [NSError errorWithDomain:NetworkRequestErrorDomain code:ASIFileManagementError userInfo:[NSDictionary dictionaryWithObjectsAndKeys:[NSString stringWithFormat:@"Decompression of %@ failed with code %hi",[self temporaryFileDownloadPath],decompressionStatus],NSLocalizedDescriptionKey,nil]];
@@ -2279,7 +2979,18 @@ static BOOL isiPhoneOS2;
 {
 	NSError *underlyingError = [(NSError *)CFReadStreamCopyError(readStream) autorelease];
 	
+	// The server may close an idle connection just as we pick it up again
+	// GET and HEAD requests that haven't had a response yet are safe to send again, so they get one more go on a new connection
+	BOOL shouldRetry = ([self didReuseConnection] && ![self responseHeaders] && [self retryCount] == 0 && ([[self requestMethod] isEqualToString:@"GET"] || [[self requestMethod] isEqualToString:@"HEAD"]));
+	
 	[self cancelLoad];
+	
+	if (shouldRetry && ![self isCancelled]) {
+		[self setRetryCount:[self retryCount]+1];
+		[self startRequest];
+		return;
+	}
+	
 	[self setComplete:YES];
 	
 	if (![self error]) { // We may already have handled this error
@@ -2301,6 +3012,141 @@ static BOOL isiPhoneOS2;
 	
 }
 
+#pragma mark persistent connections
+
+// Finds an idle connection to the same server and tags our stream so CFNetwork will use it, or registers a new connection
+// Returns the stream that last used the connection (retained), which should be closed once our stream is open
+- (CFReadStreamRef)configurePersistentConnection
+{
+	NSString *scheme = [[[self url] scheme] lowercaseString];
+	NSString *host = [[[self url] host] lowercaseString];
+	NSNumber *port = [[self url] port];
+	if (!port) {
+		port = [NSNumber numberWithInt:([scheme isEqualToString:@"https"] ? 443 : 80)];
+	}
+	
+	CFReadStreamRef oldStream = NULL;
+	
+	[connectionsLock lock];
+	[ASIHTTPRequest expirePersistentConnections];
+	
+	// Don't reuse a connection we already own (eg after a redirect) and always use a new one when retrying after a reused connection dropped
+	// Only GET and HEAD pick up an idle connection, since only they can be sent again if the server closed it while it sat in the pool
+	// Other methods, which may carry a body, connect afresh and leave their connection in the pool for the next GET
+	[self removePersistentConnection];
+	BOOL canRetry = ([[self requestMethod] isEqualToString:@"GET"] || [[self requestMethod] isEqualToString:@"HEAD"]);
+	if ([self retryCount] == 0 && canRetry) {
+		for (NSMutableDictionary *existingConnection in persistentConnectionsPool) {
+			if ([existingConnection objectForKey:@"stream"] && [[existingConnection objectForKey:@"host"] isEqualToString:host] && [[existingConnection objectForKey:@"port"] isEqualToNumber:port] && [[existingConnection objectForKey:@"scheme"] isEqualToString:scheme]) {
+				[self setConnectionInfo:existingConnection];
+				break;
+			}
+		}
+	}
+	
+	if ([self connectionInfo]) {
+		oldStream = (CFReadStreamRef)[[self connectionInfo] objectForKey:@"stream"];
+		CFRetain(oldStream);
+		[[self connectionInfo] removeObjectForKey:@"stream"];
+		[[self connectionInfo] removeObjectForKey:@"expires"];
+		[self setDidReuseConnection:YES];
+		persistentConnectionsReused++;
+	} else {
+		[self setConnectionInfo:[NSMutableDictionary dictionaryWithObjectsAndKeys:[NSNumber numberWithUnsignedLong:nextConnectionNumberToCreate++],@"id",host,@"host",port,@"port",scheme,@"scheme",nil]];
+		[persistentConnectionsPool addObject:[self connectionInfo]];
+		[self setDidReuseConnection:NO];
+		persistentConnectionsCreated++;
+	}
+	[connectionsLock unlock];
+	
+	CFReadStreamSetProperty(readStream, kCFStreamPropertyHTTPAttemptPersistentConnection, kCFBooleanTrue);
+	
+	// Streams with the same properties share connections behind the scenes, so tagging each stream with the id of its connection makes CFNetwork pick the one we kept open
+	// See http://lists.apple.com/archives/macnetworkprog/2008/Dec/msg00001.html
+	CFReadStreamSetProperty(readStream, CFSTR("ASIStreamID"), [[self connectionInfo] objectForKey:@"id"]);
+	
+	return oldStream;
+}
+
+// Puts our connection back in the pool with the (still open) stream, or closes it if we already have enough idle connections to this server
+- (void)returnPersistentConnection
+{
+	[connectionsLock lock];
+	NSUInteger idleConnections = 0;
+	for (NSDictionary *existingConnection in persistentConnectionsPool) {
+		if ([existingConnection objectForKey:@"stream"] && [[existingConnection objectForKey:@"host"] isEqualToString:[[self connectionInfo] objectForKey:@"host"]] && [[existingConnection objectForKey:@"port"] isEqualToNumber:[[self connectionInfo] objectForKey:@"port"]]) {
+			idleConnections++;
+		}
+	}
+	if (idleConnections < ASIMaxIdleConnectionsPerHost) {
+		[[self connectionInfo] setObject:(id)readStream forKey:@"stream"];
+		[[self connectionInfo] setObject:[NSDate dateWithTimeIntervalSinceNow:[self persistentConnectionTimeoutSeconds]] forKey:@"expires"];
+	} else {
+		CFReadStreamClose(readStream);
+		[persistentConnectionsPool removeObjectIdenticalTo:[self connectionInfo]];
+	}
+	[self setConnectionInfo:nil];
+	[connectionsLock unlock];
+}
+
+// Forgets about our connection, the caller is responsible for closing the stream
+- (void)removePersistentConnection
+{
+	if (![self connectionInfo]) {
+		return;
+	}
+	[connectionsLock lock];
+	[persistentConnectionsPool removeObjectIdenticalTo:[self connectionInfo]];
+	[self setConnectionInfo:nil];
+	[connectionsLock unlock];
+}
+
++ (void)expirePersistentConnections
+{
+	[connectionsLock lock];
+	NSUInteger i = [persistentConnectionsPool count];
+	while (i > 0) {
+		i--;
+		NSDictionary *existingConnection = [persistentConnectionsPool objectAtIndex:i];
+		if ([existingConnection objectForKey:@"stream"] && [[existingConnection objectForKey:@"expires"] timeIntervalSinceNow] <= 0) {
+			CFReadStreamClose((CFReadStreamRef)[existingConnection objectForKey:@"stream"]);
+			[persistentConnectionsPool removeObjectAtIndex:i];
+		}
+	}
+	[connectionsLock unlock];
+}
+
++ (void)closePersistentConnections
+{
+	[connectionsLock lock];
+	NSUInteger i = [persistentConnectionsPool count];
+	while (i > 0) {
+		i--;
+		NSDictionary *existingConnection = [persistentConnectionsPool objectAtIndex:i];
+		if ([existingConnection objectForKey:@"stream"]) {
+			CFReadStreamClose((CFReadStreamRef)[existingConnection objectForKey:@"stream"]);
+			[persistentConnectionsPool removeObjectAtIndex:i];
+		}
+	}
+	[connectionsLock unlock];
+}
+
++ (unsigned long)persistentConnectionsCreated
+{
+	[connectionsLock lock];
+	unsigned long count = persistentConnectionsCreated;
+	[connectionsLock unlock];
+	return count;
+}
+
++ (unsigned long)persistentConnectionsReused
+{
+	[connectionsLock lock];
+	unsigned long count = persistentConnectionsReused;
+	[connectionsLock unlock];
+	return count;
+}
+
 #pragma mark global queue
 
 + (NSOperationQueue *)sharedRequestQueue
@@ -2913,102 +3759,128 @@ static BOOL isiPhoneOS2;
 + (BOOL)isBandwidthThrottled
 {
 #if TARGET_OS_IPHONE
-	[bandwidthThrottlingLock lock];
-
-	BOOL throttle = isBandwidthThrottled || (!shouldThrottleBandwithForWWANOnly && (maxBandwidthPerSecond));
-	[bandwidthThrottlingLock unlock];
-	return throttle;
+	return isBandwidthThrottled || (!shouldThrottleBandwithForWWANOnly && (maxBandwidthPerSecond));
 #else
-	[bandwidthThrottlingLock lock];
-	BOOL throttle = (maxBandwidthPerSecond);
-	[bandwidthThrottlingLock unlock];
-	return throttle;
+	return (maxBandwidthPerSecond);
 #endif
 }
 
 + (unsigned long)maxBandwidthPerSecond
 {
-	[bandwidthThrottlingLock lock];
-	unsigned long amount = maxBandwidthPerSecond;
-	[bandwidthThrottlingLock unlock];
-	return amount;
+	return maxBandwidthPerSecond;
 }
 
 + (void)setMaxBandwidthPerSecond:(unsigned long)bytes
 {
-	[bandwidthThrottlingLock lock];
+	// Start with a full bucket
+	ASIAtomicStore64(&bandwidthTokens, bytes);
+	ASIAtomicStore64(&bandwidthTokensRefilledAt, (int64_t)(CFAbsoluteTimeGetCurrent()*1000000));
 	maxBandwidthPerSecond = bytes;
-	[bandwidthThrottlingLock unlock];
 }
 
 + (void)incrementBandwidthUsedInLastSecond:(unsigned long)bytes
 {
-	[bandwidthThrottlingLock lock];
-	bandwidthUsedInLastSecond += bytes;
-	//NSLog(@"used in last second: %lu",bandwidthUsedInLastSecond);
-	[bandwidthThrottlingLock unlock];
+	OSAtomicAdd64Barrier(bytes, &bandwidthUsedInCurrentPeriod);
+	if (maxBandwidthPerSecond) {
+		OSAtomicAdd64Barrier(-(int64_t)bytes, &bandwidthTokens);
+	}
 }
 
+// Moves the bytes used in the second that just ended into the history
+// Any thread may call this, only the one that wins the compare-and-swap on bandwidthPeriod does anything
 + (void)recordBandwidthUsage
 {
-	if (bandwidthUsedInLastSecond == 0) {
-		[bandwidthUsageTracker removeAllObjects];
-	} else {
-		NSTimeInterval interval = [bandwidthMeasurementDate timeIntervalSinceNow];
-		while ((interval < 0 || [bandwidthUsageTracker count] > 5) && [bandwidthUsageTracker count] > 0) {
-			[bandwidthUsageTracker removeObjectAtIndex:0];
-			interval++;
-		}
+	int64_t period = (int64_t)floor(CFAbsoluteTimeGetCurrent());
+	int64_t lastPeriod = ASIAtomicLoad64(&bandwidthPeriod);
+	if (period <= lastPeriod || !OSAtomicCompareAndSwap64Barrier(lastPeriod, period, &bandwidthPeriod)) {
+		return;
 	}
-	//NSLog(@"Used: %qi",bandwidthUsedInLastSecond);
-	[bandwidthUsageTracker addObject:[NSNumber numberWithUnsignedLong:bandwidthUsedInLastSecond]];
-	[bandwidthMeasurementDate release];
-	bandwidthMeasurementDate = [[NSDate dateWithTimeIntervalSinceNow:1] retain];
-	bandwidthUsedInLastSecond = 0;
+	int64_t used = ASIAtomicSwap64(&bandwidthUsedInCurrentPeriod, 0);
 	
-	NSUInteger measurements = [bandwidthUsageTracker count];
-	unsigned long totalBytes = 0;
-	for (NSNumber *bytes in bandwidthUsageTracker) {
-		totalBytes += [bytes unsignedLongValue];
+	// Seconds where nothing happened to close the period count as nothing used
+	int64_t idleSeconds = period-lastPeriod-1;
+	if (!lastPeriod || idleSeconds > ASIBandwidthHistoryLength) {
+		idleSeconds = ASIBandwidthHistoryLength;
 	}
-	averageBandwidthUsedPerSecond = totalBytes/measurements;		
+	int64_t end = OSAtomicAdd64Barrier(idleSeconds+1, &bandwidthHistoryCount);
+	int64_t slot;
+	for (slot = end-idleSeconds-1; slot < end-1; slot++) {
+		bandwidthHistory[slot%ASIBandwidthHistoryLength] = 0;
+	}
+	//NSLog(@"Used: %qi",used);
+	bandwidthHistory[(end-1)%ASIBandwidthHistoryLength] = (unsigned long)used;
 }
 
+// An exponentially weighted moving average of the last few seconds
 + (unsigned long)averageBandwidthUsedPerSecond
 {
-	[bandwidthThrottlingLock lock];
+	[self recordBandwidthUsage];
 	
-	if (!bandwidthMeasurementDate || [bandwidthMeasurementDate timeIntervalSinceNow] < 0) {
-		[self recordBandwidthUsage];
+	NSUInteger first = (NSUInteger)(ASIAtomicLoad64(&bandwidthHistoryCount)%ASIBandwidthHistoryLength);
+	double average = bandwidthHistory[first];
+	NSUInteger i;
+	for (i=1; i<ASIBandwidthHistoryLength; i++) {
+		average = ASIBandwidthAverageWeight*bandwidthHistory[(first+i)%ASIBandwidthHistoryLength] + (1-ASIBandwidthAverageWeight)*average;
 	}
-	unsigned long amount = 	averageBandwidthUsedPerSecond;
-	[bandwidthThrottlingLock unlock];
-	return amount;
+	return (unsigned long)average;
 }
 
+// Used by requests running on their own threads
+// Sleeps this request's thread while the bucket is empty. Other requests carry on until they find it empty too
 + (void)measureBandwidthUsage
 {
-	// Other requests may have to wait for this lock if we're sleeping, but this is fine, since in that case we already know they shouldn't be sending or receiving data
-	[bandwidthThrottlingLock lock];
-
-	if (!bandwidthMeasurementDate || [bandwidthMeasurementDate timeIntervalSinceNow] < -0) {
-		[self recordBandwidthUsage];
+	[self recordBandwidthUsage];
+	
+	unsigned long limit = maxBandwidthPerSecond;
+	if (!limit) {
+		return;
 	}
+	ASIRefillBandwidthTokens();
+	int64_t tokens = ASIAtomicLoad64(&bandwidthTokens);
 	
-	// Are we performing bandwidth throttling?
-	if (maxBandwidthPerSecond > 0) {	
-		// How much data can we still send or receive this second?
-		long long bytesRemaining = (long long)maxBandwidthPerSecond - (long long)bandwidthUsedInLastSecond;
-				
-		// Have we used up our allowance?
-		if (bytesRemaining < 8) {
+	// Have we used up our allowance?
+	if (tokens < 8) {
+		[NSThread sleepForTimeInterval:MIN(1.0, (8-tokens)/(double)limit)];
+	}
+}
+
+// Called on each tick of the timeout wheel
+// Requests on the network thread can't sleep, so those over budget have their streams unscheduled until the bucket has tokens again
++ (void)performBandwidthThrottling
+{
+	[self recordBandwidthUsage];
+	
+	if ([self isBandwidthThrottled]) {
+		ASIRefillBandwidthTokens();
+		if (ASIAtomicLoad64(&bandwidthTokens) <= 0) {
 			
-			// Yes, put this request to sleep until a second is up
-			[NSThread sleepUntilDate:bandwidthMeasurementDate];
-			[self recordBandwidthUsage];
+			// CFNetwork reads request bodies as it sees fit, so requests still uploading are paused here rather than as they read
+			for (ASIHTTPRequest *theRequest in progressRequests) {
+				if ([theRequest totalBytesSent] < [theRequest postLength]) {
+					[theRequest pauseForBandwidth];
+				}
+			}
+			return;
 		}
 	}
-	[bandwidthThrottlingLock unlock];
+	
+	for (ASIHTTPRequest *theRequest in throttledRequests) {
+		if (theRequest->readStream && theRequest->readStreamIsPausedForBandwidth && [theRequest lastActivityTime] && ![theRequest complete] && ![theRequest isCancelled]) {
+			CFReadStreamScheduleWithRunLoop(theRequest->readStream, networkRunLoop, ASIHTTPRequestRunMode);
+		}
+		theRequest->readStreamIsPausedForBandwidth = NO;
+	}
+	[throttledRequests removeAllObjects];
+}
+
+- (void)pauseForBandwidth
+{
+	if (!readStream || readStreamIsPausedForBandwidth) {
+		return;
+	}
+	CFReadStreamUnscheduleFromRunLoop(readStream, networkRunLoop, ASIHTTPRequestRunMode);
+	readStreamIsPausedForBandwidth = YES;
+	[throttledRequests addObject:self];
 }
 
 #if TARGET_OS_IPHONE
@@ -3019,54 +3891,43 @@ static BOOL isiPhoneOS2;
 	} else {
 		[[NSNotificationCenter defaultCenter] removeObserver:self name:@"kNetworkReachabilityChangedNotification" object:nil];
 		[ASIHTTPRequest setMaxBandwidthPerSecond:0];
-		[bandwidthThrottlingLock lock];
 		shouldThrottleBandwithForWWANOnly = NO;
-		[bandwidthThrottlingLock unlock];
 	}
 }
 
 + (void)throttleBandwidthForWWANUsingLimit:(unsigned long)limit
 {	
-	[bandwidthThrottlingLock lock];
 	shouldThrottleBandwithForWWANOnly = YES;
-	maxBandwidthPerSecond = limit;
+	[ASIHTTPRequest setMaxBandwidthPerSecond:limit];
 	[[Reachability sharedReachability] setNetworkStatusNotificationsEnabled:YES];
 	[[NSNotificationCenter defaultCenter] addObserver:self selector:@selector(reachabilityChanged:) name:@"kNetworkReachabilityChangedNotification" object:nil];
-	[bandwidthThrottlingLock unlock];
 	[ASIHTTPRequest reachabilityChanged:nil];
 }
 
 + (void)reachabilityChanged:(NSNotification *)note
 {
-	[bandwidthThrottlingLock lock];	
 	if ([[Reachability sharedReachability] internetConnectionStatus] == ReachableViaCarrierDataNetwork) {
 		isBandwidthThrottled = YES;
 	} else {
 		isBandwidthThrottled = NO;
 	}
-	[bandwidthThrottlingLock unlock];
 }
 #endif
 
 + (unsigned long)maxUploadReadLength
 {
-
-	[bandwidthThrottlingLock lock];
+	unsigned long limit = maxBandwidthPerSecond;
+	ASIRefillBandwidthTokens();
+	int64_t tokens = ASIAtomicLoad64(&bandwidthTokens);
+	if (!limit || tokens <= 0) {
+		return 0;
+	}
 	
 	// We'll split our bandwidth allowance into 4 (which is the default for an ASINetworkQueue's max concurrent operations count) to give all running requests a fighting chance of reading data this cycle
-	unsigned long toRead = maxBandwidthPerSecond/4;
-	if (maxBandwidthPerSecond > 0 && (bandwidthUsedInLastSecond + toRead > maxBandwidthPerSecond)) {
-		toRead = maxBandwidthPerSecond-bandwidthUsedInLastSecond;
-		if (toRead < 0) {
-			toRead = 0;
-		}
-	}
-
-	if (toRead == 0 || !bandwidthMeasurementDate || [bandwidthMeasurementDate timeIntervalSinceNow] < -0) {
-		[NSThread sleepUntilDate:bandwidthMeasurementDate];
-		[self recordBandwidthUsage];
+	unsigned long toRead = limit/4;
+	if ((int64_t)toRead > tokens) {
+		toRead = (unsigned long)tokens;
 	}
-	[bandwidthThrottlingLock unlock];	
 	return toRead;
 }
 
@@ -3142,6 +4003,11 @@ static BOOL isiPhoneOS2;
 @synthesize requestCredentials;
 @synthesize responseStatusCode;
 @synthesize rawResponseData;
+@synthesize responseChunks;
+@synthesize responseAllocationCount;
+@synthesize responseDecompressor;
+@synthesize shouldWaitToInflateCompressedResponses;
+@synthesize responseDataConsumer;
 @synthesize lastActivityTime;
 @synthesize timeOutSeconds;
 @synthesize requestMethod;
@@ -3162,6 +4028,7 @@ static BOOL isiPhoneOS2;
 @synthesize allowResumeForFileDownloads;
 @synthesize userInfo;
 @synthesize postBodyFilePath;
+@synthesize postBodySegments;
 @synthesize compressedPostBodyFilePath;
 @synthesize postBodyWriteStream;
 @synthesize postBodyReadStream;
@@ -3195,6 +4062,12 @@ static BOOL isiPhoneOS2;
 @synthesize responseStatusMessage;
 @synthesize shouldPresentCredentialsBeforeChallenge;
 @synthesize haveBuiltRequestHeaders;
+@synthesize shouldAttemptPersistentConnection;
+@synthesize persistentConnectionTimeoutSeconds;
+@synthesize connectionCanBeReused;
+@synthesize didReuseConnection;
+@synthesize retryCount;
+@synthesize connectionInfo;
 @end
 
 
@@ -8,15 +8,25 @@
 
 #import <Foundation/Foundation.h>
 
+@class ASIPostBodySegmentList;
+
 // This is a wrapper for NSInputStream that pretends to be an NSInputStream itself
 // Subclassing NSInputStream seems to be tricky, and may involve overriding undocumented methods, so we'll cheat instead.
 // It is used by ASIHTTPRequest whenever we have a request body, and handles measuring and throttling the bandwidth used for uploading
 
+// A body kept as segments is written into one end of a bound stream pair as CFNetwork reads from the other, so no more than the pair's buffer is held in memory at once
+
 @interface ASIInputStream : NSObject {
 	NSInputStream *stream;
+	
+	// Only used for bodies sent from an ASIPostBodySegmentList
+	ASIPostBodySegmentList *segments;
+	NSOutputStream *segmentWriteStream;
+	NSError *segmentError;
 }
 + (id)inputStreamWithFileAtPath:(NSString *)path;
 + (id)inputStreamWithData:(NSData *)data;
++ (id)inputStreamWithSegments:(ASIPostBodySegmentList *)segmentList;
 
 @property (retain) NSInputStream *stream;
 @end
@@ -8,18 +8,20 @@
 
 #import "ASIInputStream.h"
 #import "ASIHTTPRequest.h"
+#import "ASIPostBodySegmentList.h"
 
-// Used to ensure only one request can read data at once
-static NSLock *readLock = nil;
+// Size of the buffer between the two ends of the stream pair used for segmented bodies
+#define ASIInputStreamSegmentBufferSize (64 * 1024)
 
-@implementation ASIInputStream
+@interface ASIInputStream ()
+- (void)writeSegments;
 
-+ (void)initialize
-{
-	if (self == [ASIInputStream class]) {
-		readLock = [[NSLock alloc] init];
-	}
-}
+@property (retain, nonatomic) ASIPostBodySegmentList *segments;
+@property (retain, nonatomic) NSOutputStream *segmentWriteStream;
+@property (retain, nonatomic) NSError *segmentError;
+@end
+
+@implementation ASIInputStream
 
 + (id)inputStreamWithFileAtPath:(NSString *)path
 {
@@ -35,9 +37,35 @@ static NSLock *readLock = nil;
 	return stream;
 }
 
++ (id)inputStreamWithSegments:(ASIPostBodySegmentList *)segmentList
+{
+	CFReadStreamRef readStream = NULL;
+	CFWriteStreamRef writeStream = NULL;
+	CFStreamCreateBoundPair(kCFAllocatorDefault, &readStream, &writeStream, ASIInputStreamSegmentBufferSize);
+	if (!readStream || !writeStream) {
+		if (readStream) {
+			CFRelease(readStream);
+		}
+		if (writeStream) {
+			CFRelease(writeStream);
+		}
+		return nil;
+	}
+	
+	ASIInputStream *stream = [[[self alloc] init] autorelease];
+	[stream setStream:[(NSInputStream *)NSMakeCollectable(readStream) autorelease]];
+	[stream setSegmentWriteStream:[(NSOutputStream *)NSMakeCollectable(writeStream) autorelease]];
+	[stream setSegments:segmentList];
+	[segmentList rewind];
+	return stream;
+}
+
 - (void)dealloc
 {
 	[stream release];
+	[segments release];
+	[segmentWriteStream release];
+	[segmentError release];
 	[super dealloc];
 }
 
@@ -45,19 +73,17 @@ static NSLock *readLock = nil;
 // Ok, so this works, but I don't really understand why.
 // Ideally, we'd just return the stream's hasBytesAvailable, but CFNetwork seems to want to monopolise our run loop until (presumably) its buffer is full, which will cause timeouts if we're throttling the bandwidth
 // We return NO when we shouldn't be uploading any more data because our bandwidth limit has run out (for now)
-// The call to maxUploadReadLength will recognise that we've run out of our allotted bandwidth limit, and sleep this thread for the rest of the measurement period
-// This method will be called again, but we'll almost certainly return YES the next time around, because we'll have more limit to use up
-// The NO returns seem to snap CFNetwork out of its reverie, and return control to the main loop in loadRequest, so that we can manage timeouts and progress delegate updates
+// The request's stream is unscheduled on the next tick of the network thread until the allowance refills, so this doesn't have to wait (and no lock is needed, the allowance is kept with atomic counters)
+// This method will be called again once the stream is back, and we'll almost certainly return YES then, because we'll have more limit to use up
+// The NO returns seem to snap CFNetwork out of its reverie, and return control to the run loop, so that timeouts and progress delegate updates for other requests on the network thread aren't held up
 - (BOOL)hasBytesAvailable
 {
 	
-	if ([ASIHTTPRequest isBandwidthThrottled]) {
-		[readLock lock];
-		if ([ASIHTTPRequest maxUploadReadLength] == 0) {
-			[readLock unlock];
-			return NO;
-		}
-		[readLock unlock];
+	if ([self segmentError]) {
+		return YES;
+	}
+	if ([ASIHTTPRequest isBandwidthThrottled] && [ASIHTTPRequest maxUploadReadLength] == 0) {
+		return NO;
 	}
 	return [[self stream] hasBytesAvailable];
 	
@@ -67,7 +93,6 @@ static NSLock *readLock = nil;
 // When throttling is on, we ask ASIHTTPRequest for the maximum amount of data we can read
 - (NSInteger)read:(uint8_t *)buffer maxLength:(NSUInteger)len
 {
-	[readLock lock];
 	unsigned long toRead = len;
 	if ([ASIHTTPRequest isBandwidthThrottled]) {
 		toRead = [ASIHTTPRequest maxUploadReadLength];
@@ -82,9 +107,77 @@ static NSLock *readLock = nil;
 	} else {
 		//NSLog(@"Unthrottled read %u",toRead);
 	}
-	[ASIHTTPRequest incrementBandwidthUsedInLastSecond:toRead];
-	[readLock unlock];
-	return [[self stream] read:buffer maxLength:toRead];
+	if ([self segmentError]) {
+		return -1;
+	}
+	NSInteger bytesRead = [[self stream] read:buffer maxLength:toRead];
+	if (bytesRead > 0) {
+		[ASIHTTPRequest incrementBandwidthUsedInLastSecond:bytesRead];
+	}
+	
+	// Top the pair back up with what we just made room for
+	[self writeSegments];
+	return bytesRead;
+}
+
+#pragma mark segmented bodies
+
+- (void)open
+{
+	[[self stream] open];
+	if ([self segmentWriteStream]) {
+		[[self segmentWriteStream] open];
+		[self writeSegments];
+	}
+}
+
+- (void)close
+{
+	[[self stream] close];
+	[[self segmentWriteStream] close];
+	[self setSegmentWriteStream:nil];
+	[[self segments] close];
+}
+
+// Writes straight from the segments (no copy of our own) into the pair until its buffer is full
+// When the segments run out, closing our end lets the reading end report the end of the body once CFNetwork has read the rest
+- (void)writeSegments
+{
+	NSOutputStream *writeStream = [self segmentWriteStream];
+	while (writeStream && [writeStream hasSpaceAvailable]) {
+		NSUInteger available = 0;
+		NSError *err = nil;
+		const void *bytes = [[self segments] bytesAtCursor:&available error:&err];
+		if (!bytes) {
+			if (err) {
+				[self setSegmentError:err];
+			}
+			[writeStream close];
+			[self setSegmentWriteStream:nil];
+			return;
+		}
+		NSInteger written = [writeStream write:bytes maxLength:available];
+		if (written <= 0) {
+			return;
+		}
+		[[self segments] advanceCursorBy:written];
+	}
+}
+
+- (NSStreamStatus)streamStatus
+{
+	if ([self segmentError]) {
+		return NSStreamStatusError;
+	}
+	return [[self stream] streamStatus];
+}
+
+- (NSError *)streamError
+{
+	if ([self segmentError]) {
+		return [self segmentError];
+	}
+	return [[self stream] streamError];
 }
 
 // If we get asked to perform a method we don't have (which is almost all of them), we'll just forward the message to our stream
@@ -100,4 +193,7 @@ static NSLock *readLock = nil;
 }
 
 @synthesize stream;
+@synthesize segments;
+@synthesize segmentWriteStream;
+@synthesize segmentError;
 @end
@@ -8,6 +8,9 @@
 
 #import <Foundation/Foundation.h>
 
+// Most often the queue passes its progress on to its progress delegates, in seconds
+#define ASINetworkQueueProgressUpdateInterval 0.1
+
 @interface ASINetworkQueue : NSOperationQueue {
 	
 	// Delegate will get didFail + didFinish messages (if set)
@@ -29,19 +32,29 @@
 	id uploadProgressDelegate;
 	
 	// Total amount uploaded so far for all requests in this queue
-	unsigned long long bytesUploadedSoFar;
+	// The progress counters are updated with atomic adds from the threads requests run on, and passed on to the progress delegates from the main thread
+	volatile int64_t bytesUploadedSoFar __attribute__((aligned(8)));
 	
 	// Total amount to be uploaded for all requests in this queue - requests add to this figure as they work out how much data they have to transmit
-	unsigned long long totalBytesToUpload;
+	volatile int64_t totalBytesToUpload __attribute__((aligned(8)));
 
 	// Download progress indicator, probably an NSProgressIndicator or UIProgressView
 	id downloadProgressDelegate;
 	
 	// Total amount downloaded so far for all requests in this queue
-	unsigned long long bytesDownloadedSoFar;
+	volatile int64_t bytesDownloadedSoFar __attribute__((aligned(8)));
 	
 	// Total amount to be downloaded for all requests in this queue - requests add to this figure as they receive Content-Length headers
-	unsigned long long totalBytesToDownload;
+	volatile int64_t totalBytesToDownload __attribute__((aligned(8)));
+	
+	// Set while an update of the progress delegates is on its way to the main thread, so any number of changes before it runs cost one update
+	volatile int32_t progressUpdatePending;
+	
+	// When the progress delegates were last updated, only used on the main thread
+	NSTimeInterval lastProgressUpdate;
+	
+	// How many times the progress delegates have been updated
+	unsigned int progressUpdateCount;
 	
 	// When YES, the queue will cancel all requests when a request fails. Default is YES
 	BOOL shouldCancelAllRequestsOnFailure;
@@ -71,6 +84,7 @@
 - (void)incrementUploadSizeBy:(unsigned long long)bytes;
 
 // Called during a request when data is written to the upload stream to increment the progress indicator
+// These can be called from any thread, and only count the bytes - the progress delegates are updated no more than every ASINetworkQueueProgressUpdateInterval
 - (void)incrementUploadProgressBy:(unsigned long long)bytes;
 
 // Called at the start of a request to add on the size of this download to the total
@@ -98,6 +112,9 @@
 // Returns YES if the queue is in progress
 - (BOOL)isNetworkActive;
 
+// Passes the current progress on to the progress delegates straight away, must be called on the main thread
+- (void)updateProgressDelegates;
+
 
 @property (assign,setter=setUploadProgressDelegate:) id uploadProgressDelegate;
 @property (assign,setter=setDownloadProgressDelegate:) id downloadProgressDelegate;
@@ -111,6 +128,7 @@
 @property (assign) BOOL showAccurateProgress;
 @property (assign, readonly) int requestsCount;
 @property (retain) NSDictionary *userInfo;
+@property (assign, readonly) unsigned int progressUpdateCount;
 
 @property (assign) unsigned long long bytesUploadedSoFar;
 @property (assign) unsigned long long totalBytesToUpload;
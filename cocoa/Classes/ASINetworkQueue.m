@@ -8,9 +8,12 @@
 
 #import "ASINetworkQueue.h"
 #import "ASIHTTPRequest.h"
+#import "ASIAtomic.h"
 
 // Private stuff
 @interface ASINetworkQueue ()
+- (void)setNeedsProgressUpdate;
+- (void)scheduleProgressUpdate;
 	@property (assign) int requestsCount;
 @end
 
@@ -165,7 +168,7 @@
 		// If we want to track uploading for this request accurately, we need to add the size of the post content to the total
 		} else if (uploadProgressDelegate) {
 			[request buildPostBody];
-			[self setTotalBytesToUpload:[self totalBytesToUpload]+[request postLength]];
+			OSAtomicAdd64Barrier((int64_t)[request postLength], &totalBytesToUpload);
 		}
 	}
 	[request setShowAccurateProgress:[self showAccurateProgress]];
@@ -195,6 +198,7 @@
 		[self cancelAllOperations];
 	}
 	if ([self requestsCount] == 0) {
+		[self updateProgressDelegates];
 		if ([self queueDidFinishSelector]) {
 			[[self delegate] performSelector:[self queueDidFinishSelector] withObject:self];
 		}
@@ -208,7 +212,9 @@
 	if ([self requestDidFinishSelector]) {
 		[[self delegate] performSelector:[self requestDidFinishSelector] withObject:request];
 	}
+	// Let the progress delegates reach the end before the delegate hears the queue is done
 	if ([self requestsCount] == 0) {
+		[self updateProgressDelegates];
 		if ([self queueDidFinishSelector]) {
 			[[self delegate] performSelector:[self queueDidFinishSelector] withObject:self];
 		}
@@ -216,13 +222,15 @@
 }
 
 
+#pragma mark progress
+
 - (void)setUploadBufferSize:(unsigned long long)bytes
 {
 	if (![self uploadProgressDelegate]) {
 		return;
 	}
-	[self setTotalBytesToUpload:[self totalBytesToUpload] - bytes];
-	[self incrementUploadProgressBy:0];
+	OSAtomicAdd64Barrier(-(int64_t)bytes, &totalBytesToUpload);
+	[self setNeedsProgressUpdate];
 }
 
 - (void)incrementUploadSizeBy:(unsigned long long)bytes
@@ -230,44 +238,26 @@
 	if (![self uploadProgressDelegate]) {
 		return;
 	}
-	[self setTotalBytesToUpload:[self totalBytesToUpload] + bytes];
-	[self incrementUploadProgressBy:0];
+	OSAtomicAdd64Barrier((int64_t)bytes, &totalBytesToUpload);
+	[self setNeedsProgressUpdate];
 }
 
 - (void)decrementUploadProgressBy:(unsigned long long)bytes
 {
-	if (![self uploadProgressDelegate] || [self totalBytesToUpload] == 0) {
+	if (![self uploadProgressDelegate] || ASIAtomicLoad64(&totalBytesToUpload) == 0) {
 		return;
 	}
-	[self setBytesUploadedSoFar:[self bytesUploadedSoFar] - bytes];
-	
-	double progress;
-	//Workaround for an issue with converting a long to a double on iPhone OS 2.2.1 with a base SDK >= 3.0
-	if ([ASIHTTPRequest isiPhoneOS2]) {
-		progress = [[NSNumber numberWithUnsignedLongLong:[self bytesUploadedSoFar]] doubleValue]/[[NSNumber numberWithUnsignedLongLong:[self totalBytesToUpload]] doubleValue]; 
-	} else {
-		progress = ([self bytesUploadedSoFar]*1.0)/([self totalBytesToUpload]*1.0);
-	}
-	[ASIHTTPRequest setProgress:progress forProgressIndicator:[self uploadProgressDelegate]];
+	OSAtomicAdd64Barrier(-(int64_t)bytes, &bytesUploadedSoFar);
+	[self setNeedsProgressUpdate];
 }
 
-
 - (void)incrementUploadProgressBy:(unsigned long long)bytes
 {
-	if (![self uploadProgressDelegate] || [self totalBytesToUpload] == 0) {
+	if (![self uploadProgressDelegate] || ASIAtomicLoad64(&totalBytesToUpload) == 0) {
 		return;
 	}
-	[self setBytesUploadedSoFar:[self bytesUploadedSoFar] + bytes];
-	
-	double progress;
-	//Workaround for an issue with converting a long to a double on iPhone OS 2.2.1 with a base SDK >= 3.0
-	if ([ASIHTTPRequest isiPhoneOS2]) {
-		progress = [[NSNumber numberWithUnsignedLongLong:[self bytesUploadedSoFar]] doubleValue]/[[NSNumber numberWithUnsignedLongLong:[self totalBytesToUpload]] doubleValue]; 
-	} else {
-		progress = ([self bytesUploadedSoFar]*1.0)/([self totalBytesToUpload]*1.0);
-	}
-	[ASIHTTPRequest setProgress:progress forProgressIndicator:[self uploadProgressDelegate]];
-
+	OSAtomicAdd64Barrier((int64_t)bytes, &bytesUploadedSoFar);
+	[self setNeedsProgressUpdate];
 }
 
 - (void)incrementDownloadSizeBy:(unsigned long long)bytes
@@ -275,27 +265,111 @@
 	if (![self downloadProgressDelegate]) {
 		return;
 	}
-	[self setTotalBytesToDownload:[self totalBytesToDownload] + bytes];
-	[self incrementDownloadProgressBy:0];
+	OSAtomicAdd64Barrier((int64_t)bytes, &totalBytesToDownload);
+	[self setNeedsProgressUpdate];
 }
 
 - (void)incrementDownloadProgressBy:(unsigned long long)bytes
 {
-	if (![self downloadProgressDelegate] || [self totalBytesToDownload] == 0) {
+	if (![self downloadProgressDelegate] || ASIAtomicLoad64(&totalBytesToDownload) == 0) {
 		return;
 	}
-	[self setBytesDownloadedSoFar:[self bytesDownloadedSoFar] + bytes];
-	
-	double progress;
-	//Workaround for an issue with converting a long to a double on iPhone OS 2.2.1 with a base SDK >= 3.0
-	if ([ASIHTTPRequest isiPhoneOS2]) {
-		progress = [[NSNumber numberWithUnsignedLongLong:[self bytesDownloadedSoFar]] doubleValue]/[[NSNumber numberWithUnsignedLongLong:[self totalBytesToDownload]] doubleValue]; 
+	OSAtomicAdd64Barrier((int64_t)bytes, &bytesDownloadedSoFar);
+	[self setNeedsProgressUpdate];
+}
+
+// Only the first change since the last update sends anything to the main thread
+- (void)setNeedsProgressUpdate
+{
+	if (OSAtomicCompareAndSwap32Barrier(0, 1, &progressUpdatePending)) {
+		[self performSelectorOnMainThread:@selector(scheduleProgressUpdate) withObject:nil waitUntilDone:NO];
+	}
+}
+
+// Holds the update back until a full interval has passed since the last one
+- (void)scheduleProgressUpdate
+{
+	NSTimeInterval wait = lastProgressUpdate + ASINetworkQueueProgressUpdateInterval - CFAbsoluteTimeGetCurrent();
+	if (wait > 0) {
+		[self performSelector:@selector(updateProgressDelegates) withObject:nil afterDelay:wait inModes:[NSArray arrayWithObject:NSRunLoopCommonModes]];
 	} else {
-		progress = ([self bytesDownloadedSoFar]*1.0)/([self totalBytesToDownload]*1.0);
+		[self updateProgressDelegates];
+	}
+}
+
+- (void)updateProgressDelegates
+{
+	[NSObject cancelPreviousPerformRequestsWithTarget:self selector:@selector(updateProgressDelegates) object:nil];
+	lastProgressUpdate = CFAbsoluteTimeGetCurrent();
+	progressUpdateCount++;
+	
+	// Cleared before we read the counters, so a change from here on asks for another update
+	OSAtomicCompareAndSwap32Barrier(1, 0, &progressUpdatePending);
+	
+	unsigned long long total = [self totalBytesToUpload];
+	if ([self uploadProgressDelegate] && total > 0) {
+		double progress;
+		//Workaround for an issue with converting a long to a double on iPhone OS 2.2.1 with a base SDK >= 3.0
+		if ([ASIHTTPRequest isiPhoneOS2]) {
+			progress = [[NSNumber numberWithUnsignedLongLong:[self bytesUploadedSoFar]] doubleValue]/[[NSNumber numberWithUnsignedLongLong:total] doubleValue]; 
+		} else {
+			progress = ([self bytesUploadedSoFar]*1.0)/(total*1.0);
+		}
+		[ASIHTTPRequest setProgress:progress forProgressIndicator:[self uploadProgressDelegate]];
+	}
+	
+	total = [self totalBytesToDownload];
+	if ([self downloadProgressDelegate] && total > 0) {
+		double progress;
+		//Workaround for an issue with converting a long to a double on iPhone OS 2.2.1 with a base SDK >= 3.0
+		if ([ASIHTTPRequest isiPhoneOS2]) {
+			progress = [[NSNumber numberWithUnsignedLongLong:[self bytesDownloadedSoFar]] doubleValue]/[[NSNumber numberWithUnsignedLongLong:total] doubleValue]; 
+		} else {
+			progress = ([self bytesDownloadedSoFar]*1.0)/(total*1.0);
+		}
+		[ASIHTTPRequest setProgress:progress forProgressIndicator:[self downloadProgressDelegate]];
 	}
-	[ASIHTTPRequest setProgress:progress forProgressIndicator:[self downloadProgressDelegate]];
 }
 
+- (unsigned long long)bytesUploadedSoFar
+{
+	return (unsigned long long)ASIAtomicLoad64(&bytesUploadedSoFar);
+}
+
+- (void)setBytesUploadedSoFar:(unsigned long long)bytes
+{
+	ASIAtomicStore64(&bytesUploadedSoFar, (int64_t)bytes);
+}
+
+- (unsigned long long)totalBytesToUpload
+{
+	return (unsigned long long)ASIAtomicLoad64(&totalBytesToUpload);
+}
+
+- (void)setTotalBytesToUpload:(unsigned long long)bytes
+{
+	ASIAtomicStore64(&totalBytesToUpload, (int64_t)bytes);
+}
+
+- (unsigned long long)bytesDownloadedSoFar
+{
+	return (unsigned long long)ASIAtomicLoad64(&bytesDownloadedSoFar);
+}
+
+- (void)setBytesDownloadedSoFar:(unsigned long long)bytes
+{
+	ASIAtomicStore64(&bytesDownloadedSoFar, (int64_t)bytes);
+}
+
+- (unsigned long long)totalBytesToDownload
+{
+	return (unsigned long long)ASIAtomicLoad64(&totalBytesToDownload);
+}
+
+- (void)setTotalBytesToDownload:(unsigned long long)bytes
+{
+	ASIAtomicStore64(&totalBytesToDownload, (int64_t)bytes);
+}
 
 // Since this queue takes over as the delegate for all requests it contains, it should forward authorisation requests to its own delegate
 - (void)authenticationNeededForRequest:(ASIHTTPRequest *)request
@@ -331,10 +405,7 @@
 
 
 @synthesize requestsCount;
-@synthesize bytesUploadedSoFar;
-@synthesize totalBytesToUpload;
-@synthesize bytesDownloadedSoFar;
-@synthesize totalBytesToDownload;
+@synthesize progressUpdateCount;
 @synthesize shouldCancelAllRequestsOnFailure;
 @synthesize uploadProgressDelegate;
 @synthesize downloadProgressDelegate;
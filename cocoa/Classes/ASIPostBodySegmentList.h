@@ -0,0 +1,56 @@
+//
+//  ASIPostBodySegmentList.h
+//  asi-http-request
+//
+
+#import <Foundation/Foundation.h>
+
+// A request body kept as a list of pieces rather than one buffer or temporary file
+// Strings are encoded into small header buffers, NSData is kept by reference, and files are read in place through a memory map when the body is sent
+// Build the list first, then read it from the start with bytesAtCursor:error: and advanceCursorBy: - it can't be added to while it's being read
+
+@interface ASIPostBodySegmentList : NSObject {
+
+	// NSData for strings and data, NSDictionary with path, offset and length for files
+	NSMutableArray *segments;
+
+	// The header buffer strings are being encoded into, until some data or a file comes after them
+	NSMutableData *openStringBuffer;
+
+	unsigned long long length;
+
+	// Where the next read starts
+	NSUInteger segmentIndex;
+	unsigned long long segmentOffset;
+
+	// The part of a file segment that is mapped at the moment
+	void *mappedBytes;
+	size_t mappedLength;
+	unsigned long long mappedFileOffset;
+	NSUInteger mappedSegmentIndex;
+}
++ (id)segmentList;
+
+// Encodes the string onto the end of the list, sharing a buffer with any strings appended just before it
+- (void)appendString:(NSString *)string encoding:(NSStringEncoding)encoding;
+
+// Data is kept by reference rather than copied, so mutable data must not change until the body has been sent
+- (void)appendData:(NSData *)data;
+
+// The file's size is taken now and must not change before the body has been sent
+- (BOOL)appendFileAtPath:(NSString *)path error:(NSError **)err;
+- (void)appendFileAtPath:(NSString *)path offset:(unsigned long long)offset length:(unsigned long long)fileLength;
+
+// Moves back to the start of the list, so the body can be sent again
+- (void)rewind;
+
+// Returns the bytes from the cursor to the end of the current segment or mapped window, or NULL at the end of the list or if a file can't be read
+- (const void *)bytesAtCursor:(NSUInteger *)bytesLength error:(NSError **)err;
+- (void)advanceCursorBy:(NSUInteger)bytesLength;
+
+// Unmaps any file segment, called automatically when the list goes away
+- (void)close;
+
+// The size of the whole body
+@property (assign, readonly) unsigned long long length;
+@end
@@ -0,0 +1,211 @@
+//
+//  ASIPostBodySegmentList.m
+//  asi-http-request
+//
+
+#import "ASIPostBodySegmentList.h"
+#import "ASIHTTPRequest.h"
+#import <sys/mman.h>
+#import <sys/stat.h>
+#import <fcntl.h>
+#import <unistd.h>
+
+// The most of a file we map at once, so large uploads don't use up our address space
+#define ASIPostBodyMapWindowSize (4 * 1024 * 1024)
+
+@interface ASIPostBodySegmentList ()
+- (unsigned long long)lengthOfSegment:(id)segment;
+- (BOOL)mapFileSegment:(NSDictionary *)segment atOffset:(unsigned long long)offset error:(NSError **)err;
+@end
+
+@implementation ASIPostBodySegmentList
+
++ (id)segmentList
+{
+	return [[[self alloc] init] autorelease];
+}
+
+- (id)init
+{
+	self = [super init];
+	segments = [[NSMutableArray alloc] init];
+	return self;
+}
+
+- (void)dealloc
+{
+	[self close];
+	[segments release];
+	[openStringBuffer release];
+	[super dealloc];
+}
+
+- (void)finalize
+{
+	[self close];
+	[super finalize];
+}
+
+#pragma mark building the list
+
+- (void)appendString:(NSString *)string encoding:(NSStringEncoding)encoding
+{
+	NSUInteger maxLength = [string maximumLengthOfBytesUsingEncoding:encoding];
+	if (maxLength == 0) {
+		return;
+	}
+	if (!openStringBuffer) {
+		openStringBuffer = [[NSMutableData alloc] initWithCapacity:256];
+		[segments addObject:openStringBuffer];
+	}
+	NSUInteger start = [openStringBuffer length];
+	NSUInteger used = 0;
+	[openStringBuffer setLength:start+maxLength];
+	[string getBytes:(char *)[openStringBuffer mutableBytes]+start maxLength:maxLength usedLength:&used encoding:encoding options:0 range:NSMakeRange(0,[string length]) remainingRange:NULL];
+	[openStringBuffer setLength:start+used];
+	length += used;
+}
+
+- (void)appendData:(NSData *)data
+{
+	if ([data length] == 0) {
+		return;
+	}
+	[openStringBuffer release];
+	openStringBuffer = nil;
+	[segments addObject:data];
+	length += [data length];
+}
+
+- (BOOL)appendFileAtPath:(NSString *)path error:(NSError **)err
+{
+	NSError *attributesError = nil;
+	NSDictionary *attributes = [[NSFileManager defaultManager] attributesOfItemAtPath:path error:&attributesError];
+	if (!attributes) {
+		if (err) {
+			*err = [NSError errorWithDomain:NetworkRequestErrorDomain code:ASIFileManagementError userInfo:[NSDictionary dictionaryWithObjectsAndKeys:[NSString stringWithFormat:@"Failed to get attributes for file at path '%@'",path],NSLocalizedDescriptionKey,attributesError,NSUnderlyingErrorKey,nil]];
+		}
+		return NO;
+	}
+	[self appendFileAtPath:path offset:0 length:[attributes fileSize]];
+	return YES;
+}
+
+- (void)appendFileAtPath:(NSString *)path offset:(unsigned long long)offset length:(unsigned long long)fileLength
+{
+	if (fileLength == 0) {
+		return;
+	}
+	[openStringBuffer release];
+	openStringBuffer = nil;
+	[segments addObject:[NSDictionary dictionaryWithObjectsAndKeys:path,@"path",[NSNumber numberWithUnsignedLongLong:offset],@"offset",[NSNumber numberWithUnsignedLongLong:fileLength],@"length",nil]];
+	length += fileLength;
+}
+
+- (unsigned long long)lengthOfSegment:(id)segment
+{
+	if ([segment isKindOfClass:[NSData class]]) {
+		return [segment length];
+	}
+	return [[segment objectForKey:@"length"] unsignedLongLongValue];
+}
+
+#pragma mark reading the list
+
+- (void)rewind
+{
+	[self close];
+	segmentIndex = 0;
+	segmentOffset = 0;
+}
+
+- (const void *)bytesAtCursor:(NSUInteger *)bytesLength error:(NSError **)err
+{
+	*bytesLength = 0;
+	while (segmentIndex < [segments count] && segmentOffset >= [self lengthOfSegment:[segments objectAtIndex:segmentIndex]]) {
+		segmentIndex++;
+		segmentOffset = 0;
+	}
+	if (segmentIndex >= [segments count]) {
+		[self close];
+		return NULL;
+	}
+
+	id segment = [segments objectAtIndex:segmentIndex];
+	if ([segment isKindOfClass:[NSData class]]) {
+		*bytesLength = (NSUInteger)([segment length] - segmentOffset);
+		return (const char *)[segment bytes] + segmentOffset;
+	}
+
+	unsigned long long offset = [[segment objectForKey:@"offset"] unsignedLongLongValue] + segmentOffset;
+	if (!mappedBytes || mappedSegmentIndex != segmentIndex || offset < mappedFileOffset || offset >= mappedFileOffset + mappedLength) {
+		if (![self mapFileSegment:segment atOffset:offset error:err]) {
+			return NULL;
+		}
+	}
+	*bytesLength = (NSUInteger)(mappedFileOffset + mappedLength - offset);
+	return (const char *)mappedBytes + (offset - mappedFileOffset);
+}
+
+- (void)advanceCursorBy:(NSUInteger)bytesLength
+{
+	segmentOffset += bytesLength;
+}
+
+// Maps the window of the file that starts at the page holding offset and runs to the end of the segment, or the window size if that comes first
+- (BOOL)mapFileSegment:(NSDictionary *)segment atOffset:(unsigned long long)offset error:(NSError **)err
+{
+	[self close];
+
+	NSString *path = [segment objectForKey:@"path"];
+	unsigned long long segmentEnd = [[segment objectForKey:@"offset"] unsignedLongLongValue] + [[segment objectForKey:@"length"] unsignedLongLongValue];
+	unsigned long long windowStart = offset - (offset % getpagesize());
+	unsigned long long windowEnd = windowStart + ASIPostBodyMapWindowSize;
+	if (windowEnd > segmentEnd) {
+		windowEnd = segmentEnd;
+	}
+
+	NSString *failure = nil;
+	int fd = open([path fileSystemRepresentation], O_RDONLY);
+	if (fd < 0) {
+		failure = @"Failed to open file at path '%@'";
+	} else {
+		// Reading a mapped page beyond the end of the file would crash us, so make sure it's still as long as when we were given it
+		struct stat fileInfo;
+		if (fstat(fd, &fileInfo) != 0 || (unsigned long long)fileInfo.st_size < segmentEnd) {
+			failure = @"The file at path '%@' changed size before it could be sent";
+		} else {
+			void *bytes = mmap(NULL, (size_t)(windowEnd - windowStart), PROT_READ, MAP_SHARED, fd, (off_t)windowStart);
+			if (bytes == MAP_FAILED) {
+				failure = @"Failed to map file at path '%@'";
+			} else {
+				madvise(bytes, (size_t)(windowEnd - windowStart), MADV_SEQUENTIAL);
+				mappedBytes = bytes;
+				mappedLength = (size_t)(windowEnd - windowStart);
+				mappedFileOffset = windowStart;
+				mappedSegmentIndex = segmentIndex;
+			}
+		}
+		close(fd);
+	}
+
+	if (failure) {
+		if (err) {
+			*err = [NSError errorWithDomain:NetworkRequestErrorDomain code:ASIFileManagementError userInfo:[NSDictionary dictionaryWithObjectsAndKeys:[NSString stringWithFormat:failure,path],NSLocalizedDescriptionKey,nil]];
+		}
+		return NO;
+	}
+	return YES;
+}
+
+- (void)close
+{
+	if (mappedBytes) {
+		munmap(mappedBytes, mappedLength);
+		mappedBytes = NULL;
+		mappedLength = 0;
+	}
+}
+
+@synthesize length;
+@end
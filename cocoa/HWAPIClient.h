@@ -0,0 +1,109 @@
+#import <Cocoa/Cocoa.h>
+
+@class ASIHTTPRequest;
+@class HWLatencyHistogram;
+
+// Answers an endpoint needs before its own latency sets its timeout and hedge delay
+#define HWAPIMinLatencySamples 20
+
+// Used for an endpoint's requests until it has enough samples
+#define HWAPIDefaultTimeout 10.0
+
+// After that, timeouts are this multiple of the endpoint's p99, within the limits
+#define HWAPITimeoutMultiplier 3.0
+#define HWAPIMinTimeout 2.0
+#define HWAPIMaxTimeout 30.0
+
+// A list call still unanswered at its endpoint's p95 is sent a second time, never sooner than this
+#define HWAPIMinHedgeDelay 0.05
+
+// An endpoint's histograms are halved when it has this many samples, or when they were last
+// halved this many seconds ago, so its timeout and hedge delay follow how it behaves now
+#define HWAPIMaxLatencySamples 200
+#define HWAPILatencyHalfLife 300.0
+
+// The phases each method's answers are timed in. Connect includes the DNS lookup,
+// which CFNetwork doesn't report on its own, and is only recorded for new connections.
+// Parse is only recorded for requests parsed with an HWJSONResponseParser.
+#define HWAPIPhaseTotal @"total"
+#define HWAPIPhaseConnect @"connect"
+#define HWAPIPhaseFirstByte @"first byte"
+#define HWAPIPhaseDownload @"download"
+#define HWAPIPhaseParse @"parse"
+
+// The one queue every HighwireAPI sends its requests on, and the place their
+// latency is measured. Each API method keeps a histogram of how long its
+// answers took, which sets the timeout of its next requests, and one for each
+// phase of them, for diagnosing where the time went. A request that times out
+// counts as an answer that took its whole timeout, so an endpoint that slows
+// down past its timeout gets longer timeouts rather than failing from then on.
+//
+// List calls go through sendIdempotentRequest:, which leaves a request for a
+// URL that is already on its way unsent and hands the first one's answer to
+// every caller instead, so repeated clicks or several windows asking for the
+// same list cost one round trip. If the answer takes longer than the method's
+// p95, an identical hedge request is sent and whichever answers first is used.
+//
+// Used from the main thread only.
+@interface HWAPIClient : NSObject {
+	NSOperationQueue *queue;
+
+	// URL -> the idempotent request in flight for it: "method", "waiters" (each a dictionary
+	// with "caller" and "failSelector") and "requests" (the original, and the hedge once sent)
+	NSMutableDictionary *inFlight;
+
+	// API method -> phase -> HWLatencyHistogram of successful answers and timeouts
+	NSMutableDictionary *latencyHistograms;
+
+	// API method -> NSDate its histograms were last halved
+	NSMutableDictionary *latencyDecayedAt;
+
+	BOOL hedgesRequests;
+
+	unsigned long sentRequestCount;
+	unsigned long coalescedRequestCount;
+	unsigned long hedgedRequestCount;
+	unsigned long hedgeWinCount;
+}
+
++ (HWAPIClient *)sharedObject;
+
+- (NSOperationQueue *)queue;
+
+// Sends the request with the method's timeout, passing its callbacks on to its delegate as usual
+- (void)sendRequest:(ASIHTTPRequest *)request forMethod:(NSString *)method;
+
+// Sends the request unless an identical one is in flight. The parsed response
+// goes to the caller's <method>Result: handler, as with -[HighwireAPI batch:],
+// and a failure to failSelector with the request that failed.
+- (void)sendIdempotentRequest:(ASIHTTPRequest *)request forMethod:(NSString *)method from:(id)caller didFailSelector:(SEL)failSelector;
+
+// HWAPIDefaultTimeout until the method has HWAPIMinLatencySamples answers, then scaled from its p99
+- (NSTimeInterval)timeoutForMethod:(NSString *)method;
+
+// 0 (no hedging) until the method has HWAPIMinLatencySamples answers, then its p95
+- (NSTimeInterval)hedgeDelayForMethod:(NSString *)method;
+
+// The total time for the method's answers, nil for a method that hasn't answered yet
+- (HWLatencyHistogram *)latencyHistogramForMethod:(NSString *)method;
+
+// One of the HWAPIPhase names, nil if the method has no samples for it
+- (HWLatencyHistogram *)latencyHistogramForMethod:(NSString *)method phase:(NSString *)phase;
+
+// The counters below and a summary line for every method and phase, for showing to the user
+- (NSString *)diagnosticsDescription;
+
+// The counters and every histogram with its buckets, as JSON
+- (BOOL)writeDiagnosticsToFile:(NSString *)path;
+
+// Requests sent through sendIdempotentRequest:, those answered by one already in flight,
+// hedge requests sent, and hedges that answered before the request they hedged
+- (unsigned long)sentRequestCount;
+- (unsigned long)coalescedRequestCount;
+- (unsigned long)hedgedRequestCount;
+- (unsigned long)hedgeWinCount;
+
+// YES unless turned off, eg to measure without it
+@property (nonatomic, assign) BOOL hedgesRequests;
+
+@end
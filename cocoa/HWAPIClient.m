@@ -0,0 +1,435 @@
+#import "HWAPIClient.h"
+#import "ASIHTTPRequest.h"
+#import "HWAPIResponseCache.h"
+#import "HWJSONResponseParser.h"
+#import "HWLatencyHistogram.h"
+#import "JSON.h"
+
+@interface HWAPIClient ()
+- (void)startRequest:(ASIHTTPRequest *)request;
+- (void)recordLatencyOfRequest:(ASIHTTPRequest *)request;
+- (void)recordTimeoutOfRequest:(ASIHTTPRequest *)request;
+- (void)decayHistogramsForMethod:(NSString *)method;
+- (void)recordValue:(NSTimeInterval)seconds forMethod:(NSString *)method phase:(NSString *)phase;
+- (NSArray *)phases;
+- (ASIHTTPRequest *)requestLike:(ASIHTTPRequest *)request;
+- (void)hedge:(NSString *)key;
+- (void)finishInFlightRequest:(NSString *)key;
+- (void)requestSucceeded:(ASIHTTPRequest *)request;
+- (void)requestFailed:(ASIHTTPRequest *)request;
+- (void)idempotentRequestSucceeded:(ASIHTTPRequest *)request;
+- (void)idempotentRequestFailed:(ASIHTTPRequest *)request;
+@end
+
+@implementation HWAPIClient
+
+@synthesize hedgesRequests;
+
+static HWAPIClient *_sharedObject = nil;
+
+- (id)init
+{
+	[super init];
+	queue = [[NSOperationQueue alloc] init];
+	inFlight = [[NSMutableDictionary alloc] init];
+	latencyHistograms = [[NSMutableDictionary alloc] init];
+	latencyDecayedAt = [[NSMutableDictionary alloc] init];
+	hedgesRequests = YES;
+	return self;
+}
+
++ (HWAPIClient *)sharedObject
+{
+	if(!_sharedObject)
+		_sharedObject = [[self alloc] init];
+	return _sharedObject;
+}
+
+- (NSOperationQueue *)queue
+{
+	return queue;
+}
+
+#pragma mark -
+#pragma mark Sending
+#pragma mark -
+
+- (void)sendRequest:(ASIHTTPRequest *)request forMethod:(NSString *)method
+{
+	// The caller's callbacks ride along in userInfo and are called once the latency is recorded
+	NSMutableDictionary *info = [NSMutableDictionary dictionaryWithDictionary:[request userInfo]];
+	[info setObject:method forKey:@"apiMethod"];
+	if([request delegate])
+	{
+		[info setObject:[request delegate] forKey:@"delegate"];
+		[info setObject:NSStringFromSelector([request didFinishSelector]) forKey:@"didFinishSelector"];
+		[info setObject:NSStringFromSelector([request didFailSelector]) forKey:@"didFailSelector"];
+	}
+	[request setUserInfo:info];
+
+	[request setDelegate:self];
+	[request setDidFinishSelector:@selector(requestSucceeded:)];
+	[request setDidFailSelector:@selector(requestFailed:)];
+	[self startRequest:request];
+}
+
+- (void)sendIdempotentRequest:(ASIHTTPRequest *)request forMethod:(NSString *)method from:(id)caller didFailSelector:(SEL)failSelector
+{
+	// The URL carries the account and every parameter, so requests for the same URL get the same answer
+	NSString *key = [[request url] absoluteString];
+	NSDictionary *waiter = [NSDictionary dictionaryWithObjectsAndKeys:caller, @"caller", NSStringFromSelector(failSelector), @"failSelector", nil];
+
+	NSMutableDictionary *entry = [inFlight objectForKey:key];
+	if(entry)
+	{
+		[[entry objectForKey:@"waiters"] addObject:waiter];
+		coalescedRequestCount++;
+		return;
+	}
+	[inFlight setObject:[NSMutableDictionary dictionaryWithObjectsAndKeys:method, @"method",
+						 [NSMutableArray arrayWithObject:waiter], @"waiters",
+						 [NSMutableArray arrayWithObject:request], @"requests", nil] forKey:key];
+	sentRequestCount++;
+
+	// Redirects change the request's URL, so it carries the key it was filed under
+	NSMutableDictionary *info = [NSMutableDictionary dictionaryWithDictionary:[request userInfo]];
+	[info setObject:key forKey:@"coalescingKey"];
+	[info setObject:method forKey:@"apiMethod"];
+	[request setUserInfo:info];
+
+	[request setDelegate:self];
+	[request setDidFinishSelector:@selector(idempotentRequestSucceeded:)];
+	[request setDidFailSelector:@selector(idempotentRequestFailed:)];
+	[self startRequest:request];
+
+	NSTimeInterval hedgeDelay = [self hedgeDelayForMethod:method];
+	if(hedgesRequests && hedgeDelay > 0)
+		[self performSelector:@selector(hedge:) withObject:key afterDelay:hedgeDelay];
+}
+
+- (void)startRequest:(ASIHTTPRequest *)request
+{
+	NSMutableDictionary *info = [NSMutableDictionary dictionaryWithDictionary:[request userInfo]];
+	[info setObject:[NSDate date] forKey:@"sentAt"];
+	[request setUserInfo:info];
+
+	[request setTimeOutSeconds:[self timeoutForMethod:[info objectForKey:@"apiMethod"]]];
+	[queue addOperation:request];
+}
+
+// A fresh request for the same URL and headers, with a parser of its own if the original had one
+- (ASIHTTPRequest *)requestLike:(ASIHTTPRequest *)request
+{
+	ASIHTTPRequest *copy = [ASIHTTPRequest requestWithURL:[request url]];
+	[copy setRequestMethod:[request requestMethod]];
+	[copy setRequestHeaders:[NSMutableDictionary dictionaryWithDictionary:[request requestHeaders]]];
+	[copy setUserInfo:[request userInfo]];
+	if([[request responseDataConsumer] isKindOfClass:[HWJSONResponseParser class]])
+		[copy setResponseDataConsumer:[HWJSONResponseParser parser]];
+	[copy setDelegate:self];
+	[copy setDidFinishSelector:@selector(idempotentRequestSucceeded:)];
+	[copy setDidFailSelector:@selector(idempotentRequestFailed:)];
+	return copy;
+}
+
+- (void)hedge:(NSString *)key
+{
+	NSMutableDictionary *entry = [inFlight objectForKey:key];
+	NSMutableArray *requests = [entry objectForKey:@"requests"];
+	if([requests count] != 1)
+		return;
+
+	ASIHTTPRequest *hedgeRequest = [self requestLike:[requests objectAtIndex:0]];
+	NSMutableDictionary *info = [NSMutableDictionary dictionaryWithDictionary:[hedgeRequest userInfo]];
+	[info setObject:[NSNumber numberWithBool:YES] forKey:@"isHedge"];
+	[hedgeRequest setUserInfo:info];
+
+	[requests addObject:hedgeRequest];
+	hedgedRequestCount++;
+	[self startRequest:hedgeRequest];
+}
+
+#pragma mark -
+#pragma mark Latency
+#pragma mark -
+
+- (void)recordLatencyOfRequest:(ASIHTTPRequest *)request
+{
+	NSString *method = [[request userInfo] objectForKey:@"apiMethod"];
+	NSDate *sentAt = [[request userInfo] objectForKey:@"sentAt"];
+	if(!method || !sentAt)
+		return;
+
+	[self recordValue:-[sentAt timeIntervalSinceNow] forMethod:method phase:HWAPIPhaseTotal];
+	if([request connectDuration] > 0)
+		[self recordValue:[request connectDuration] forMethod:method phase:HWAPIPhaseConnect];
+	if([request firstByteDuration] > 0)
+		[self recordValue:[request firstByteDuration] forMethod:method phase:HWAPIPhaseFirstByte];
+	if([request downloadDuration] > 0)
+		[self recordValue:[request downloadDuration] forMethod:method phase:HWAPIPhaseDownload];
+
+	// A 304 was answered from the cache, so there was nothing to parse
+	id consumer = [request responseDataConsumer];
+	if([consumer isKindOfClass:[HWJSONResponseParser class]] && [request responseStatusCode] != 304)
+		[self recordValue:[consumer parseTime] forMethod:method phase:HWAPIPhaseParse];
+}
+
+// The attempt took at least its whole timeout, which is what it is recorded as
+- (void)recordTimeoutOfRequest:(ASIHTTPRequest *)request
+{
+	NSString *method = [[request userInfo] objectForKey:@"apiMethod"];
+	if(!method || [[request error] code] != ASIRequestTimedOutErrorType)
+		return;
+
+	[self recordValue:[request timeOutSeconds] forMethod:method phase:HWAPIPhaseTotal];
+}
+
+- (void)recordValue:(NSTimeInterval)seconds forMethod:(NSString *)method phase:(NSString *)phase
+{
+	NSMutableDictionary *phases = [latencyHistograms objectForKey:method];
+	if(!phases)
+	{
+		phases = [NSMutableDictionary dictionary];
+		[latencyHistograms setObject:phases forKey:method];
+		[latencyDecayedAt setObject:[NSDate date] forKey:method];
+	}
+	if([phase isEqualToString:HWAPIPhaseTotal])
+		[self decayHistogramsForMethod:method];
+
+	HWLatencyHistogram *histogram = [phases objectForKey:phase];
+	if(!histogram)
+	{
+		histogram = [[HWLatencyHistogram alloc] initWithName:[NSString stringWithFormat:@"%@ %@", method, phase]];
+		[phases setObject:histogram forKey:phase];
+	}
+	[histogram recordValue:seconds];
+}
+
+// Every phase at once, so they keep describing the same requests
+- (void)decayHistogramsForMethod:(NSString *)method
+{
+	NSDictionary *phases = [latencyHistograms objectForKey:method];
+	if([[phases objectForKey:HWAPIPhaseTotal] count] < HWAPIMaxLatencySamples &&
+	   -[[latencyDecayedAt objectForKey:method] timeIntervalSinceNow] < HWAPILatencyHalfLife)
+		return;
+
+	for(NSString *phase in phases)
+		[[phases objectForKey:phase] decay];
+	[latencyDecayedAt setObject:[NSDate date] forKey:method];
+}
+
+- (NSArray *)phases
+{
+	return [NSArray arrayWithObjects:HWAPIPhaseTotal, HWAPIPhaseConnect, HWAPIPhaseFirstByte, HWAPIPhaseDownload, HWAPIPhaseParse, nil];
+}
+
+- (HWLatencyHistogram *)latencyHistogramForMethod:(NSString *)method
+{
+	return [self latencyHistogramForMethod:method phase:HWAPIPhaseTotal];
+}
+
+- (HWLatencyHistogram *)latencyHistogramForMethod:(NSString *)method phase:(NSString *)phase
+{
+	return [[latencyHistograms objectForKey:method] objectForKey:phase];
+}
+
+- (NSTimeInterval)timeoutForMethod:(NSString *)method
+{
+	HWLatencyHistogram *histogram = [self latencyHistogramForMethod:method];
+	if([histogram count] < HWAPIMinLatencySamples)
+		return HWAPIDefaultTimeout;
+
+	NSTimeInterval timeout = [histogram valueAtPercentile:99] * HWAPITimeoutMultiplier;
+	return MIN(MAX(timeout, HWAPIMinTimeout), HWAPIMaxTimeout);
+}
+
+- (NSTimeInterval)hedgeDelayForMethod:(NSString *)method
+{
+	HWLatencyHistogram *histogram = [self latencyHistogramForMethod:method];
+	if([histogram count] < HWAPIMinLatencySamples)
+		return 0;
+
+	return MAX([histogram valueAtPercentile:95], HWAPIMinHedgeDelay);
+}
+
+#pragma mark -
+#pragma mark ASIHTTPRequest Delegate
+#pragma mark -
+
+- (void)requestSucceeded:(ASIHTTPRequest *)request
+{
+	[self recordLatencyOfRequest:request];
+
+	id delegate = [[request userInfo] objectForKey:@"delegate"];
+	SEL selector = NSSelectorFromString([[request userInfo] objectForKey:@"didFinishSelector"]);
+	if(delegate && [delegate respondsToSelector:selector])
+		[delegate performSelector:selector withObject:request];
+}
+
+- (void)requestFailed:(ASIHTTPRequest *)request
+{
+	[self recordTimeoutOfRequest:request];
+
+	id delegate = [[request userInfo] objectForKey:@"delegate"];
+	SEL selector = NSSelectorFromString([[request userInfo] objectForKey:@"didFailSelector"]);
+	if(delegate && [delegate respondsToSelector:selector])
+		[delegate performSelector:selector withObject:request];
+}
+
+// Callers that ask again from their handlers start a new request rather than joining the one that just ended
+- (void)finishInFlightRequest:(NSString *)key
+{
+	[NSObject cancelPreviousPerformRequestsWithTarget:self selector:@selector(hedge:) object:key];
+	[inFlight removeObjectForKey:key];
+}
+
+- (void)idempotentRequestSucceeded:(ASIHTTPRequest *)request
+{
+	NSString *key = [[request userInfo] objectForKey:@"coalescingKey"];
+	NSMutableDictionary *entry = [inFlight objectForKey:key];
+	if(![[entry objectForKey:@"requests"] containsObject:request])
+		return;
+
+	[self recordLatencyOfRequest:request];
+
+	// Not modified, but the cache no longer has what wasn't modified: ask again for the whole answer
+	if([[HWAPIResponseCache sharedObject] lostObjectForResponseToRequest:request])
+	{
+		ASIHTTPRequest *refetch = [self requestLike:request];
+		[[refetch requestHeaders] removeObjectForKey:@"If-None-Match"];
+		NSMutableDictionary *info = [NSMutableDictionary dictionaryWithDictionary:[refetch userInfo]];
+		[info removeObjectForKey:@"isHedge"];
+		[refetch setUserInfo:info];
+
+		for(ASIHTTPRequest *other in [entry objectForKey:@"requests"])
+		{
+			if(other == request) continue;
+			[other setDelegate:nil];
+			[other cancel];
+		}
+		[[entry objectForKey:@"requests"] setArray:[NSArray arrayWithObject:refetch]];
+		[self startRequest:refetch];
+		return;
+	}
+
+	if([[request userInfo] objectForKey:@"isHedge"])
+		hedgeWinCount++;
+
+	// The first answer wins, the other attempt is called off
+	for(ASIHTTPRequest *other in [entry objectForKey:@"requests"])
+	{
+		if(other == request) continue;
+		[other setDelegate:nil];
+		[other cancel];
+	}
+	[self finishInFlightRequest:key];
+
+	// Parsed once, however many callers there are
+	id object = [[HWAPIResponseCache sharedObject] objectForResponseToRequest:request];
+	SEL handler = NSSelectorFromString([NSString stringWithFormat:@"%@Result:", [entry objectForKey:@"method"]]);
+	for(NSDictionary *waiter in [entry objectForKey:@"waiters"])
+	{
+		id caller = [waiter objectForKey:@"caller"];
+		if([caller respondsToSelector:handler])
+			[caller performSelector:handler withObject:object];
+	}
+}
+
+- (void)idempotentRequestFailed:(ASIHTTPRequest *)request
+{
+	NSString *key = [[request userInfo] objectForKey:@"coalescingKey"];
+	NSMutableDictionary *entry = [inFlight objectForKey:key];
+	NSMutableArray *requests = [entry objectForKey:@"requests"];
+	if(![requests containsObject:request])
+		return;
+
+	[self recordTimeoutOfRequest:request];
+
+	// A list call gets a second try: the hedge goes out now if it hadn't already
+	if(hedgesRequests && [requests count] == 1 && ![[request userInfo] objectForKey:@"isHedge"])
+	{
+		[NSObject cancelPreviousPerformRequestsWithTarget:self selector:@selector(hedge:) object:key];
+		[self hedge:key];
+	}
+
+	// While the other attempt is still out there may yet be an answer
+	[requests removeObject:request];
+	if([requests count])
+		return;
+
+	[self finishInFlightRequest:key];
+	for(NSDictionary *waiter in [entry objectForKey:@"waiters"])
+	{
+		SEL failSelector = NSSelectorFromString([waiter objectForKey:@"failSelector"]);
+		id caller = [waiter objectForKey:@"caller"];
+		if([caller respondsToSelector:failSelector])
+			[caller performSelector:failSelector withObject:request];
+	}
+}
+
+#pragma mark -
+#pragma mark Counters
+#pragma mark -
+
+- (unsigned long)sentRequestCount
+{
+	return sentRequestCount;
+}
+
+- (unsigned long)coalescedRequestCount
+{
+	return coalescedRequestCount;
+}
+
+- (unsigned long)hedgedRequestCount
+{
+	return hedgedRequestCount;
+}
+
+- (unsigned long)hedgeWinCount
+{
+	return hedgeWinCount;
+}
+
+#pragma mark -
+#pragma mark Diagnostics
+#pragma mark -
+
+- (NSString *)diagnosticsDescription
+{
+	NSMutableString *description = [NSMutableString stringWithFormat:@"%lu list requests sent, %lu coalesced, %lu hedged, %lu hedges won\n",
+									sentRequestCount, coalescedRequestCount, hedgedRequestCount, hedgeWinCount];
+
+	for(NSString *method in [[latencyHistograms allKeys] sortedArrayUsingSelector:@selector(compare:)])
+		for(NSString *phase in [self phases])
+		{
+			HWLatencyHistogram *histogram = [self latencyHistogramForMethod:method phase:phase];
+			if(histogram)
+				[description appendFormat:@"%@\n", [histogram summary]];
+		}
+	return description;
+}
+
+- (BOOL)writeDiagnosticsToFile:(NSString *)path
+{
+	NSMutableDictionary *methods = [NSMutableDictionary dictionary];
+	for(NSString *method in latencyHistograms)
+	{
+		NSMutableDictionary *phases = [NSMutableDictionary dictionary];
+		for(NSString *phase in [latencyHistograms objectForKey:method])
+			[phases setObject:[[self latencyHistogramForMethod:method phase:phase] dictionaryRepresentation] forKey:phase];
+		[methods setObject:phases forKey:method];
+	}
+
+	NSDictionary *diagnostics = [NSDictionary dictionaryWithObjectsAndKeys:
+								 [NSNumber numberWithUnsignedLong:sentRequestCount], @"sentRequestCount",
+								 [NSNumber numberWithUnsignedLong:coalescedRequestCount], @"coalescedRequestCount",
+								 [NSNumber numberWithUnsignedLong:hedgedRequestCount], @"hedgedRequestCount",
+								 [NSNumber numberWithUnsignedLong:hedgeWinCount], @"hedgeWinCount",
+								 methods, @"methods", nil];
+
+	[[NSFileManager defaultManager] createDirectoryAtPath:[path stringByDeletingLastPathComponent] withIntermediateDirectories:YES attributes:nil error:NULL];
+	return [[diagnostics JSONRepresentation] writeToFile:path atomically:YES encoding:NSUTF8StringEncoding error:NULL];
+}
+
+@end
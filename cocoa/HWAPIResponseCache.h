@@ -0,0 +1,39 @@
+#import <Cocoa/Cocoa.h>
+
+@class ASIHTTPRequest;
+
+// Parsed responses of the Highwire list calls, keyed by account, method and
+// parameters and tagged with the ETag the server sent. Requests go out with
+// If-None-Match, and a 304 hands back the object parsed last time without
+// touching the JSON parser.
+@interface HWAPIResponseCache : NSObject {
+	// Cache key -> dictionary with "etag" and "object"
+	NSMutableDictionary *entries;
+
+	unsigned long hits;
+	unsigned long misses;
+}
+
++ (HWAPIResponseCache *)sharedObject;
+
++ (NSString *)keyForMethod:(NSString *)method params:(NSDictionary *)params;
+
+// Adds If-None-Match when there's a cached entry, and remembers the key in the request's userInfo
+- (void)prepareRequest:(ASIHTTPRequest *)request forKey:(NSString *)key;
+
+// The cached object on a 304, otherwise the parsed body (cached when it came with an ETag),
+// taken from the request's HWJSONResponseParser if it had one
+- (id)objectForResponseToRequest:(ASIHTTPRequest *)request;
+
+// YES for a 304 whose cached object went away after the request was sent (eg on sign out),
+// in which case it has to be sent again without If-None-Match
+- (BOOL)lostObjectForResponseToRequest:(ASIHTTPRequest *)request;
+
+// Forgets everything, used when the user signs out
+- (void)removeAllObjects;
+
+// Responses answered from the cache, and responses that had to be parsed
+- (unsigned long)hits;
+- (unsigned long)misses;
+
+@end
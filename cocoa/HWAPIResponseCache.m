@@ -0,0 +1,113 @@
+#import "HWAPIResponseCache.h"
+#import "ASIHTTPRequest.h"
+#import "HWJSONResponseParser.h"
+
+@implementation HWAPIResponseCache
+
+static HWAPIResponseCache *_sharedObject = nil;
+
+- (id)init
+{
+	[super init];
+	entries = [[NSMutableDictionary alloc] init];
+	return self;
+}
+
++ (HWAPIResponseCache *)sharedObject
+{
+	if(!_sharedObject)
+		_sharedObject = [[self alloc] init];
+	return _sharedObject;
+}
+
++ (NSString *)keyForMethod:(NSString *)method params:(NSDictionary *)params
+{
+	// The account is part of the key so signing in as someone else never sees the last user's lists
+	NSMutableString *key = [NSMutableString stringWithFormat:@"%@|%@", [[NSUserDefaults standardUserDefaults] valueForKey:@"hwEmail"], method];
+	for(NSString *name in [[params allKeys] sortedArrayUsingSelector:@selector(compare:)])
+		[key appendFormat:@"&%@=%@", name, [params objectForKey:name]];
+	return key;
+}
+
+- (void)prepareRequest:(ASIHTTPRequest *)request forKey:(NSString *)key
+{
+	NSDictionary *entry;
+	@synchronized(self)
+	{
+		entry = [entries objectForKey:key];
+	}
+
+	if(entry)
+		[request addRequestHeader:@"If-None-Match" value:[entry objectForKey:@"etag"]];
+
+	NSMutableDictionary *info = [NSMutableDictionary dictionaryWithDictionary:[request userInfo]];
+	[info setObject:key forKey:@"cacheKey"];
+	[request setUserInfo:info];
+}
+
+- (id)objectForResponseToRequest:(ASIHTTPRequest *)request
+{
+	NSString *key = [[request userInfo] objectForKey:@"cacheKey"];
+
+	if([request responseStatusCode] == 304)
+	{
+		@synchronized(self)
+		{
+			id cached = [[entries objectForKey:key] objectForKey:@"object"];
+			if(cached)
+				hits++;
+			else
+				misses++;
+			return cached;
+		}
+	}
+
+	id object = [HWJSONResponseParser objectForResponseToRequest:request];
+
+	// Header names come back in whatever case the server used
+	NSString *etag = nil;
+	for(NSString *name in [request responseHeaders])
+		if([name caseInsensitiveCompare:@"ETag"] == NSOrderedSame)
+			etag = [[request responseHeaders] objectForKey:name];
+
+	@synchronized(self)
+	{
+		misses++;
+		if(key && etag && object && ![object valueForKey:@"error"])
+			[entries setObject:[NSDictionary dictionaryWithObjectsAndKeys:etag, @"etag", object, @"object", nil] forKey:key];
+		else if(key)
+			[entries removeObjectForKey:key];
+	}
+	return object;
+}
+
+- (BOOL)lostObjectForResponseToRequest:(ASIHTTPRequest *)request
+{
+	if([request responseStatusCode] != 304)
+		return NO;
+
+	@synchronized(self)
+	{
+		return ![[entries objectForKey:[[request userInfo] objectForKey:@"cacheKey"]] objectForKey:@"object"];
+	}
+}
+
+- (void)removeAllObjects
+{
+	@synchronized(self)
+	{
+		[entries removeAllObjects];
+	}
+}
+
+- (unsigned long)hits
+{
+	return hits;
+}
+
+- (unsigned long)misses
+{
+	return misses;
+}
+
+@end
@@ -0,0 +1,39 @@
+#import <Cocoa/Cocoa.h>
+#import "HWBenchmark.h"
+
+@class HWLatencyHistogram;
+
+// Updates each thread makes to the bandwidth counters in the contention test
+#define HWBandwidthBenchmarkUpdates 200000
+
+// Size of each response, and the limit all of them share, in the throttled download test
+#define HWBandwidthBenchmarkResponseSize (128 * 1024)
+#define HWBandwidthBenchmarkLimit (1024 * 1024)
+
+// The throttled downloads are slow on purpose, so they get longer than other runs
+#define HWBandwidthBenchmarkTimeout (2 * HWBenchmarkTimeout)
+
+// Measures ASIHTTPRequest's bandwidth accounting under contention. First a
+// number of threads hammer the counters every read and write goes through,
+// next to the same work done under one global lock the way it used to be.
+// Then the same number of requests download from a mock API at once with
+// throttling on, to check the limit holds and the requests share it fairly.
+//
+// HighwireBenchmarks -HWBandwidthBenchmark 32 runs it.
+@interface HWBandwidthBenchmark : HWBenchmark {
+	int concurrency;
+
+	NSDate *startedAt;
+	HWLatencyHistogram *completionHistogram;
+}
+
+- (id)initWithConcurrency:(int)aConcurrency;
+
+// Seconds per update with every thread updating at once
+- (NSTimeInterval)measureAtomicCounters;
+- (NSTimeInterval)measureLockedCounters;
+
+// Returns NO if some download failed or didn't finish in time
+- (BOOL)runThrottledDownloads;
+
+@end
@@ -0,0 +1,162 @@
+#import "HWBandwidthBenchmark.h"
+#import "HWLatencyHistogram.h"
+#import "HWMockAPIServer.h"
+#import "ASIHTTPRequest.h"
+
+@interface HWBandwidthBenchmark ()
+- (NSTimeInterval)measureUpdatesUsingSelector:(SEL)selector;
+- (void)updateAtomicCounters:(NSConditionLock *)finished;
+- (void)updateLockedCounters:(NSConditionLock *)finished;
+@end
+
+// Stands in for the old bandwidthThrottlingLock and the counter it guarded
+static NSLock *lockedCountersLock = nil;
+static unsigned long lockedBandwidthUsed = 0;
+
+@implementation HWBandwidthBenchmark
+
++ (int)runWithUserDefaults
+{
+	HWBandwidthBenchmark *benchmark = [[HWBandwidthBenchmark alloc] initWithConcurrency:[self intArgumentOrDefault:32]];
+
+	NSTimeInterval locked = [benchmark measureLockedCounters];
+	NSTimeInterval atomic = [benchmark measureAtomicCounters];
+	NSLog(@"%d threads updating the bandwidth counters: %.0f ns per update with one lock, %.0f ns with atomic counters",
+		  benchmark->concurrency, locked * 1000000000.0, atomic * 1000000000.0);
+
+	BOOL completed = [benchmark runThrottledDownloads];
+	return completed ? 0 : 1;
+}
+
+- (id)initWithConcurrency:(int)aConcurrency
+{
+	[super init];
+	concurrency = aConcurrency;
+	completionHistogram = [[HWLatencyHistogram alloc] initWithName:@"queued -> download finished"];
+	lockedCountersLock = [[NSLock alloc] init];
+	return self;
+}
+
+- (NSTimeInterval)measureAtomicCounters
+{
+	// A limit nobody will reach, so every update goes through the token bucket as well
+	[ASIHTTPRequest setMaxBandwidthPerSecond:1 << 30];
+	NSTimeInterval perUpdate = [self measureUpdatesUsingSelector:@selector(updateAtomicCounters:)];
+	[ASIHTTPRequest setMaxBandwidthPerSecond:0];
+	return perUpdate;
+}
+
+- (NSTimeInterval)measureLockedCounters
+{
+	lockedBandwidthUsed = 0;
+	return [self measureUpdatesUsingSelector:@selector(updateLockedCounters:)];
+}
+
+- (NSTimeInterval)measureUpdatesUsingSelector:(SEL)selector
+{
+	NSConditionLock *finished = [[NSConditionLock alloc] initWithCondition:0];
+	NSDate *start = [NSDate date];
+
+	for(int i = 0; i < concurrency; i++)
+		[NSThread detachNewThreadSelector:selector toTarget:self withObject:finished];
+
+	[finished lockWhenCondition:concurrency];
+	[finished unlock];
+	return -[start timeIntervalSinceNow] / ((double)concurrency * HWBandwidthBenchmarkUpdates);
+}
+
+// What a request does for each read: count the bytes, then see how much more it may read
+- (void)updateAtomicCounters:(NSConditionLock *)finished
+{
+	NSAutoreleasePool *pool = [[NSAutoreleasePool alloc] init];
+	for(int i = 0; i < HWBandwidthBenchmarkUpdates; i++)
+	{
+		[ASIHTTPRequest incrementBandwidthUsedInLastSecond:1024];
+		[ASIHTTPRequest maxUploadReadLength];
+	}
+
+	[finished lock];
+	[finished unlockWithCondition:[finished condition] + 1];
+	[pool drain];
+}
+
+- (void)updateLockedCounters:(NSConditionLock *)finished
+{
+	NSAutoreleasePool *pool = [[NSAutoreleasePool alloc] init];
+	unsigned long limit = 1 << 30;
+	for(int i = 0; i < HWBandwidthBenchmarkUpdates; i++)
+	{
+		[lockedCountersLock lock];
+		lockedBandwidthUsed += 1024;
+		[lockedCountersLock unlock];
+
+		[lockedCountersLock lock];
+		volatile unsigned long remaining = limit - lockedBandwidthUsed;
+		(void)remaining;
+		[lockedCountersLock unlock];
+	}
+
+	[finished lock];
+	[finished unlockWithCondition:[finished condition] + 1];
+	[pool drain];
+}
+
+- (BOOL)runThrottledDownloads
+{
+	if(![self startMockAPI])
+		return NO;
+
+	// A JSON string long enough to make up the response size
+	NSMutableString *json = [NSMutableString stringWithString:@"{\"data\":\""];
+	while([json length] < HWBandwidthBenchmarkResponseSize - 2)
+		[json appendString:@"0123456789abcdef"];
+	[json appendString:@"\"}"];
+	[mockAPI setResponse:json forMethod:@"download"];
+
+	[completionHistogram reset];
+	[ASIHTTPRequest setMaxBandwidthPerSecond:HWBandwidthBenchmarkLimit];
+
+	NSOperationQueue *queue = [[NSOperationQueue alloc] init];
+	[queue setMaxConcurrentOperationCount:concurrency];
+	outstanding = concurrency;
+	failures = 0;
+	startedAt = [NSDate date];
+
+	for(int i = 0; i < concurrency; i++)
+	{
+		NSURL *url = [NSURL URLWithString:[NSString stringWithFormat:@"%@?method=download&n=%d", [mockAPI baseURL], i]];
+		ASIHTTPRequest *request = [ASIHTTPRequest requestWithURL:url];
+		[request setTimeOutSeconds:HWBandwidthBenchmarkTimeout];
+		[request setDelegate:self];
+		[request setDidFinishSelector:@selector(requestFinished:)];
+		[request setDidFailSelector:@selector(requestFailed:)];
+		[queue addOperation:request];
+	}
+
+	[self runUntil:@selector(isFinished) timeout:HWBandwidthBenchmarkTimeout];
+
+	NSTimeInterval elapsed = -[startedAt timeIntervalSinceNow];
+	unsigned long long bytes = (unsigned long long)(concurrency - outstanding - failures) * [json length];
+	NSLog(@"%d throttled downloads: %.0f KB/s against a limit of %d KB/s, %.0f KB/s average reported",
+		  concurrency, bytes / elapsed / 1024.0, HWBandwidthBenchmarkLimit / 1024, [ASIHTTPRequest averageBandwidthUsedPerSecond] / 1024.0);
+	NSLog(@"%@\n%@", [completionHistogram summary], [completionHistogram bucketDescription]);
+	if(failures)
+		NSLog(@"%d downloads failed", failures);
+
+	[queue cancelAllOperations];
+	[ASIHTTPRequest setMaxBandwidthPerSecond:0];
+	[self stopMockAPI];
+	return outstanding == 0 && failures == 0;
+}
+
+#pragma mark -
+#pragma mark ASIHTTPRequest Delegate
+#pragma mark -
+
+- (void)requestFinished:(ASIHTTPRequest *)request
+{
+	[completionHistogram recordValue:-[startedAt timeIntervalSinceNow]];
+	[super requestFinished:request];
+}
+
+@end
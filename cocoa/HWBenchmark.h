@@ -0,0 +1,51 @@
+#import <Cocoa/Cocoa.h>
+
+@class HWMockAPIServer;
+@class ASIHTTPRequest;
+
+// Seconds a run may take before it counts as failed, unless a benchmark needs longer
+#define HWBenchmarkTimeout 60.0
+
+// What the benchmarks and harnesses in HighwireBenchmarks have in common: a
+// mock API on a loopback port, counters for requests still out and requests
+// that failed, and a way to spin the run loop until a run is done. Each
+// subclass is selected by an option named after it, so
+//
+// HighwireBenchmarks -HWHTTPCoreBenchmark 1,10,100
+//
+// calls +[HWHTTPCoreBenchmark runWithUserDefaults], which reads "1,10,100"
+// back with +argument.
+@interface HWBenchmark : NSObject {
+	HWMockAPIServer *mockAPI;
+
+	int outstanding;
+	int failures;
+}
+
+// Runs the benchmark from the command line and returns the exit status. Subclasses override this.
++ (int)runWithUserDefaults;
+
+// The value given for the option named after the class, if any
++ (NSString *)argument;
+
+// The argument as a number, or value if it isn't a positive one
++ (int)intArgumentOrDefault:(int)value;
+
+// The argument as a comma separated list of positive counts, or defaults if it has none
++ (NSArray *)countsFromArgumentOrDefaults:(NSArray *)defaults;
+
+// Starts a mock API on an unused loopback port. Returns NO if it couldn't listen.
+- (BOOL)startMockAPI;
+- (void)stopMockAPI;
+
+// Spins the current run loop until condition returns YES or timeout passes, and returns what it last returned
+- (BOOL)runUntil:(SEL)condition timeout:(NSTimeInterval)timeout;
+
+// Whether every request sent has finished or failed, the condition most runs wait on
+- (BOOL)isFinished;
+
+// Delegate methods that keep the counters, for subclasses to extend
+- (void)requestFinished:(ASIHTTPRequest *)request;
+- (void)requestFailed:(ASIHTTPRequest *)request;
+
+@end
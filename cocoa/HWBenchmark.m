@@ -0,0 +1,80 @@
+#import "HWBenchmark.h"
+#import "HWMockAPIServer.h"
+#import "HWTrafficRecorder.h"
+#import "ASIHTTPRequest.h"
+
+@implementation HWBenchmark
+
++ (int)runWithUserDefaults
+{
+	NSLog(@"%@ doesn't run from the command line", self);
+	return 1;
+}
+
++ (NSString *)argument
+{
+	return [[NSUserDefaults standardUserDefaults] stringForKey:NSStringFromClass(self)];
+}
+
++ (int)intArgumentOrDefault:(int)value
+{
+	int argument = [[self argument] intValue];
+	return argument > 0 ? argument : value;
+}
+
++ (NSArray *)countsFromArgumentOrDefaults:(NSArray *)defaults
+{
+	NSMutableArray *counts = [NSMutableArray array];
+	for(NSString *count in [[self argument] componentsSeparatedByString:@","])
+		if([count intValue] > 0)
+			[counts addObject:[NSNumber numberWithInt:[count intValue]]];
+	return [counts count] ? counts : defaults;
+}
+
+- (BOOL)startMockAPI
+{
+	mockAPI = [[HWMockAPIServer alloc] initWithPort:[HWTrafficRecorder unusedLoopbackPort]];
+	if([mockAPI start])
+		return YES;
+
+	NSLog(@"The mock API couldn't start");
+	mockAPI = nil;
+	return NO;
+}
+
+- (void)stopMockAPI
+{
+	[mockAPI stop];
+	mockAPI = nil;
+}
+
+- (BOOL)runUntil:(SEL)condition timeout:(NSTimeInterval)timeout
+{
+	BOOL (*test)(id, SEL) = (BOOL (*)(id, SEL))[self methodForSelector:condition];
+	NSDate *deadline = [NSDate dateWithTimeIntervalSinceNow:timeout];
+	while(!test(self, condition) && [deadline timeIntervalSinceNow] > 0)
+		[[NSRunLoop currentRunLoop] runMode:NSDefaultRunLoopMode beforeDate:[NSDate dateWithTimeIntervalSinceNow:0.05]];
+	return test(self, condition);
+}
+
+- (BOOL)isFinished
+{
+	return outstanding <= 0;
+}
+
+#pragma mark -
+#pragma mark ASIHTTPRequest Delegate
+#pragma mark -
+
+- (void)requestFinished:(ASIHTTPRequest *)request
+{
+	outstanding--;
+}
+
+- (void)requestFailed:(ASIHTTPRequest *)request
+{
+	failures++;
+	outstanding--;
+}
+
+@end
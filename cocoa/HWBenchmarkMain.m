@@ -0,0 +1,41 @@
+#import <Cocoa/Cocoa.h>
+#import "HWBenchmark.h"
+#import "HWTrafficReplayer.h"
+
+// Each option picks what runs, the value after it is that run's argument.
+// The class answers +runWithUserDefaults with the exit status.
+static const struct {
+	NSString *option;
+	NSString *className;
+	NSString *usage;
+} HWBenchmarkTable[] = {
+	{ @"HWReplayCapture", @"HWTrafficReplayer", @"<file> replays a capture made by HWTrafficRecorder" },
+	{ @"HWLatencyHarness", @"HWLatencyHarness", @"1,10,100 measures discovery-to-availability latency for that many services" },
+	{ @"HWHTTPCoreBenchmark", @"HWHTTPCoreBenchmark", @"1,10,100 compares the HTTP client's shared network thread with a thread per request" },
+	{ @"HWBandwidthBenchmark", @"HWBandwidthBenchmark", @"32 measures bandwidth accounting with that many requests at once" },
+	{ @"HWInflateBenchmark", @"HWInflateBenchmark", @"4096 compares inflating a 4 MB gzipped response as it arrives with inflating it afterwards" },
+	{ @"HWQueueProgressBenchmark", @"HWQueueProgressBenchmark", @"2000 measures progress reporting for a queue of that many small requests" },
+	{ @"HWHedgingBenchmark", @"HWHedgingBenchmark", @"200 measures list call latency against a mock API with a slow tail, with and without hedging" },
+};
+
+int main(int argc, char *argv[])
+{
+	NSAutoreleasePool *pool = [[NSAutoreleasePool alloc] init];
+	int count = sizeof(HWBenchmarkTable) / sizeof(HWBenchmarkTable[0]);
+	int result = -1;
+
+	for(int i = 0; i < count && result < 0; i++)
+		if([[NSUserDefaults standardUserDefaults] stringForKey:HWBenchmarkTable[i].option])
+			result = [NSClassFromString(HWBenchmarkTable[i].className) runWithUserDefaults];
+
+	if(result < 0)
+	{
+		fprintf(stderr, "usage: %s -<option> <argument>\n", argv[0]);
+		for(int i = 0; i < count; i++)
+			fprintf(stderr, "  -%s %s\n", [HWBenchmarkTable[i].option UTF8String], [HWBenchmarkTable[i].usage UTF8String]);
+		result = 1;
+	}
+
+	[pool drain];
+	return result;
+}
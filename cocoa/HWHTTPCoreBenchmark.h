@@ -0,0 +1,41 @@
+#import <Cocoa/Cocoa.h>
+#import "HWBenchmark.h"
+
+@class HWLatencyHistogram;
+
+// Seconds the mock API waits before answering each request
+#define HWHTTPCoreBenchmarkServerDelay 0.05
+
+// Compares the shared network thread in ASIHTTPRequest with the old design,
+// where each request ran its own run loop on an operation queue thread and
+// looked for timeouts every quarter of a second. Each run queues a number of
+// requests against a mock API on a queue set up like HighwireAPI's, and
+// records the time from queueing to the delegate hearing back, along with the
+// most threads the requests needed at once and the buffers each response took.
+//
+// HighwireBenchmarks -HWHTTPCoreBenchmark 1,10,100 runs it.
+@interface HWHTTPCoreBenchmark : HWBenchmark {
+	NSOperationQueue *queue;
+
+	int baselineThreads;
+	int peakThreads;
+	unsigned long responseAllocations;
+
+	HWLatencyHistogram *latencyHistogram;
+}
+
+- (BOOL)setUp;
+- (void)tearDown;
+
+// Returns NO if some request didn't finish in time
+- (BOOL)runWithRequestCount:(int)count usingRequestThreads:(BOOL)requestThreads;
+
+// Most threads in use during the last run beyond those there before it, not counting the mock API's
+- (int)peakThreads;
+
+// Buffers each finished request allocated for its response body, on average
+- (double)responseAllocationsPerRequest;
+
+- (HWLatencyHistogram *)latencyHistogram;
+
+@end
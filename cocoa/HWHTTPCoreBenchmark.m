@@ -0,0 +1,149 @@
+#import "HWHTTPCoreBenchmark.h"
+#import "HWLatencyHistogram.h"
+#import "HWMockAPIServer.h"
+#import "ASIHTTPRequest.h"
+#import <mach/mach.h>
+
+static int HWThreadCount(void)
+{
+	thread_act_array_t threads;
+	mach_msg_type_number_t count = 0;
+	if(task_threads(mach_task_self(), &threads, &count) != KERN_SUCCESS)
+		return 0;
+
+	for(mach_msg_type_number_t i = 0; i < count; i++)
+		mach_port_deallocate(mach_task_self(), threads[i]);
+	vm_deallocate(mach_task_self(), (vm_address_t)threads, count * sizeof(thread_act_t));
+	return (int)count;
+}
+
+@interface HWHTTPCoreBenchmark ()
+- (void)sampleThreads:(NSTimer *)timer;
+@end
+
+@implementation HWHTTPCoreBenchmark
+
++ (int)runWithUserDefaults
+{
+	NSArray *counts = [self countsFromArgumentOrDefaults:[NSArray arrayWithObjects:[NSNumber numberWithInt:1],
+		[NSNumber numberWithInt:10], [NSNumber numberWithInt:50], [NSNumber numberWithInt:100], nil]];
+
+	HWHTTPCoreBenchmark *benchmark = [[HWHTTPCoreBenchmark alloc] init];
+	if(![benchmark setUp])
+		return 1;
+
+	int failed = 0;
+	for(NSNumber *count in counts)
+	{
+		// The old design first, so the network thread isn't there yet to be counted against it
+		for(int design = 0; design < 2; design++)
+		{
+			BOOL requestThreads = (design == 0);
+			BOOL completed = [benchmark runWithRequestCount:[count intValue] usingRequestThreads:requestThreads];
+			if(!completed) failed++;
+
+			NSLog(@"%@ requests, %@: peak %d threads, %.1f buffer allocations per response%@", count, requestThreads ? @"thread per request" : @"shared network thread",
+				  [benchmark peakThreads], [benchmark responseAllocationsPerRequest], completed ? @"" : @" (timed out, partial results)");
+			NSLog(@"%@\n%@", [[benchmark latencyHistogram] summary], [[benchmark latencyHistogram] bucketDescription]);
+		}
+	}
+
+	[benchmark tearDown];
+	return failed ? 1 : 0;
+}
+
+- (id)init
+{
+	[super init];
+	latencyHistogram = [[HWLatencyHistogram alloc] initWithName:@"queued -> delegate finished"];
+	return self;
+}
+
+- (BOOL)setUp
+{
+	if(![self startMockAPI])
+		return NO;
+	mockAPI.defaultDelay = HWHTTPCoreBenchmarkServerDelay;
+	return YES;
+}
+
+- (void)tearDown
+{
+	[self stopMockAPI];
+	[ASIHTTPRequest setUsesRequestThreads:NO];
+}
+
+- (BOOL)runWithRequestCount:(int)count usingRequestThreads:(BOOL)requestThreads
+{
+	[latencyHistogram reset];
+	[ASIHTTPRequest setUsesRequestThreads:requestThreads];
+
+	// Set up the way HighwireAPI does it
+	queue = [[NSOperationQueue alloc] init];
+	outstanding = count;
+	failures = 0;
+	responseAllocations = 0;
+	baselineThreads = HWThreadCount();
+	peakThreads = 0;
+
+	NSTimer *sampler = [NSTimer scheduledTimerWithTimeInterval:0.005 target:self selector:@selector(sampleThreads:) userInfo:nil repeats:YES];
+
+	for(int i = 0; i < count; i++)
+	{
+		NSURL *url = [NSURL URLWithString:[NSString stringWithFormat:@"%@?method=benchmark&n=%d", [mockAPI baseURL], i]];
+		ASIHTTPRequest *request = [ASIHTTPRequest requestWithURL:url];
+		[request setUserInfo:[NSDictionary dictionaryWithObject:[NSDate date] forKey:@"queuedAt"]];
+		[request setDelegate:self];
+		[request setDidFinishSelector:@selector(requestFinished:)];
+		[request setDidFailSelector:@selector(requestFailed:)];
+		[queue addOperation:request];
+	}
+
+	[self runUntil:@selector(isFinished) timeout:HWBenchmarkTimeout];
+
+	// Let the queue and the request threads wind down before the next run counts its baseline
+	[queue waitUntilAllOperationsAreFinished];
+	[sampler invalidate];
+	[[NSRunLoop currentRunLoop] runUntilDate:[NSDate dateWithTimeIntervalSinceNow:0.5]];
+	queue = nil;
+
+	if(failures)
+		NSLog(@"%d requests failed", failures);
+	return outstanding == 0 && failures == 0;
+}
+
+- (void)sampleThreads:(NSTimer *)timer
+{
+	int threads = HWThreadCount() - baselineThreads - (int)[mockAPI activeConnectionCount];
+	if(threads > peakThreads)
+		peakThreads = threads;
+}
+
+- (int)peakThreads
+{
+	return peakThreads;
+}
+
+- (double)responseAllocationsPerRequest
+{
+	uint64_t finished = [latencyHistogram count];
+	return finished ? (double)responseAllocations / finished : 0;
+}
+
+- (HWLatencyHistogram *)latencyHistogram
+{
+	return latencyHistogram;
+}
+
+#pragma mark -
+#pragma mark ASIHTTPRequest Delegate
+#pragma mark -
+
+- (void)requestFinished:(ASIHTTPRequest *)request
+{
+	[latencyHistogram recordValue:-[[[request userInfo] objectForKey:@"queuedAt"] timeIntervalSinceNow]];
+	responseAllocations += [request responseAllocationCount];
+	[super requestFinished:request];
+}
+
+@end
@@ -0,0 +1,44 @@
+#import <Cocoa/Cocoa.h>
+#import "HWBenchmark.h"
+
+@class HWAPIClient;
+@class HWLatencyHistogram;
+
+// The mock API answers in HWHedgingBenchmarkDelay, except every
+// HWHedgingBenchmarkTailEvery'th request, which it holds for HWHedgingBenchmarkTailDelay
+#define HWHedgingBenchmarkDelay 0.02
+#define HWHedgingBenchmarkTailDelay 2.0
+#define HWHedgingBenchmarkTailEvery 25
+
+// Requests go one after another, some of them held for the tail delay, so a run gets longer than most
+#define HWHedgingBenchmarkTimeout (5 * HWBenchmarkTimeout)
+
+// Checks HWAPIClient's tail latency policy against a mock API with a slow
+// tail injected. Sends list calls one after another, the way the app refreshes,
+// first with hedging off and then on, each time with a fresh client that has to
+// learn the endpoint's latency before it hedges. Reports the latency each
+// caller saw, how many hedges went out and won, and the timeout the client
+// settled on.
+//
+// HighwireBenchmarks -HWHedgingBenchmark 200 runs it.
+@interface HWHedgingBenchmark : HWBenchmark {
+	HWAPIClient *client;
+	int requestCount;
+
+	NSDate *sentAt;
+	HWLatencyHistogram *latencyHistogram;
+}
+
+- (id)initWithRequestCount:(int)count;
+
+// Returns NO if some request failed or the run didn't finish in time
+- (BOOL)runWithHedging:(BOOL)hedging;
+
+- (HWAPIClient *)client;
+- (HWLatencyHistogram *)latencyHistogram;
+
+// HWAPIClient callbacks
+- (void)listAllMachinesResult:(NSDictionary *)dict;
+- (void)listAllMachinesFailed:(id)request;
+
+@end
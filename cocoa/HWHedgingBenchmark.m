@@ -0,0 +1,100 @@
+#import "HWHedgingBenchmark.h"
+#import "HWAPIClient.h"
+#import "HWLatencyHistogram.h"
+#import "HWMockAPIServer.h"
+#import "HWJSONResponseParser.h"
+#import "ASIHTTPRequest.h"
+
+@implementation HWHedgingBenchmark
+
++ (int)runWithUserDefaults
+{
+	HWHedgingBenchmark *benchmark = [[HWHedgingBenchmark alloc] initWithRequestCount:[self intArgumentOrDefault:200]];
+
+	int failed = 0;
+	for(int hedging = 0; hedging < 2; hedging++)
+	{
+		BOOL completed = [benchmark runWithHedging:hedging];
+		if(!completed) failed++;
+
+		HWAPIClient *client = [benchmark client];
+		NSLog(@"%@: %lu hedges sent, %lu answered first, timeout settled at %.2fs, hedge delay %.0fms%@",
+			  hedging ? @"Hedging after p95" : @"No hedging", [client hedgedRequestCount], [client hedgeWinCount],
+			  [client timeoutForMethod:@"listAllMachines"], [client hedgeDelayForMethod:@"listAllMachines"] * 1000.0,
+			  completed ? @"" : @" (failed or timed out, partial results)");
+		NSLog(@"%@\n%@", [[benchmark latencyHistogram] summary], [[benchmark latencyHistogram] bucketDescription]);
+	}
+	return failed ? 1 : 0;
+}
+
+- (id)initWithRequestCount:(int)count
+{
+	[super init];
+	requestCount = count;
+	latencyHistogram = [[HWLatencyHistogram alloc] initWithName:@"without hedging"];
+	return self;
+}
+
+- (BOOL)runWithHedging:(BOOL)hedging
+{
+	if(![self startMockAPI])
+		return NO;
+	mockAPI.defaultDelay = HWHedgingBenchmarkDelay;
+	[mockAPI setTailDelay:HWHedgingBenchmarkTailDelay everyNthRequest:HWHedgingBenchmarkTailEvery forMethod:@"listAllMachines"];
+
+	client = [[HWAPIClient alloc] init];
+	client.hedgesRequests = hedging;
+	[latencyHistogram reset];
+	[latencyHistogram setName:hedging ? @"with hedging" : @"without hedging"];
+	outstanding = 0;
+	failures = 0;
+
+	NSDate *deadline = [NSDate dateWithTimeIntervalSinceNow:HWHedgingBenchmarkTimeout];
+	for(int i = 0; i < requestCount && [deadline timeIntervalSinceNow] > 0; i++)
+	{
+		NSURL *url = [NSURL URLWithString:[NSString stringWithFormat:@"%@?method=listAllMachines&n=%d", [mockAPI baseURL], i]];
+		ASIHTTPRequest *request = [ASIHTTPRequest requestWithURL:url];
+		[request setResponseDataConsumer:[HWJSONResponseParser parser]];
+
+		outstanding = 1;
+		sentAt = [NSDate date];
+		[client sendIdempotentRequest:request forMethod:@"listAllMachines" from:self didFailSelector:@selector(listAllMachinesFailed:)];
+		[self runUntil:@selector(isFinished) timeout:[deadline timeIntervalSinceNow]];
+	}
+
+	// Give called off requests time to go before the server does
+	[[client queue] cancelAllOperations];
+	[[NSRunLoop currentRunLoop] runUntilDate:[NSDate dateWithTimeIntervalSinceNow:0.5]];
+	[self stopMockAPI];
+
+	if(failures)
+		NSLog(@"%d requests failed", failures);
+	return outstanding == 0 && failures == 0 && [latencyHistogram count] + failures == (uint64_t)requestCount;
+}
+
+- (HWAPIClient *)client
+{
+	return client;
+}
+
+- (HWLatencyHistogram *)latencyHistogram
+{
+	return latencyHistogram;
+}
+
+#pragma mark -
+#pragma mark HWAPIClient Callbacks
+#pragma mark -
+
+- (void)listAllMachinesResult:(NSDictionary *)dict
+{
+	[latencyHistogram recordValue:-[sentAt timeIntervalSinceNow]];
+	outstanding--;
+}
+
+- (void)listAllMachinesFailed:(id)request
+{
+	[self requestFailed:request];
+}
+
+@end
@@ -0,0 +1,40 @@
+#import <Cocoa/Cocoa.h>
+#import <SystemConfiguration/SystemConfiguration.h>
+
+// Caches this machine's hostname and the set of addresses on its interfaces
+// so the discovery path never has to ask NSHost (which can block on DNS).
+// The cache is rebuilt whenever System Configuration reports an address or
+// hostname change.
+@interface HWHostIdentity : NSObject {
+	NSString *hostname;
+	NSSet *addresses;
+
+	SCDynamicStoreRef store;
+	CFRunLoopSourceRef storeSource;
+
+	// Calls waiting for the first hostname lookup, main thread only
+	NSMutableArray *hostnameWaiters;
+}
+
++ (HWHostIdentity *)sharedObject;
+
+// The name we register this machine under with the Highwire service.
+// Nil until the first NSHost lookup finishes on its background thread.
+- (NSString *)hostname;
+
+// Performs the selector on the main thread straight away if the hostname is known, otherwise
+// once it is, so calls keyed by hostname never go out under a name that's about to change
+- (void)performSelectorWhenHostnameIsKnown:(SEL)selector target:(id)target object:(id)object;
+
+// Every address string (as formatted by -[NSData host]) assigned to a local interface
+- (NSSet *)addresses;
+
+- (BOOL)isLocalAddress:(NSString *)address;
+
+// YES if any of the sockaddr NSData objects belongs to this machine
+- (BOOL)containsAnyAddress:(NSArray *)socketAddresses;
+
+- (void)refresh;
+- (void)refreshHostname:(id)unused;
+
+@end
@@ -0,0 +1,168 @@
+#import "HWHostIdentity.h"
+#import "NetServiceBrowserDelegate.h"
+#import <sys/socket.h>
+#import <netinet/in.h>
+#import <arpa/inet.h>
+#import <ifaddrs.h>
+
+static void HWHostIdentityStoreCallBack(SCDynamicStoreRef store, CFArrayRef changedKeys, void *info)
+{
+	[(HWHostIdentity *)info refresh];
+}
+
+@interface HWHostIdentity ()
+- (void)runHostnameWaiters;
+@end
+
+@implementation HWHostIdentity
+
+static HWHostIdentity *_sharedObject = nil;
+
+- (id)init
+{
+	[super init];
+
+	SCDynamicStoreContext context = { 0, self, NULL, NULL, NULL };
+	store = SCDynamicStoreCreate(NULL, CFSTR("Highwire"), HWHostIdentityStoreCallBack, &context);
+	if(store)
+	{
+		NSArray *keys = [NSArray arrayWithObjects:NSMakeCollectable(SCDynamicStoreKeyCreateHostNames(NULL)),
+						 NSMakeCollectable(SCDynamicStoreKeyCreateComputerName(NULL)), nil];
+		NSArray *patterns = [NSArray arrayWithObjects:@"State:/Network/Interface/.*/IPv4", @"State:/Network/Interface/.*/IPv6", nil];
+		SCDynamicStoreSetNotificationKeys(store, (CFArrayRef)keys, (CFArrayRef)patterns);
+
+		storeSource = SCDynamicStoreCreateRunLoopSource(NULL, store, 0);
+		CFRunLoopAddSource([[NSRunLoop mainRunLoop] getCFRunLoop], storeSource, kCFRunLoopCommonModes);
+	}
+
+	hostnameWaiters = [[NSMutableArray alloc] init];
+	[self refresh];
+	return self;
+}
+
++ (HWHostIdentity *)sharedObject
+{
+	if(!_sharedObject)
+		_sharedObject = [[self alloc] init];
+	return _sharedObject;
+}
+
+- (void)refresh
+{
+	NSMutableSet *newAddresses = [NSMutableSet set];
+
+	struct ifaddrs *interfaces = NULL;
+	if(getifaddrs(&interfaces) == 0)
+	{
+		for(struct ifaddrs *ifa = interfaces; ifa; ifa = ifa->ifa_next)
+		{
+			if(!ifa->ifa_addr) continue;
+
+			if(ifa->ifa_addr->sa_family == AF_INET6)
+			{
+				// The kernel embeds the scope of link-local addresses in the address itself,
+				// resolved services carry it in sin6_scope_id instead
+				struct sockaddr_in6 addr6 = *(struct sockaddr_in6 *)ifa->ifa_addr;
+				if(IN6_IS_ADDR_LINKLOCAL(&addr6.sin6_addr))
+				{
+					addr6.sin6_addr.s6_addr[2] = 0;
+					addr6.sin6_addr.s6_addr[3] = 0;
+				}
+				NSString *host = [[NSData dataWithBytes:&addr6 length:sizeof(addr6)] host];
+				if(host) [newAddresses addObject:host];
+			}
+			else if(ifa->ifa_addr->sa_family == AF_INET)
+			{
+				NSString *host = [[NSData dataWithBytes:ifa->ifa_addr length:sizeof(struct sockaddr_in)] host];
+				if(host) [newAddresses addObject:host];
+			}
+		}
+		freeifaddrs(interfaces);
+	}
+
+	@synchronized(self)
+	{
+		addresses = [newAddresses copy];
+	}
+
+	// NSHost can block on reverse DNS, so the name is always looked up off the calling thread
+	[NSThread detachNewThreadSelector:@selector(refreshHostname:) toTarget:self withObject:nil];
+}
+
+- (void)refreshHostname:(id)unused
+{
+	NSAutoreleasePool *pool = [[NSAutoreleasePool alloc] init];
+
+	// Keep using the NSHost name so machines stay registered under the same hostname as before
+	[NSHost flushHostCache];
+	NSString *newHostname = [[NSHost currentHost] name];
+	if(!newHostname)
+		newHostname = [[NSProcessInfo processInfo] hostName];
+
+	@synchronized(self)
+	{
+		hostname = [newHostname copy];
+	}
+	[self performSelectorOnMainThread:@selector(runHostnameWaiters) withObject:nil waitUntilDone:NO];
+
+	[pool drain];
+}
+
+- (void)performSelectorWhenHostnameIsKnown:(SEL)selector target:(id)target object:(id)object
+{
+	if([self hostname])
+	{
+		[target performSelector:selector withObject:object];
+		return;
+	}
+	[hostnameWaiters addObject:[NSArray arrayWithObjects:target, NSStringFromSelector(selector), object ? object : [NSNull null], nil]];
+}
+
+- (void)runHostnameWaiters
+{
+	NSArray *waiters = [hostnameWaiters copy];
+	[hostnameWaiters removeAllObjects];
+
+	for(NSArray *waiter in waiters)
+	{
+		id object = [waiter objectAtIndex:2];
+		[[waiter objectAtIndex:0] performSelector:NSSelectorFromString([waiter objectAtIndex:1]) withObject:(object == [NSNull null] ? nil : object)];
+	}
+}
+
+- (NSString *)hostname
+{
+	@synchronized(self)
+	{
+		return hostname;
+	}
+	return nil;
+}
+
+- (NSSet *)addresses
+{
+	@synchronized(self)
+	{
+		return addresses;
+	}
+	return nil;
+}
+
+- (BOOL)isLocalAddress:(NSString *)address
+{
+	return address && [[self addresses] containsObject:address];
+}
+
+- (BOOL)containsAnyAddress:(NSArray *)socketAddresses
+{
+	NSSet *local = [self addresses];
+	for(NSData *addr in socketAddresses)
+	{
+		NSString *host = [addr host];
+		if(host && [local containsObject:host])
+			return YES;
+	}
+	return NO;
+}
+
+@end
@@ -0,0 +1,41 @@
+#import <Cocoa/Cocoa.h>
+#import "HWBenchmark.h"
+
+@class HWLatencyHistogram;
+
+// Downloads of each kind the benchmark times, one after another
+#define HWInflateBenchmarkRuns 10
+
+// Compares inflating gzipped responses as they arrive with storing them whole
+// and inflating afterwards, which ASIHTTPRequest still does when a request has
+// shouldWaitToInflateCompressedResponses set. A mock API serves a large
+// gzipped machine list; each design downloads it into memory and into a file,
+// timing each download up to having the uncompressed data and recording the
+// most memory in use at any point above what was in use when it started.
+//
+// HighwireBenchmarks -HWInflateBenchmark 4096 runs it with a 4 MB response.
+@interface HWInflateBenchmark : HWBenchmark {
+	NSUInteger responseSize;
+	NSDate *startedAt;
+
+	volatile BOOL sampling;
+	volatile size_t baselineMemory;
+	volatile size_t peakMemory;
+
+	HWLatencyHistogram *timeHistogram;
+}
+
+- (id)initWithResponseSize:(NSUInteger)bytes;
+
+- (BOOL)setUp;
+- (void)tearDown;
+
+// Returns NO if a download failed or didn't finish in time
+- (BOOL)runDownloadsToFile:(BOOL)toFile waitingToInflate:(BOOL)waitToInflate;
+
+// Most bytes in use above the starting point during any download of the last run
+- (size_t)peakMemory;
+
+- (HWLatencyHistogram *)timeHistogram;
+
+@end
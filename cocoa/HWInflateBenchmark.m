@@ -0,0 +1,159 @@
+#import "HWInflateBenchmark.h"
+#import "HWLatencyHistogram.h"
+#import "HWMockAPIServer.h"
+#import "ASIHTTPRequest.h"
+#import <malloc/malloc.h>
+
+static size_t HWMemoryInUse(void)
+{
+	malloc_statistics_t stats;
+	malloc_zone_statistics(NULL, &stats);
+	return stats.size_in_use;
+}
+
+@interface HWInflateBenchmark ()
+- (void)sampleMemory:(id)unused;
+@end
+
+@implementation HWInflateBenchmark
+
++ (int)runWithUserDefaults
+{
+	HWInflateBenchmark *benchmark = [[HWInflateBenchmark alloc] initWithResponseSize:[self intArgumentOrDefault:4096] * 1024];
+	if(![benchmark setUp])
+		return 1;
+
+	int failed = 0;
+	for(int toFile = 0; toFile < 2; toFile++)
+	{
+		for(int design = 0; design < 2; design++)
+		{
+			BOOL waitToInflate = (design == 0);
+			BOOL completed = [benchmark runDownloadsToFile:toFile waitingToInflate:waitToInflate];
+			if(!completed) failed++;
+
+			NSLog(@"%@, %@: peak %.0f KB above baseline%@", toFile ? @"to file" : @"to memory",
+				  waitToInflate ? @"inflated after download" : @"inflated as received",
+				  [benchmark peakMemory] / 1024.0, completed ? @"" : @" (failed, partial results)");
+			NSLog(@"%@\n%@", [[benchmark timeHistogram] summary], [[benchmark timeHistogram] bucketDescription]);
+		}
+	}
+
+	[benchmark tearDown];
+	return failed ? 1 : 0;
+}
+
+- (id)initWithResponseSize:(NSUInteger)bytes
+{
+	[super init];
+	responseSize = bytes;
+	timeHistogram = [[HWLatencyHistogram alloc] initWithName:@"request started -> uncompressed data"];
+	return self;
+}
+
+- (BOOL)setUp
+{
+	if(![self startMockAPI])
+		return NO;
+	mockAPI.compressesResponses = YES;
+
+	// Something shaped like the machine list, so it compresses about as well as the real thing
+	NSMutableString *json = [NSMutableString stringWithString:@"{\"success\":true,\"machines\":["];
+	for(int i = 0; [json length] < responseSize - 2; i++)
+		[json appendFormat:@"%@{\"id\":%d,\"name\":\"machine-%d\",\"address\":\"10.%d.%d.%d\",\"port\":%d,\"online\":%@}",
+		 i ? @"," : @"", i, i * 7919 % 100000, i / 65536 % 256, i / 256 % 256, i % 256, 1024 + i * 31 % 60000, i % 3 ? @"true" : @"false"];
+	[json appendString:@"]}"];
+	[mockAPI setResponse:json forMethod:@"inflate"];
+	return YES;
+}
+
+- (void)tearDown
+{
+	[self stopMockAPI];
+}
+
+- (BOOL)runDownloadsToFile:(BOOL)toFile waitingToInflate:(BOOL)waitToInflate
+{
+	[timeHistogram reset];
+	peakMemory = 0;
+
+	NSString *path = [NSTemporaryDirectory() stringByAppendingPathComponent:[[NSProcessInfo processInfo] globallyUniqueString]];
+	BOOL completed = YES;
+
+	for(int i = 0; i < HWInflateBenchmarkRuns && completed; i++)
+	{
+		[[NSGarbageCollector defaultCollector] collectExhaustively];
+
+		NSURL *url = [NSURL URLWithString:[NSString stringWithFormat:@"%@?method=inflate&n=%d", [mockAPI baseURL], i]];
+		ASIHTTPRequest *request = [ASIHTTPRequest requestWithURL:url];
+		[request setTimeOutSeconds:HWBenchmarkTimeout];
+		[request setShouldWaitToInflateCompressedResponses:waitToInflate];
+		if(toFile)
+			[request setDownloadDestinationPath:path];
+		[request setDelegate:self];
+		[request setDidFinishSelector:@selector(requestFinished:)];
+		[request setDidFailSelector:@selector(requestFailed:)];
+
+		outstanding = 1;
+		failures = 0;
+		baselineMemory = HWMemoryInUse();
+		sampling = YES;
+		[NSThread detachNewThreadSelector:@selector(sampleMemory:) toTarget:self withObject:nil];
+
+		startedAt = [NSDate date];
+		[request startAsynchronous];
+
+		BOOL finished = [self runUntil:@selector(isFinished) timeout:HWBenchmarkTimeout];
+
+		sampling = NO;
+		completed = finished && failures == 0;
+		[[NSFileManager defaultManager] removeItemAtPath:path error:NULL];
+	}
+	return completed;
+}
+
+// Runs on a thread of its own so it keeps sampling while the main thread inflates
+- (void)sampleMemory:(id)unused
+{
+	NSAutoreleasePool *pool = [[NSAutoreleasePool alloc] init];
+	while(sampling)
+	{
+		size_t inUse = HWMemoryInUse();
+		if(inUse > baselineMemory && inUse - baselineMemory > peakMemory)
+			peakMemory = inUse - baselineMemory;
+		usleep(500);
+	}
+	[pool drain];
+}
+
+- (size_t)peakMemory
+{
+	return peakMemory;
+}
+
+- (HWLatencyHistogram *)timeHistogram
+{
+	return timeHistogram;
+}
+
+#pragma mark -
+#pragma mark ASIHTTPRequest Delegate
+#pragma mark -
+
+- (void)requestFinished:(ASIHTTPRequest *)request
+{
+	// Downloads to memory that waited to inflate only do it here
+	if(![request downloadDestinationPath] && [[request responseData] length] < responseSize)
+		failures++;
+
+	[timeHistogram recordValue:-[startedAt timeIntervalSinceNow]];
+	[super requestFinished:request];
+}
+
+- (void)requestFailed:(ASIHTTPRequest *)request
+{
+	NSLog(@"Download failed: %@", [[request error] localizedDescription]);
+	[super requestFailed:request];
+}
+
+@end
@@ -0,0 +1,27 @@
+#import <Cocoa/Cocoa.h>
+#import "ASIHTTPRequest.h"
+
+@class SBJsonStreamParser;
+@class SBJsonStreamParserAdapter;
+
+// Parses an API response with SBJsonStreamParser while ASIHTTPRequest is still
+// receiving it, so the object is built by the time the request finishes and the
+// body is never held as one NSString. Set one as a request's responseDataConsumer.
+@interface HWJSONResponseParser : NSObject <ASIHTTPRequestDataConsumer> {
+	SBJsonStreamParser *parser;
+	SBJsonStreamParserAdapter *adapter;
+	NSTimeInterval parseTime;
+}
+
++ (HWJSONResponseParser *)parser;
+
+// The parsed response, or nil if it wasn't a complete JSON object or array
+- (id)object;
+
+// Seconds spent parsing so far, not counting the waits between pieces of the response
+- (NSTimeInterval)parseTime;
+
+// The response parsed as it arrived if the request had a parser, otherwise its responseString parsed now
++ (id)objectForResponseToRequest:(ASIHTTPRequest *)request;
+
+@end
@@ -0,0 +1,48 @@
+#import "HWJSONResponseParser.h"
+#import "JSON.h"
+
+@implementation HWJSONResponseParser
+
++ (HWJSONResponseParser *)parser
+{
+	return [[[self alloc] init] autorelease];
+}
+
+- (id)init
+{
+	[super init];
+	parser = [[SBJsonStreamParser alloc] init];
+	adapter = [[SBJsonStreamParserAdapter alloc] init];
+	[parser setDelegate:adapter];
+	return self;
+}
+
+- (void)request:(ASIHTTPRequest *)request didReceiveBytes:(const void *)bytes length:(NSUInteger)length
+{
+	CFAbsoluteTime start = CFAbsoluteTimeGetCurrent();
+	[parser parseBytes:bytes length:length];
+	parseTime += CFAbsoluteTimeGetCurrent() - start;
+}
+
+- (id)object
+{
+	if([parser status] != SBJsonStreamParserComplete)
+		return nil;
+	return [adapter object];
+}
+
+- (NSTimeInterval)parseTime
+{
+	return parseTime;
+}
+
++ (id)objectForResponseToRequest:(ASIHTTPRequest *)request
+{
+	if([[request responseDataConsumer] isKindOfClass:[HWJSONResponseParser class]])
+		return [(HWJSONResponseParser *)[request responseDataConsumer] object];
+
+	SBJSON *json = [[SBJSON alloc] init];
+	return [json objectWithString:[request responseString]];
+}
+
+@end
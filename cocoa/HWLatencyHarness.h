@@ -0,0 +1,46 @@
+#import <Cocoa/Cocoa.h>
+#import "HWBenchmark.h"
+
+@class HWServiceEventClient;
+@class HWLatencyHistogram;
+
+// Type the synthetic announcements use, so they can't be mistaken for real services
+#define HWLatencyHarnessServiceType @"_hwbench._tcp."
+
+// Measures how long a service takes from appearing on the LAN to being usable
+// on a remote client. Synthetic announcements go into NetServiceBrowserDelegate
+// and travel the real path: the resolve pipeline, HWServiceSync to a mock web
+// service, the service event channel, and re-publishing through
+// HWServicePublisher on a simulated client in the same process.
+//
+// HighwireBenchmarks -HWLatencyHarness 1,10,100,500 runs it and logs
+// per-stage histograms for each service count.
+@interface HWLatencyHarness : HWBenchmark {
+	HWServiceEventClient *client;
+	BOOL snapshotReceived;
+
+	// Service key ("type|name") -> NSDate for each stage of the current run.
+	// syncedAt is filled in on the mock API thread.
+	NSMutableDictionary *injectedAt;
+	NSMutableDictionary *syncedAt;
+	NSMutableDictionary *streamedAt;
+	NSMutableDictionary *publishedAt;
+
+	NSMutableDictionary *proxiedServices;
+	NSMutableArray *injectedServices;
+
+	HWLatencyHistogram *syncHistogram;
+	HWLatencyHistogram *streamHistogram;
+	HWLatencyHistogram *publishHistogram;
+	HWLatencyHistogram *totalHistogram;
+}
+
+- (BOOL)setUp;
+- (void)tearDown;
+
+// Returns NO if some service didn't make it through every stage in time
+- (BOOL)runWithServiceCount:(int)count;
+
+- (NSArray *)histograms;
+
+@end
@@ -0,0 +1,237 @@
+#import "HWLatencyHarness.h"
+#import "HWLatencyHistogram.h"
+#import "HWMockAPIServer.h"
+#import "HWSyntheticNetService.h"
+#import "HWServiceEvent.h"
+#import "HWServiceEventClient.h"
+#import "HWServiceEventServer.h"
+#import "HWServicePublisher.h"
+#import "HWProxiedService.h"
+#import "HWServiceSync.h"
+#import "HWTrafficRecorder.h"
+#import "HighwireAPI.h"
+#import "NetServiceBrowserDelegate.h"
+#import "NSData+Base64.h"
+#import "JSON.h"
+
+@interface HWLatencyHarness ()
+- (BOOL)allPublished;
+- (BOOL)allRemoved;
+- (BOOL)hasSnapshot;
+@end
+
+@implementation HWLatencyHarness
+
++ (int)runWithUserDefaults
+{
+	NSArray *counts = [self countsFromArgumentOrDefaults:[NSArray arrayWithObjects:[NSNumber numberWithInt:1], [NSNumber numberWithInt:10],
+		[NSNumber numberWithInt:50], [NSNumber numberWithInt:100], [NSNumber numberWithInt:250], [NSNumber numberWithInt:500], nil]];
+
+	HWLatencyHarness *harness = [[HWLatencyHarness alloc] init];
+	if(![harness setUp])
+		return 1;
+
+	int failures = 0;
+	for(NSNumber *count in counts)
+	{
+		BOOL completed = [harness runWithServiceCount:[count intValue]];
+		if(!completed) failures++;
+
+		NSLog(@"%@ services%@", count, completed ? @"" : @" (timed out, partial results)");
+		for(HWLatencyHistogram *histogram in [harness histograms])
+			NSLog(@"%@\n%@", [histogram summary], [histogram bucketDescription]);
+	}
+
+	[harness tearDown];
+	return failures ? 1 : 0;
+}
+
+- (id)init
+{
+	[super init];
+	injectedAt = [[NSMutableDictionary alloc] init];
+	syncedAt = [[NSMutableDictionary alloc] init];
+	streamedAt = [[NSMutableDictionary alloc] init];
+	publishedAt = [[NSMutableDictionary alloc] init];
+	proxiedServices = [[NSMutableDictionary alloc] init];
+	injectedServices = [[NSMutableArray alloc] init];
+
+	syncHistogram = [[HWLatencyHistogram alloc] initWithName:@"announce -> synced"];
+	streamHistogram = [[HWLatencyHistogram alloc] initWithName:@"announce -> client event"];
+	publishHistogram = [[HWLatencyHistogram alloc] initWithName:@"client event -> re-published"];
+	totalHistogram = [[HWLatencyHistogram alloc] initWithName:@"announce -> re-published"];
+	return self;
+}
+
+- (BOOL)setUp
+{
+	if(![self startMockAPI])
+		return NO;
+	mockAPI.delegate = self;
+	[HighwireAPI setBaseURL:[mockAPI baseURL]];
+
+	// The simulated client talks to the event server directly instead of through an ssh forward
+	int eventPort = [HWTrafficRecorder unusedLoopbackPort];
+	if(![[HWServiceEventServer sharedObject] startOnPort:eventPort])
+		return NO;
+
+	[HWServicePublisher sharedObject].delegate = self;
+	client = [[HWServiceEventClient alloc] initWithPort:eventPort];
+	client.delegate = self;
+	if(![client connect] || ![self runUntil:@selector(hasSnapshot) timeout:5.0])
+	{
+		NSLog(@"The service event channel never sent its snapshot");
+		return NO;
+	}
+	return YES;
+}
+
+- (void)tearDown
+{
+	[client stop];
+	[[HWServicePublisher sharedObject] stopAllServices];
+	[[HWServiceEventServer sharedObject] stop];
+	[self stopMockAPI];
+}
+
+- (BOOL)hasSnapshot
+{
+	return snapshotReceived;
+}
+
+- (BOOL)allPublished
+{
+	@synchronized(syncedAt)
+	{
+		return [publishedAt count] == [injectedAt count] && [syncedAt count] == [injectedAt count];
+	}
+	return NO;
+}
+
+- (BOOL)allRemoved
+{
+	return [proxiedServices count] == 0;
+}
+
+- (BOOL)runWithServiceCount:(int)count
+{
+	[injectedAt removeAllObjects];
+	@synchronized(syncedAt)
+	{
+		[syncedAt removeAllObjects];
+	}
+	[streamedAt removeAllObjects];
+	[publishedAt removeAllObjects];
+	[injectedServices removeAllObjects];
+	for(HWLatencyHistogram *histogram in [self histograms])
+		[histogram reset];
+
+	NSData *txt = [NSNetService dataFromTXTRecordDictionary:[NSDictionary dictionaryWithObject:[@"1" dataUsingEncoding:NSUTF8StringEncoding] forKey:@"txtvers"]];
+	NetServiceBrowserDelegate *nsb = [NetServiceBrowserDelegate sharedObject];
+
+	for(int i = 0; i < count; i++)
+	{
+		NSString *name = [NSString stringWithFormat:@"Synthetic %d-%d", count, i];
+		HWSyntheticNetService *service = [[HWSyntheticNetService alloc] initWithName:name type:HWLatencyHarnessServiceType port:20000 + i TXTRecordData:txt];
+		[injectedServices addObject:service];
+		[injectedAt setObject:[NSDate date] forKey:[NSString stringWithFormat:@"%@|%@", HWLatencyHarnessServiceType, name]];
+		[nsb netServiceBrowser:nil didFindService:service moreComing:(i < count - 1)];
+	}
+
+	BOOL completed = [self runUntil:@selector(allPublished) timeout:HWServiceSyncWindow + HWBenchmarkTimeout];
+
+	for(NSString *key in injectedAt)
+	{
+		NSDate *injected = [injectedAt objectForKey:key];
+		NSDate *streamed = [streamedAt objectForKey:key];
+		NSDate *published = [publishedAt objectForKey:key];
+		NSDate *synced;
+		@synchronized(syncedAt)
+		{
+			synced = [syncedAt objectForKey:key];
+		}
+
+		if(synced) [syncHistogram recordValue:[synced timeIntervalSinceDate:injected]];
+		if(streamed) [streamHistogram recordValue:[streamed timeIntervalSinceDate:injected]];
+		if(streamed && published) [publishHistogram recordValue:[published timeIntervalSinceDate:streamed]];
+		if(published) [totalHistogram recordValue:[published timeIntervalSinceDate:injected]];
+	}
+
+	// Withdraw everything and let the removals reach the client and the mock API before the next run
+	for(HWSyntheticNetService *service in injectedServices)
+		[nsb netServiceBrowser:nil didRemoveService:service moreComing:NO];
+	[self runUntil:@selector(allRemoved) timeout:HWBenchmarkTimeout];
+	[[HWServiceSync sharedObject] flush];
+	[[NSRunLoop currentRunLoop] runUntilDate:[NSDate dateWithTimeIntervalSinceNow:1.0]];
+
+	return completed;
+}
+
+- (NSArray *)histograms
+{
+	return [NSArray arrayWithObjects:syncHistogram, streamHistogram, publishHistogram, totalHistogram, nil];
+}
+
+#pragma mark -
+#pragma mark Mock API Delegate
+#pragma mark -
+
+- (void)mockAPIServer:(HWMockAPIServer *)server didReceiveRequestForMethod:(NSString *)method body:(NSData *)body
+{
+	if(![method isEqualToString:@"syncServices"]) return;
+
+	NSDate *now = [NSDate date];
+	NSString *added = [[HWMockAPIServer formValuesFromBody:body] objectForKey:@"added"];
+	SBJSON *json = [[SBJSON alloc] init];
+
+	for(NSDictionary *record in [json objectWithString:added])
+	{
+		NSString *name = [[NSString alloc] initWithData:[NSData dataFromBase64String:[record objectForKey:@"name"]] encoding:NSUTF8StringEncoding];
+		NSString *type = [[NSString alloc] initWithData:[NSData dataFromBase64String:[record objectForKey:@"type"]] encoding:NSUTF8StringEncoding];
+		@synchronized(syncedAt)
+		{
+			[syncedAt setObject:now forKey:[NSString stringWithFormat:@"%@|%@", type, name]];
+		}
+	}
+}
+
+#pragma mark -
+#pragma mark Simulated Client
+#pragma mark -
+
+- (void)serviceEventClient:(HWServiceEventClient *)aClient didReceiveSnapshot:(NSArray *)events
+{
+	snapshotReceived = YES;
+}
+
+- (void)serviceEventClient:(HWServiceEventClient *)aClient didReceiveEvent:(HWServiceEvent *)event
+{
+	if(event.kind == HWServiceEventAdded && ![proxiedServices objectForKey:[event key]])
+	{
+		[streamedAt setObject:[NSDate date] forKey:[event key]];
+
+		HWProxiedService *proxied = [[HWProxiedService alloc] initWithName:[NSString stringWithFormat:@"%@ (Highwire)", event.name]
+																	  type:event.type
+																	  port:event.port
+															 TXTRecordData:event.TXTRecordData];
+		[proxiedServices setObject:proxied forKey:[event key]];
+		[[HWServicePublisher sharedObject] publishServices:[NSArray arrayWithObject:proxied]];
+	}
+	else if(event.kind == HWServiceEventRemoved)
+	{
+		[[proxiedServices objectForKey:[event key]] stop];
+		[proxiedServices removeObjectForKey:[event key]];
+	}
+}
+
+- (void)servicePublisher:(HWServicePublisher *)publisher didPublishBatch:(NSArray *)services inTime:(NSTimeInterval)seconds
+{
+	for(NSString *key in proxiedServices)
+	{
+		HWProxiedService *proxied = [proxiedServices objectForKey:key];
+		if(![services containsObject:proxied] || !proxied.registeredName) continue;
+		[publishedAt setObject:[proxied.publishStarted addTimeInterval:proxied.registrationTime] forKey:key];
+	}
+}
+
+@end
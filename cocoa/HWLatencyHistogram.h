@@ -0,0 +1,46 @@
+#import <Cocoa/Cocoa.h>
+
+// Values are bucketed by power of two microseconds, each power split into
+// HWLatencySubBuckets linear steps, so any recorded value is kept to within
+// about 6% from a microsecond up to an hour with a fixed amount of memory.
+#define HWLatencyBucketPowers 32
+#define HWLatencySubBuckets 16
+
+@interface HWLatencyHistogram : NSObject {
+	NSString *name;
+	uint64_t counts[HWLatencyBucketPowers * HWLatencySubBuckets];
+	uint64_t totalCount;
+	double sum;
+	NSTimeInterval minValue;
+	NSTimeInterval maxValue;
+}
+
+- (id)initWithName:(NSString *)aName;
+
+- (void)recordValue:(NSTimeInterval)seconds;
+- (void)reset;
+
+// Halves every count, so the samples recorded so far weigh half as much as those to come
+- (void)decay;
+
+- (uint64_t)count;
+- (NSTimeInterval)minValue;
+- (NSTimeInterval)maxValue;
+- (NSTimeInterval)mean;
+
+// percentile is 0-100
+- (NSTimeInterval)valueAtPercentile:(double)percentile;
+
+// One line: count, min, p50, p90, p99, max in milliseconds
+- (NSString *)summary;
+
+// Counts per 1-2-5 millisecond bucket, one line each, empty buckets left out
+- (NSString *)bucketDescription;
+
+// For export: name, count, min, mean, max and percentiles in milliseconds, and
+// "buckets", [value in microseconds, count] for every bucket that isn't empty
+- (NSDictionary *)dictionaryRepresentation;
+
+@property (nonatomic, retain) NSString *name;
+
+@end
@@ -0,0 +1,179 @@
+#import "HWLatencyHistogram.h"
+
+#define HWLatencyBucketCount (HWLatencyBucketPowers * HWLatencySubBuckets)
+
+static int HWLatencyIndexForMicroseconds(uint64_t usec)
+{
+	if(usec < HWLatencySubBuckets)
+		return (int)usec;
+
+	int power = 0;
+	while((usec >> power) >= 2 * HWLatencySubBuckets)
+		power++;
+	if(power + 1 >= HWLatencyBucketPowers)
+		return HWLatencyBucketCount - 1;
+
+	// Values in [16 << power, 32 << power) share a power and step by 1 << power
+	return (power + 1) * HWLatencySubBuckets + (int)((usec >> power) - HWLatencySubBuckets);
+}
+
+static uint64_t HWLatencyMicrosecondsForIndex(int index)
+{
+	if(index < HWLatencySubBuckets)
+		return index;
+
+	int power = index / HWLatencySubBuckets - 1;
+	uint64_t step = (uint64_t)1 << power;
+	return ((uint64_t)(index % HWLatencySubBuckets + HWLatencySubBuckets) << power) + step / 2;
+}
+
+@implementation HWLatencyHistogram
+
+@synthesize name;
+
+- (id)initWithName:(NSString *)aName
+{
+	[super init];
+	name = [aName copy];
+	[self reset];
+	return self;
+}
+
+- (void)reset
+{
+	memset(counts, 0, sizeof(counts));
+	totalCount = 0;
+	sum = 0;
+	minValue = 0;
+	maxValue = 0;
+}
+
+- (void)recordValue:(NSTimeInterval)seconds
+{
+	if(seconds < 0) seconds = 0;
+
+	counts[HWLatencyIndexForMicroseconds((uint64_t)(seconds * 1000000.0))]++;
+	if(totalCount == 0 || seconds < minValue) minValue = seconds;
+	if(seconds > maxValue) maxValue = seconds;
+	totalCount++;
+	sum += seconds;
+}
+
+- (void)decay
+{
+	if(totalCount == 0) return;
+
+	double mean = [self mean];
+	totalCount = 0;
+	minValue = 0;
+	maxValue = 0;
+	for(int i = 0; i < HWLatencyBucketCount; i++)
+	{
+		counts[i] /= 2;
+		if(!counts[i]) continue;
+
+		// The exact extremes may have been halved away, so fall back to the buckets still holding samples
+		NSTimeInterval value = HWLatencyMicrosecondsForIndex(i) / 1000000.0;
+		if(totalCount == 0) minValue = value;
+		maxValue = value;
+		totalCount += counts[i];
+	}
+	sum = mean * totalCount;
+}
+
+- (uint64_t)count
+{
+	return totalCount;
+}
+
+- (NSTimeInterval)minValue
+{
+	return minValue;
+}
+
+- (NSTimeInterval)maxValue
+{
+	return maxValue;
+}
+
+- (NSTimeInterval)mean
+{
+	return totalCount ? sum / totalCount : 0;
+}
+
+- (NSTimeInterval)valueAtPercentile:(double)percentile
+{
+	if(totalCount == 0) return 0;
+
+	uint64_t target = (uint64_t)ceil(percentile / 100.0 * totalCount);
+	if(target < 1) target = 1;
+
+	uint64_t seen = 0;
+	for(int i = 0; i < HWLatencyBucketCount; i++)
+	{
+		seen += counts[i];
+		if(seen >= target)
+			return MIN(MAX(HWLatencyMicrosecondsForIndex(i) / 1000000.0, minValue), maxValue);
+	}
+	return maxValue;
+}
+
+- (NSString *)summary
+{
+	return [NSString stringWithFormat:@"%@: n=%llu min=%.2fms p50=%.2fms p90=%.2fms p99=%.2fms max=%.2fms",
+			name, totalCount, minValue * 1000.0, [self valueAtPercentile:50] * 1000.0,
+			[self valueAtPercentile:90] * 1000.0, [self valueAtPercentile:99] * 1000.0, maxValue * 1000.0];
+}
+
+- (NSString *)bucketDescription
+{
+	static const double limits[] = { 1, 2, 5, 10, 20, 50, 100, 200, 500, 1000, 2000, 5000, 10000, 20000, 50000 };
+	int limitCount = sizeof(limits) / sizeof(limits[0]);
+	uint64_t bucketCounts[sizeof(limits) / sizeof(limits[0]) + 1];
+	memset(bucketCounts, 0, sizeof(bucketCounts));
+
+	for(int i = 0; i < HWLatencyBucketCount; i++)
+	{
+		if(!counts[i]) continue;
+		double ms = HWLatencyMicrosecondsForIndex(i) / 1000.0;
+		int b = 0;
+		while(b < limitCount && ms >= limits[b])
+			b++;
+		bucketCounts[b] += counts[i];
+	}
+
+	NSMutableString *description = [NSMutableString string];
+	for(int b = 0; b <= limitCount; b++)
+	{
+		if(!bucketCounts[b]) continue;
+		NSString *range = (b == limitCount) ? [NSString stringWithFormat:@">= %.0fms", limits[b - 1]]
+											: [NSString stringWithFormat:@"< %.0fms", limits[b]];
+		int bar = (int)(40 * bucketCounts[b] / totalCount);
+		[description appendFormat:@"  %@ %6llu %@\n", [range stringByPaddingToLength:10 withString:@" " startingAtIndex:0],
+			bucketCounts[b], [@"" stringByPaddingToLength:MAX(bar, 1) withString:@"#" startingAtIndex:0]];
+	}
+	return description;
+}
+
+- (NSDictionary *)dictionaryRepresentation
+{
+	NSMutableArray *buckets = [NSMutableArray array];
+	for(int i = 0; i < HWLatencyBucketCount; i++)
+		if(counts[i])
+			[buckets addObject:[NSArray arrayWithObjects:[NSNumber numberWithUnsignedLongLong:HWLatencyMicrosecondsForIndex(i)],
+								[NSNumber numberWithUnsignedLongLong:counts[i]], nil]];
+
+	return [NSDictionary dictionaryWithObjectsAndKeys:name ? name : @"", @"name",
+			[NSNumber numberWithUnsignedLongLong:totalCount], @"count",
+			[NSNumber numberWithDouble:minValue * 1000.0], @"min",
+			[NSNumber numberWithDouble:[self mean] * 1000.0], @"mean",
+			[NSNumber numberWithDouble:[self valueAtPercentile:50] * 1000.0], @"p50",
+			[NSNumber numberWithDouble:[self valueAtPercentile:90] * 1000.0], @"p90",
+			[NSNumber numberWithDouble:[self valueAtPercentile:95] * 1000.0], @"p95",
+			[NSNumber numberWithDouble:[self valueAtPercentile:99] * 1000.0], @"p99",
+			[NSNumber numberWithDouble:[self valueAtPercentile:99.9] * 1000.0], @"p999",
+			[NSNumber numberWithDouble:maxValue * 1000.0], @"max",
+			buckets, @"buckets", nil];
+}
+
+@end
@@ -0,0 +1,57 @@
+#import <Cocoa/Cocoa.h>
+
+// A stand-in for the Highwire web service on a loopback port, for harnesses and
+// benchmarks. Every request gets {"success":true} unless a response is set for
+// its method, optionally after an injected delay. Point HighwireAPI at it with
+// +[HighwireAPI setBaseURL:] or the HWAPIBaseURL default.
+@interface HWMockAPIServer : NSObject {
+	int port;
+	int listenSocket;
+	BOOL running;
+
+	NSMutableDictionary *responses;
+	NSMutableDictionary *delays;
+	NSMutableDictionary *tailDelays;
+	NSMutableDictionary *methodRequestCounts;
+	NSTimeInterval defaultDelay;
+	unsigned long requestCount;
+	unsigned long activeConnectionCount;
+	BOOL compressesResponses;
+
+	id delegate;
+}
+
+- (id)initWithPort:(int)aPort;
+
+- (BOOL)start;
+- (void)stop;
+
+- (NSString *)baseURL;
+
+- (void)setResponse:(NSString *)json forMethod:(NSString *)method;
+- (void)setDelay:(NSTimeInterval)seconds forMethod:(NSString *)method;
+
+// Holds every nth request for the method for the given delay instead, to give it a slow tail
+- (void)setTailDelay:(NSTimeInterval)seconds everyNthRequest:(int)n forMethod:(NSString *)method;
+
+// Decodes an application/x-www-form-urlencoded body
++ (NSDictionary *)formValuesFromBody:(NSData *)body;
+
+- (void)acceptConnections:(id)unused;
+
+@property (nonatomic, assign) NSTimeInterval defaultDelay;
+@property (nonatomic, assign) id delegate;
+@property (readonly) unsigned long requestCount;
+
+// Connections being served right now, each on a thread of its own
+@property (readonly) unsigned long activeConnectionCount;
+
+// Gzips responses for requests that accept it, the way the real API does
+@property (nonatomic, assign) BOOL compressesResponses;
+
+@end
+
+@interface NSObject (HWMockAPIServerDelegate)
+// Called on the server thread as soon as a request has been read, before any delay
+- (void)mockAPIServer:(HWMockAPIServer *)server didReceiveRequestForMethod:(NSString *)method body:(NSData *)body;
+@end
@@ -0,0 +1,234 @@
+#import "HWMockAPIServer.h"
+#import "ASIHTTPRequest.h"
+#import <sys/socket.h>
+#import <netinet/in.h>
+#import <arpa/inet.h>
+#import <unistd.h>
+
+#define HWMockAPIMaxRequestLength (1024 * 1024)
+
+@interface HWMockAPIServer ()
+- (void)handleConnection:(NSNumber *)socketNumber;
+- (NSString *)methodForRequestLine:(NSString *)line;
+@end
+
+@implementation HWMockAPIServer
+
+@synthesize defaultDelay;
+@synthesize delegate;
+@synthesize requestCount;
+@synthesize activeConnectionCount;
+@synthesize compressesResponses;
+
+- (id)initWithPort:(int)aPort
+{
+	[super init];
+	port = aPort;
+	listenSocket = -1;
+	responses = [[NSMutableDictionary alloc] init];
+	delays = [[NSMutableDictionary alloc] init];
+	tailDelays = [[NSMutableDictionary alloc] init];
+	methodRequestCounts = [[NSMutableDictionary alloc] init];
+	return self;
+}
+
+- (BOOL)start
+{
+	listenSocket = socket(AF_INET, SOCK_STREAM, 0);
+	int yes = 1;
+	setsockopt(listenSocket, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes));
+
+	struct sockaddr_in addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_len = sizeof(addr);
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	addr.sin_port = htons(port);
+
+	if(bind(listenSocket, (struct sockaddr *)&addr, sizeof(addr)) != 0 || listen(listenSocket, 64) != 0)
+	{
+		NSLog(@"Unable to start the mock API on port %d", port);
+		close(listenSocket);
+		listenSocket = -1;
+		return NO;
+	}
+
+	running = YES;
+	[NSThread detachNewThreadSelector:@selector(acceptConnections:) toTarget:self withObject:nil];
+	return YES;
+}
+
+- (void)stop
+{
+	running = NO;
+	if(listenSocket >= 0)
+	{
+		close(listenSocket);
+		listenSocket = -1;
+	}
+}
+
+- (NSString *)baseURL
+{
+	return [NSString stringWithFormat:@"http://127.0.0.1:%d/", port];
+}
+
+- (void)setResponse:(NSString *)json forMethod:(NSString *)method
+{
+	@synchronized(self)
+	{
+		[responses setObject:json forKey:method];
+	}
+}
+
+- (void)setDelay:(NSTimeInterval)seconds forMethod:(NSString *)method
+{
+	@synchronized(self)
+	{
+		[delays setObject:[NSNumber numberWithDouble:seconds] forKey:method];
+	}
+}
+
+- (void)setTailDelay:(NSTimeInterval)seconds everyNthRequest:(int)n forMethod:(NSString *)method
+{
+	@synchronized(self)
+	{
+		[tailDelays setObject:[NSArray arrayWithObjects:[NSNumber numberWithDouble:seconds], [NSNumber numberWithInt:n], nil] forKey:method];
+		[methodRequestCounts removeObjectForKey:method];
+	}
+}
+
++ (NSDictionary *)formValuesFromBody:(NSData *)body
+{
+	NSMutableDictionary *values = [NSMutableDictionary dictionary];
+	NSString *string = [[NSString alloc] initWithData:body encoding:NSUTF8StringEncoding];
+
+	for(NSString *pair in [string componentsSeparatedByString:@"&"])
+	{
+		NSArray *parts = [pair componentsSeparatedByString:@"="];
+		if([parts count] != 2) continue;
+
+		NSString *key = [[[parts objectAtIndex:0] stringByReplacingOccurrencesOfString:@"+" withString:@" "] stringByReplacingPercentEscapesUsingEncoding:NSUTF8StringEncoding];
+		NSString *value = [[[parts objectAtIndex:1] stringByReplacingOccurrencesOfString:@"+" withString:@" "] stringByReplacingPercentEscapesUsingEncoding:NSUTF8StringEncoding];
+		if(key && value)
+			[values setObject:value forKey:key];
+	}
+	return values;
+}
+
+- (NSString *)methodForRequestLine:(NSString *)line
+{
+	NSRange range = [line rangeOfString:@"method="];
+	if(range.location == NSNotFound) return @"";
+
+	NSString *rest = [line substringFromIndex:NSMaxRange(range)];
+	NSRange end = [rest rangeOfCharacterFromSet:[NSCharacterSet characterSetWithCharactersInString:@"& "]];
+	return end.location == NSNotFound ? rest : [rest substringToIndex:end.location];
+}
+
+- (void)acceptConnections:(id)unused
+{
+	while(running)
+	{
+		int client = accept(listenSocket, NULL, NULL);
+		if(client < 0) break;
+
+		// A thread per connection so an injected delay holds up only its own request
+		[NSThread detachNewThreadSelector:@selector(handleConnection:) toTarget:self withObject:[NSNumber numberWithInt:client]];
+	}
+}
+
+- (void)handleConnection:(NSNumber *)socketNumber
+{
+	NSAutoreleasePool *pool = [[NSAutoreleasePool alloc] init];
+	@synchronized(self)
+	{
+		activeConnectionCount++;
+	}
+	int client = [socketNumber intValue];
+	int yes = 1;
+	setsockopt(client, SOL_SOCKET, SO_NOSIGPIPE, &yes, sizeof(yes));
+
+	NSMutableData *request = [NSMutableData data];
+	NSUInteger headerLength = 0;
+	NSUInteger contentLength = 0;
+	char buffer[16384];
+
+	while([request length] < HWMockAPIMaxRequestLength)
+	{
+		ssize_t n = read(client, buffer, sizeof(buffer));
+		if(n <= 0) break;
+		[request appendBytes:buffer length:n];
+
+		if(!headerLength)
+		{
+			NSRange end = [[[NSString alloc] initWithData:request encoding:NSISOLatin1StringEncoding] rangeOfString:@"\r\n\r\n"];
+			if(end.location == NSNotFound) continue;
+			headerLength = NSMaxRange(end);
+
+			NSString *headers = [[NSString alloc] initWithData:[request subdataWithRange:NSMakeRange(0, headerLength)] encoding:NSISOLatin1StringEncoding];
+			for(NSString *line in [headers componentsSeparatedByString:@"\r\n"])
+				if([[line lowercaseString] hasPrefix:@"content-length:"])
+					contentLength = [[line substringFromIndex:15] intValue];
+		}
+		if(headerLength && [request length] >= headerLength + contentLength)
+			break;
+	}
+
+	if(headerLength)
+	{
+		NSString *headers = [[NSString alloc] initWithData:[request subdataWithRange:NSMakeRange(0, headerLength)] encoding:NSISOLatin1StringEncoding];
+		NSString *requestLine = [[headers componentsSeparatedByString:@"\r\n"] objectAtIndex:0];
+		NSString *method = [self methodForRequestLine:requestLine];
+		NSData *body = [request subdataWithRange:NSMakeRange(headerLength, MIN(contentLength, [request length] - headerLength))];
+
+		if([delegate respondsToSelector:@selector(mockAPIServer:didReceiveRequestForMethod:body:)])
+			[delegate mockAPIServer:self didReceiveRequestForMethod:method body:body];
+
+		NSString *json;
+		NSTimeInterval delay;
+		@synchronized(self)
+		{
+			requestCount++;
+			json = [responses objectForKey:method];
+			delay = [delays objectForKey:method] ? [[delays objectForKey:method] doubleValue] : defaultDelay;
+
+			int n = [[methodRequestCounts objectForKey:method] intValue] + 1;
+			[methodRequestCounts setObject:[NSNumber numberWithInt:n] forKey:method];
+			NSArray *tail = [tailDelays objectForKey:method];
+			if(tail && [[tail objectAtIndex:1] intValue] > 0 && n % [[tail objectAtIndex:1] intValue] == 0)
+				delay = [[tail objectAtIndex:0] doubleValue];
+		}
+		if(!json) json = @"{\"success\":true}";
+		if(delay > 0) usleep((useconds_t)(delay * 1000000));
+
+		NSData *bodyData = [json dataUsingEncoding:NSUTF8StringEncoding];
+		NSString *encoding = @"";
+		if(compressesResponses && [[headers lowercaseString] rangeOfString:@"accept-encoding: gzip"].location != NSNotFound)
+		{
+			bodyData = [ASIHTTPRequest compressData:bodyData];
+			encoding = @"Content-Encoding: gzip\r\n";
+		}
+		NSString *responseHeaders = [NSString stringWithFormat:@"HTTP/1.1 200 OK\r\nContent-Type: application/json\r\n%@Content-Length: %u\r\nConnection: close\r\n\r\n", encoding, [bodyData length]];
+		NSMutableData *response = [NSMutableData dataWithData:[responseHeaders dataUsingEncoding:NSASCIIStringEncoding]];
+		[response appendData:bodyData];
+
+		const uint8_t *bytes = [response bytes];
+		NSUInteger sent = 0;
+		while(sent < [response length])
+		{
+			ssize_t w = write(client, bytes + sent, [response length] - sent);
+			if(w <= 0) break;
+			sent += w;
+		}
+	}
+
+	close(client);
+	@synchronized(self)
+	{
+		activeConnectionCount--;
+	}
+	[pool drain];
+}
+
+@end
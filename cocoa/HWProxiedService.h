@@ -0,0 +1,38 @@
+#import <Cocoa/Cocoa.h>
+#import <dns_sd.h>
+
+// A remote machine's service re-published on this Mac, pointing at the local
+// end of its ssh tunnel. Registration goes through HWServicePublisher so all
+// of a machine's services share one connection to mDNSResponder.
+@interface HWProxiedService : NSObject {
+	NSString *name;
+	NSString *type;
+	int port;
+	NSData *TXTRecordData;
+
+	// Name mDNSResponder actually registered, differs from name after a conflict
+	NSString *registeredName;
+	DNSServiceErrorType error;
+	NSTimeInterval registrationTime;
+
+	DNSServiceRef registration;
+	NSDate *publishStarted;
+}
+
+- (id)initWithName:(NSString *)aName type:(NSString *)aType port:(int)aPort TXTRecordData:(NSData *)txt;
+
+// Same calls SSHTunnel makes on an NSNetService when a tunnel reconnects or goes away
+- (void)publish;
+- (void)stop;
+
+@property (nonatomic, retain) NSString *name;
+@property (nonatomic, retain) NSString *type;
+@property (nonatomic, assign) int port;
+@property (nonatomic, retain) NSData *TXTRecordData;
+@property (nonatomic, retain) NSString *registeredName;
+@property (nonatomic, assign) DNSServiceErrorType error;
+@property (nonatomic, assign) NSTimeInterval registrationTime;
+@property (nonatomic, assign) DNSServiceRef registration;
+@property (nonatomic, retain) NSDate *publishStarted;
+
+@end
@@ -0,0 +1,36 @@
+#import "HWProxiedService.h"
+#import "HWServicePublisher.h"
+
+@implementation HWProxiedService
+
+@synthesize name;
+@synthesize type;
+@synthesize port;
+@synthesize TXTRecordData;
+@synthesize registeredName;
+@synthesize error;
+@synthesize registrationTime;
+@synthesize registration;
+@synthesize publishStarted;
+
+- (id)initWithName:(NSString *)aName type:(NSString *)aType port:(int)aPort TXTRecordData:(NSData *)txt
+{
+	[super init];
+	name = [aName copy];
+	type = [aType copy];
+	port = aPort;
+	TXTRecordData = [txt copy];
+	return self;
+}
+
+- (void)publish
+{
+	[[HWServicePublisher sharedObject] publishServices:[NSArray arrayWithObject:self]];
+}
+
+- (void)stop
+{
+	[[HWServicePublisher sharedObject] stopService:self];
+}
+
+@end
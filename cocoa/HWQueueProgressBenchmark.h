@@ -0,0 +1,32 @@
+#import <Cocoa/Cocoa.h>
+#import "HWBenchmark.h"
+
+// Requests an ASINetworkQueue runs at once in the benchmark
+#define HWQueueProgressBenchmarkConcurrency 8
+
+// The whole queue has to finish in this time, so it gets longer than a single request
+#define HWQueueProgressBenchmarkTimeout (2 * HWBenchmarkTimeout)
+
+// Runs a queue of small requests against a mock API through an ASINetworkQueue
+// with upload and download progress delegates, the case where progress
+// bookkeeping used to cost about as much as the requests themselves. Reports
+// the time the queue took and how often the progress delegates were updated,
+// which should stay near one update per ASINetworkQueueProgressUpdateInterval
+// however many requests there are. The benchmark is its own progress
+// delegate, standing in for an NSProgressIndicator.
+//
+// HighwireBenchmarks -HWQueueProgressBenchmark 2000 runs it.
+@interface HWQueueProgressBenchmark : HWBenchmark {
+	int requestCount;
+
+	BOOL queueFinished;
+	unsigned int progressUpdates;
+	double lastProgress;
+}
+
+- (id)initWithRequestCount:(int)count;
+
+// Returns NO if some request failed or the queue didn't finish in time
+- (BOOL)run;
+
+@end
@@ -0,0 +1,102 @@
+#import "HWQueueProgressBenchmark.h"
+#import "HWMockAPIServer.h"
+#import "ASIFormDataRequest.h"
+#import "ASINetworkQueue.h"
+
+@interface HWQueueProgressBenchmark ()
+- (void)queueFinished:(ASINetworkQueue *)queue;
+@end
+
+@implementation HWQueueProgressBenchmark
+
++ (int)runWithUserDefaults
+{
+	HWQueueProgressBenchmark *benchmark = [[HWQueueProgressBenchmark alloc] initWithRequestCount:[self intArgumentOrDefault:2000]];
+	return [benchmark run] ? 0 : 1;
+}
+
+- (id)initWithRequestCount:(int)count
+{
+	[super init];
+	requestCount = count;
+	return self;
+}
+
+- (BOOL)run
+{
+	if(![self startMockAPI])
+		return NO;
+	[mockAPI setResponse:@"{\"ok\":true}" forMethod:@"progress"];
+
+	ASINetworkQueue *queue = [ASINetworkQueue queue];
+	[queue setMaxConcurrentOperationCount:HWQueueProgressBenchmarkConcurrency];
+	[queue setShouldCancelAllRequestsOnFailure:NO];
+	[queue setDelegate:self];
+	[queue setRequestDidFinishSelector:@selector(requestFinished:)];
+	[queue setRequestDidFailSelector:@selector(requestFailed:)];
+	[queue setQueueDidFinishSelector:@selector(queueFinished:)];
+	[queue setUploadProgressDelegate:self];
+	[queue setDownloadProgressDelegate:self];
+
+	queueFinished = NO;
+	outstanding = requestCount;
+	failures = 0;
+	progressUpdates = 0;
+	lastProgress = 0;
+
+	// Small form posts, so each request has a body to count as well as a response
+	for(int i = 0; i < requestCount; i++)
+	{
+		NSURL *url = [NSURL URLWithString:[NSString stringWithFormat:@"%@?method=progress&n=%d", [mockAPI baseURL], i]];
+		ASIFormDataRequest *request = [ASIFormDataRequest requestWithURL:url];
+		[request setPostValue:[NSString stringWithFormat:@"%d", i] forKey:@"n"];
+		[queue addOperation:request];
+	}
+
+	NSDate *startedAt = [NSDate date];
+	[queue go];
+
+	[self runUntil:@selector(isFinished) timeout:HWQueueProgressBenchmarkTimeout];
+
+	NSTimeInterval elapsed = -[startedAt timeIntervalSinceNow];
+	NSLog(@"%d requests through an ASINetworkQueue: %.2f s (%.0f requests/s), %u progress updates (%.1f per second, %u from the queue), last progress %.2f%@",
+		  requestCount, elapsed, requestCount / elapsed, progressUpdates, progressUpdates / elapsed, [queue progressUpdateCount], lastProgress,
+		  queueFinished ? @"" : @" (timed out)");
+	if(failures)
+		NSLog(@"%d requests failed", failures);
+
+	[queue cancelAllOperations];
+	[self stopMockAPI];
+	return queueFinished && failures == 0;
+}
+
+#pragma mark -
+#pragma mark Progress Indicator
+#pragma mark -
+
+- (void)setMaxValue:(double)max
+{
+}
+
+- (void)setDoubleValue:(double)progress
+{
+	progressUpdates++;
+	lastProgress = progress;
+}
+
+#pragma mark -
+#pragma mark ASINetworkQueue Delegate
+#pragma mark -
+
+// The queue only counts as done once it has passed on its last progress update
+- (BOOL)isFinished
+{
+	return queueFinished;
+}
+
+- (void)queueFinished:(ASINetworkQueue *)queue
+{
+	queueFinished = YES;
+}
+
+@end
@@ -0,0 +1,51 @@
+#import <Cocoa/Cocoa.h>
+
+// Wire format of the service event channel, all integers in network byte order.
+// On connect the server sends the magic, a uint16 version and a uint16 reserved
+// field, then an Added event for every shared service and a SnapshotDone event.
+// Every event after that is a live change.
+//
+// Event: uint32 length of what follows, uint8 kind, uint8 reserved, uint16 port,
+// uint16 name length, uint16 type length, uint16 TXT length, then the UTF-8 name,
+// the UTF-8 type and the raw TXT record.
+#define HWServiceEventMagic "HWSE"
+#define HWServiceEventVersion 1
+#define HWServiceEventHelloLength 8
+#define HWServiceEventHeaderLength 14
+
+typedef enum _HWServiceEventKind {
+	HWServiceEventAdded = 1,
+	HWServiceEventRemoved = 2,
+	HWServiceEventTXTChanged = 3,
+	HWServiceEventSnapshotDone = 4
+} HWServiceEventKind;
+
+@interface HWServiceEvent : NSObject {
+	HWServiceEventKind kind;
+	NSString *name;
+	NSString *type;
+	int port;
+	NSData *TXTRecordData;
+}
+
++ (NSData *)helloData;
+
+- (id)initWithKind:(HWServiceEventKind)aKind service:(NSNetService *)service;
+- (id)initWithKind:(HWServiceEventKind)aKind name:(NSString *)aName type:(NSString *)aType port:(int)aPort TXTRecordData:(NSData *)txt;
+
+// Identifies the service across events, the same for add, remove and TXT change
+- (NSString *)key;
+
+- (NSData *)data;
+
+// Takes one complete event off the front of buffer. Returns nil when more bytes are
+// needed, or when the bytes are garbage, in which case malformed is set.
++ (HWServiceEvent *)nextEventFromBuffer:(NSMutableData *)buffer malformed:(BOOL *)malformed;
+
+@property (nonatomic, assign) HWServiceEventKind kind;
+@property (nonatomic, retain) NSString *name;
+@property (nonatomic, retain) NSString *type;
+@property (nonatomic, assign) int port;
+@property (nonatomic, retain) NSData *TXTRecordData;
+
+@end
@@ -0,0 +1,98 @@
+#import "HWServiceEvent.h"
+
+// Nothing we send comes close, anything bigger means the stream is out of step
+#define HWServiceEventMaxLength (HWServiceEventHeaderLength + 3 * 65535)
+
+@implementation HWServiceEvent
+
+@synthesize kind;
+@synthesize name;
+@synthesize type;
+@synthesize port;
+@synthesize TXTRecordData;
+
++ (NSData *)helloData
+{
+	uint16_t header[2] = { htons(HWServiceEventVersion), 0 };
+	NSMutableData *data = [NSMutableData dataWithBytes:HWServiceEventMagic length:4];
+	[data appendBytes:header length:sizeof(header)];
+	return data;
+}
+
+- (id)initWithKind:(HWServiceEventKind)aKind service:(NSNetService *)service
+{
+	return [self initWithKind:aKind name:[service name] type:[service type] port:[service port] TXTRecordData:[service TXTRecordData]];
+}
+
+- (id)initWithKind:(HWServiceEventKind)aKind name:(NSString *)aName type:(NSString *)aType port:(int)aPort TXTRecordData:(NSData *)txt
+{
+	[super init];
+	kind = aKind;
+	name = [aName copy];
+	type = [aType copy];
+	port = aPort;
+	TXTRecordData = [txt copy];
+	return self;
+}
+
+- (NSString *)key
+{
+	return [NSString stringWithFormat:@"%@|%@", type, name];
+}
+
+- (NSData *)data
+{
+	NSData *nameData = [name dataUsingEncoding:NSUTF8StringEncoding];
+	NSData *typeData = [type dataUsingEncoding:NSUTF8StringEncoding];
+	NSData *txt = TXTRecordData;
+	if([nameData length] > 65535 || [typeData length] > 65535 || [txt length] > 65535)
+		return nil;
+
+	uint8_t header[HWServiceEventHeaderLength];
+	uint32_t length = htonl(HWServiceEventHeaderLength - 4 + [nameData length] + [typeData length] + [txt length]);
+	uint16_t fields[4] = { htons(port), htons([nameData length]), htons([typeData length]), htons([txt length]) };
+	memcpy(header, &length, 4);
+	header[4] = kind;
+	header[5] = 0;
+	memcpy(header + 6, fields, sizeof(fields));
+
+	NSMutableData *data = [NSMutableData dataWithBytes:header length:sizeof(header)];
+	[data appendData:nameData];
+	[data appendData:typeData];
+	[data appendData:txt];
+	return data;
+}
+
++ (HWServiceEvent *)nextEventFromBuffer:(NSMutableData *)buffer malformed:(BOOL *)malformed
+{
+	*malformed = NO;
+	if([buffer length] < HWServiceEventHeaderLength) return nil;
+
+	const uint8_t *bytes = [buffer bytes];
+	uint32_t length;
+	uint16_t fields[4];
+	memcpy(&length, bytes, 4);
+	memcpy(fields, bytes + 6, sizeof(fields));
+	length = ntohl(length) + 4;
+
+	NSUInteger nameLength = ntohs(fields[1]);
+	NSUInteger typeLength = ntohs(fields[2]);
+	NSUInteger txtLength = ntohs(fields[3]);
+	if(length > HWServiceEventMaxLength || length != HWServiceEventHeaderLength + nameLength + typeLength + txtLength)
+	{
+		*malformed = YES;
+		return nil;
+	}
+	if([buffer length] < length) return nil;
+
+	const uint8_t *body = bytes + HWServiceEventHeaderLength;
+	NSString *aName = [[NSString alloc] initWithBytes:body length:nameLength encoding:NSUTF8StringEncoding];
+	NSString *aType = [[NSString alloc] initWithBytes:body + nameLength length:typeLength encoding:NSUTF8StringEncoding];
+	NSData *txt = [NSData dataWithBytes:body + nameLength + typeLength length:txtLength];
+	HWServiceEvent *event = [[HWServiceEvent alloc] initWithKind:bytes[4] name:aName type:aType port:ntohs(fields[0]) TXTRecordData:txt];
+
+	[buffer replaceBytesInRange:NSMakeRange(0, length) withBytes:NULL length:0];
+	return event;
+}
+
+@end
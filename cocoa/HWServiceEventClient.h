@@ -0,0 +1,47 @@
+#import <Cocoa/Cocoa.h>
+
+@class HWServiceEvent;
+
+// Seconds between attempts to reopen a service event channel that dropped
+#define HWServiceEventReconnectDelay 5.0
+
+// Reads the service event stream of a remote machine through the local end of
+// its control tunnel. Each (re)connect starts with a full snapshot so changes
+// missed while disconnected are reconciled.
+@interface HWServiceEventClient : NSObject {
+	int port;
+	NSFileHandle *handle;
+	NSMutableData *buffer;
+
+	BOOL receivedHello;
+	BOOL everConnected;
+	BOOL stopped;
+
+	// Added events collected until SnapshotDone, nil once the snapshot is delivered
+	NSMutableArray *snapshot;
+
+	NSTimer *reconnectTimer;
+	id delegate;
+}
+
+- (id)initWithPort:(int)aPort;
+
+// NO if nothing accepts connections on the port
+- (BOOL)connect;
+- (void)stop;
+
+- (void)didRead:(NSNotification *)aNotification;
+
+@property (nonatomic, assign) id delegate;
+
+@end
+
+@interface NSObject (HWServiceEventClientDelegate)
+// Every service the remote machine shares right now, as HWServiceEventAdded events
+- (void)serviceEventClient:(HWServiceEventClient *)client didReceiveSnapshot:(NSArray *)events;
+- (void)serviceEventClient:(HWServiceEventClient *)client didReceiveEvent:(HWServiceEvent *)event;
+
+// The first connection closed before the server said hello, usually a sharing
+// machine running a Highwire without the event channel
+- (void)serviceEventClientDidFailToConnect:(HWServiceEventClient *)client;
+@end
@@ -0,0 +1,152 @@
+#import "HWServiceEventClient.h"
+#import "HWServiceEvent.h"
+#import <sys/socket.h>
+#import <netinet/in.h>
+#import <arpa/inet.h>
+
+@interface HWServiceEventClient ()
+- (void)disconnect;
+- (void)processBuffer;
+@end
+
+@implementation HWServiceEventClient
+
+@synthesize delegate;
+
+- (id)initWithPort:(int)aPort
+{
+	[super init];
+	port = aPort;
+	buffer = [[NSMutableData alloc] init];
+	return self;
+}
+
+- (BOOL)connect
+{
+	[reconnectTimer invalidate];
+	reconnectTimer = nil;
+	if(stopped || handle) return YES;
+
+	int s = socket(AF_INET, SOCK_STREAM, 0);
+	struct sockaddr_in addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_len = sizeof(addr);
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	addr.sin_port = htons(port);
+
+	if(connect(s, (struct sockaddr *)&addr, sizeof(addr)) != 0)
+	{
+		close(s);
+		if(everConnected)
+			reconnectTimer = [NSTimer scheduledTimerWithTimeInterval:HWServiceEventReconnectDelay target:self selector:@selector(connect) userInfo:nil repeats:NO];
+		return NO;
+	}
+
+	receivedHello = NO;
+	snapshot = [[NSMutableArray alloc] init];
+	[buffer setLength:0];
+
+	handle = [[NSFileHandle alloc] initWithFileDescriptor:s closeOnDealloc:YES];
+	[[NSNotificationCenter defaultCenter] addObserver:self
+											 selector:@selector(didRead:)
+												 name:NSFileHandleReadCompletionNotification
+											   object:handle];
+	[handle readInBackgroundAndNotify];
+	return YES;
+}
+
+- (void)stop
+{
+	stopped = YES;
+	[reconnectTimer invalidate];
+	reconnectTimer = nil;
+	[self disconnect];
+}
+
+- (void)disconnect
+{
+	if(!handle) return;
+
+	[[NSNotificationCenter defaultCenter] removeObserver:self name:NSFileHandleReadCompletionNotification object:handle];
+	[handle closeFile];
+	handle = nil;
+	snapshot = nil;
+}
+
+- (void)didRead:(NSNotification *)aNotification
+{
+	NSData *data = [[aNotification userInfo] objectForKey:NSFileHandleNotificationDataItem];
+	if([data length] == 0)
+	{
+		// ssh accepts the local connection even when nothing listens on the far side,
+		// so a first connection that closes without a hello counts as a failed connect
+		BOOL failed = !everConnected && !receivedHello;
+		[self disconnect];
+
+		if(failed)
+		{
+			if([delegate respondsToSelector:@selector(serviceEventClientDidFailToConnect:)])
+				[delegate serviceEventClientDidFailToConnect:self];
+		}
+		else if(!stopped)
+			reconnectTimer = [NSTimer scheduledTimerWithTimeInterval:HWServiceEventReconnectDelay target:self selector:@selector(connect) userInfo:nil repeats:NO];
+		return;
+	}
+
+	[buffer appendData:data];
+	[self processBuffer];
+	[handle readInBackgroundAndNotify];
+}
+
+- (void)processBuffer
+{
+	if(!receivedHello)
+	{
+		if([buffer length] < HWServiceEventHelloLength) return;
+
+		uint16_t version;
+		memcpy(&version, (const uint8_t *)[buffer bytes] + 4, sizeof(version));
+		if(memcmp([buffer bytes], HWServiceEventMagic, 4) != 0 || ntohs(version) != HWServiceEventVersion)
+		{
+			NSLog(@"Service event channel on port %d sent an unknown hello", port);
+			[self stop];
+			return;
+		}
+
+		[buffer replaceBytesInRange:NSMakeRange(0, HWServiceEventHelloLength) withBytes:NULL length:0];
+		receivedHello = YES;
+		everConnected = YES;
+	}
+
+	BOOL malformed = NO;
+	HWServiceEvent *event;
+	while(handle && (event = [HWServiceEvent nextEventFromBuffer:buffer malformed:&malformed]))
+	{
+		if(snapshot)
+		{
+			if(event.kind == HWServiceEventAdded)
+				[snapshot addObject:event];
+			else if(event.kind == HWServiceEventSnapshotDone)
+			{
+				NSArray *events = snapshot;
+				snapshot = nil;
+				if([delegate respondsToSelector:@selector(serviceEventClient:didReceiveSnapshot:)])
+					[delegate serviceEventClient:self didReceiveSnapshot:events];
+			}
+			continue;
+		}
+
+		if([delegate respondsToSelector:@selector(serviceEventClient:didReceiveEvent:)])
+			[delegate serviceEventClient:self didReceiveEvent:event];
+	}
+
+	if(malformed)
+	{
+		NSLog(@"Service event channel on port %d is out of step, reconnecting", port);
+		[self disconnect];
+		reconnectTimer = [NSTimer scheduledTimerWithTimeInterval:HWServiceEventReconnectDelay target:self selector:@selector(connect) userInfo:nil repeats:NO];
+	}
+}
+
+@end
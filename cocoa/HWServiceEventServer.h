@@ -0,0 +1,24 @@
+#import <Cocoa/Cocoa.h>
+
+// Streams service changes from this machine's NetServiceBrowserDelegate to
+// connected Highwire clients. It listens on the loopback side of the control
+// tunnel (the sharing port + 1), so clients reach it through their ssh
+// forward and never need the web API to learn about new services.
+@interface HWServiceEventServer : NSObject {
+	NSFileHandle *listenHandle;
+	NSMutableArray *clients;
+}
+
++ (HWServiceEventServer *)sharedObject;
+
+- (BOOL)startOnPort:(int)port;
+- (void)stop;
+
+- (void)serviceWasAdded:(NSNetService *)service;
+- (void)serviceWasRemoved:(NSNetService *)service;
+- (void)serviceDidUpdateTXTRecord:(NSNetService *)service;
+
+- (void)connectionAccepted:(NSNotification *)aNotification;
+- (void)clientDidRead:(NSNotification *)aNotification;
+
+@end
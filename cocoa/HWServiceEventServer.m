@@ -0,0 +1,156 @@
+#import "HWServiceEventServer.h"
+#import "HWServiceEvent.h"
+#import "NetServiceBrowserDelegate.h"
+#import <sys/socket.h>
+#import <netinet/in.h>
+#import <arpa/inet.h>
+
+@interface HWServiceEventServer ()
+- (void)sendData:(NSData *)data toClient:(NSFileHandle *)client;
+- (void)broadcastEvent:(HWServiceEvent *)event;
+- (void)dropClient:(NSFileHandle *)client;
+@end
+
+@implementation HWServiceEventServer
+
+static HWServiceEventServer *_sharedObject = nil;
+
+- (id)init
+{
+	[super init];
+	clients = [[NSMutableArray alloc] init];
+	return self;
+}
+
++ (HWServiceEventServer *)sharedObject
+{
+	if(!_sharedObject)
+		_sharedObject = [[self alloc] init];
+	return _sharedObject;
+}
+
+- (BOOL)startOnPort:(int)port
+{
+	if(listenHandle) return YES;
+
+	int s = socket(AF_INET, SOCK_STREAM, 0);
+	int yes = 1;
+	setsockopt(s, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes));
+
+	// Only reachable through the ssh forward, which connects from the loopback interface
+	struct sockaddr_in addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_len = sizeof(addr);
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	addr.sin_port = htons(port);
+
+	if(bind(s, (struct sockaddr *)&addr, sizeof(addr)) != 0 || listen(s, 8) != 0)
+	{
+		NSLog(@"Unable to listen for service event clients on port %d", port);
+		close(s);
+		return NO;
+	}
+
+	listenHandle = [[NSFileHandle alloc] initWithFileDescriptor:s closeOnDealloc:YES];
+	[[NSNotificationCenter defaultCenter] addObserver:self
+											 selector:@selector(connectionAccepted:)
+												 name:NSFileHandleConnectionAcceptedNotification
+											   object:listenHandle];
+	[listenHandle acceptConnectionInBackgroundAndNotify];
+	return YES;
+}
+
+- (void)stop
+{
+	for(NSFileHandle *client in [[clients copy] autorelease])
+		[self dropClient:client];
+
+	if(listenHandle)
+	{
+		[[NSNotificationCenter defaultCenter] removeObserver:self name:NSFileHandleConnectionAcceptedNotification object:listenHandle];
+		[listenHandle closeFile];
+		listenHandle = nil;
+	}
+}
+
+- (void)connectionAccepted:(NSNotification *)aNotification
+{
+	NSFileHandle *client = [[aNotification userInfo] objectForKey:NSFileHandleNotificationFileHandleItem];
+	[listenHandle acceptConnectionInBackgroundAndNotify];
+	if(!client) return;
+
+	// A client that goes away mid-write should fail the write, not kill the app
+	int yes = 1;
+	setsockopt([client fileDescriptor], SOL_SOCKET, SO_NOSIGPIPE, &yes, sizeof(yes));
+
+	[clients addObject:client];
+	[[NSNotificationCenter defaultCenter] addObserver:self
+											 selector:@selector(clientDidRead:)
+												 name:NSFileHandleReadCompletionNotification
+											   object:client];
+	[client readInBackgroundAndNotify];
+
+	// Hello and the current service list go out as one write
+	NSMutableData *snapshot = [NSMutableData dataWithData:[HWServiceEvent helloData]];
+	for(NSNetService *service in [[NetServiceBrowserDelegate sharedObject] services])
+		[snapshot appendData:[[[HWServiceEvent alloc] initWithKind:HWServiceEventAdded service:service] data]];
+	[snapshot appendData:[[[HWServiceEvent alloc] initWithKind:HWServiceEventSnapshotDone name:@"" type:@"" port:0 TXTRecordData:nil] data]];
+	[self sendData:snapshot toClient:client];
+}
+
+- (void)clientDidRead:(NSNotification *)aNotification
+{
+	// Clients never send anything, a read only completes when they hang up
+	NSFileHandle *client = [aNotification object];
+	NSData *data = [[aNotification userInfo] objectForKey:NSFileHandleNotificationDataItem];
+	if([data length] > 0)
+		[client readInBackgroundAndNotify];
+	else
+		[self dropClient:client];
+}
+
+- (void)dropClient:(NSFileHandle *)client
+{
+	[[NSNotificationCenter defaultCenter] removeObserver:self name:NSFileHandleReadCompletionNotification object:client];
+	[client closeFile];
+	[clients removeObject:client];
+}
+
+- (void)sendData:(NSData *)data toClient:(NSFileHandle *)client
+{
+	@try
+	{
+		[client writeData:data];
+	}
+	@catch(NSException *e)
+	{
+		[self dropClient:client];
+	}
+}
+
+- (void)broadcastEvent:(HWServiceEvent *)event
+{
+	NSData *data = [event data];
+	if(!data) return;
+
+	for(NSFileHandle *client in [[clients copy] autorelease])
+		[self sendData:data toClient:client];
+}
+
+- (void)serviceWasAdded:(NSNetService *)service
+{
+	[self broadcastEvent:[[HWServiceEvent alloc] initWithKind:HWServiceEventAdded service:service]];
+}
+
+- (void)serviceWasRemoved:(NSNetService *)service
+{
+	[self broadcastEvent:[[HWServiceEvent alloc] initWithKind:HWServiceEventRemoved service:service]];
+}
+
+- (void)serviceDidUpdateTXTRecord:(NSNetService *)service
+{
+	[self broadcastEvent:[[HWServiceEvent alloc] initWithKind:HWServiceEventTXTChanged service:service]];
+}
+
+@end
@@ -0,0 +1,50 @@
+#import <Cocoa/Cocoa.h>
+#import <dns_sd.h>
+
+@class HWProxiedService;
+
+// Seconds to wait for mDNSResponder to confirm a batch before reporting what we have
+#define HWServicePublishTimeout 10.0
+
+// Registers proxied services over a single shared mDNSResponder connection
+// (kDNSServiceFlagsShareConnection) instead of one NSNetService and daemon
+// connection per service. Registrations go out back to back, the daemon
+// probes them concurrently, and the results come back to the delegate as
+// one batch along with how long it took.
+@interface HWServicePublisher : NSObject {
+	DNSServiceRef connection;
+	CFSocketRef connectionSocket;
+	CFRunLoopSourceRef connectionSource;
+
+	NSMutableArray *publishedServices;
+
+	// Services of the current batch still waiting for their register callback
+	NSMutableArray *pendingServices;
+	NSMutableArray *batchServices;
+	NSDate *batchStarted;
+	NSTimer *batchTimer;
+
+	id delegate;
+}
+
++ (HWServicePublisher *)sharedObject;
+
+- (void)publishServices:(NSArray *)services;
+- (void)stopService:(HWProxiedService *)service;
+
+// Replaces the TXT record of a registered service in place, without re-registering it
+- (void)updateTXTRecordForService:(HWProxiedService *)service;
+- (void)stopAllServices;
+
+- (void)processResult;
+- (void)service:(HWProxiedService *)service didRegisterWithName:(NSString *)registeredName error:(DNSServiceErrorType)errorCode;
+
+@property (nonatomic, assign) id delegate;
+
+@end
+
+@interface NSObject (HWServicePublisherDelegate)
+// services are HWProxiedService objects with registeredName, error and registrationTime filled in.
+// Services still unconfirmed at the timeout come back without a registeredName.
+- (void)servicePublisher:(HWServicePublisher *)publisher didPublishBatch:(NSArray *)services inTime:(NSTimeInterval)seconds;
+@end
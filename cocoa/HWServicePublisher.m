@@ -0,0 +1,237 @@
+#import "HWServicePublisher.h"
+#import "HWProxiedService.h"
+
+@interface HWServicePublisher ()
+- (BOOL)openConnection;
+- (void)closeConnection;
+- (void)registerService:(HWProxiedService *)service;
+- (void)finishBatch;
+@end
+
+static void HWServicePublisherSocketCallBack(CFSocketRef s, CFSocketCallBackType type, CFDataRef address, const void *data, void *info)
+{
+	[(HWServicePublisher *)info processResult];
+}
+
+static void HWServicePublisherRegisterCallBack(DNSServiceRef sdRef, DNSServiceFlags flags, DNSServiceErrorType errorCode,
+											   const char *name, const char *regtype, const char *domain, void *context)
+{
+	HWProxiedService *service = (HWProxiedService *)context;
+	NSString *registeredName = name ? [NSString stringWithUTF8String:name] : nil;
+	[[HWServicePublisher sharedObject] service:service didRegisterWithName:registeredName error:errorCode];
+}
+
+@implementation HWServicePublisher
+
+@synthesize delegate;
+
+static HWServicePublisher *_sharedObject = nil;
+
+- (id)init
+{
+	[super init];
+	publishedServices = [[NSMutableArray alloc] init];
+	pendingServices = [[NSMutableArray alloc] init];
+	batchServices = [[NSMutableArray alloc] init];
+	return self;
+}
+
++ (HWServicePublisher *)sharedObject
+{
+	if(!_sharedObject)
+		_sharedObject = [[self alloc] init];
+	return _sharedObject;
+}
+
+- (BOOL)openConnection
+{
+	if(connection) return YES;
+
+	DNSServiceErrorType err = DNSServiceCreateConnection(&connection);
+	if(err != kDNSServiceErr_NoError)
+	{
+		NSLog(@"Unable to connect to mDNSResponder (%d)", err);
+		connection = NULL;
+		return NO;
+	}
+
+	CFSocketContext context = { 0, self, NULL, NULL, NULL };
+	connectionSocket = CFSocketCreateWithNative(NULL, DNSServiceRefSockFD(connection), kCFSocketReadCallBack, HWServicePublisherSocketCallBack, &context);
+
+	// The socket belongs to the DNSServiceRef, CFSocket must not close it
+	CFSocketSetSocketFlags(connectionSocket, CFSocketGetSocketFlags(connectionSocket) & ~kCFSocketCloseOnInvalidate);
+	connectionSource = CFSocketCreateRunLoopSource(NULL, connectionSocket, 0);
+	CFRunLoopAddSource([[NSRunLoop mainRunLoop] getCFRunLoop], connectionSource, kCFRunLoopCommonModes);
+	return YES;
+}
+
+- (void)closeConnection
+{
+	if(connectionSource)
+	{
+		CFRunLoopSourceInvalidate(connectionSource);
+		CFRelease(connectionSource);
+		connectionSource = NULL;
+	}
+	if(connectionSocket)
+	{
+		CFSocketInvalidate(connectionSocket);
+		CFRelease(connectionSocket);
+		connectionSocket = NULL;
+	}
+	if(connection)
+	{
+		// Deallocating the shared connection also drops every registration made on it
+		DNSServiceRefDeallocate(connection);
+		connection = NULL;
+	}
+	for(HWProxiedService *service in publishedServices)
+		service.registration = NULL;
+}
+
+- (void)publishServices:(NSArray *)services
+{
+	if(![self openConnection]) return;
+
+	if([pendingServices count] == 0)
+	{
+		[batchServices removeAllObjects];
+		batchStarted = [NSDate date];
+		batchTimer = [NSTimer scheduledTimerWithTimeInterval:HWServicePublishTimeout target:self selector:@selector(finishBatch) userInfo:nil repeats:NO];
+	}
+
+	// Every request is written to the one socket back to back, nothing waits on a reply
+	for(HWProxiedService *service in services)
+	{
+		if(service.registration) continue;
+		[self registerService:service];
+	}
+
+	if([pendingServices count] == 0)
+		[self finishBatch];
+}
+
+- (void)registerService:(HWProxiedService *)service
+{
+	NSData *txt = service.TXTRecordData;
+	const char *regtype = [service.type UTF8String];
+	DNSServiceRef ref = connection;
+
+	service.registeredName = nil;
+	service.error = kDNSServiceErr_NoError;
+	service.publishStarted = [NSDate date];
+
+	DNSServiceErrorType err = DNSServiceRegister(&ref, kDNSServiceFlagsShareConnection, kDNSServiceInterfaceIndexAny,
+												 [service.name UTF8String], regtype, NULL, NULL, htons(service.port),
+												 [txt length], [txt bytes], HWServicePublisherRegisterCallBack, service);
+	[batchServices addObject:service];
+	if(err != kDNSServiceErr_NoError)
+	{
+		service.error = err;
+		return;
+	}
+
+	service.registration = ref;
+	if(![publishedServices containsObject:service])
+		[publishedServices addObject:service];
+	[pendingServices addObject:service];
+}
+
+- (void)stopService:(HWProxiedService *)service
+{
+	// Deallocating a ref made with kDNSServiceFlagsShareConnection only removes that one registration
+	if(service.registration)
+		DNSServiceRefDeallocate(service.registration);
+	service.registration = NULL;
+	[publishedServices removeObject:service];
+
+	if([pendingServices containsObject:service])
+	{
+		[pendingServices removeObject:service];
+		if([pendingServices count] == 0)
+			[self finishBatch];
+	}
+
+	if([publishedServices count] == 0)
+		[self closeConnection];
+}
+
+- (void)updateTXTRecordForService:(HWProxiedService *)service
+{
+	if(!service.registration) return;
+
+	// A NULL RecordRef means the service's primary TXT record
+	NSData *txt = service.TXTRecordData;
+	DNSServiceErrorType err = DNSServiceUpdateRecord(service.registration, NULL, 0, [txt length], [txt bytes], 0);
+	if(err != kDNSServiceErr_NoError)
+		NSLog(@"Unable to update the TXT record of %@ (%d)", service.name, err);
+}
+
+- (void)stopAllServices
+{
+	[self closeConnection];
+	[publishedServices removeAllObjects];
+	[pendingServices removeAllObjects];
+	[self finishBatch];
+}
+
+- (void)processResult
+{
+	DNSServiceErrorType err = DNSServiceProcessResult(connection);
+	if(err == kDNSServiceErr_NoError) return;
+
+	// mDNSResponder went away (crash, sleep/wake restart), register everything again on a new connection
+	NSLog(@"Lost the mDNSResponder connection (%d), re-registering %d services", err, [publishedServices count]);
+	NSArray *services = [publishedServices copy];
+	[self closeConnection];
+	[pendingServices removeAllObjects];
+	[self publishServices:services];
+}
+
+- (void)service:(HWProxiedService *)service didRegisterWithName:(NSString *)registeredName error:(DNSServiceErrorType)errorCode
+{
+	service.error = errorCode;
+	if(errorCode == kDNSServiceErr_NoError)
+		service.registeredName = registeredName;
+
+	if(![pendingServices containsObject:service])
+	{
+		// Conflicts found after the batch was reported show up here as a later rename
+		if(errorCode == kDNSServiceErr_NoError && ![registeredName isEqualToString:service.name])
+			NSLog(@"Service %@ was renamed to %@ by a conflict", service.name, registeredName);
+		return;
+	}
+
+	service.registrationTime = [[NSDate date] timeIntervalSinceDate:service.publishStarted];
+	[pendingServices removeObject:service];
+	if([pendingServices count] == 0)
+		[self finishBatch];
+}
+
+- (void)finishBatch
+{
+	[batchTimer invalidate];
+	batchTimer = nil;
+	if(!batchStarted) return;
+
+	NSTimeInterval elapsed = [[NSDate date] timeIntervalSinceDate:batchStarted];
+	NSArray *services = [batchServices copy];
+	batchStarted = nil;
+	[batchServices removeAllObjects];
+	[pendingServices removeAllObjects];
+
+	int renamed = 0, failed = 0;
+	for(HWProxiedService *service in services)
+	{
+		if(service.error != kDNSServiceErr_NoError || !service.registeredName)
+			failed++;
+		else if(![service.registeredName isEqualToString:service.name])
+			renamed++;
+	}
+	NSLog(@"Published %d services in %.3fs (%d renamed, %d failed)", [services count], elapsed, renamed, failed);
+
+	if([delegate respondsToSelector:@selector(servicePublisher:didPublishBatch:inTime:)])
+		[delegate servicePublisher:self didPublishBatch:services inTime:elapsed];
+}
+
+@end
@@ -0,0 +1,44 @@
+#import <Cocoa/Cocoa.h>
+
+@class HighwireAPI;
+
+// Seconds to gather service announcements before sending them as one syncServices call
+#define HWServiceSyncWindow 2.0
+
+// Seconds to wait before retrying a sync that failed
+#define HWServiceSyncRetryDelay 30.0
+
+// Collects local service adds and removes and sends them to the Highwire
+// service as a single diff. Announcements of a service whose record hasn't
+// changed since the last successful sync are dropped.
+@interface HWServiceSync : NSObject {
+	HighwireAPI *api;
+
+	// Service key -> record from +[HighwireAPI recordForService:]
+	NSMutableDictionary *pendingAdds;
+	NSMutableDictionary *pendingRemoves;
+	NSMutableDictionary *syncedRecords;
+
+	// The batch currently being sent, merged back into the pending sets if it fails
+	NSDictionary *inFlightAdds;
+	NSDictionary *inFlightRemoves;
+
+	NSTimer *flushTimer;
+}
+
++ (HWServiceSync *)sharedObject;
+
+- (void)serviceWasAdded:(NSNetService *)service;
+- (void)serviceWasRemoved:(NSNetService *)service;
+
+// Sends whatever is pending right away
+- (void)flush;
+
+// Forgets everything synced so far, used when the machine is unregistered
+- (void)reset;
+
+// HighwireAPI delegate methods
+- (void)servicesSyncSucceeded;
+- (void)servicesSyncFailed;
+
+@end
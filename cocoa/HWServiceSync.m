@@ -0,0 +1,136 @@
+#import "HWServiceSync.h"
+#import "HighwireAPI.h"
+
+@interface HWServiceSync ()
+- (NSString *)keyForService:(NSNetService *)service;
+- (void)scheduleFlushAfter:(NSTimeInterval)delay;
+@end
+
+@implementation HWServiceSync
+
+static HWServiceSync *_sharedObject = nil;
+
+- (id)init
+{
+	[super init];
+	api = [[HighwireAPI alloc] init];
+	api.delegate = self;
+	pendingAdds = [[NSMutableDictionary alloc] init];
+	pendingRemoves = [[NSMutableDictionary alloc] init];
+	syncedRecords = [[NSMutableDictionary alloc] init];
+	return self;
+}
+
++ (HWServiceSync *)sharedObject
+{
+	if(!_sharedObject)
+		_sharedObject = [[self alloc] init];
+	return _sharedObject;
+}
+
+- (NSString *)keyForService:(NSNetService *)service
+{
+	return [NSString stringWithFormat:@"%@|%@", [service type], [service name]];
+}
+
+- (void)serviceWasAdded:(NSNetService *)service
+{
+	NSString *key = [self keyForService:service];
+	NSDictionary *record = [HighwireAPI recordForService:service];
+
+	[pendingRemoves removeObjectForKey:key];
+
+	// A flapping or re-announced service with the same port and TXT record is already on the server,
+	// unless a remove for it is on its way there, which the add has to follow
+	NSDictionary *known = [inFlightAdds objectForKey:key] ? [inFlightAdds objectForKey:key] : [syncedRecords objectForKey:key];
+	if(![inFlightRemoves objectForKey:key] && [known isEqualToDictionary:record])
+	{
+		[pendingAdds removeObjectForKey:key];
+		return;
+	}
+
+	[pendingAdds setObject:record forKey:key];
+	[self scheduleFlushAfter:HWServiceSyncWindow];
+}
+
+- (void)serviceWasRemoved:(NSNetService *)service
+{
+	NSString *key = [self keyForService:service];
+	[pendingAdds removeObjectForKey:key];
+
+	if([syncedRecords objectForKey:key] || [inFlightAdds objectForKey:key])
+	{
+		NSDictionary *record = [HighwireAPI recordForService:service];
+		[pendingRemoves setObject:[NSDictionary dictionaryWithObjectsAndKeys:[record objectForKey:@"type"], @"type",
+								   [record objectForKey:@"name"], @"name", nil] forKey:key];
+		[self scheduleFlushAfter:HWServiceSyncWindow];
+	}
+}
+
+- (void)scheduleFlushAfter:(NSTimeInterval)delay
+{
+	// The window starts with the first change, later changes ride along instead of pushing it back
+	if(flushTimer) return;
+	flushTimer = [NSTimer scheduledTimerWithTimeInterval:delay target:self selector:@selector(flush) userInfo:nil repeats:NO];
+}
+
+- (void)flush
+{
+	[flushTimer invalidate];
+	flushTimer = nil;
+
+	// One batch at a time, the next goes out when this one finishes
+	if(inFlightAdds || inFlightRemoves) return;
+	if([pendingAdds count] == 0 && [pendingRemoves count] == 0) return;
+
+	inFlightAdds = [pendingAdds copy];
+	inFlightRemoves = [pendingRemoves copy];
+	[pendingAdds removeAllObjects];
+	[pendingRemoves removeAllObjects];
+
+	NSLog(@"Syncing services: %lu added, %lu removed", (unsigned long)[inFlightAdds count], (unsigned long)[inFlightRemoves count]);
+	[api syncServicesAdding:[inFlightAdds allValues] removing:[inFlightRemoves allValues]];
+}
+
+- (void)reset
+{
+	[flushTimer invalidate];
+	flushTimer = nil;
+	[pendingAdds removeAllObjects];
+	[pendingRemoves removeAllObjects];
+	[syncedRecords removeAllObjects];
+}
+
+#pragma mark -
+#pragma mark HighwireAPI Delegate
+#pragma mark -
+
+- (void)servicesSyncSucceeded
+{
+	[syncedRecords addEntriesFromDictionary:inFlightAdds];
+	[syncedRecords removeObjectsForKeys:[inFlightRemoves allKeys]];
+	inFlightAdds = nil;
+	inFlightRemoves = nil;
+
+	if([pendingAdds count] > 0 || [pendingRemoves count] > 0)
+		[self scheduleFlushAfter:HWServiceSyncWindow];
+}
+
+- (void)servicesSyncFailed
+{
+	NSLog(@"Service sync failed: %@", api.errorMessage);
+
+	// Anything that changed again while the request was out wins over the failed batch
+	for(NSString *key in inFlightAdds)
+		if(![pendingAdds objectForKey:key] && ![pendingRemoves objectForKey:key])
+			[pendingAdds setObject:[inFlightAdds objectForKey:key] forKey:key];
+	for(NSString *key in inFlightRemoves)
+		if(![pendingAdds objectForKey:key] && ![pendingRemoves objectForKey:key])
+			[pendingRemoves setObject:[inFlightRemoves objectForKey:key] forKey:key];
+
+	inFlightAdds = nil;
+	inFlightRemoves = nil;
+	[self scheduleFlushAfter:HWServiceSyncRetryDelay];
+}
+
+@end
@@ -0,0 +1,25 @@
+#import <Cocoa/Cocoa.h>
+
+typedef enum _HWServiceSocketProfile {
+	HWServiceSocketDefault = 0,
+	HWServiceSocketLowLatency = 1,
+	HWServiceSocketThroughput = 2
+} HWServiceSocketProfile;
+
+@interface HWServiceType : NSObject {
+	NSString *type;
+	NSString *name;
+	HWServiceSocketProfile socketProfile;
+}
+
+// Builds a type from one Services.plist entry
+- (id)initWithDictionary:(NSDictionary *)dict;
+
+// Applies the socket profile (TCP_NODELAY, buffer sizes) to a connected socket
+- (void)applySocketProfileToSocket:(int)socket;
+
+@property (nonatomic, retain) NSString *type;
+@property (nonatomic, retain) NSString *name;
+@property (nonatomic, assign) HWServiceSocketProfile socketProfile;
+
+@end
@@ -0,0 +1,46 @@
+#import "HWServiceType.h"
+#import <sys/socket.h>
+#import <netinet/in.h>
+#import <netinet/tcp.h>
+
+@implementation HWServiceType
+
+@synthesize type;
+@synthesize name;
+@synthesize socketProfile;
+
+- (id)initWithDictionary:(NSDictionary *)dict
+{
+	[super init];
+	self.type = [dict valueForKey:@"Service"];
+	self.name = [dict valueForKey:@"Name"];
+
+	NSString *profile = [dict valueForKey:@"Socket"];
+	if([profile isEqualToString:@"LowLatency"])
+		self.socketProfile = HWServiceSocketLowLatency;
+	else if([profile isEqualToString:@"Throughput"])
+		self.socketProfile = HWServiceSocketThroughput;
+
+	return self;
+}
+
+- (void)applySocketProfileToSocket:(int)socket
+{
+	int value;
+	switch(socketProfile)
+	{
+		case HWServiceSocketLowLatency:
+			value = 1;
+			setsockopt(socket, IPPROTO_TCP, TCP_NODELAY, &value, sizeof(value));
+			break;
+		case HWServiceSocketThroughput:
+			value = 256 * 1024;
+			setsockopt(socket, SOL_SOCKET, SO_SNDBUF, &value, sizeof(value));
+			setsockopt(socket, SOL_SOCKET, SO_RCVBUF, &value, sizeof(value));
+			break;
+		default:
+			break;
+	}
+}
+
+@end
@@ -0,0 +1,28 @@
+#import <Cocoa/Cocoa.h>
+#import "HWServiceType.h"
+
+// The known Bonjour service types from Services.plist, loaded once and shared
+// by every subsystem. Lookups by type go through a collision-free (perfect)
+// hash table built at load time, so they cost one hash and one compare.
+@interface HWServiceTypeRegistry : NSObject {
+	// Service types in Services.plist order, also what keeps the table entries alive
+	NSArray *types;
+
+	HWServiceType **table;
+	uint32_t tableMask;
+	uint32_t seed;
+}
+
++ (HWServiceTypeRegistry *)sharedRegistry;
+
+- (id)initWithContentsOfFile:(NSString *)path;
+
+- (NSArray *)allTypes;
+
+// Case-insensitive, the trailing dot is optional. Returns nil for unknown types.
+- (HWServiceType *)serviceTypeForType:(NSString *)type;
+
+// Display name for a type, or the type itself when it isn't known
+- (NSString *)nameForType:(NSString *)type;
+
+@end
@@ -0,0 +1,163 @@
+#import "HWServiceTypeRegistry.h"
+
+// Longest service type we'll hash, DNS-SD limits the service name to 15 characters
+#define HWMaxServiceTypeLength 64
+
+// Largest table buildTable tries before settling for one where some types don't fit
+#define HWMaxServiceTypeTableSize 65536
+
+static uint32_t HWServiceTypeHash(const char *str, uint32_t seed)
+{
+	// FNV-1a over the lower-cased type
+	uint32_t hash = 2166136261u ^ seed;
+	for(; *str; str++)
+	{
+		char c = *str;
+		if(c >= 'A' && c <= 'Z') c += 'a' - 'A';
+		hash = (hash ^ (uint8_t)c) * 16777619u;
+	}
+	return hash;
+}
+
+static BOOL HWNormalizeServiceType(NSString *type, char *buffer)
+{
+	if(![type getCString:buffer maxLength:HWMaxServiceTypeLength - 1 encoding:NSUTF8StringEncoding])
+		return NO;
+
+	size_t len = strlen(buffer);
+	if(len == 0) return NO;
+	if(buffer[len - 1] != '.')
+	{
+		buffer[len] = '.';
+		buffer[len + 1] = '\0';
+	}
+	return YES;
+}
+
+@interface HWServiceTypeRegistry ()
+- (void)buildTable;
+@end
+
+@implementation HWServiceTypeRegistry
+
+static HWServiceTypeRegistry *_sharedRegistry = nil;
+
++ (HWServiceTypeRegistry *)sharedRegistry
+{
+	if(!_sharedRegistry)
+		_sharedRegistry = [[self alloc] initWithContentsOfFile:[[NSBundle mainBundle] pathForResource:@"Services" ofType:@"plist"]];
+	return _sharedRegistry;
+}
+
+- (id)initWithContentsOfFile:(NSString *)path
+{
+	[super init];
+
+	// Types that normalize the same (eg differing only in case or the trailing dot) could never
+	// get slots of their own, so only the first one is kept
+	NSMutableArray *loaded = [NSMutableArray array];
+	NSMutableSet *seen = [NSMutableSet set];
+	char buffer[HWMaxServiceTypeLength];
+	for(NSDictionary *dict in [NSArray arrayWithContentsOfFile:path])
+	{
+		HWServiceType *serviceType = [[[HWServiceType alloc] initWithDictionary:dict] autorelease];
+		if(!serviceType.type || !HWNormalizeServiceType(serviceType.type, buffer))
+			continue;
+
+		NSString *key = [[NSString stringWithUTF8String:buffer] lowercaseString];
+		if([seen containsObject:key])
+		{
+			NSLog(@"Ignoring duplicate service type %@ in %@", serviceType.type, [path lastPathComponent]);
+			continue;
+		}
+		[seen addObject:key];
+		[loaded addObject:serviceType];
+	}
+	types = [loaded copy];
+
+	[self buildTable];
+	return self;
+}
+
+- (void)finalize
+{
+	free(table);
+	[super finalize];
+}
+
+// Picks a table size and seed so every known type lands in its own slot
+- (void)buildTable
+{
+	uint32_t size = 8;
+	while(size < [types count] * 2)
+		size <<= 1;
+
+	char buffer[HWMaxServiceTypeLength];
+	for(; size <= HWMaxServiceTypeTableSize; size <<= 1)
+	{
+		table = realloc(table, size * sizeof(HWServiceType *));
+		tableMask = size - 1;
+
+		for(seed = 0; seed < 1024; seed++)
+		{
+			memset(table, 0, size * sizeof(HWServiceType *));
+
+			BOOL collision = NO;
+			for(HWServiceType *serviceType in types)
+			{
+				HWNormalizeServiceType(serviceType.type, buffer);
+				uint32_t slot = HWServiceTypeHash(buffer, seed) & tableMask;
+				if(table[slot])
+				{
+					collision = YES;
+					break;
+				}
+				table[slot] = serviceType;
+			}
+
+			if(!collision)
+				return;
+		}
+	}
+
+	// Distinct types shouldn't get here, but if they do the ones that collide go unknown rather than hanging launch
+	NSLog(@"No collision-free service type table up to %d slots, some types won't be recognised", HWMaxServiceTypeTableSize);
+	seed = 0;
+	memset(table, 0, (tableMask + 1) * sizeof(HWServiceType *));
+	for(HWServiceType *serviceType in types)
+	{
+		HWNormalizeServiceType(serviceType.type, buffer);
+		uint32_t slot = HWServiceTypeHash(buffer, seed) & tableMask;
+		if(!table[slot])
+			table[slot] = serviceType;
+	}
+}
+
+- (NSArray *)allTypes
+{
+	return types;
+}
+
+- (HWServiceType *)serviceTypeForType:(NSString *)type
+{
+	char buffer[HWMaxServiceTypeLength];
+	if(!type || !HWNormalizeServiceType(type, buffer))
+		return nil;
+
+	HWServiceType *serviceType = table[HWServiceTypeHash(buffer, seed) & tableMask];
+	if(!serviceType) return nil;
+
+	char known[HWMaxServiceTypeLength];
+	if(!HWNormalizeServiceType(serviceType.type, known) || strcasecmp(buffer, known) != 0)
+		return nil;
+
+	return serviceType;
+}
+
+- (NSString *)nameForType:(NSString *)type
+{
+	HWServiceType *serviceType = [self serviceTypeForType:type];
+	return serviceType ? serviceType.name : type;
+}
+
+@end
@@ -0,0 +1,56 @@
+#import <Cocoa/Cocoa.h>
+
+// Snapshot file format, all integers in network byte order.
+// Header: the magic, uint16 version, uint16 account length, uint32 machine count,
+// then the UTF-8 account.
+//
+// Machine: uint16 guid, hostname, ip and port lengths, uint32 service count, then
+// the four UTF-8 strings and the machine's services.
+//
+// Service: uint16 remote port, uint16 local proxy port, uint16 name length, uint16
+// type length, uint16 TXT length, uint16 reserved, then the UTF-8 name, the UTF-8
+// type and the raw TXT record.
+#define HWSnapshotMagic "HWSN"
+#define HWSnapshotVersion 1
+
+// The last machine list, each machine's services and the local ports they were
+// proxied on, kept on disk so the main window can show something the moment it
+// opens. The file is memory-mapped and parsed once at launch. A file from another
+// version or another account is ignored.
+@interface HWSnapshotCache : NSObject {
+	NSString *account;
+
+	// HWMachine objects
+	NSMutableArray *machines;
+
+	// Hostname -> array of HWServiceEvent
+	NSMutableDictionary *services;
+
+	// Hostname -> (HWServiceEvent key -> NSNumber local port)
+	NSMutableDictionary *localPorts;
+}
+
++ (HWSnapshotCache *)sharedObject;
+
++ (NSString *)snapshotPath;
+
+// YES when the snapshot on disk was written for this account
+- (BOOL)hasSnapshotForAccount:(NSString *)anAccount;
+
+- (NSArray *)machines;
+- (void)setMachines:(NSArray *)cpus;
+
+// Added events for the services last seen on the machine
+- (NSArray *)servicesForHost:(NSString *)hostname;
+- (void)setServices:(NSArray *)events localPorts:(NSDictionary *)ports forHost:(NSString *)hostname;
+
+// The local port the service was proxied on last time, 0 if unknown
+- (int)localPortForService:(NSString *)key onHost:(NSString *)hostname;
+
+- (BOOL)load;
+- (BOOL)save;
+
+// Forgets everything and removes the file, used when the user signs out
+- (void)clear;
+
+@end
@@ -0,0 +1,258 @@
+#import "HWSnapshotCache.h"
+#import "HWMachine.h"
+#import "HWServiceEvent.h"
+
+#define HWSnapshotHeaderLength 12
+#define HWSnapshotMachineLength 12
+#define HWSnapshotServiceLength 12
+
+@interface HWSnapshotCache ()
+- (NSData *)snapshotData;
+@end
+
+// Bounds-checked reads off the mapped file, every one fails once the cursor would pass end
+static BOOL HWSnapshotRead16(const uint8_t **cursor, const uint8_t *end, uint16_t *value)
+{
+	if(end - *cursor < 2) return NO;
+	memcpy(value, *cursor, 2);
+	*value = ntohs(*value);
+	*cursor += 2;
+	return YES;
+}
+
+static BOOL HWSnapshotRead32(const uint8_t **cursor, const uint8_t *end, uint32_t *value)
+{
+	if(end - *cursor < 4) return NO;
+	memcpy(value, *cursor, 4);
+	*value = ntohl(*value);
+	*cursor += 4;
+	return YES;
+}
+
+static NSString *HWSnapshotReadString(const uint8_t **cursor, const uint8_t *end, NSUInteger length)
+{
+	if((NSUInteger)(end - *cursor) < length) return nil;
+	NSString *string = [[NSString alloc] initWithBytes:*cursor length:length encoding:NSUTF8StringEncoding];
+	*cursor += length;
+	return string;
+}
+
+static void HWSnapshotAppend16(NSMutableData *data, NSUInteger value)
+{
+	uint16_t v = htons((uint16_t)value);
+	[data appendBytes:&v length:2];
+}
+
+static void HWSnapshotAppend32(NSMutableData *data, NSUInteger value)
+{
+	uint32_t v = htonl((uint32_t)value);
+	[data appendBytes:&v length:4];
+}
+
+@implementation HWSnapshotCache
+
+static HWSnapshotCache *_sharedObject = nil;
+
+- (id)init
+{
+	[super init];
+	machines = [[NSMutableArray alloc] init];
+	services = [[NSMutableDictionary alloc] init];
+	localPorts = [[NSMutableDictionary alloc] init];
+	[self load];
+	return self;
+}
+
++ (HWSnapshotCache *)sharedObject
+{
+	if(!_sharedObject)
+		_sharedObject = [[self alloc] init];
+	return _sharedObject;
+}
+
++ (NSString *)snapshotPath
+{
+	NSString *dir = [NSHomeDirectory() stringByAppendingPathComponent:@"Library/Caches/Highwire"];
+	[[NSFileManager defaultManager] createDirectoryAtPath:dir withIntermediateDirectories:YES attributes:nil error:nil];
+	return [dir stringByAppendingPathComponent:@"Snapshot.hwsnap"];
+}
+
+- (BOOL)hasSnapshotForAccount:(NSString *)anAccount
+{
+	return [anAccount length] > 0 && [account isEqualToString:anAccount] && [machines count] > 0;
+}
+
+- (NSArray *)machines
+{
+	return machines;
+}
+
+- (void)setMachines:(NSArray *)cpus
+{
+	account = [[[NSUserDefaults standardUserDefaults] valueForKey:@"hwEmail"] copy];
+	[machines setArray:cpus];
+
+	// Services of machines that are gone aren't worth keeping
+	NSMutableSet *hostnames = [NSMutableSet set];
+	for(HWMachine *cpu in cpus)
+		if(cpu.hostname) [hostnames addObject:cpu.hostname];
+	for(NSString *hostname in [services allKeys])
+	{
+		if([hostnames containsObject:hostname]) continue;
+		[services removeObjectForKey:hostname];
+		[localPorts removeObjectForKey:hostname];
+	}
+
+	[self save];
+}
+
+- (NSArray *)servicesForHost:(NSString *)hostname
+{
+	return hostname ? [services objectForKey:hostname] : nil;
+}
+
+- (void)setServices:(NSArray *)events localPorts:(NSDictionary *)ports forHost:(NSString *)hostname
+{
+	if(!hostname) return;
+	[services setObject:[NSArray arrayWithArray:events] forKey:hostname];
+	[localPorts setObject:[NSDictionary dictionaryWithDictionary:ports] forKey:hostname];
+	[self save];
+}
+
+- (int)localPortForService:(NSString *)key onHost:(NSString *)hostname
+{
+	if(!hostname) return 0;
+	return [[[localPorts objectForKey:hostname] objectForKey:key] intValue];
+}
+
+#pragma mark -
+#pragma mark Reading and Writing
+#pragma mark -
+
+- (BOOL)load
+{
+	// Mapped rather than read, only the pages we touch while parsing come off the disk.
+	// -save replaces the file instead of rewriting it, so the mapping never changes under us.
+	NSData *mapped = [NSData dataWithContentsOfFile:[HWSnapshotCache snapshotPath] options:NSMappedRead error:nil];
+	if([mapped length] < HWSnapshotHeaderLength || memcmp([mapped bytes], HWSnapshotMagic, 4) != 0)
+		return NO;
+
+	const uint8_t *cursor = (const uint8_t *)[mapped bytes] + 4;
+	const uint8_t *end = (const uint8_t *)[mapped bytes] + [mapped length];
+
+	uint16_t version, accountLength;
+	uint32_t machineCount;
+	HWSnapshotRead16(&cursor, end, &version);
+	HWSnapshotRead16(&cursor, end, &accountLength);
+	HWSnapshotRead32(&cursor, end, &machineCount);
+	if(version != HWSnapshotVersion)
+		return NO;
+
+	NSString *loadedAccount = HWSnapshotReadString(&cursor, end, accountLength);
+	NSMutableArray *loadedMachines = [NSMutableArray array];
+	NSMutableDictionary *loadedServices = [NSMutableDictionary dictionary];
+	NSMutableDictionary *loadedPorts = [NSMutableDictionary dictionary];
+
+	for(uint32_t m = 0; m < machineCount; m++)
+	{
+		uint16_t lengths[4];
+		uint32_t serviceCount;
+		for(int i = 0; i < 4; i++)
+			if(!HWSnapshotRead16(&cursor, end, &lengths[i])) return NO;
+		if(!HWSnapshotRead32(&cursor, end, &serviceCount)) return NO;
+
+		HWMachine *cpu = [[HWMachine alloc] init];
+		cpu.guid = HWSnapshotReadString(&cursor, end, lengths[0]);
+		cpu.hostname = HWSnapshotReadString(&cursor, end, lengths[1]);
+		cpu.ip = HWSnapshotReadString(&cursor, end, lengths[2]);
+		cpu.port = HWSnapshotReadString(&cursor, end, lengths[3]);
+		if(!cpu.hostname) return NO;
+		[loadedMachines addObject:cpu];
+
+		NSMutableArray *events = [NSMutableArray array];
+		NSMutableDictionary *ports = [NSMutableDictionary dictionary];
+		for(uint32_t s = 0; s < serviceCount; s++)
+		{
+			uint16_t fields[6];
+			for(int i = 0; i < 6; i++)
+				if(!HWSnapshotRead16(&cursor, end, &fields[i])) return NO;
+
+			NSString *name = HWSnapshotReadString(&cursor, end, fields[2]);
+			NSString *type = HWSnapshotReadString(&cursor, end, fields[3]);
+			if(!name || !type || (NSUInteger)(end - cursor) < fields[4]) return NO;
+			NSData *txt = [NSData dataWithBytes:cursor length:fields[4]];
+			cursor += fields[4];
+
+			HWServiceEvent *event = [[HWServiceEvent alloc] initWithKind:HWServiceEventAdded name:name type:type port:fields[0] TXTRecordData:txt];
+			[events addObject:event];
+			if(fields[1])
+				[ports setObject:[NSNumber numberWithInt:fields[1]] forKey:[event key]];
+		}
+		[loadedServices setObject:events forKey:cpu.hostname];
+		[loadedPorts setObject:ports forKey:cpu.hostname];
+	}
+
+	account = loadedAccount;
+	[machines setArray:loadedMachines];
+	[services setDictionary:loadedServices];
+	[localPorts setDictionary:loadedPorts];
+	return YES;
+}
+
+- (NSData *)snapshotData
+{
+	NSData *accountData = [account dataUsingEncoding:NSUTF8StringEncoding];
+	NSMutableData *data = [NSMutableData dataWithBytes:HWSnapshotMagic length:4];
+	HWSnapshotAppend16(data, HWSnapshotVersion);
+	HWSnapshotAppend16(data, [accountData length]);
+	HWSnapshotAppend32(data, [machines count]);
+	[data appendData:accountData];
+
+	for(HWMachine *cpu in machines)
+	{
+		NSArray *strings = [NSArray arrayWithObjects:cpu.guid ? cpu.guid : @"", cpu.hostname ? cpu.hostname : @"",
+							cpu.ip ? cpu.ip : @"", cpu.port ? [cpu.port description] : @"", nil];
+		NSArray *events = [services objectForKey:cpu.hostname];
+		NSDictionary *ports = [localPorts objectForKey:cpu.hostname];
+
+		for(NSString *string in strings)
+			HWSnapshotAppend16(data, [string lengthOfBytesUsingEncoding:NSUTF8StringEncoding]);
+		HWSnapshotAppend32(data, [events count]);
+		for(NSString *string in strings)
+			[data appendData:[string dataUsingEncoding:NSUTF8StringEncoding]];
+
+		for(HWServiceEvent *event in events)
+		{
+			NSData *nameData = [event.name dataUsingEncoding:NSUTF8StringEncoding];
+			NSData *typeData = [event.type dataUsingEncoding:NSUTF8StringEncoding];
+			HWSnapshotAppend16(data, event.port);
+			HWSnapshotAppend16(data, [[ports objectForKey:[event key]] intValue]);
+			HWSnapshotAppend16(data, [nameData length]);
+			HWSnapshotAppend16(data, [typeData length]);
+			HWSnapshotAppend16(data, [event.TXTRecordData length]);
+			HWSnapshotAppend16(data, 0);
+			[data appendData:nameData];
+			[data appendData:typeData];
+			if(event.TXTRecordData)
+				[data appendData:event.TXTRecordData];
+		}
+	}
+	return data;
+}
+
+- (BOOL)save
+{
+	if(!account) return NO;
+	return [[self snapshotData] writeToFile:[HWSnapshotCache snapshotPath] atomically:YES];
+}
+
+- (void)clear
+{
+	account = nil;
+	[machines removeAllObjects];
+	[services removeAllObjects];
+	[localPorts removeAllObjects];
+	[[NSFileManager defaultManager] removeItemAtPath:[HWSnapshotCache snapshotPath] error:nil];
+}
+
+@end
@@ -0,0 +1,13 @@
+#import <Cocoa/Cocoa.h>
+
+// An NSNetService that never touches mDNSResponder. It "resolves" on the next
+// run loop pass to 127.0.0.1 and the given port, so harnesses can push
+// announcements through NetServiceBrowserDelegate as if they came off the LAN.
+@interface HWSyntheticNetService : NSNetService {
+	NSData *syntheticTXTRecord;
+	NSArray *syntheticAddresses;
+}
+
+- (id)initWithName:(NSString *)aName type:(NSString *)aType port:(int)aPort TXTRecordData:(NSData *)txt;
+
+@end
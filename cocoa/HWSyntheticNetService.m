@@ -0,0 +1,75 @@
+#import "HWSyntheticNetService.h"
+#import <sys/socket.h>
+#import <netinet/in.h>
+#import <arpa/inet.h>
+
+@interface HWSyntheticNetService ()
+- (void)finishResolve;
+@end
+
+@implementation HWSyntheticNetService
+
+- (id)initWithName:(NSString *)aName type:(NSString *)aType port:(int)aPort TXTRecordData:(NSData *)txt
+{
+	[super initWithDomain:@"local." type:aType name:aName port:aPort];
+	syntheticTXTRecord = [txt copy];
+
+	struct sockaddr_in addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_len = sizeof(addr);
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	addr.sin_port = htons(aPort);
+	syntheticAddresses = [[NSArray alloc] initWithObjects:[NSData dataWithBytes:&addr length:sizeof(addr)], nil];
+	return self;
+}
+
+- (NSArray *)addresses
+{
+	return syntheticAddresses;
+}
+
+- (NSData *)TXTRecordData
+{
+	return syntheticTXTRecord;
+}
+
+- (BOOL)setTXTRecordData:(NSData *)recordData
+{
+	syntheticTXTRecord = [recordData copy];
+	return YES;
+}
+
+- (NSString *)hostName
+{
+	return @"localhost.";
+}
+
+- (void)resolveWithTimeout:(NSTimeInterval)timeout
+{
+	[self performSelector:@selector(finishResolve) withObject:nil afterDelay:0];
+}
+
+- (void)finishResolve
+{
+	if([[self delegate] respondsToSelector:@selector(netServiceDidResolveAddress:)])
+		[[self delegate] netServiceDidResolveAddress:self];
+}
+
+- (void)publish
+{
+}
+
+- (void)stop
+{
+}
+
+- (void)startMonitoring
+{
+}
+
+- (void)stopMonitoring
+{
+}
+
+@end
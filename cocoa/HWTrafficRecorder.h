@@ -0,0 +1,62 @@
+#import <Cocoa/Cocoa.h>
+
+@class HWServiceType;
+
+// Capture files start with this header followed by a flat list of records.
+// Every record is a 16 byte header in network byte order plus its payload:
+//   uint32 connection, uint8 kind, uint8 pad[3], uint32 microseconds since the previous record, uint32 length
+#define HWCaptureMagic "HWCP"
+#define HWCaptureVersion 1
+
+typedef enum _HWCaptureRecordKind {
+	HWCaptureConnectionOpened = 0,
+	HWCaptureClientData = 1,
+	HWCaptureServerData = 2,
+	HWCaptureConnectionClosed = 3
+} HWCaptureRecordKind;
+
+typedef struct _HWCaptureRecordHeader {
+	uint32_t connection;
+	uint8_t kind;
+	uint8_t pad[3];
+	uint32_t delay;
+	uint32_t length;
+} HWCaptureRecordHeader;
+
+// Sits in front of a forwarded port and relays every connection to the real
+// tunnel endpoint, writing each byte stream and its timing to a capture file.
+// It listens on every interface, as the forward it takes the place of does.
+@interface HWTrafficRecorder : NSObject {
+	int listenPort;
+	int targetPort;
+	int listenSocket;
+	BOOL running;
+
+	NSString *capturePath;
+	FILE *captureFile;
+	NSLock *captureLock;
+	uint32_t nextConnection;
+	struct timeval lastRecordTime;
+
+	// Sockets of the connections being relayed, shut down by stop so their threads end, guarded by captureLock
+	NSMutableSet *relaySockets;
+
+	// When set, relayed sockets get this type's socket profile like the real forward would
+	HWServiceType *serviceType;
+}
+
+@property (nonatomic, retain, readonly) NSString *capturePath;
+@property (nonatomic, retain) HWServiceType *serviceType;
+
+// Directory new capture files are written to (~/Library/Logs/Highwire/Captures)
++ (NSString *)captureDirectory;
+
+// Returns a loopback port that nothing is currently bound to
++ (int)unusedLoopbackPort;
+
+- (id)initWithListenPort:(int)aListenPort targetPort:(int)aTargetPort capturePath:(NSString *)aPath;
+
+- (BOOL)start;
+- (void)stop;
+
+@end
@@ -0,0 +1,253 @@
+#import "HWTrafficRecorder.h"
+#import "HWServiceType.h"
+#import <sys/socket.h>
+#import <sys/time.h>
+#import <netinet/in.h>
+#import <arpa/inet.h>
+#import <unistd.h>
+
+#define HWRelayBufferSize 65536
+
+@interface HWTrafficRecorder ()
+- (void)acceptConnections:(id)unused;
+- (void)relayConnection:(NSArray *)info;
+- (void)writeRecordForConnection:(uint32_t)connection kind:(HWCaptureRecordKind)kind bytes:(const void *)bytes length:(uint32_t)length;
+@end
+
+@implementation HWTrafficRecorder
+
+@synthesize capturePath;
+@synthesize serviceType;
+
++ (NSString *)captureDirectory
+{
+	NSString *dir = [NSHomeDirectory() stringByAppendingPathComponent:@"Library/Logs/Highwire/Captures"];
+	[[NSFileManager defaultManager] createDirectoryAtPath:dir withIntermediateDirectories:YES attributes:nil error:nil];
+	return dir;
+}
+
++ (int)unusedLoopbackPort
+{
+	int s = socket(AF_INET, SOCK_STREAM, 0);
+	if(s < 0) return 0;
+
+	struct sockaddr_in addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_len = sizeof(addr);
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	addr.sin_port = 0;
+
+	int port = 0;
+	socklen_t len = sizeof(addr);
+	if(bind(s, (struct sockaddr *)&addr, sizeof(addr)) == 0 && getsockname(s, (struct sockaddr *)&addr, &len) == 0)
+		port = ntohs(addr.sin_port);
+
+	close(s);
+	return port;
+}
+
+- (id)initWithListenPort:(int)aListenPort targetPort:(int)aTargetPort capturePath:(NSString *)aPath
+{
+	[super init];
+	listenPort = aListenPort;
+	targetPort = aTargetPort;
+	listenSocket = -1;
+	capturePath = [aPath copy];
+	captureLock = [[NSLock alloc] init];
+	relaySockets = [[NSMutableSet alloc] init];
+	return self;
+}
+
+- (BOOL)start
+{
+	captureFile = fopen([capturePath fileSystemRepresentation], "wb");
+	if(!captureFile)
+	{
+		NSLog(@"Unable to open capture file %@", capturePath);
+		return NO;
+	}
+
+	uint16_t header[2] = { htons(HWCaptureVersion), 0 };
+	fwrite(HWCaptureMagic, 1, 4, captureFile);
+	fwrite(header, sizeof(header), 1, captureFile);
+	gettimeofday(&lastRecordTime, NULL);
+
+	listenSocket = socket(AF_INET, SOCK_STREAM, 0);
+	int yes = 1;
+	setsockopt(listenSocket, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes));
+
+	struct sockaddr_in addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_len = sizeof(addr);
+	addr.sin_family = AF_INET;
+	// Every interface, like the ssh -L *:port forward it stands in for, so LAN clients keep working while capturing
+	addr.sin_addr.s_addr = htonl(INADDR_ANY);
+	addr.sin_port = htons(listenPort);
+
+	if(bind(listenSocket, (struct sockaddr *)&addr, sizeof(addr)) != 0 || listen(listenSocket, 16) != 0)
+	{
+		NSLog(@"Unable to listen on port %d for traffic capture", listenPort);
+		close(listenSocket);
+		listenSocket = -1;
+		fclose(captureFile);
+		captureFile = NULL;
+		return NO;
+	}
+
+	running = YES;
+	[NSThread detachNewThreadSelector:@selector(acceptConnections:) toTarget:self withObject:nil];
+	NSLog(@"Capturing traffic on port %d to %@", listenPort, capturePath);
+	return YES;
+}
+
+- (void)stop
+{
+	running = NO;
+	if(listenSocket >= 0)
+	{
+		shutdown(listenSocket, SHUT_RDWR);
+		close(listenSocket);
+		listenSocket = -1;
+	}
+
+	[captureLock lock];
+	// Wakes the relay threads out of select, they close the sockets on their way out
+	for(NSNumber *s in relaySockets)
+		shutdown([s intValue], SHUT_RDWR);
+	if(captureFile)
+	{
+		fclose(captureFile);
+		captureFile = NULL;
+	}
+	[captureLock unlock];
+}
+
+- (void)acceptConnections:(id)unused
+{
+	while(running)
+	{
+		int client = accept(listenSocket, NULL, NULL);
+		if(client < 0) break;
+
+		int server = socket(AF_INET, SOCK_STREAM, 0);
+		struct sockaddr_in addr;
+		memset(&addr, 0, sizeof(addr));
+		addr.sin_len = sizeof(addr);
+		addr.sin_family = AF_INET;
+		addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+		addr.sin_port = htons(targetPort);
+
+		if(connect(server, (struct sockaddr *)&addr, sizeof(addr)) != 0)
+		{
+			close(server);
+			close(client);
+			continue;
+		}
+
+		// A peer hanging up mid-write would otherwise kill the app with SIGPIPE
+		int yes = 1;
+		setsockopt(client, SOL_SOCKET, SO_NOSIGPIPE, &yes, sizeof(yes));
+		setsockopt(server, SOL_SOCKET, SO_NOSIGPIPE, &yes, sizeof(yes));
+
+		[serviceType applySocketProfileToSocket:client];
+		[serviceType applySocketProfileToSocket:server];
+
+		[captureLock lock];
+		uint32_t connection = nextConnection++;
+		[relaySockets addObject:[NSNumber numberWithInt:client]];
+		[relaySockets addObject:[NSNumber numberWithInt:server]];
+		[captureLock unlock];
+
+		NSArray *info = [NSArray arrayWithObjects:[NSNumber numberWithInt:client], [NSNumber numberWithInt:server], [NSNumber numberWithUnsignedInt:connection], nil];
+		[NSThread detachNewThreadSelector:@selector(relayConnection:) toTarget:self withObject:info];
+	}
+}
+
+- (void)relayConnection:(NSArray *)info
+{
+	int client = [[info objectAtIndex:0] intValue];
+	int server = [[info objectAtIndex:1] intValue];
+	uint32_t connection = [[info objectAtIndex:2] unsignedIntValue];
+	char *buffer = malloc(HWRelayBufferSize);
+
+	[self writeRecordForConnection:connection kind:HWCaptureConnectionOpened bytes:NULL length:0];
+
+	BOOL open = YES;
+	while(open && running)
+	{
+		fd_set fds;
+		FD_ZERO(&fds);
+		FD_SET(client, &fds);
+		FD_SET(server, &fds);
+		if(select(MAX(client, server) + 1, &fds, NULL, NULL, NULL) < 0) break;
+
+		int sockets[2] = { client, server };
+		for(int i = 0; i < 2 && open; i++)
+		{
+			if(!FD_ISSET(sockets[i], &fds)) continue;
+
+			ssize_t n = read(sockets[i], buffer, HWRelayBufferSize);
+			if(n <= 0)
+			{
+				open = NO;
+				break;
+			}
+
+			[self writeRecordForConnection:connection kind:(i == 0 ? HWCaptureClientData : HWCaptureServerData) bytes:buffer length:(uint32_t)n];
+
+			ssize_t sent = 0;
+			while(sent < n)
+			{
+				ssize_t w = write(sockets[1 - i], buffer + sent, n - sent);
+				if(w <= 0)
+				{
+					open = NO;
+					break;
+				}
+				sent += w;
+			}
+		}
+	}
+
+	[self writeRecordForConnection:connection kind:HWCaptureConnectionClosed bytes:NULL length:0];
+
+	free(buffer);
+
+	// Out of the set before closing, so stop can't shut down a descriptor that has been reused
+	[captureLock lock];
+	[relaySockets removeObject:[NSNumber numberWithInt:client]];
+	[relaySockets removeObject:[NSNumber numberWithInt:server]];
+	[captureLock unlock];
+	close(client);
+	close(server);
+}
+
+- (void)writeRecordForConnection:(uint32_t)connection kind:(HWCaptureRecordKind)kind bytes:(const void *)bytes length:(uint32_t)length
+{
+	struct timeval now;
+	gettimeofday(&now, NULL);
+
+	[captureLock lock];
+	if(captureFile)
+	{
+		uint64_t delay = (uint64_t)(now.tv_sec - lastRecordTime.tv_sec) * 1000000 + (now.tv_usec - lastRecordTime.tv_usec);
+		lastRecordTime = now;
+
+		HWCaptureRecordHeader header;
+		memset(&header, 0, sizeof(header));
+		header.connection = htonl(connection);
+		header.kind = kind;
+		header.delay = htonl(delay > UINT32_MAX ? UINT32_MAX : (uint32_t)delay);
+		header.length = htonl(length);
+
+		fwrite(&header, sizeof(header), 1, captureFile);
+		if(length > 0)
+			fwrite(bytes, 1, length, captureFile);
+		if(kind == HWCaptureConnectionClosed)
+			fflush(captureFile);
+	}
+	[captureLock unlock];
+}
+
+@end
@@ -0,0 +1,41 @@
+#import <Cocoa/Cocoa.h>
+#import "HWTrafficRecorder.h"
+
+// Drives the client side of a capture file made by HWTrafficRecorder back
+// through a forwarded port, either at the recorded pace or as fast as possible.
+// A local echo or sink stand-in can take the place of the real service.
+@interface HWTrafficReplayer : NSObject {
+	NSString *capturePath;
+
+	// Connection number -> array of record dictionaries (kind, offset, data)
+	NSMutableDictionary *connections;
+
+	int standInSocket;
+	BOOL standInEchoes;
+
+	NSConditionLock *finishedLock;
+	NSLock *statsLock;
+	unsigned long long bytesSent;
+	unsigned long long bytesReceived;
+	unsigned int mismatchedConnections;
+	unsigned int failedConnections;
+}
+
+- (id)initWithCapturePath:(NSString *)aPath;
+
+// Parses the capture file. Returns NO if it is missing or malformed.
+- (BOOL)load;
+
+// Listens on port, echoing every byte back (echo == YES) or discarding it
+- (BOOL)startStandInOnPort:(int)port echo:(BOOL)echo;
+- (void)stopStandIn;
+
+// Replays every recorded connection against port and blocks until all of them finish.
+// Returns a dictionary with connections, bytesSent, bytesReceived, seconds, failed and mismatched keys.
+- (NSDictionary *)replayToPort:(int)port asFastAsPossible:(BOOL)fast;
+
+// Entry point for running a replay from the command line. Reads the HWReplayCapture,
+// HWReplayPort, HWReplayStandInPort, HWReplayStandIn (echo/sink) and HWReplayFast defaults.
++ (int)runWithUserDefaults;
+
+@end
@@ -0,0 +1,336 @@
+#import "HWTrafficReplayer.h"
+#import <sys/socket.h>
+#import <sys/time.h>
+#import <netinet/in.h>
+#import <arpa/inet.h>
+#import <unistd.h>
+#import <fcntl.h>
+
+#define HWReplayBufferSize 65536
+
+static double HWCurrentTime(void)
+{
+	struct timeval now;
+	gettimeofday(&now, NULL);
+	return now.tv_sec + now.tv_usec / 1000000.0;
+}
+
+static int HWListenOnPort(int port)
+{
+	int s = socket(AF_INET, SOCK_STREAM, 0);
+	int yes = 1;
+	setsockopt(s, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes));
+
+	struct sockaddr_in addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_len = sizeof(addr);
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_ANY);
+	addr.sin_port = htons(port);
+
+	if(bind(s, (struct sockaddr *)&addr, sizeof(addr)) != 0 || listen(s, 64) != 0)
+	{
+		close(s);
+		return -1;
+	}
+	return s;
+}
+
+@interface HWTrafficReplayer ()
+- (void)acceptStandInConnections:(id)unused;
+- (void)serveStandInConnection:(NSNumber *)socketNumber;
+- (void)replayConnection:(NSArray *)info;
+@end
+
+@implementation HWTrafficReplayer
+
+- (id)initWithCapturePath:(NSString *)aPath
+{
+	[super init];
+	capturePath = [aPath copy];
+	connections = [[NSMutableDictionary alloc] init];
+	standInSocket = -1;
+	statsLock = [[NSLock alloc] init];
+	return self;
+}
+
+- (BOOL)load
+{
+	NSData *capture = [NSData dataWithContentsOfMappedFile:capturePath];
+	if([capture length] < 8 || memcmp([capture bytes], HWCaptureMagic, 4) != 0)
+		return NO;
+
+	const char *bytes = [capture bytes];
+	if(ntohs(*(uint16_t *)(bytes + 4)) != HWCaptureVersion)
+		return NO;
+
+	[connections removeAllObjects];
+
+	NSUInteger pos = 8;
+	double offset = 0;
+	while(pos + sizeof(HWCaptureRecordHeader) <= [capture length])
+	{
+		HWCaptureRecordHeader header;
+		memcpy(&header, bytes + pos, sizeof(header));
+		pos += sizeof(header);
+
+		uint32_t length = ntohl(header.length);
+		if(pos + length > [capture length])
+			return NO;
+
+		offset += ntohl(header.delay) / 1000000.0;
+
+		NSNumber *key = [NSNumber numberWithUnsignedInt:ntohl(header.connection)];
+		NSMutableArray *records = [connections objectForKey:key];
+		if(!records)
+		{
+			records = [NSMutableArray array];
+			[connections setObject:records forKey:key];
+		}
+
+		NSDictionary *record = [NSDictionary dictionaryWithObjectsAndKeys:[NSNumber numberWithInt:header.kind], @"kind",
+								[NSNumber numberWithDouble:offset], @"offset",
+								[capture subdataWithRange:NSMakeRange(pos, length)], @"data", nil];
+		[records addObject:record];
+		pos += length;
+	}
+
+	return YES;
+}
+
+#pragma mark -
+#pragma mark Stand-in Service
+#pragma mark -
+
+- (BOOL)startStandInOnPort:(int)port echo:(BOOL)echo
+{
+	standInSocket = HWListenOnPort(port);
+	if(standInSocket < 0)
+		return NO;
+
+	standInEchoes = echo;
+	[NSThread detachNewThreadSelector:@selector(acceptStandInConnections:) toTarget:self withObject:nil];
+	return YES;
+}
+
+- (void)stopStandIn
+{
+	if(standInSocket >= 0)
+	{
+		shutdown(standInSocket, SHUT_RDWR);
+		close(standInSocket);
+		standInSocket = -1;
+	}
+}
+
+- (void)acceptStandInConnections:(id)unused
+{
+	int s;
+	while((s = accept(standInSocket, NULL, NULL)) >= 0)
+	{
+		int yes = 1;
+		setsockopt(s, SOL_SOCKET, SO_NOSIGPIPE, &yes, sizeof(yes));
+		[NSThread detachNewThreadSelector:@selector(serveStandInConnection:) toTarget:self withObject:[NSNumber numberWithInt:s]];
+	}
+}
+
+- (void)serveStandInConnection:(NSNumber *)socketNumber
+{
+	int s = [socketNumber intValue];
+	char *buffer = malloc(HWReplayBufferSize);
+
+	ssize_t n;
+	while((n = read(s, buffer, HWReplayBufferSize)) > 0)
+	{
+		if(!standInEchoes) continue;
+
+		ssize_t sent = 0;
+		while(sent < n)
+		{
+			ssize_t w = write(s, buffer + sent, n - sent);
+			if(w <= 0) break;
+			sent += w;
+		}
+	}
+
+	free(buffer);
+	close(s);
+}
+
+#pragma mark -
+#pragma mark Replay
+#pragma mark -
+
+- (NSDictionary *)replayToPort:(int)port asFastAsPossible:(BOOL)fast
+{
+	bytesSent = bytesReceived = 0;
+	mismatchedConnections = failedConnections = 0;
+	finishedLock = [[NSConditionLock alloc] initWithCondition:[connections count]];
+
+	double start = HWCurrentTime();
+	for(NSNumber *key in connections)
+	{
+		NSArray *info = [NSArray arrayWithObjects:[connections objectForKey:key], [NSNumber numberWithInt:port],
+						 [NSNumber numberWithBool:fast], [NSNumber numberWithDouble:start], nil];
+		[NSThread detachNewThreadSelector:@selector(replayConnection:) toTarget:self withObject:info];
+	}
+
+	[finishedLock lockWhenCondition:0];
+	[finishedLock unlock];
+	double elapsed = HWCurrentTime() - start;
+
+	return [NSDictionary dictionaryWithObjectsAndKeys:[NSNumber numberWithUnsignedInt:[connections count]], @"connections",
+			[NSNumber numberWithUnsignedLongLong:bytesSent], @"bytesSent",
+			[NSNumber numberWithUnsignedLongLong:bytesReceived], @"bytesReceived",
+			[NSNumber numberWithDouble:elapsed], @"seconds",
+			[NSNumber numberWithUnsignedInt:failedConnections], @"failed",
+			[NSNumber numberWithUnsignedInt:mismatchedConnections], @"mismatched", nil];
+}
+
+- (void)replayConnection:(NSArray *)info
+{
+	NSArray *records = [info objectAtIndex:0];
+	int port = [[info objectAtIndex:1] intValue];
+	BOOL fast = [[info objectAtIndex:2] boolValue];
+	double start = [[info objectAtIndex:3] doubleValue];
+
+	NSMutableData *sentData = [NSMutableData data];
+	NSMutableData *receivedData = [NSMutableData data];
+	char *buffer = malloc(HWReplayBufferSize);
+	BOOL failed = NO;
+
+	if(!fast && [records count] > 0)
+	{
+		double wait = start + [[[records objectAtIndex:0] objectForKey:@"offset"] doubleValue] - HWCurrentTime();
+		if(wait > 0) usleep(wait * 1000000);
+	}
+
+	int s = socket(AF_INET, SOCK_STREAM, 0);
+	int yes = 1;
+	setsockopt(s, SOL_SOCKET, SO_NOSIGPIPE, &yes, sizeof(yes));
+
+	struct sockaddr_in addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_len = sizeof(addr);
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	addr.sin_port = htons(port);
+
+	if(connect(s, (struct sockaddr *)&addr, sizeof(addr)) != 0)
+		failed = YES;
+	else
+		fcntl(s, F_SETFL, fcntl(s, F_GETFL) | O_NONBLOCK);
+
+	for(NSDictionary *record in records)
+	{
+		if(failed) break;
+		if([[record objectForKey:@"kind"] intValue] != HWCaptureClientData) continue;
+
+		if(!fast)
+		{
+			double wait = start + [[record objectForKey:@"offset"] doubleValue] - HWCurrentTime();
+			if(wait > 0) usleep(wait * 1000000);
+		}
+
+		NSData *data = [record objectForKey:@"data"];
+		const char *bytes = [data bytes];
+		NSUInteger sent = 0;
+		while(sent < [data length] && !failed)
+		{
+			fd_set readFds, writeFds;
+			FD_ZERO(&readFds);
+			FD_ZERO(&writeFds);
+			FD_SET(s, &readFds);
+			FD_SET(s, &writeFds);
+			select(s + 1, &readFds, &writeFds, NULL, NULL);
+
+			// Drain whatever the far side sent back so a full receive window can't stall us
+			if(FD_ISSET(s, &readFds))
+			{
+				ssize_t n = read(s, buffer, HWReplayBufferSize);
+				if(n > 0)
+					[receivedData appendBytes:buffer length:n];
+				else if(n == 0)
+					failed = YES;
+			}
+
+			if(FD_ISSET(s, &writeFds))
+			{
+				ssize_t w = write(s, bytes + sent, [data length] - sent);
+				if(w > 0)
+					sent += w;
+			}
+		}
+		[sentData appendData:data];
+	}
+
+	if(!failed)
+	{
+		// Half-close and collect the rest of the response until the stand-in hangs up
+		shutdown(s, SHUT_WR);
+		fcntl(s, F_SETFL, fcntl(s, F_GETFL) & ~O_NONBLOCK);
+		ssize_t n;
+		while((n = read(s, buffer, HWReplayBufferSize)) > 0)
+			[receivedData appendBytes:buffer length:n];
+	}
+
+	close(s);
+	free(buffer);
+
+	[statsLock lock];
+	bytesSent += [sentData length];
+	bytesReceived += [receivedData length];
+	if(failed)
+		failedConnections++;
+	else if(standInEchoes && ![sentData isEqualToData:receivedData])
+		mismatchedConnections++;
+	[statsLock unlock];
+
+	[finishedLock lock];
+	[finishedLock unlockWithCondition:[finishedLock condition] - 1];
+}
+
+#pragma mark -
+#pragma mark Command Line
+#pragma mark -
+
++ (int)runWithUserDefaults
+{
+	NSUserDefaults *defaults = [NSUserDefaults standardUserDefaults];
+	HWTrafficReplayer *replayer = [[HWTrafficReplayer alloc] initWithCapturePath:[defaults stringForKey:@"HWReplayCapture"]];
+	if(![replayer load])
+	{
+		NSLog(@"Unable to read capture file %@", [defaults stringForKey:@"HWReplayCapture"]);
+		return 1;
+	}
+
+	int standInPort = [defaults integerForKey:@"HWReplayStandInPort"];
+	if(standInPort > 0)
+	{
+		BOOL echo = ![[defaults stringForKey:@"HWReplayStandIn"] isEqualToString:@"sink"];
+		if(![replayer startStandInOnPort:standInPort echo:echo])
+		{
+			NSLog(@"Unable to start stand-in service on port %d", standInPort);
+			return 1;
+		}
+	}
+
+	// Without an explicit port we talk straight to the stand-in, which measures the replay overhead alone
+	int port = [defaults integerForKey:@"HWReplayPort"];
+	if(port <= 0) port = standInPort;
+
+	NSDictionary *results = [replayer replayToPort:port asFastAsPossible:[defaults boolForKey:@"HWReplayFast"]];
+	double seconds = [[results objectForKey:@"seconds"] doubleValue];
+	unsigned long long total = [[results objectForKey:@"bytesSent"] unsignedLongLongValue] + [[results objectForKey:@"bytesReceived"] unsignedLongLongValue];
+
+	NSLog(@"Replayed %@ connections in %.3fs: %@ bytes sent, %@ bytes received, %.1f KB/s, %@ failed, %@ mismatched",
+		  [results objectForKey:@"connections"], seconds,
+		  [results objectForKey:@"bytesSent"], [results objectForKey:@"bytesReceived"],
+		  seconds > 0 ? total / seconds / 1024.0 : 0.0,
+		  [results objectForKey:@"failed"], [results objectForKey:@"mismatched"]);
+
+	[replayer stopStandIn];
+	return [[results objectForKey:@"failed"] intValue] > 0 ? 1 : 0;
+}
+
+@end
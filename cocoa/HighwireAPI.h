@@ -3,6 +3,13 @@
 
 @class ASIHTTPRequest;
 
+// Seconds the server holds a waitForChanges request before answering that nothing changed
+#define HWChangesWaitTimeout 25
+
+// Seconds to wait before asking again after a waitForChanges request fails, doubling up to the maximum
+#define HWChangesMinRetryDelay 2.0
+#define HWChangesMaxRetryDelay 60.0
+
 @interface HighwireAPI : NSObject {
 	id delegate;
 
@@ -12,22 +19,35 @@
 	NSString * errorMessage;
 
 	NSOperationQueue * queue;
+
+	// The long poll for changes: the token from the last answer, and the request waiting now
+	BOOL watchingForChanges;
+	NSString * changeToken;
+	ASIHTTPRequest * changesRequest;
+	NSTimeInterval changesRetryDelay;
 }
 
 @property (nonatomic, retain) id delegate;
 @property (nonatomic, retain) NSString * errorMessage;
 
+// Where API calls go, http://api.highwireapp.com unless overridden
++ (NSString *)baseURL;
++ (void)setBaseURL:(NSString *)url;
+
 - (void)login;
 - (void)loginSucceeded_Callback:(ASIHTTPRequest *)request;
 - (void)loginFailed_Callback:(ASIHTTPRequest *)request;
+- (void)loginResult:(NSDictionary *)dict;
 
 - (void)registerWithEmail:(NSString *)anEmail andPassword:(NSString *)aPassword;
 - (void)registerSucceeded_Callback:(ASIHTTPRequest *)request;
 - (void)registerFailed_Callback:(ASIHTTPRequest *)request;
 
+// The list calls go through HWAPIClient, so a second call while the first
+// is on its way shares its answer
 - (void)refreshListOfMachines;
-- (void)refreshListOfMachinesSucceeded_Callback:(ASIHTTPRequest *)request;
 - (void)refreshListOfMachinesFailed_Callback:(ASIHTTPRequest *)request;
+- (void)listAllMachinesResult:(NSDictionary *)dict;
 
 - (void)addThisMachineWithPort:(int)port;
 - (void)addThisMachineSucceeded_Callback:(ASIHTTPRequest *)request;
@@ -40,8 +60,37 @@
 
 - (void)removeService:(NSNetService *)service;
 
++ (NSDictionary *)recordForService:(NSNetService *)service;
+- (void)syncServicesAdding:(NSArray *)added removing:(NSArray *)removed;
+- (void)syncServicesSucceeded_Callback:(ASIHTTPRequest *)request;
+- (void)syncServicesFailed_Callback:(ASIHTTPRequest *)request;
+
 - (void)listAllServicesForHost:(NSString *)hostname;
-- (void)listAllServicesSucceeded_Callback:(ASIHTTPRequest *)request;
 - (void)listAllServicesFailed_Callback:(ASIHTTPRequest *)request;
+- (void)listAllServicesResult:(NSDictionary *)dict;
+
+// Runs several API methods in one authenticated request. Each call is a
+// dictionary from +callWithMethod:params: and its result is handed to the
+// matching <method>Result: handler, so the delegate hears the same messages
+// it would for separate calls.
++ (NSDictionary *)callWithMethod:(NSString *)method params:(NSDictionary *)params;
+- (void)batch:(NSArray *)calls;
+- (void)batchSucceeded_Callback:(ASIHTTPRequest *)request;
+- (void)batchFailed_Callback:(ASIHTTPRequest *)request;
+
+// Startup in one round trip: refreshListOfMachinesSucceeded: then loginWasSuccessful
+- (void)loginAndRefreshListOfMachines;
+
+// Keeps a waitForChanges request open on the server. When the user's machines
+// change the list is refreshed (refreshListOfMachinesSucceeded:), and when their
+// services change the delegate hears remoteServicesDidChange. Does nothing if
+// already watching. The open request keeps this object alive, so owners must
+// call stopWatchingForChanges before letting it go.
+- (void)watchForChanges;
+- (void)stopWatchingForChanges;
+- (void)waitForChanges;
+- (void)waitForChangesSucceeded_Callback:(ASIHTTPRequest *)request;
+- (void)waitForChangesFailed_Callback:(ASIHTTPRequest *)request;
+- (void)waitForChangesResult:(NSDictionary *)dict;
 
 @end
@@ -5,16 +5,42 @@
 #import "JSON.h"
 #import "HWMachine.h"
 #import "NSData+Base64.h"
+#import "HWHostIdentity.h"
+#import "HWAPIResponseCache.h"
+#import "HWJSONResponseParser.h"
+#import "HWAPIClient.h"
+
+@interface HighwireAPI ()
+- (void)addThisMachineWithPortNumber:(NSNumber *)port;
+- (void)syncServicesWithChanges:(NSArray *)changes;
+@end
 
 @implementation HighwireAPI
 
 @synthesize delegate;
 @synthesize errorMessage;
 
+static NSString *_baseURL = nil;
+
++ (NSString *)baseURL
+{
+	if(_baseURL)
+		return _baseURL;
+
+	// -HWAPIBaseURL http://127.0.0.1:8080 points the app at a local copy of the web service
+	NSString *url = [[NSUserDefaults standardUserDefaults] stringForKey:@"HWAPIBaseURL"];
+	return url ? url : @"http://api.highwireapp.com";
+}
+
++ (void)setBaseURL:(NSString *)url
+{
+	_baseURL = [url copy];
+}
+
 - (id)init
 {
 	[super init];
-	queue = [[NSOperationQueue alloc] init];
+	queue = [[HWAPIClient sharedObject] queue];
 	return self;
 }
 
@@ -27,21 +53,24 @@
 	email = [[NSUserDefaults standardUserDefaults] valueForKey:@"hwEmail"];
 	password = [[NSUserDefaults standardUserDefaults] valueForKey:@"hwPassword"];
 
-	NSString *urlStr = [NSString stringWithFormat:@"http://api.highwireapp.com?method=login&email=%@&password=%@", email, password];
+	NSString *urlStr = [NSString stringWithFormat:@"%@?method=login&email=%@&password=%@", [HighwireAPI baseURL], email, password];
 	NSURL *url = [NSURL URLWithString:urlStr];
 
 	ASIHTTPRequest *request = [ASIHTTPRequest requestWithURL:url];
 	[request setDelegate:self];
 	[request setDidFinishSelector:@selector(loginSucceeded_Callback:)];
+	[request setResponseDataConsumer:[HWJSONResponseParser parser]];
 	[request setDidFailSelector:@selector(loginFailed_Callback:)];
-	[queue addOperation:request];
+	[[HWAPIClient sharedObject] sendRequest:request forMethod:@"login"];
 }
 
 - (void)loginSucceeded_Callback:(ASIHTTPRequest *)request
 {
-	SBJSON *json = [[SBJSON alloc] init];
-	NSDictionary *dict = [json objectWithString:[request responseString]];
+	[self loginResult:[HWJSONResponseParser objectForResponseToRequest:request]];
+}
 
+- (void)loginResult:(NSDictionary *)dict
+{
 	if([dict valueForKey:@"success"])
 		[self.delegate performSelector:@selector(loginWasSuccessful)];
 	else
@@ -63,20 +92,20 @@
 
 - (void)registerWithEmail:(NSString *)anEmail andPassword:(NSString *)aPassword
 {
-	NSString *urlStr = [NSString stringWithFormat:@"http://api.highwireapp.com?method=createAccount&email=%@&password=%@", anEmail, aPassword];
+	NSString *urlStr = [NSString stringWithFormat:@"%@?method=createAccount&email=%@&password=%@", [HighwireAPI baseURL], anEmail, aPassword];
 	NSURL *url = [NSURL URLWithString:urlStr];
 	NSLog(@"URL: %@", urlStr);
 	ASIHTTPRequest *request = [ASIHTTPRequest requestWithURL:url];
 	[request setDelegate:self];
 	[request setDidFinishSelector:@selector(registerSucceeded_Callback:)];
+	[request setResponseDataConsumer:[HWJSONResponseParser parser]];
 	[request setDidFailSelector:@selector(registerFailed_Callback:)];
-	[queue addOperation:request];	
+	[[HWAPIClient sharedObject] sendRequest:request forMethod:@"createAccount"];	
 }
 
 - (void)registerSucceeded_Callback:(ASIHTTPRequest *)request
 {
-	SBJSON *json = [[SBJSON alloc] init];
-	NSDictionary *dict = [json objectWithString:[request responseString]];
+	NSDictionary *dict = [HWJSONResponseParser objectForResponseToRequest:request];
 	
 	if([dict valueForKey:@"success"])
 		[self.delegate performSelector:@selector(registrationWasSuccessful)];
@@ -102,23 +131,27 @@
 	email = [[NSUserDefaults standardUserDefaults] valueForKey:@"hwEmail"];
 	password = [[NSUserDefaults standardUserDefaults] valueForKey:@"hwPassword"];
 	
-	NSString *urlStr = [NSString stringWithFormat:@"http://api.highwireapp.com?method=listAllMachines&email=%@&password=%@", email, password];
+	NSString *urlStr = [NSString stringWithFormat:@"%@?method=listAllMachines&email=%@&password=%@", [HighwireAPI baseURL], email, password];
 	NSURL *url = [NSURL URLWithString:urlStr];
 	
 	ASIHTTPRequest *request = [ASIHTTPRequest requestWithURL:url];
-	[request setDelegate:self];
-	[request setDidFinishSelector:@selector(refreshListOfMachinesSucceeded_Callback:)];
-	[request setDidFailSelector:@selector(refreshListOfMachinesFailed_Callback:)];
-	[queue addOperation:request];	
+	[[HWAPIResponseCache sharedObject] prepareRequest:request forKey:[HWAPIResponseCache keyForMethod:@"listAllMachines" params:nil]];
+	[request setResponseDataConsumer:[HWJSONResponseParser parser]];
+	[[HWAPIClient sharedObject] sendIdempotentRequest:request forMethod:@"listAllMachines" from:self didFailSelector:@selector(refreshListOfMachinesFailed_Callback:)];
 }
 
-- (void)refreshListOfMachinesSucceeded_Callback:(ASIHTTPRequest *)request
+- (void)listAllMachinesResult:(NSDictionary *)dict
 {
-	SBJSON *json = [[SBJSON alloc] init];
-	NSDictionary *dict = [json objectWithString:[request responseString]];
-	
+	// An answer that didn't parse must not pass for an empty list, which would wipe the window and the snapshot
+	if(![dict isKindOfClass:[NSDictionary class]] || [dict valueForKey:@"error"])
+		return;
+	NSArray *cpuDicts = [dict objectForKey:@"cpus"];
+	if(![cpuDicts isKindOfClass:[NSArray class]])
+		return;
+
 	NSMutableArray *cpus = [[NSMutableArray alloc] init];
-	for(NSDictionary *cpuDict in [dict objectForKey:@"cpus"]) {
+	for(NSDictionary *cpuDict in cpuDicts) {
+		if(![cpuDict isKindOfClass:[NSDictionary class]]) continue;
 		HWMachine *cpu = [[HWMachine alloc] init];
 		cpu.guid = [cpuDict objectForKey:@"guid"];
 		cpu.hostname = [cpuDict objectForKey:@"hostname"];
@@ -141,17 +174,29 @@
 
 - (void)addThisMachineWithPort:(int)port
 {
+	// The hostname is the machine's key on the server, so nothing goes out until it's known
+	if(![[HWHostIdentity sharedObject] hostname])
+	{
+		[[HWHostIdentity sharedObject] performSelectorWhenHostnameIsKnown:@selector(addThisMachineWithPortNumber:) target:self object:[NSNumber numberWithInt:port]];
+		return;
+	}
+
 	email = [[NSUserDefaults standardUserDefaults] valueForKey:@"hwEmail"];
 	password = [[NSUserDefaults standardUserDefaults] valueForKey:@"hwPassword"];
 	
-	NSString *urlStr = [NSString stringWithFormat:@"http://api.highwireapp.com?method=addMachine&email=%@&password=%@&hostname=%@&port=%d", email, password, [[NSHost currentHost] name], port];
+	NSString *urlStr = [NSString stringWithFormat:@"%@?method=addMachine&email=%@&password=%@&hostname=%@&port=%d", [HighwireAPI baseURL], email, password, [[HWHostIdentity sharedObject] hostname], port];
 	NSURL *url = [NSURL URLWithString:urlStr];
 
 	ASIHTTPRequest *request = [ASIHTTPRequest requestWithURL:url];
 	[request setDelegate:self];
 	[request setDidFinishSelector:@selector(addThisMachineSucceeded_Callback:)];
 	[request setDidFailSelector:@selector(addThisMachineFailed_Callback:)];
-	[queue addOperation:request];
+	[[HWAPIClient sharedObject] sendRequest:request forMethod:@"addMachine"];
+}
+
+- (void)addThisMachineWithPortNumber:(NSNumber *)port
+{
+	[self addThisMachineWithPort:[port intValue]];
 }
 
 - (void)addThisMachineSucceeded_Callback:(ASIHTTPRequest *)request
@@ -170,17 +215,23 @@
 
 - (void)removeThisMachine
 {
+	if(![[HWHostIdentity sharedObject] hostname])
+	{
+		[[HWHostIdentity sharedObject] performSelectorWhenHostnameIsKnown:@selector(removeThisMachine) target:self object:nil];
+		return;
+	}
+
 	email = [[NSUserDefaults standardUserDefaults] valueForKey:@"hwEmail"];
 	password = [[NSUserDefaults standardUserDefaults] valueForKey:@"hwPassword"];
 	
-	NSString *urlStr = [NSString stringWithFormat:@"http://api.highwireapp.com?method=removeMachine&email=%@&password=%@&hostname=%@", email, password, [[NSHost currentHost] name]];
+	NSString *urlStr = [NSString stringWithFormat:@"%@?method=removeMachine&email=%@&password=%@&hostname=%@", [HighwireAPI baseURL], email, password, [[HWHostIdentity sharedObject] hostname]];
 	NSURL *url = [NSURL URLWithString:urlStr];
 	
 	ASIHTTPRequest *request = [ASIHTTPRequest requestWithURL:url];
 	[request setDelegate:self];
 	[request setDidFinishSelector:@selector(removeThisMachine_Callback:)];
 	[request setDidFailSelector:@selector(removeThisMachine_Callback:)];
-	[queue addOperation:request];
+	[[HWAPIClient sharedObject] sendRequest:request forMethod:@"removeMachine"];
 }
 
 - (void)removeThisMachine_Callback:(ASIHTTPRequest *)request
@@ -194,27 +245,29 @@
 
 - (void)addService:(NSNetService *)service
 {
+	if(![[HWHostIdentity sharedObject] hostname])
+	{
+		[[HWHostIdentity sharedObject] performSelectorWhenHostnameIsKnown:@selector(addService:) target:self object:service];
+		return;
+	}
+
 	email = [[NSUserDefaults standardUserDefaults] valueForKey:@"hwEmail"];
 	password = [[NSUserDefaults standardUserDefaults] valueForKey:@"hwPassword"];
 	
-	NSString *urlStr = [NSString stringWithFormat:@"http://api.highwireapp.com?method=addService&email=%@&password=%@", email, password];
+	NSString *urlStr = [NSString stringWithFormat:@"%@?method=addService&email=%@&password=%@", [HighwireAPI baseURL], email, password];
 	NSURL *url = [NSURL URLWithString:urlStr];
 	
 	NSLog(@"Adding service: %@ %@ %d", [service type], [service name], [service port]);
 
-	NSHost *currentHost = [NSHost currentHost];
-	if(currentHost)
-	{
-		ASIFormDataRequest *request = [ASIFormDataRequest requestWithURL:url];
-		[request setPostValue:[currentHost name] forKey:@"hostname"];
-		[request setPostValue:[[[service type] dataUsingEncoding:NSUTF8StringEncoding] base64EncodedString] forKey:@"type"];
-		[request setPostValue:[[[service name] dataUsingEncoding:NSUTF8StringEncoding] base64EncodedString] forKey:@"name"];
-		[request setPostValue:[[service TXTRecordData] base64EncodedString] forKey:@"txt_record"];
-		[request setPostValue:[NSString stringWithFormat:@"%d", [service port]] forKey:@"port"];
-		
-		[request setDelegate:self];
-		[queue addOperation:request];
-	}
+	ASIFormDataRequest *request = [ASIFormDataRequest requestWithURL:url];
+	[request setPostValue:[[HWHostIdentity sharedObject] hostname] forKey:@"hostname"];
+	[request setPostValue:[[[service type] dataUsingEncoding:NSUTF8StringEncoding] base64EncodedString] forKey:@"type"];
+	[request setPostValue:[[[service name] dataUsingEncoding:NSUTF8StringEncoding] base64EncodedString] forKey:@"name"];
+	[request setPostValue:[[service TXTRecordData] base64EncodedString] forKey:@"txt_record"];
+	[request setPostValue:[NSString stringWithFormat:@"%d", [service port]] forKey:@"port"];
+
+	[request setDelegate:self];
+	[[HWAPIClient sharedObject] sendRequest:request forMethod:@"addService"];
 }
 
 #pragma mark -
@@ -223,19 +276,89 @@
 
 - (void)removeService:(NSNetService *)service
 {
+	if(![[HWHostIdentity sharedObject] hostname])
+	{
+		[[HWHostIdentity sharedObject] performSelectorWhenHostnameIsKnown:@selector(removeService:) target:self object:service];
+		return;
+	}
+
 	email = [[NSUserDefaults standardUserDefaults] valueForKey:@"hwEmail"];
 	password = [[NSUserDefaults standardUserDefaults] valueForKey:@"hwPassword"];
 
-	NSString *urlStr = [NSString stringWithFormat:@"http://api.highwireapp.com?method=removeService&email=%@&password=%@", email, password];
+	NSString *urlStr = [NSString stringWithFormat:@"%@?method=removeService&email=%@&password=%@", [HighwireAPI baseURL], email, password];
 	NSURL *url = [NSURL URLWithString:urlStr];
 	
 	ASIFormDataRequest *request = [ASIFormDataRequest requestWithURL:url];
-	[request setPostValue:[[NSHost currentHost] name] forKey:@"hostname"];
+	[request setPostValue:[[HWHostIdentity sharedObject] hostname] forKey:@"hostname"];
 	[request setPostValue:[[[service type] dataUsingEncoding:NSUTF8StringEncoding] base64EncodedString] forKey:@"type"];
 	[request setPostValue:[[[service name] dataUsingEncoding:NSUTF8StringEncoding] base64EncodedString] forKey:@"name"];
 
 	[request setDelegate:self];
-	[queue addOperation:request];
+	[[HWAPIClient sharedObject] sendRequest:request forMethod:@"removeService"];
+}
+
+#pragma mark -
+#pragma mark Sync Services
+#pragma mark -
+
+// The same base64 fields addService posts, keyed for the syncServices JSON body
++ (NSDictionary *)recordForService:(NSNetService *)service
+{
+	NSData *txt = [service TXTRecordData];
+	return [NSDictionary dictionaryWithObjectsAndKeys:[[[service type] dataUsingEncoding:NSUTF8StringEncoding] base64EncodedString], @"type",
+			[[[service name] dataUsingEncoding:NSUTF8StringEncoding] base64EncodedString], @"name",
+			txt ? [txt base64EncodedString] : @"", @"txt_record",
+			[NSString stringWithFormat:@"%d", [service port]], @"port", nil];
+}
+
+- (void)syncServicesAdding:(NSArray *)added removing:(NSArray *)removed
+{
+	if(![[HWHostIdentity sharedObject] hostname])
+	{
+		[[HWHostIdentity sharedObject] performSelectorWhenHostnameIsKnown:@selector(syncServicesWithChanges:) target:self object:[NSArray arrayWithObjects:added, removed, nil]];
+		return;
+	}
+
+	email = [[NSUserDefaults standardUserDefaults] valueForKey:@"hwEmail"];
+	password = [[NSUserDefaults standardUserDefaults] valueForKey:@"hwPassword"];
+
+	NSString *urlStr = [NSString stringWithFormat:@"%@?method=syncServices&email=%@&password=%@", [HighwireAPI baseURL], email, password];
+	NSURL *url = [NSURL URLWithString:urlStr];
+
+	ASIFormDataRequest *request = [ASIFormDataRequest requestWithURL:url];
+	[request setPostValue:[[HWHostIdentity sharedObject] hostname] forKey:@"hostname"];
+	[request setPostValue:[added JSONRepresentation] forKey:@"added"];
+	[request setPostValue:[removed JSONRepresentation] forKey:@"removed"];
+
+	[request setDelegate:self];
+	[request setDidFinishSelector:@selector(syncServicesSucceeded_Callback:)];
+	[request setResponseDataConsumer:[HWJSONResponseParser parser]];
+	[request setDidFailSelector:@selector(syncServicesFailed_Callback:)];
+	[[HWAPIClient sharedObject] sendRequest:request forMethod:@"syncServices"];
+}
+
+- (void)syncServicesWithChanges:(NSArray *)changes
+{
+	[self syncServicesAdding:[changes objectAtIndex:0] removing:[changes objectAtIndex:1]];
+}
+
+- (void)syncServicesSucceeded_Callback:(ASIHTTPRequest *)request
+{
+	NSDictionary *dict = [HWJSONResponseParser objectForResponseToRequest:request];
+
+	if([dict valueForKey:@"success"])
+		[self.delegate performSelector:@selector(servicesSyncSucceeded)];
+	else
+	{
+		self.errorMessage = [dict valueForKey:@"error"];
+		[self.delegate performSelector:@selector(servicesSyncFailed)];
+	}
+}
+
+- (void)syncServicesFailed_Callback:(ASIHTTPRequest *)request
+{
+	self.errorMessage = @"An unknown error occurred. Please try again.";
+	[self.delegate performSelector:@selector(servicesSyncFailed)];
 }
 
 #pragma mark -
@@ -247,20 +370,19 @@
 	email = [[NSUserDefaults standardUserDefaults] valueForKey:@"hwEmail"];
 	password = [[NSUserDefaults standardUserDefaults] valueForKey:@"hwPassword"];
 
-	NSString *urlStr = [NSString stringWithFormat:@"http://api.highwireapp.com?method=listAllServices&email=%@&password=%@&hostname=%@", email, password, hostname];
+	NSString *urlStr = [NSString stringWithFormat:@"%@?method=listAllServices&email=%@&password=%@&hostname=%@", [HighwireAPI baseURL], email, password, hostname];
 	NSURL *url = [NSURL URLWithString:urlStr];
 	
 	ASIHTTPRequest *request = [ASIHTTPRequest requestWithURL:url];
-	[request setDelegate:self];
-	[request setDidFinishSelector:@selector(listAllServicesSucceeded_Callback:)];
-	[request setDidFailSelector:@selector(listAllServicesFailed_Callback:)];
-	[queue addOperation:request];	
+	[[HWAPIResponseCache sharedObject] prepareRequest:request forKey:[HWAPIResponseCache keyForMethod:@"listAllServices" params:[NSDictionary dictionaryWithObject:hostname forKey:@"hostname"]]];
+	[request setResponseDataConsumer:[HWJSONResponseParser parser]];
+	[[HWAPIClient sharedObject] sendIdempotentRequest:request forMethod:@"listAllServices" from:self didFailSelector:@selector(listAllServicesFailed_Callback:)];
 }
 
-- (void)listAllServicesSucceeded_Callback:(ASIHTTPRequest *)request
+- (void)listAllServicesResult:(NSDictionary *)dict
 {
-	SBJSON *json = [[SBJSON alloc] init];
-	NSDictionary *dict = [json objectWithString:[request responseString]];
+	if([dict valueForKey:@"error"])
+		return;
 
 	[self.delegate performSelector:@selector(listAllServicesSucceeded:) withObject:[dict objectForKey:@"services"]];
 }
@@ -270,4 +392,157 @@
 	
 }
 
+#pragma mark -
+#pragma mark Batch
+#pragma mark -
+
++ (NSDictionary *)callWithMethod:(NSString *)method params:(NSDictionary *)params
+{
+	return [NSDictionary dictionaryWithObjectsAndKeys:method, @"method", params ? params : [NSDictionary dictionary], @"params", nil];
+}
+
+- (void)batch:(NSArray *)calls
+{
+	email = [[NSUserDefaults standardUserDefaults] valueForKey:@"hwEmail"];
+	password = [[NSUserDefaults standardUserDefaults] valueForKey:@"hwPassword"];
+
+	NSString *urlStr = [NSString stringWithFormat:@"%@?method=batch&email=%@&password=%@", [HighwireAPI baseURL], email, password];
+	NSURL *url = [NSURL URLWithString:urlStr];
+
+	ASIFormDataRequest *request = [ASIFormDataRequest requestWithURL:url];
+	[request setPostValue:[calls JSONRepresentation] forKey:@"calls"];
+	[request setUserInfo:[NSDictionary dictionaryWithObject:calls forKey:@"calls"]];
+	[request setResponseDataConsumer:[HWJSONResponseParser parser]];
+
+	[request setDelegate:self];
+	[request setDidFinishSelector:@selector(batchSucceeded_Callback:)];
+	[request setDidFailSelector:@selector(batchFailed_Callback:)];
+	[[HWAPIClient sharedObject] sendRequest:request forMethod:@"batch"];
+}
+
+- (void)batchSucceeded_Callback:(ASIHTTPRequest *)request
+{
+	NSDictionary *dict = [HWJSONResponseParser objectForResponseToRequest:request];
+	NSArray *results = [dict objectForKey:@"results"];
+	NSArray *calls = [[request userInfo] objectForKey:@"calls"];
+
+	// Each result goes to the handler the single call would have used, eg loginResult:.
+	// If the batch itself failed (bad login) every call sees that error.
+	for(NSUInteger i = 0; i < [calls count]; i++)
+	{
+		id result = i < [results count] ? [results objectAtIndex:i] : nil;
+		if(![result isKindOfClass:[NSDictionary class]])
+			result = [dict valueForKey:@"error"] ? dict : [NSDictionary dictionaryWithObject:@"An unknown error occurred. Please try again." forKey:@"error"];
+
+		SEL handler = NSSelectorFromString([NSString stringWithFormat:@"%@Result:", [[calls objectAtIndex:i] objectForKey:@"method"]]);
+		if([self respondsToSelector:handler])
+			[self performSelector:handler withObject:result];
+	}
+}
+
+- (void)batchFailed_Callback:(ASIHTTPRequest *)request
+{
+	NSDictionary *result = [NSDictionary dictionaryWithObject:@"An unknown error occurred. Please try again." forKey:@"error"];
+	for(NSDictionary *call in [[request userInfo] objectForKey:@"calls"])
+	{
+		SEL handler = NSSelectorFromString([NSString stringWithFormat:@"%@Result:", [call objectForKey:@"method"]]);
+		if([self respondsToSelector:handler])
+			[self performSelector:handler withObject:result];
+	}
+}
+
+- (void)loginAndRefreshListOfMachines
+{
+	// Machines first, so the delegate already has them when it hears the login worked
+	[self batch:[NSArray arrayWithObjects:[HighwireAPI callWithMethod:@"listAllMachines" params:nil],
+				 [HighwireAPI callWithMethod:@"login" params:nil], nil]];
+}
+
+#pragma mark -
+#pragma mark Watch for Changes
+#pragma mark -
+
+- (void)watchForChanges
+{
+	// Already watching, or a retry is waiting: either way one request at a time
+	if(watchingForChanges)
+		return;
+
+	watchingForChanges = YES;
+	changesRetryDelay = 0;
+	[self waitForChanges];
+}
+
+- (void)stopWatchingForChanges
+{
+	watchingForChanges = NO;
+	[NSObject cancelPreviousPerformRequestsWithTarget:self selector:@selector(waitForChanges) object:nil];
+	[changesRequest setDelegate:nil];
+	[changesRequest cancel];
+	changesRequest = nil;
+
+	// The next watch may be for another account
+	changeToken = nil;
+}
+
+- (void)waitForChanges
+{
+	if(!watchingForChanges || changesRequest)
+		return;
+
+	email = [[NSUserDefaults standardUserDefaults] valueForKey:@"hwEmail"];
+	password = [[NSUserDefaults standardUserDefaults] valueForKey:@"hwPassword"];
+
+	// Without a token the server answers straight away with one
+	NSMutableString *urlStr = [NSMutableString stringWithFormat:@"%@?method=waitForChanges&email=%@&password=%@&timeout=%d", [HighwireAPI baseURL], email, password, HWChangesWaitTimeout];
+	if(changeToken)
+		[urlStr appendFormat:@"&since=%@", changeToken];
+	NSURL *url = [NSURL URLWithString:urlStr];
+
+	ASIHTTPRequest *request = [ASIHTTPRequest requestWithURL:url];
+	[request setTimeOutSeconds:HWChangesWaitTimeout + 15];
+	[request setDelegate:self];
+	[request setDidFinishSelector:@selector(waitForChangesSucceeded_Callback:)];
+	[request setDidFailSelector:@selector(waitForChangesFailed_Callback:)];
+	changesRequest = request;
+	[queue addOperation:request];
+}
+
+- (void)waitForChangesSucceeded_Callback:(ASIHTTPRequest *)request
+{
+	changesRequest = nil;
+	SBJSON *json = [[SBJSON alloc] init];
+	[self waitForChangesResult:[json objectWithString:[request responseString]]];
+}
+
+- (void)waitForChangesResult:(NSDictionary *)dict
+{
+	if(![dict valueForKey:@"token"])
+	{
+		[self waitForChangesFailed_Callback:nil];
+		return;
+	}
+
+	changesRetryDelay = 0;
+	changeToken = [[dict valueForKey:@"token"] copy];
+
+	if([[dict valueForKey:@"machinesChanged"] boolValue])
+		[self refreshListOfMachines];
+	if([[dict valueForKey:@"servicesChanged"] boolValue] && [self.delegate respondsToSelector:@selector(remoteServicesDidChange)])
+		[self.delegate performSelector:@selector(remoteServicesDidChange)];
+
+	[self waitForChanges];
+}
+
+- (void)waitForChangesFailed_Callback:(ASIHTTPRequest *)request
+{
+	changesRequest = nil;
+	if(!watchingForChanges)
+		return;
+
+	// Back off so a server that's down or turning us away isn't asked again straight away
+	changesRetryDelay = changesRetryDelay ? MIN(changesRetryDelay * 2, HWChangesMaxRetryDelay) : HWChangesMinRetryDelay;
+	[self performSelector:@selector(waitForChanges) withObject:nil afterDelay:changesRetryDelay];
+}
+
 @end
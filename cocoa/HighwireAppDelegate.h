@@ -12,6 +12,10 @@
 }
 
 - (void)showMainWindow;
+- (void)showMainWindowWithMachines:(NSArray *)cpus;
+
+// Swaps the main window for the login window, used when the saved login stops working
+- (void)showLoginWindow;
 - (IBAction)showConnectionsWindow:(id)sender;
 - (IBAction)reopenMainWindow:(id)sender;
 
@@ -20,4 +24,7 @@
 - (IBAction)signOut:(id)sender;
 - (IBAction)toggleStatusItem:(id)sender;
 
+// Writes the API latency histograms to ~/Library/Logs/Highwire and shows a summary of them
+- (IBAction)showAPIDiagnostics:(id)sender;
+
 @end
@@ -1,6 +1,9 @@
 
 #import "HighwireAppDelegate.h"
 #import "HighwireAPI.h"
+#import "HWAPIClient.h"
+#import "HWAPIResponseCache.h"
+#import "HWSnapshotCache.h"
 
 @implementation HighwireAppDelegate
 
@@ -14,16 +17,48 @@
 		[[NSUserDefaults standardUserDefaults] setValue:@"64000" forKey:@"sharePort"];
 	}
 	
+	// Added here rather than in MainMenu so it sits next to Preferences in the application menu
+	NSMenu *appMenu = [[[NSApp mainMenu] itemAtIndex:0] submenu];
+	NSMenuItem *diagnosticsItem = [[NSMenuItem alloc] initWithTitle:@"API Diagnostics..." action:@selector(showAPIDiagnostics:) keyEquivalent:@""];
+	[diagnosticsItem setTarget:self];
+	[appMenu insertItem:diagnosticsItem atIndex:MIN(2, [appMenu numberOfItems])];
+
 	loginController = [[LoginWindowController alloc] initWithWindowNibName:@"LoginWindow"];
-	[loginController showWindow:self];	
+
+	// With a saved login and last session's snapshot the main window opens straight away, logging in behind it
+	NSString *email = [[NSUserDefaults standardUserDefaults] valueForKey:@"hwEmail"];
+	NSString *pw = [[NSUserDefaults standardUserDefaults] valueForKey:@"hwPassword"];
+	if([pw length] > 0 && [[HWSnapshotCache sharedObject] hasSnapshotForAccount:email])
+		[self showMainWindow];
+	else
+		[loginController showWindow:self];	
 }
 
 - (void)showMainWindow
+{
+	[self showMainWindowWithMachines:nil];
+}
+
+- (void)showMainWindowWithMachines:(NSArray *)cpus
 {
 	mainController = [[MainWindowController alloc] initWithWindowNibName:@"MainWindow"];
+	mainController.initialMachines = cpus;
 	[mainController showWindow:self];
 }
 
+- (void)showLoginWindow
+{
+	if(mainController)
+	{
+		[mainController tearDown];
+		[[mainController window] performClose:self];
+		mainController = nil;
+	}
+
+	// The login window tries the saved login again as it opens and reports why it failed
+	[loginController showWindow:self];
+}
+
 - (IBAction)showConnectionsWindow:(id)sender
 {
 	NSWindow *w = [mainController window];
@@ -88,9 +123,12 @@
 {
 	[[NSUserDefaults standardUserDefaults] setValue:@"" forKey:@"hwEmail"];
 	[[NSUserDefaults standardUserDefaults] setValue:@"" forKey:@"hwPassword"];
+	[[HWAPIResponseCache sharedObject] removeAllObjects];
+	[[HWSnapshotCache sharedObject] clear];
 
 	if(mainController)
 	{
+		[mainController tearDown];
 		[[mainController window] performClose:self];
 		mainController = nil;
 	}
@@ -104,4 +142,17 @@
 		[mainController toggleStatusItem:sender];
 }
 
+- (IBAction)showAPIDiagnostics:(id)sender
+{
+	NSString *path = [NSHomeDirectory() stringByAppendingPathComponent:@"Library/Logs/Highwire/APIDiagnostics.json"];
+	BOOL written = [[HWAPIClient sharedObject] writeDiagnosticsToFile:path];
+
+	NSAlert *alert = [[[NSAlert alloc] init] autorelease];
+	[alert addButtonWithTitle:@"Ok"];
+	[alert setMessageText:@"API Diagnostics"];
+	[alert setInformativeText:[NSString stringWithFormat:@"%@\n%@ %@", [[HWAPIClient sharedObject] diagnosticsDescription],
+							   written ? @"Histograms written to" : @"Couldn't write the histograms to", path]];
+	[alert runModal];
+}
+
 @end
@@ -47,4 +47,6 @@
 #import "SBJSON.h"
 #import "NSObject+SBJSON.h"
 #import "NSString+SBJSON.h"
+#import "SBJsonStreamParser.h"
+#import "SBJsonStreamParserAdapter.h"
 
@@ -0,0 +1,74 @@
+/*
+ Push parser for SBJson, fed JSON text a piece at a time.
+ */
+
+#import <Foundation/Foundation.h>
+#import "SBJsonBase.h"
+
+@class SBJsonStreamParser;
+
+/**
+ @brief Events the stream parser reports as it works through its input.
+ 
+ Values are mapped to the same types SBJsonParser uses: strings are NSMutableString,
+ numbers NSDecimalNumber and booleans NSNumber.
+ */
+@protocol SBJsonStreamParserDelegate
+
+- (void)parserFoundObjectStart:(SBJsonStreamParser*)parser;
+- (void)parser:(SBJsonStreamParser*)parser foundObjectKey:(NSString*)key;
+- (void)parserFoundObjectEnd:(SBJsonStreamParser*)parser;
+
+- (void)parserFoundArrayStart:(SBJsonStreamParser*)parser;
+- (void)parserFoundArrayEnd:(SBJsonStreamParser*)parser;
+
+- (void)parser:(SBJsonStreamParser*)parser foundBoolean:(BOOL)x;
+- (void)parserFoundNull:(SBJsonStreamParser*)parser;
+- (void)parser:(SBJsonStreamParser*)parser foundNumber:(NSNumber*)num;
+- (void)parser:(SBJsonStreamParser*)parser foundString:(NSString*)string;
+
+@end
+
+typedef enum {
+    SBJsonStreamParserComplete,
+    SBJsonStreamParserWaitingForData,
+    SBJsonStreamParserError
+} SBJsonStreamParserStatus;
+
+/**
+ @brief A JSON parser that takes its input in chunks.
+ 
+ Each call to -parse: reports whatever events the new bytes complete to the delegate, so a
+ document can be parsed while it's still being downloaded, without ever holding all of its
+ text. A token split between two chunks is kept until the rest of it arrives.
+ 
+ As with -[SBJsonParser objectWithString:], the document must be an object or an array.
+ Once it's complete any further input other than whitespace is an error.
+ */
+@interface SBJsonStreamParser : SBJsonBase {
+    
+@private
+    id<SBJsonStreamParserDelegate> delegate;
+    SBJsonStreamParserStatus status;
+    int state;
+    
+    // '{' or '[' for each container we're inside
+    NSMutableData *containers;
+    
+    // The start of a token that ran past the end of the last chunk
+    NSMutableData *pending;
+}
+
+@property (assign) id<SBJsonStreamParserDelegate> delegate;
+@property (readonly) SBJsonStreamParserStatus status;
+
+/**
+ @brief Parse the next chunk of the document, which should be UTF-8.
+ 
+ Returns SBJsonStreamParserWaitingForData until the document is complete. After an error
+ the parser ignores any more input; errorTrace says what went wrong.
+ */
+- (SBJsonStreamParserStatus)parse:(NSData*)data;
+- (SBJsonStreamParserStatus)parseBytes:(const char*)bytes length:(NSUInteger)length;
+
+@end
@@ -0,0 +1,499 @@
+/*
+ Push parser for SBJson, fed JSON text a piece at a time.
+ */
+
+#import "SBJsonStreamParser.h"
+
+// Where we are in the document, which decides what may come next
+enum {
+    SBStateRoot,                // before the opening { or [
+    SBStateObjectStart,         // after {, a key or }
+    SBStateObjectKey,           // after a comma in an object, a key
+    SBStateObjectColon,
+    SBStateObjectValue,
+    SBStateObjectCommaOrEnd,
+    SBStateArrayStart,          // after [, a value or ]
+    SBStateArrayValue,          // after a comma in an array, a value
+    SBStateArrayCommaOrEnd,
+    SBStateDone
+};
+
+#define isWhitespace(ch) ((ch) == ' ' || (ch) == '\t' || (ch) == '\n' || (ch) == '\r')
+#define isDigit(ch) ((ch) >= '0' && (ch) <= '9')
+
+@interface SBJsonStreamParser ()
+
+- (BOOL)beginValue;
+- (void)endValue;
+
+- (BOOL)openContainer:(char)type;
+- (BOOL)closeContainer:(char)type;
+
+// These return the number of bytes the token took up, 0 if it runs past the end of the input, or -1 on error
+- (NSInteger)scanString:(const char *)c end:(const char *)end;
+- (NSInteger)scanNumber:(const char *)c end:(const char *)end;
+- (NSInteger)scanLiteral:(const char *)c end:(const char *)end;
+
+- (NSMutableString *)stringFrom:(const char *)c to:(const char *)end;
+- (BOOL)appendUTF8From:(const char *)c to:(const char *)end toString:(NSMutableString *)string;
+- (BOOL)scanHexQuad:(const char *)c end:(const char *)end into:(unichar *)x;
+
+@end
+
+
+@implementation SBJsonStreamParser
+
+@synthesize delegate;
+@synthesize status;
+
+- (id)init {
+    self = [super init];
+    if (self) {
+        status = SBJsonStreamParserWaitingForData;
+        state = SBStateRoot;
+        containers = [[NSMutableData alloc] initWithCapacity:16];
+        pending = [[NSMutableData alloc] init];
+    }
+    return self;
+}
+
+- (void)dealloc {
+    [containers release];
+    [pending release];
+    [super dealloc];
+}
+
+- (SBJsonStreamParserStatus)parse:(NSData*)data {
+    return [self parseBytes:[data bytes] length:[data length]];
+}
+
+- (SBJsonStreamParserStatus)parseBytes:(const char*)bytes length:(NSUInteger)length {
+    if (status == SBJsonStreamParserError)
+        return status;
+    
+    // Carry on from a token the last chunk cut short
+    const char *c = bytes;
+    const char *end = bytes + length;
+    if ([pending length]) {
+        [pending appendBytes:bytes length:length];
+        c = [pending bytes];
+        end = c + [pending length];
+    }
+    
+    const char *incomplete = NULL;
+    while (c < end) {
+        if (isWhitespace(*c)) {
+            c++;
+            continue;
+        }
+        
+        if (state == SBStateDone) {
+            [self addErrorWithCode:ETRAILGARBAGE description:@"Garbage after JSON"];
+            status = SBJsonStreamParserError;
+            break;
+        }
+        
+        NSInteger used = 1;
+        switch (*c) {
+            case '{':
+            case '[':
+                if (![self openContainer:*c])
+                    used = -1;
+                break;
+            case '}':
+            case ']':
+                if (![self closeContainer:*c])
+                    used = -1;
+                break;
+            case ',':
+                if (state == SBStateObjectCommaOrEnd) {
+                    state = SBStateObjectKey;
+                } else if (state == SBStateArrayCommaOrEnd) {
+                    state = SBStateArrayValue;
+                } else {
+                    [self addErrorWithCode:EPARSE description:@"Unexpected ','"];
+                    used = -1;
+                }
+                break;
+            case ':':
+                if (state == SBStateObjectColon) {
+                    state = SBStateObjectValue;
+                } else {
+                    [self addErrorWithCode:EPARSE description:@"Unexpected ':'"];
+                    used = -1;
+                }
+                break;
+            case '"':
+                used = [self scanString:c end:end];
+                break;
+            case 't':
+            case 'f':
+            case 'n':
+                used = [self scanLiteral:c end:end];
+                break;
+            case '-':
+            case '0'...'9':
+                used = [self scanNumber:c end:end];
+                break;
+            case '+':
+                [self addErrorWithCode:EPARSENUM description:@"Leading + disallowed in number"];
+                used = -1;
+                break;
+            default:
+                [self addErrorWithCode:EPARSE description:@"Unrecognised leading character"];
+                used = -1;
+                break;
+        }
+        
+        if (used < 0) {
+            status = SBJsonStreamParserError;
+            break;
+        }
+        if (used == 0) {
+            incomplete = c;
+            break;
+        }
+        c += used;
+    }
+    
+    // Keep what there is of the unfinished token for next time
+    if (incomplete && status != SBJsonStreamParserError) {
+        NSData *rest = [NSData dataWithBytes:incomplete length:end - incomplete];
+        [pending setData:rest];
+    } else {
+        [pending setLength:0];
+    }
+    
+    if (status != SBJsonStreamParserError && state == SBStateDone)
+        status = SBJsonStreamParserComplete;
+    return status;
+}
+
+#pragma mark Structure
+
+- (BOOL)beginValue {
+    switch (state) {
+        case SBStateObjectValue:
+        case SBStateArrayStart:
+        case SBStateArrayValue:
+            return YES;
+        case SBStateRoot:
+            [self addErrorWithCode:EFRAGMENT description:@"Valid fragment, but not JSON"];
+            return NO;
+        case SBStateObjectStart:
+        case SBStateObjectKey:
+            [self addErrorWithCode:EPARSE description:@"Object key string expected"];
+            return NO;
+        case SBStateObjectColon:
+            [self addErrorWithCode:EPARSE description:@"Expected ':' separating key and value"];
+            return NO;
+        default:
+            [self addErrorWithCode:EPARSE description:@"Expected ',' or end of container"];
+            return NO;
+    }
+}
+
+- (void)endValue {
+    NSUInteger count = [containers length];
+    if (!count)
+        state = SBStateDone;
+    else if (((const char *)[containers bytes])[count - 1] == '{')
+        state = SBStateObjectCommaOrEnd;
+    else
+        state = SBStateArrayCommaOrEnd;
+}
+
+- (BOOL)openContainer:(char)type {
+    if (state != SBStateRoot && ![self beginValue])
+        return NO;
+    
+    if (maxDepth && [containers length] >= maxDepth) {
+        [self addErrorWithCode:EDEPTH description: @"Nested too deep"];
+        return NO;
+    }
+    
+    [containers appendBytes:&type length:1];
+    if (type == '{') {
+        state = SBStateObjectStart;
+        [delegate parserFoundObjectStart:self];
+    } else {
+        state = SBStateArrayStart;
+        [delegate parserFoundArrayStart:self];
+    }
+    return YES;
+}
+
+- (BOOL)closeContainer:(char)type {
+    if (type == '}') {
+        if (state == SBStateObjectKey) {
+            [self addErrorWithCode:ETRAILCOMMA description: @"Trailing comma disallowed in object"];
+            return NO;
+        }
+        if (state != SBStateObjectStart && state != SBStateObjectCommaOrEnd) {
+            [self addErrorWithCode:EPARSE description:@"Unexpected '}'"];
+            return NO;
+        }
+        [containers setLength:[containers length] - 1];
+        [delegate parserFoundObjectEnd:self];
+        
+    } else {
+        if (state == SBStateArrayValue) {
+            [self addErrorWithCode:ETRAILCOMMA description: @"Trailing comma disallowed in array"];
+            return NO;
+        }
+        if (state != SBStateArrayStart && state != SBStateArrayCommaOrEnd) {
+            [self addErrorWithCode:EPARSE description:@"Unexpected ']'"];
+            return NO;
+        }
+        [containers setLength:[containers length] - 1];
+        [delegate parserFoundArrayEnd:self];
+    }
+    
+    [self endValue];
+    return YES;
+}
+
+#pragma mark Tokens
+
+- (NSInteger)scanString:(const char *)c end:(const char *)end {
+    BOOL isKey = (state == SBStateObjectStart || state == SBStateObjectKey);
+    if (!isKey && ![self beginValue])
+        return -1;
+    
+    // Make sure we have all of it before decoding anything
+    const char *s = c + 1;
+    while (s < end && *s != '"') {
+        if (*s == '\\')
+            s++;
+        s++;
+    }
+    if (s >= end)
+        return 0;
+    
+    NSMutableString *string = [self stringFrom:c + 1 to:s];
+    if (!string)
+        return -1;
+    
+    if (isKey) {
+        [delegate parser:self foundObjectKey:string];
+        state = SBStateObjectColon;
+    } else {
+        [delegate parser:self foundString:string];
+        [self endValue];
+    }
+    return s + 1 - c;
+}
+
+- (NSInteger)scanLiteral:(const char *)c end:(const char *)end {
+    if (![self beginValue])
+        return -1;
+    
+    const char *literal = (*c == 't') ? "true" : (*c == 'f') ? "false" : "null";
+    NSInteger length = strlen(literal);
+    NSInteger available = MIN(length, end - c);
+    if (strncmp(c, literal, available)) {
+        [self addErrorWithCode:EPARSE description:[NSString stringWithFormat:@"Expected '%s'", literal]];
+        return -1;
+    }
+    if (available < length)
+        return 0;
+    
+    if (*c == 'n')
+        [delegate parserFoundNull:self];
+    else
+        [delegate parser:self foundBoolean:(*c == 't')];
+    [self endValue];
+    return length;
+}
+
+- (NSInteger)scanNumber:(const char *)c end:(const char *)end {
+    if (![self beginValue])
+        return -1;
+    
+    // The document is always a container, so something follows every number;
+    // until it arrives we can't tell whether the number is finished
+    const char *ns = c;
+    if ('-' == *c)
+        c++;
+    if (c >= end)
+        return 0;
+    
+    if ('0' == *c) {
+        c++;
+        if (c < end && isDigit(*c)) {
+            [self addErrorWithCode:EPARSENUM description: @"Leading 0 disallowed in number"];
+            return -1;
+        }
+    } else if (!isDigit(*c)) {
+        [self addErrorWithCode:EPARSENUM description: @"No digits after initial minus"];
+        return -1;
+    } else {
+        while (c < end && isDigit(*c))
+            c++;
+    }
+    if (c >= end)
+        return 0;
+    
+    // Fractional part
+    if ('.' == *c) {
+        c++;
+        if (c >= end)
+            return 0;
+        if (!isDigit(*c)) {
+            [self addErrorWithCode:EPARSENUM description: @"No digits after decimal point"];
+            return -1;
+        }
+        while (c < end && isDigit(*c))
+            c++;
+        if (c >= end)
+            return 0;
+    }
+    
+    // Exponential part
+    if ('e' == *c || 'E' == *c) {
+        c++;
+        if (c < end && ('-' == *c || '+' == *c))
+            c++;
+        if (c >= end)
+            return 0;
+        if (!isDigit(*c)) {
+            [self addErrorWithCode:EPARSENUM description: @"No digits after exponent"];
+            return -1;
+        }
+        while (c < end && isDigit(*c))
+            c++;
+        if (c >= end)
+            return 0;
+    }
+    
+    NSString *str = [[NSString alloc] initWithBytesNoCopy:(char*)ns
+                                                   length:c - ns
+                                                 encoding:NSUTF8StringEncoding
+                                             freeWhenDone:NO];
+    NSDecimalNumber *number = [NSDecimalNumber decimalNumberWithString:str];
+    [str release];
+    if (!number) {
+        [self addErrorWithCode:EPARSENUM description: @"Failed creating decimal instance"];
+        return -1;
+    }
+    
+    [delegate parser:self foundNumber:number];
+    [self endValue];
+    return c - ns;
+}
+
+#pragma mark Strings
+
+// Decodes the text between a string's quotes
+- (NSMutableString *)stringFrom:(const char *)c to:(const char *)end {
+    NSMutableString *string = [NSMutableString stringWithCapacity:end - c];
+    const char *run = c;
+    
+    while (c < end) {
+        unsigned char ch = *c;
+        if (ch >= 0x20 && ch != '\\') {
+            c++;
+            continue;
+        }
+        if (ch < 0x20) {
+            [self addErrorWithCode:ECTRL description: [NSString stringWithFormat:@"Unescaped control character '0x%x'", ch]];
+            return nil;
+        }
+        
+        if (![self appendUTF8From:run to:c toString:string])
+            return nil;
+        
+        // scanString: made sure there's at least one character after the backslash
+        unichar chars[2];
+        NSUInteger count = 1;
+        switch (*++c) {
+            case '\\':
+            case '/':
+            case '"':
+                chars[0] = *c;
+                break;
+                
+            case 'b':   chars[0] = '\b';  break;
+            case 'n':   chars[0] = '\n';  break;
+            case 'r':   chars[0] = '\r';  break;
+            case 't':   chars[0] = '\t';  break;
+            case 'f':   chars[0] = '\f';  break;
+                
+            case 'u':
+                if (![self scanHexQuad:c + 1 end:end into:&chars[0]])
+                    return nil;
+                c += 4;
+                
+                if (chars[0] >= 0xd800 && chars[0] < 0xdc00) {
+                    // A high surrogate, the low one must follow
+                    if (!(c + 2 < end && c[1] == '\\' && c[2] == 'u' && [self scanHexQuad:c + 3 end:end into:&chars[1]])) {
+                        [self addErrorWithCode:EUNICODE description: @"Missing low character in surrogate pair"];
+                        return nil;
+                    }
+                    if (chars[1] < 0xdc00 || chars[1] > 0xdfff) {
+                        [self addErrorWithCode:EUNICODE description:@"Invalid low surrogate char"];
+                        return nil;
+                    }
+                    c += 6;
+                    count = 2;
+                    
+                } else if (chars[0] >= 0xdc00 && chars[0] < 0xe000) {
+                    [self addErrorWithCode:EUNICODE description:@"Invalid high character in surrogate pair"];
+                    return nil;
+                }
+                break;
+                
+            default:
+                [self addErrorWithCode:EESCAPE description: [NSString stringWithFormat:@"Illegal escape sequence '0x%x'", (unsigned char)*c]];
+                return nil;
+        }
+        CFStringAppendCharacters((CFMutableStringRef)string, chars, count);
+        run = ++c;
+    }
+    
+    if (![self appendUTF8From:run to:c toString:string])
+        return nil;
+    return string;
+}
+
+- (BOOL)appendUTF8From:(const char *)c to:(const char *)end toString:(NSMutableString *)string {
+    if (end == c)
+        return YES;
+    
+    NSString *t = [[NSString alloc] initWithBytesNoCopy:(char*)c
+                                                 length:end - c
+                                               encoding:NSUTF8StringEncoding
+                                           freeWhenDone:NO];
+    if (!t) {
+        [self addErrorWithCode:EUNICODE description:@"Invalid UTF-8 in string"];
+        return NO;
+    }
+    [string appendString:t];
+    [t release];
+    return YES;
+}
+
+- (BOOL)scanHexQuad:(const char *)c end:(const char *)end into:(unichar *)x {
+    if (end - c < 4) {
+        [self addErrorWithCode:EUNICODE description:@"Missing hex quad"];
+        return NO;
+    }
+    
+    *x = 0;
+    for (int i = 0; i < 4; i++) {
+        unichar uc = c[i];
+        int d = (uc >= '0' && uc <= '9')
+        ? uc - '0' : (uc >= 'a' && uc <= 'f')
+        ? (uc - 'a' + 10) : (uc >= 'A' && uc <= 'F')
+        ? (uc - 'A' + 10) : -1;
+        if (d == -1) {
+            [self addErrorWithCode:EUNICODE description:@"Missing hex digit in quad"];
+            return NO;
+        }
+        *x *= 16;
+        *x += d;
+    }
+    return YES;
+}
+
+@end
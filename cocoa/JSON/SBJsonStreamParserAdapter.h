@@ -0,0 +1,30 @@
+/*
+ Builds objects from the events of an SBJsonStreamParser.
+ */
+
+#import <Foundation/Foundation.h>
+#import "SBJsonStreamParser.h"
+
+/**
+ @brief Delegate for SBJsonStreamParser that builds the document as it's parsed.
+ 
+ Each array and object is filled in as its values arrive, so the result is ready as soon
+ as the last byte has been parsed. The result is the same as -[SBJsonParser objectWithString:]
+ would give for the whole text.
+ */
+@interface SBJsonStreamParserAdapter : NSObject <SBJsonStreamParserDelegate> {
+    
+@private
+    // The containers being filled in, outermost first
+    NSMutableArray *stack;
+    
+    // The key waiting for a value in each object on the stack (NSNull for arrays)
+    NSMutableArray *keyStack;
+    
+    id object;
+}
+
+/// The document, once the parser says it's complete
+@property (readonly) id object;
+
+@end
@@ -0,0 +1,97 @@
+/*
+ Builds objects from the events of an SBJsonStreamParser.
+ */
+
+#import "SBJsonStreamParserAdapter.h"
+
+@interface SBJsonStreamParserAdapter ()
+- (void)addValue:(id)value;
+- (void)pushContainer:(id)container;
+- (void)popContainer;
+@end
+
+
+@implementation SBJsonStreamParserAdapter
+
+@synthesize object;
+
+- (id)init {
+    self = [super init];
+    if (self) {
+        stack = [[NSMutableArray alloc] initWithCapacity:8];
+        keyStack = [[NSMutableArray alloc] initWithCapacity:8];
+    }
+    return self;
+}
+
+- (void)dealloc {
+    [stack release];
+    [keyStack release];
+    [object release];
+    [super dealloc];
+}
+
+- (void)addValue:(id)value {
+    id container = [stack lastObject];
+    if (!container) {
+        [object release];
+        object = [value retain];
+        
+    } else if ([keyStack lastObject] == [NSNull null]) {
+        [container addObject:value];
+        
+    } else {
+        [container setObject:value forKey:[keyStack lastObject]];
+    }
+}
+
+- (void)pushContainer:(id)container {
+    [self addValue:container];
+    [stack addObject:container];
+    [keyStack addObject:[NSNull null]];
+}
+
+- (void)popContainer {
+    [stack removeLastObject];
+    [keyStack removeLastObject];
+}
+
+#pragma mark SBJsonStreamParserDelegate
+
+- (void)parserFoundObjectStart:(SBJsonStreamParser*)parser {
+    [self pushContainer:[NSMutableDictionary dictionaryWithCapacity:7]];
+}
+
+- (void)parser:(SBJsonStreamParser*)parser foundObjectKey:(NSString*)key {
+    [keyStack replaceObjectAtIndex:[keyStack count] - 1 withObject:key];
+}
+
+- (void)parserFoundObjectEnd:(SBJsonStreamParser*)parser {
+    [self popContainer];
+}
+
+- (void)parserFoundArrayStart:(SBJsonStreamParser*)parser {
+    [self pushContainer:[NSMutableArray arrayWithCapacity:8]];
+}
+
+- (void)parserFoundArrayEnd:(SBJsonStreamParser*)parser {
+    [self popContainer];
+}
+
+- (void)parser:(SBJsonStreamParser*)parser foundBoolean:(BOOL)x {
+    [self addValue:[NSNumber numberWithBool:x]];
+}
+
+- (void)parserFoundNull:(SBJsonStreamParser*)parser {
+    [self addValue:[NSNull null]];
+}
+
+- (void)parser:(SBJsonStreamParser*)parser foundNumber:(NSNumber*)num {
+    [self addValue:num];
+}
+
+- (void)parser:(SBJsonStreamParser*)parser foundString:(NSString*)string {
+    [self addValue:string];
+}
+
+@end
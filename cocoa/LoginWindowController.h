@@ -20,6 +20,9 @@
 	IBOutlet NSTextField * txtRegPassword2;
 	
 	HighwireAPI * api;
+
+	// Machine list fetched in the same request as the login, handed to the main window
+	NSArray * machines;
 	
 	// View swapping
 	IBOutlet NSBox * theBox;
@@ -33,6 +36,7 @@
 - (IBAction)loginWasClicked:(id)sender;
 - (void)loginWasSuccessful;
 - (void)loginWasUnsuccessful;
+- (void)refreshListOfMachinesSucceeded:(NSArray *)cpus;
 
 - (IBAction)registerWasClicked:(id)sender;
 - (void)registrationWasSuccessful;
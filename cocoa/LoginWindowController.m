@@ -39,7 +39,8 @@
 	[[NSUserDefaults standardUserDefaults] setValue:[txtEmail stringValue] forKey:@"hwEmail"];
 	[[NSUserDefaults standardUserDefaults] setValue:[txtPassword stringValue] forKey:@"hwPassword"];
 	
-	[api login];
+	machines = nil;
+	[api loginAndRefreshListOfMachines];
 }
 
 - (void)loginWasSuccessful
@@ -51,7 +52,12 @@
 	[txtPassword setEnabled:YES];
 	
 	[[self window] performClose:self];
-	[[NSApp delegate] showMainWindow];
+	[[NSApp delegate] showMainWindowWithMachines:machines];
+}
+
+- (void)refreshListOfMachinesSucceeded:(NSArray *)cpus
+{
+	machines = cpus;
 }
 
 - (void)loginWasUnsuccessful
@@ -6,6 +6,10 @@
 #import "SSHTunnelManager.h"
 
 @class HighwireAPI;
+@class HWMachine;
+@class HWServiceEvent;
+@class HWServiceEventClient;
+@class HWProxiedService;
 
 @interface MainWindowController : NSWindowController {
 	IBOutlet NSArrayController *machines;
@@ -34,6 +38,9 @@
 	IBOutlet NSMenu *statusMenuList;
 	
 	HighwireAPI * api;
+
+	// Machines that came with the login, so awakeFromNib doesn't have to ask again
+	NSArray *initialMachines;
 	
 	int randomPort;
 	
@@ -41,14 +48,26 @@
 
 	// Client
 	NetServiceBrowserDelegate *remoteNSB;
-	NSMutableArray *remoteServicesToPublish;
+	HWMachine *connectedMachine;
+	HWServiceEventClient *serviceEvents;
+
+	// HWServiceEvent key -> HWProxiedService, and the local port the next one gets
+	NSMutableDictionary *proxiedServices;
+	int nextProxyPort;
+
+	// HWServiceEvent key -> the Added event as the remote machine last described it, for the snapshot
+	NSMutableDictionary *remoteServices;
 
 	// Server
 	NSConnection *nsbConnection;
-	NSMutableArray *nsBrowsers;
 }
 
+@property (nonatomic, retain) NSArray *initialMachines;
+
 - (void)refreshListOfMachinesSucceeded:(NSArray *)cpus;
+- (void)showMachines:(NSArray *)cpus;
+- (void)loginWasSuccessful;
+- (void)loginWasUnsuccessful;
 - (void)showShutdownSheet;
 - (IBAction)turnOnSharing:(id)sender;
 - (IBAction)stopSharing:(id)sender;
@@ -70,12 +89,21 @@
 
 - (void)publishBonjourServicesUsingDO;
 
+- (int)proxyPortForService:(NSString *)key;
+- (void)saveServiceSnapshot;
+- (HWProxiedService *)proxyService:(HWServiceEvent *)event;
+- (void)reconcileServices:(NSArray *)events;
+- (void)remoteServicesDidChange;
+
 - (IBAction)purchase:(id)sender;
 - (void)registrationDisconnect;
 - (void)registrationDisconnect_Callback:(NSAlert *)alert returnCode:(NSInteger)returnCode contextInfo:(void *)contextInfo;
 
 - (IBAction)toggleStatusItem:(id)sender;
 
+// Stops watching the API for changes, called before the controller is let go on sign out
+- (void)tearDown;
+
 - (IBAction)showConnections:(id)sender;
 - (IBAction)connectToRemoteMachineWasClicked:(id)sender;
 @end
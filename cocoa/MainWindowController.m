@@ -5,23 +5,62 @@
 #import "COTImageRow.h"
 #import "HighwireAppDelegate.h"
 #import "NSData+Base64.h"
+#import "ServiceDiscovery.h"
+#import "HWProxiedService.h"
+#import "HWServicePublisher.h"
+#import "HWServiceEvent.h"
+#import "HWServiceEventClient.h"
+#import "HWServiceEventServer.h"
+#import "HWSnapshotCache.h"
 
 #import "sys/socket.h"
 #import "netinet/in.h"
+#import "sys/sysctl.h"
+
+// Milliseconds since the process started, for time-to-first-render
+static double HWMillisecondsSinceLaunch(void)
+{
+	struct kinfo_proc info;
+	size_t length = sizeof(info);
+	int mib[4] = { CTL_KERN, KERN_PROC, KERN_PROC_PID, getpid() };
+	if(sysctl(mib, 4, &info, &length, NULL, 0) != 0)
+		return 0;
+
+	struct timeval now;
+	gettimeofday(&now, NULL);
+	struct timeval started = info.kp_proc.p_starttime;
+	return (now.tv_sec - started.tv_sec) * 1000.0 + (now.tv_usec - started.tv_usec) / 1000.0;
+}
 
 @implementation MainWindowController
 
+@synthesize initialMachines;
+
 - (void)awakeFromNib
 {
 	SSHTunnelManager *tm = [SSHTunnelManager sharedObject];
 	tm.delegate = self;
 	
-	remoteServicesToPublish = [[NSMutableArray alloc] init];
-	nsBrowsers = [[NSMutableArray alloc] init];
+	proxiedServices = [[NSMutableDictionary alloc] init];
+	[HWServicePublisher sharedObject].delegate = self;
 	
 	api = [[HighwireAPI alloc] init];
 	api.delegate = self;
-	[api refreshListOfMachines];
+	[api watchForChanges];
+	remoteServices = [[NSMutableDictionary alloc] init];
+	if(initialMachines)
+		[self refreshListOfMachinesSucceeded:initialMachines];
+	else
+	{
+		// Show last session's machines right away and log in behind them
+		NSArray *cached = [[HWSnapshotCache sharedObject] machines];
+		if([cached count] > 0)
+		{
+			[self showMachines:cached];
+			NSLog(@"Machine list rendered from snapshot %.1f ms after launch", HWMillisecondsSinceLaunch());
+		}
+		[api loginAndRefreshListOfMachines];
+	}
 
 	if([[[NSUserDefaults standardUserDefaults] valueForKey:@"shareOnStartup"] boolValue])
 		[self turnOnSharing:self];
@@ -39,9 +78,49 @@
 
 - (void)refreshListOfMachinesSucceeded:(NSArray *)cpus
 {
-	for(HWMachine *cpu in cpus) {
-		[machines addObject:cpu];
+	[self showMachines:cpus];
+	[[HWSnapshotCache sharedObject] setMachines:[machines content]];
+	NSLog(@"Machine list rendered from network %.1f ms after launch", HWMillisecondsSinceLaunch());
+}
+
+- (void)showMachines:(NSArray *)cpus
+{
+	// Machines already listed (eg from the snapshot) are updated in place so the selection and connection state survive
+	NSMutableDictionary *listed = [NSMutableDictionary dictionary];
+	for(HWMachine *cpu in [machines content])
+		if(cpu.hostname) [listed setObject:cpu forKey:cpu.hostname];
+
+	NSMutableSet *seen = [NSMutableSet set];
+	for(HWMachine *cpu in cpus)
+	{
+		if(!cpu.hostname) continue;
+		[seen addObject:cpu.hostname];
+
+		HWMachine *existing = [listed objectForKey:cpu.hostname];
+		if(existing)
+		{
+			if(![existing.guid isEqual:cpu.guid]) existing.guid = cpu.guid;
+			if(![existing.ip isEqual:cpu.ip]) existing.ip = cpu.ip;
+			if(![existing.port isEqual:cpu.port]) existing.port = cpu.port;
+		}
+		else
+			[machines addObject:cpu];
 	}
+
+	for(HWMachine *cpu in [NSArray arrayWithArray:[machines content]])
+		if(![seen containsObject:cpu.hostname] && ![cpu.isConnected boolValue])
+			[machines removeObject:cpu];
+}
+
+- (void)loginWasSuccessful
+{
+}
+
+- (void)loginWasUnsuccessful
+{
+	// The snapshot was shown on the strength of a saved login that no longer works
+	NSLog(@"Saved login failed: %@", api.errorMessage);
+	[[NSApp delegate] showLoginWindow];
 }
 
 - (void)showShutdownSheet
@@ -102,7 +181,8 @@
 	[pm stopBlocking];
 	
 	[nsbConnection invalidate];
-	[nsBrowsers removeAllObjects];
+	[[HWServiceEventServer sharedObject] stop];
+	[[ServiceDiscovery sharedObject] stop];
 	
 	[txtSharingStatus setStringValue:@"Your Mac will be securely shared to other computers running Highwire."];
 	[btnStartSharing setTitle:@"Turn on Sharing"];
@@ -193,48 +273,180 @@
 	[alert setAlertStyle:NSWarningAlertStyle];
 	[alert beginSheetModalForWindow:[self window] modalDelegate:self didEndSelector:nil contextInfo:nil];
 
-	[api listAllServicesForHost:cpu.hostname];
+	// Services arrive as a snapshot and then live changes over the control tunnel.
+	// Machines running an older Highwire don't serve events, so fall back to the web API.
+	connectedMachine = cpu;
+	nextProxyPort = [cpu.port intValue] + 2;
+	[serviceEvents stop];
+	serviceEvents = [[HWServiceEventClient alloc] initWithPort:[cpu.port intValue] + 1];
+	serviceEvents.delegate = self;
+	if(![serviceEvents connect])
+		[self serviceEventClientDidFailToConnect:serviceEvents];
+}
+
+- (void)serviceEventClientDidFailToConnect:(HWServiceEventClient *)client
+{
+	NSLog(@"No service event channel on %@, asking the Highwire service instead", connectedMachine.hostname);
+	serviceEvents = nil;
+
+	// Bring up what the machine shared last time while the web API answers
+	NSArray *cached = [[HWSnapshotCache sharedObject] servicesForHost:connectedMachine.hostname];
+	if([cached count] > 0 && [proxiedServices count] == 0)
+		[self reconcileServices:cached];
+
+	[api listAllServicesForHost:connectedMachine.hostname];
+}
+
+- (void)serviceEventClient:(HWServiceEventClient *)client didReceiveSnapshot:(NSArray *)events
+{
+	[self reconcileServices:events];
+}
+
+- (void)serviceEventClient:(HWServiceEventClient *)client didReceiveEvent:(HWServiceEvent *)event
+{
+	HWProxiedService *proxied = [proxiedServices objectForKey:[event key]];
+
+	if(event.kind == HWServiceEventAdded)
+		[remoteServices setObject:event forKey:[event key]];
+	else if(event.kind == HWServiceEventRemoved)
+		[remoteServices removeObjectForKey:[event key]];
+	else if(event.kind == HWServiceEventTXTChanged && [remoteServices objectForKey:[event key]])
+		[[remoteServices objectForKey:[event key]] setTXTRecordData:event.TXTRecordData];
+
+	if(event.kind == HWServiceEventAdded && !proxied)
+	{
+		proxied = [self proxyService:event];
+		[[HWServicePublisher sharedObject] publishServices:[NSArray arrayWithObject:proxied]];
+	}
+	else if(event.kind == HWServiceEventRemoved && proxied)
+	{
+		[[SSHTunnelManager sharedObject] closeTunnelsForService:proxied];
+		[proxiedServices removeObjectForKey:[event key]];
+	}
+	else if(event.kind == HWServiceEventTXTChanged && proxied)
+	{
+		proxied.TXTRecordData = event.TXTRecordData;
+		[[HWServicePublisher sharedObject] updateTXTRecordForService:proxied];
+	}
+	[self saveServiceSnapshot];
+}
+
+- (void)remoteServicesDidChange
+{
+	// Only needed when there's no service event channel keeping us up to date
+	if(connectedMachine && !serviceEvents)
+		[api listAllServicesForHost:connectedMachine.hostname];
 }
 
 - (void)listAllServicesSucceeded:(NSArray *)services
 {	
-	HWMachine *cpu = [[machines arrangedObjects] objectAtIndex:[machines selectionIndex]];
-
-	int p = [cpu.port intValue] + 2;
-	
-	// Re-publish each service locally
+	NSMutableArray *events = [NSMutableArray array];
 	for(NSDictionary *service in services)
 	{
 		NSString *name = [[NSString alloc] initWithData:[NSData dataFromBase64String:[service valueForKey:@"name"]] encoding:NSUTF8StringEncoding];
 		NSString *type = [[NSString alloc] initWithData:[NSData dataFromBase64String:[service valueForKey:@"type"]] encoding:NSUTF8StringEncoding];
 		int foreignPort = [[service valueForKey:@"port"] intValue];
 		NSLog(@"SERVICE: %@, %@, %d", name, type, foreignPort);
-		
-		NSNetService *aService = [[NSNetService alloc] initWithDomain:@"" type:type name:[NSString stringWithFormat:@"%@ (Highwire)", name] port:p];
-		[aService setTXTRecordData:[NSData dataFromBase64String:[service valueForKey:@"txt_record"]]];
-		[aService setDelegate:self];
-		[aService publish];
-		[remoteServicesToPublish addObject:aService];
-		
-		NSDictionary *userInfo = [NSDictionary dictionaryWithObjectsAndKeys:aService, @"service", nil];
-		
-		// Create an ssh tunnel for each service
-		SSHTunnelManager *tm = [SSHTunnelManager sharedObject];
-		[tm createTunnelToHost:cpu.ip
-				 fromLocalPort:p
-				 toForeignPort:foreignPort
-				   throughPort:[cpu.port intValue]
-				  withUsername:[txtRemoteUsername stringValue]
-				   andPassword:[txtRemotePassword stringValue]
-					  userInfo:userInfo];
-		
-		p++;
-	}	
 
-	// Connect to our nsb object and retrieve list of available services
-	// NSSocketPort *port = [[NSSocketPort alloc] initRemoteWithTCPPort:([cpu.port intValue] + 1) host:@"127.0.0.1"];
-	// NSConnection *connection = [NSConnection connectionWithReceivePort:nil sendPort:port];
-	// remoteNSB = (NetServiceBrowserDelegate *)[connection rootProxy];
+		[events addObject:[[HWServiceEvent alloc] initWithKind:HWServiceEventAdded
+														  name:name
+														  type:type
+														  port:foreignPort
+												 TXTRecordData:[NSData dataFromBase64String:[service valueForKey:@"txt_record"]]]];
+	}
+	[self reconcileServices:events];
+}
+
+- (int)proxyPortForService:(NSString *)key
+{
+	NSMutableSet *used = [NSMutableSet set];
+	for(HWProxiedService *proxied in [proxiedServices allValues])
+		[used addObject:[NSNumber numberWithInt:proxied.port]];
+
+	// Same local port as last time, so anything pointed at it keeps working
+	int p = [[HWSnapshotCache sharedObject] localPortForService:key onHost:connectedMachine.hostname];
+	if(p <= 0 || [used containsObject:[NSNumber numberWithInt:p]])
+	{
+		do
+			p = nextProxyPort++;
+		while([used containsObject:[NSNumber numberWithInt:p]]);
+	}
+	return p;
+}
+
+- (void)saveServiceSnapshot
+{
+	NSMutableDictionary *ports = [NSMutableDictionary dictionary];
+	for(NSString *key in proxiedServices)
+		[ports setObject:[NSNumber numberWithInt:[[proxiedServices objectForKey:key] port]] forKey:key];
+	[[HWSnapshotCache sharedObject] setServices:[remoteServices allValues] localPorts:ports forHost:connectedMachine.hostname];
+}
+
+- (HWProxiedService *)proxyService:(HWServiceEvent *)event
+{
+	int p = [self proxyPortForService:[event key]];
+	HWProxiedService *aService = [[HWProxiedService alloc] initWithName:[NSString stringWithFormat:@"%@ (Highwire)", event.name]
+																   type:event.type
+																   port:p
+														  TXTRecordData:event.TXTRecordData];
+	[proxiedServices setObject:aService forKey:[event key]];
+
+	NSDictionary *userInfo = [NSDictionary dictionaryWithObjectsAndKeys:aService, @"service", nil];
+	
+	// Create an ssh tunnel for each service
+	SSHTunnelManager *tm = [SSHTunnelManager sharedObject];
+	[tm createTunnelToHost:connectedMachine.ip
+			 fromLocalPort:p
+			 toForeignPort:event.port
+			   throughPort:[connectedMachine.port intValue]
+			  withUsername:[txtRemoteUsername stringValue]
+			   andPassword:[txtRemotePassword stringValue]
+				  userInfo:userInfo];
+	return aService;
+}
+
+- (void)reconcileServices:(NSArray *)events
+{
+	NSMutableSet *current = [NSMutableSet set];
+	NSMutableArray *added = [NSMutableArray array];
+
+	[remoteServices removeAllObjects];
+	for(HWServiceEvent *event in events)
+	{
+		[current addObject:[event key]];
+		[remoteServices setObject:event forKey:[event key]];
+		HWProxiedService *proxied = [proxiedServices objectForKey:[event key]];
+		if(!proxied)
+			[added addObject:[self proxyService:event]];
+		else if(![proxied.TXTRecordData isEqualToData:event.TXTRecordData])
+		{
+			proxied.TXTRecordData = event.TXTRecordData;
+			[[HWServicePublisher sharedObject] updateTXTRecordForService:proxied];
+		}
+	}
+
+	// Whatever went away while we weren't listening
+	for(NSString *key in [proxiedServices allKeys])
+	{
+		if([current containsObject:key]) continue;
+		[[SSHTunnelManager sharedObject] closeTunnelsForService:[proxiedServices objectForKey:key]];
+		[proxiedServices removeObjectForKey:key];
+	}
+
+	// All of the machine's services go to mDNSResponder over one shared connection
+	[[HWServicePublisher sharedObject] publishServices:added];
+	[self saveServiceSnapshot];
+}
+
+- (void)servicePublisher:(HWServicePublisher *)publisher didPublishBatch:(NSArray *)services inTime:(NSTimeInterval)seconds
+{
+	for(HWProxiedService *service in services)
+	{
+		if(service.error != kDNSServiceErr_NoError || !service.registeredName)
+			NSLog(@"Unable to publish %@ (%@): %d", service.name, service.type, service.error);
+		else if(![service.registeredName isEqualToString:service.name])
+			NSLog(@"%@ (%@) conflicted with a local service and was published as %@", service.name, service.type, service.registeredName);
+	}
 }
 
 - (void)initialConnectionFailed
@@ -262,17 +474,11 @@
 
 - (void)publishBonjourServicesUsingDO
 {
-	NetServiceBrowserDelegate *nsb = [NetServiceBrowserDelegate sharedObject];
+	// Browse only the service types that actually exist on the LAN
+	[[ServiceDiscovery sharedObject] start];
 
-	// Load our list of known Bonjour services
-	NSArray *plist = [NSArray arrayWithContentsOfFile:[[NSBundle mainBundle] pathForResource:@"Services" ofType:@"plist"]];
-	for(NSDictionary *service in plist)
-	{
-		NSNetServiceBrowser *nsBrowser = [[NSNetServiceBrowser alloc] init];
-		[nsBrowser setDelegate:nsb];
-		[nsBrowser searchForServicesOfType:[service objectForKey:@"Service"] inDomain:@""];
-		[nsBrowsers addObject:nsBrowser];
-	}
+	// Connected clients follow service changes through their control tunnel to randomPort + 1
+	[[HWServiceEventServer sharedObject] startOnPort:randomPort + 1];
 }
 
 #pragma mark -
@@ -422,6 +628,11 @@
 		[btnRemoteLogin setEnabled:NO];
 }
 
+- (void)tearDown
+{
+	[api stopWatchingForChanges];
+}
+
 - (IBAction)toggleStatusItem:(id)sender
 {
 	if([[NSUserDefaults standardUserDefaults] boolForKey:@"showStatusIcon"])
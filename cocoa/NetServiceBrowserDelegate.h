@@ -1,10 +1,22 @@
 
 #import <Cocoa/Cocoa.h>
 
+// At most this many NSNetService resolves run at once, the rest wait in resolveQueue
+#define HWMaxConcurrentResolves 4
+
+// How long a resolved address / TXT record is trusted before a re-announcement resolves again
+#define HWResolvedRecordTTL 120.0
+
 @interface NetServiceBrowserDelegate : NSObject {
     // Keeps track of available services	
     NSMutableArray *services;
-	NSMutableArray *pendingServices;
+
+	// Resolve pipeline: services waiting for a slot, and those currently resolving
+	NSMutableArray *resolveQueue;
+	NSMutableArray *resolvingServices;
+
+	// Service key (name/type/domain) -> dictionary with the resolved service and when it resolved
+	NSMutableDictionary *resolvedCache;
 
     // Keeps track of search status
     BOOL searching;
@@ -21,6 +33,23 @@
 
 - (NSMutableArray *)services;
 
+// Drops every service of the type as if each had been removed, for when its browser is stopped
+// and won't report their removals any more
+- (void)removeServicesOfType:(NSString *)type;
+
+// Resolve pipeline
++ (NSString *)keyForService:(NSNetService *)aNetService;
+- (void)enqueueResolve:(NSNetService *)aNetService;
+- (void)startQueuedResolves;
+- (void)finishResolve:(NSNetService *)sender;
+- (void)serviceDidResolve:(NSNetService *)sender;
+- (void)netService:(NSNetService *)sender didUpdateTXTRecordData:(NSData *)data;
+
 // Other methods
 - (void)handleError:(NSNumber *)error;
 @end
+
+@interface NSData (Additions)
+- (int)port;
+- (NSString *)host;
+@end
@@ -1,6 +1,8 @@
 
 #import "NetServiceBrowserDelegate.h"
-#import "HighwireAPI.h"
+#import "HWHostIdentity.h"
+#import "HWServiceSync.h"
+#import "HWServiceEventServer.h"
 #import <sys/socket.h>
 #import <netinet/in.h>
 
@@ -12,7 +14,9 @@ static NetServiceBrowserDelegate *_sharedObject = nil;
 {
     self = [super init];
     services = [[NSMutableArray alloc] init];
-    pendingServices = [[NSMutableArray alloc] init];
+    resolveQueue = [[NSMutableArray alloc] init];
+    resolvingServices = [[NSMutableArray alloc] init];
+    resolvedCache = [[NSMutableDictionary alloc] init];
     searching = NO;
     return self;
 }
@@ -46,14 +50,34 @@ static NetServiceBrowserDelegate *_sharedObject = nil;
 	NSRange range = [[aNetService type] rangeOfString:@"_udp."];
 	if(range.location != NSNotFound) return;
 	
-	[aNetService setDelegate:self];
-	[aNetService resolveWithTimeout:10.0];
-	[pendingServices addObject:aNetService];
+	[self enqueueResolve:aNetService];
 }
 
 - (void)netServiceBrowser:(NSNetServiceBrowser *)browser didRemoveService:(NSNetService *)aNetService moreComing:(BOOL)moreComing
 {
-    [services removeObject:aNetService];
+	NSString *key = [NetServiceBrowserDelegate keyForService:aNetService];
+
+	for(NSNetService *queued in [[resolveQueue copy] autorelease])
+		if([[NetServiceBrowserDelegate keyForService:queued] isEqualToString:key])
+			[resolveQueue removeObject:queued];
+
+	// Called off before it can finish, or it would be added back once it resolved
+	for(NSNetService *resolving in [[resolvingServices copy] autorelease])
+		if([[NetServiceBrowserDelegate keyForService:resolving] isEqualToString:key])
+			[self finishResolve:resolving];
+
+	[resolvedCache removeObjectForKey:key];
+
+	for(NSNetService *shared in [[services copy] autorelease])
+	{
+		if([[NetServiceBrowserDelegate keyForService:shared] isEqualToString:key])
+		{
+			[shared stopMonitoring];
+			[[HWServiceSync sharedObject] serviceWasRemoved:shared];
+			[[HWServiceEventServer sharedObject] serviceWasRemoved:shared];
+			[services removeObject:shared];
+		}
+	}
 }
 
 - (NSMutableArray *)services
@@ -61,32 +85,115 @@ static NetServiceBrowserDelegate *_sharedObject = nil;
 	return services;
 }
 
+- (void)removeServicesOfType:(NSString *)type
+{
+	NSMutableArray *known = [NSMutableArray arrayWithArray:services];
+	[known addObjectsFromArray:resolveQueue];
+	[known addObjectsFromArray:resolvingServices];
+	for(NSDictionary *cached in [resolvedCache allValues])
+		[known addObject:[cached objectForKey:@"service"]];
+
+	for(NSNetService *service in known)
+		if([[service type] isEqualToString:type])
+			[self netServiceBrowser:nil didRemoveService:service moreComing:NO];
+}
+
 - (void)handleError:(NSNumber *)error
 {
 
 }
 
-- (void)netServiceDidResolveAddress:(NSNetService *)sender
+#pragma mark -
+#pragma mark Resolve Pipeline
+#pragma mark -
+
++ (NSString *)keyForService:(NSNetService *)aNetService
+{
+	return [NSString stringWithFormat:@"%@|%@|%@", [aNetService name], [aNetService type], [aNetService domain]];
+}
+
+- (void)enqueueResolve:(NSNetService *)aNetService
 {
-	BOOL isLocal = NO;
-	for(NSData *addr in [sender addresses])
+	NSString *key = [NetServiceBrowserDelegate keyForService:aNetService];
+
+	// A fresh cached resolve answers a re-announcement without touching the network
+	NSDictionary *cached = [resolvedCache objectForKey:key];
+	if(cached && -[[cached objectForKey:@"date"] timeIntervalSinceNow] < HWResolvedRecordTTL)
 	{
-		for(NSString *addr2 in [[NSHost currentHost] addresses])
-		{
-			if([[addr host] isEqualToString:addr2])
-			{
-				isLocal = YES;
-			}
-		}
+		NSNetService *resolved = [cached objectForKey:@"service"];
+		if(![services containsObject:resolved])
+			[self serviceDidResolve:resolved];
+		return;
 	}
-	
-	if(!isLocal) return;
+	[resolvedCache removeObjectForKey:key];
+
+	// Drop duplicates of an instance that is already queued or resolving
+	for(NSNetService *pending in [resolveQueue arrayByAddingObjectsFromArray:resolvingServices])
+		if([[NetServiceBrowserDelegate keyForService:pending] isEqualToString:key])
+			return;
+
+	[resolveQueue addObject:aNetService];
+	[self startQueuedResolves];
+}
+
+- (void)startQueuedResolves
+{
+	while([resolvingServices count] < HWMaxConcurrentResolves && [resolveQueue count] > 0)
+	{
+		NSNetService *aNetService = [resolveQueue objectAtIndex:0];
+		[resolvingServices addObject:aNetService];
+		[resolveQueue removeObjectAtIndex:0];
+
+		[aNetService setDelegate:self];
+		[aNetService resolveWithTimeout:10.0];
+	}
+}
+
+- (void)finishResolve:(NSNetService *)sender
+{
+	[sender stop];
+	[resolvingServices removeObject:sender];
+	[self startQueuedResolves];
+}
+
+- (void)netService:(NSNetService *)sender didNotResolve:(NSDictionary *)errorDict
+{
+	// Covers the resolve timeout as well as outright errors
+	[self finishResolve:sender];
+}
+
+- (void)netServiceDidResolveAddress:(NSNetService *)sender
+{
+	// Services are reported once per address, only the first one matters to us
+	if(![resolvingServices containsObject:sender]) return;
+
+	[resolvedCache setObject:[NSDictionary dictionaryWithObjectsAndKeys:sender, @"service", [NSDate date], @"date", nil]
+					  forKey:[NetServiceBrowserDelegate keyForService:sender]];
+	[self finishResolve:sender];
+	[self serviceDidResolve:sender];
+}
+
+- (void)serviceDidResolve:(NSNetService *)sender
+{
+	if(![[HWHostIdentity sharedObject] containsAnyAddress:[sender addresses]]) return;
 
 	NSLog(@"ADDING HW SERVICE: (%@) (%@)", [sender hostName], [sender type]);
 	
 	[services addObject:sender];
-	HighwireAPI *api = [[HighwireAPI alloc] init];
-	[api addService:sender];
+	[[HWServiceSync sharedObject] serviceWasAdded:sender];
+	[[HWServiceEventServer sharedObject] serviceWasAdded:sender];
+
+	// Keep watching the TXT record so connected clients see changes live
+	[sender setDelegate:self];
+	[sender startMonitoring];
+}
+
+- (void)netService:(NSNetService *)sender didUpdateTXTRecordData:(NSData *)data
+{
+	if(![services containsObject:sender]) return;
+
+	[[HWServiceSync sharedObject] serviceWasAdded:sender];
+	[[HWServiceEventServer sharedObject] serviceDidUpdateTXTRecord:sender];
 }
 
 @end
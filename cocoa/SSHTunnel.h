@@ -1,6 +1,7 @@
 
 #import <Cocoa/Cocoa.h>
 
+@class HWTrafficRecorder;
 
 @interface SSHTunnel : NSObject {
 	NSTask *theTask;
@@ -10,6 +11,9 @@
 	int theLocalPort;
 	BOOL isConnected;
 	BOOL canRelaunch;
+
+	// Set when the captureTraffic default is on, relays the forwarded port through a capture file
+	HWTrafficRecorder *recorder;
 }
 
 - (void)createTunnelToHost:(NSString *)host
@@ -1,5 +1,8 @@
 
 #import "SSHTunnel.h"
+#import "HWTrafficRecorder.h"
+#import "HWServiceTypeRegistry.h"
+#import "HWProxiedService.h"
 
 @implementation SSHTunnel
 
@@ -23,7 +26,28 @@
 	
 	[[NSNotificationCenter defaultCenter] postNotification:[NSNotification notificationWithName:@"TUNNEL_STATUS_DID_CHANGE" object:nil]];
 	
-	NSString *cmd = [NSString stringWithFormat:@"ssh %@ -L *:%i:127.0.0.1:%i -l %@ -p %i", host, localPort, foreignPort, username, port];
+	// When capturing, ssh listens on a private loopback port and the recorder takes over the public one
+	NSString *bindAddress = @"*";
+	int sshLocalPort = localPort;
+	HWProxiedService *service = [theUserInfo valueForKey:@"service"];
+	if(service && [[NSUserDefaults standardUserDefaults] boolForKey:@"captureTraffic"])
+	{
+		NSString *fileName = [NSString stringWithFormat:@"%@%d-%.0f.hwcap", [service type], localPort, [[NSDate date] timeIntervalSince1970]];
+		int capturePort = [HWTrafficRecorder unusedLoopbackPort];
+		recorder = [[HWTrafficRecorder alloc] initWithListenPort:localPort
+													  targetPort:capturePort
+													 capturePath:[[HWTrafficRecorder captureDirectory] stringByAppendingPathComponent:fileName]];
+		recorder.serviceType = [[HWServiceTypeRegistry sharedRegistry] serviceTypeForType:[service type]];
+		if(capturePort > 0 && [recorder start])
+		{
+			bindAddress = @"127.0.0.1";
+			sshLocalPort = capturePort;
+		}
+		else
+			recorder = nil;
+	}
+
+	NSString *cmd = [NSString stringWithFormat:@"ssh %@ -L %@:%i:127.0.0.1:%i -l %@ -p %i", host, bindAddress, sshLocalPort, foreignPort, username, port];
 	
 	theTask = [[NSTask alloc] init];
 	thePipe = [[NSPipe alloc] init];
@@ -162,7 +186,7 @@
 {
 	canRelaunch = YES;
 	[self relaunchTask];
-	NSNetService *aService = [userInfo valueForKey:@"service"];
+	HWProxiedService *aService = [userInfo valueForKey:@"service"];
 	if(aService) [aService publish];
 }
 
@@ -170,8 +194,9 @@
 {
 	canRelaunch = NO;
 	[theTask terminate];
+	[recorder stop];
 
-	NSNetService *aService = [userInfo valueForKey:@"service"];
+	HWProxiedService *aService = [userInfo valueForKey:@"service"];
 	if(aService) [aService stop];
 }
 
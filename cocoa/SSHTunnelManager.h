@@ -20,6 +20,7 @@
 				  userInfo:(NSDictionary *)theUserInfo;
 
 - (void)closeAllTunnels;
+- (void)closeTunnelsForService:(id)service;
 - (NSArray *)tunnels;
 
 @end
@@ -45,6 +45,17 @@ static SSHTunnelManager *_sharedObject = nil;
 	}
 }
 
+- (void)closeTunnelsForService:(id)service
+{
+	for(SSHTunnel *tunnel in [[tunnels copy] autorelease])
+	{
+		if([[tunnel userInfo] valueForKey:@"service"] != service) continue;
+		[tunnel terminate];
+		[tunnels removeObject:tunnel];
+	}
+	[[NSNotificationCenter defaultCenter] postNotification:[NSNotification notificationWithName:@"TUNNEL_STATUS_DID_CHANGE" object:nil]];
+}
+
 - (NSArray *)tunnels
 {
 	return tunnels;
@@ -0,0 +1,25 @@
+#import <Cocoa/Cocoa.h>
+
+// Enumerates the service types present on the LAN with a single
+// _services._dns-sd._udp browse, then starts one browser per type that
+// passes the allow/deny lists. Found services go to NetServiceBrowserDelegate.
+@interface ServiceDiscovery : NSObject {
+	NSNetServiceBrowser *typeBrowser;
+
+	// Service type (eg _daap._tcp.) -> NSNetServiceBrowser
+	NSMutableDictionary *serviceBrowsers;
+}
+
++ (ServiceDiscovery *)sharedObject;
+
+- (void)start;
+- (void)stop;
+
+// Types seen on the LAN that are currently being browsed
+- (NSArray *)browsedTypes;
+
+// Checks a type against the serviceTypeAllowList / serviceTypeDenyList defaults.
+// An empty allow list permits every TCP type that isn't denied.
+- (BOOL)shouldBrowseType:(NSString *)type;
+
+@end
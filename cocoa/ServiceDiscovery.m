@@ -0,0 +1,117 @@
+#import "ServiceDiscovery.h"
+#import "NetServiceBrowserDelegate.h"
+
+@implementation ServiceDiscovery
+
+static ServiceDiscovery *_sharedObject = nil;
+
++ (void)initialize
+{
+	if(self == [ServiceDiscovery class])
+	{
+		// Services that either can't be forwarded usefully or are already how we get in
+		NSArray *deny = [NSArray arrayWithObjects:@"_ssh._tcp.", @"_sftp-ssh._tcp.", @"_workstation._tcp.", @"_device-info._tcp.", nil];
+		[[NSUserDefaults standardUserDefaults] registerDefaults:[NSDictionary dictionaryWithObjectsAndKeys:[NSArray array], @"serviceTypeAllowList",
+																 deny, @"serviceTypeDenyList", nil]];
+	}
+}
+
+- (id)init
+{
+	[super init];
+	serviceBrowsers = [[NSMutableDictionary alloc] init];
+	return self;
+}
+
++ (ServiceDiscovery *)sharedObject
+{
+	if(!_sharedObject)
+		_sharedObject = [[self alloc] init];
+	return _sharedObject;
+}
+
+- (void)start
+{
+	if(typeBrowser) return;
+
+	typeBrowser = [[NSNetServiceBrowser alloc] init];
+	[typeBrowser setDelegate:self];
+	[typeBrowser searchForServicesOfType:@"_services._dns-sd._udp." inDomain:@""];
+}
+
+- (void)stop
+{
+	[typeBrowser stop];
+	typeBrowser = nil;
+
+	// Stopped browsers report no more removals, so their services go now
+	for(NSString *type in [serviceBrowsers allKeys])
+	{
+		[[NetServiceBrowserDelegate sharedObject] removeServicesOfType:type];
+		[[serviceBrowsers objectForKey:type] stop];
+	}
+	[serviceBrowsers removeAllObjects];
+}
+
+- (NSArray *)browsedTypes
+{
+	return [serviceBrowsers allKeys];
+}
+
+- (BOOL)shouldBrowseType:(NSString *)type
+{
+	// Only TCP services can be carried over an ssh tunnel
+	if([type rangeOfString:@"._tcp."].location == NSNotFound)
+		return NO;
+
+	NSUserDefaults *defaults = [NSUserDefaults standardUserDefaults];
+	if([[defaults arrayForKey:@"serviceTypeDenyList"] containsObject:type])
+		return NO;
+
+	NSArray *allow = [defaults arrayForKey:@"serviceTypeAllowList"];
+	return [allow count] == 0 || [allow containsObject:type];
+}
+
+#pragma mark -
+#pragma mark NSNetServiceBrowser Delegate
+#pragma mark -
+
+// The meta-query answers with name = "_daap" and type = "_tcp.local."
+- (NSString *)serviceTypeForTypeRecord:(NSNetService *)record
+{
+	NSArray *parts = [[record type] componentsSeparatedByString:@"."];
+	return [NSString stringWithFormat:@"%@.%@.", [record name], [parts objectAtIndex:0]];
+}
+
+- (void)netServiceBrowser:(NSNetServiceBrowser *)browser didFindService:(NSNetService *)aNetService moreComing:(BOOL)moreComing
+{
+	NSString *type = [self serviceTypeForTypeRecord:aNetService];
+	if([serviceBrowsers objectForKey:type] || ![self shouldBrowseType:type])
+		return;
+
+	NSNetServiceBrowser *nsBrowser = [[NSNetServiceBrowser alloc] init];
+	[nsBrowser setDelegate:[NetServiceBrowserDelegate sharedObject]];
+	[nsBrowser searchForServicesOfType:type inDomain:@""];
+	[serviceBrowsers setObject:nsBrowser forKey:type];
+}
+
+- (void)netServiceBrowser:(NSNetServiceBrowser *)browser didRemoveService:(NSNetService *)aNetService moreComing:(BOOL)moreComing
+{
+	NSString *type = [self serviceTypeForTypeRecord:aNetService];
+	NSNetServiceBrowser *nsBrowser = [serviceBrowsers objectForKey:type];
+	if(nsBrowser)
+	{
+		// A stopped browser reports nothing more, so its services go now rather than never
+		[[NetServiceBrowserDelegate sharedObject] removeServicesOfType:type];
+		[nsBrowser stop];
+		[serviceBrowsers removeObjectForKey:type];
+	}
+}
+
+- (void)netServiceBrowser:(NSNetServiceBrowser *)browser didNotSearch:(NSDictionary *)errorDict
+{
+	NSLog(@"Service type browse failed: %@", errorDict);
+	typeBrowser = nil;
+}
+
+@end
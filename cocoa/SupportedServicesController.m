@@ -1,5 +1,6 @@
 
 #import "SupportedServicesController.h"
+#import "HWServiceTypeRegistry.h"
 
 
 @implementation SupportedServicesController
@@ -7,7 +8,7 @@
 - (id)init
 {
 	[super init];
-	services = [NSArray arrayWithContentsOfFile:[[NSBundle mainBundle] pathForResource:@"Services" ofType:@"plist"]];
+	services = [[HWServiceTypeRegistry sharedRegistry] allTypes];
 	return self;
 }
 
@@ -18,12 +19,12 @@
 
 - (id)tableView:(NSTableView *)aTableView objectValueForTableColumn:(NSTableColumn *)aTableColumn row:(int)rowIndex
 {
-	NSDictionary *service = [services objectAtIndex:rowIndex];
+	HWServiceType *service = [services objectAtIndex:rowIndex];
 	
 	if([[aTableColumn identifier] isEqualToString:@"name"])
-		return [service valueForKey:@"Name"];
+		return service.name;
 	else
-		return [service valueForKey:@"Service"];
+		return service.type;
 }
 
 @end
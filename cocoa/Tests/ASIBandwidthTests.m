@@ -0,0 +1,125 @@
+#import <SenTestingKit/SenTestingKit.h>
+#import "ASIHTTPRequest.h"
+#import "HWMockAPIServer.h"
+#import "HWTrafficRecorder.h"
+
+// Threads updating the bandwidth counters at once, and the updates each makes
+#define HWBandwidthTestThreads 8
+#define HWBandwidthTestUpdates 125
+
+// The accounting every read and write goes through, and throttling built on it.
+// These share ASIHTTPRequest's global counters, so each test leaves throttling off.
+@interface ASIBandwidthTests : SenTestCase
+{
+	NSConditionLock *threadsDone;
+	int outstanding;
+	int failures;
+}
+
+- (void)useBandwidth:(id)unused;
+
+@end
+
+@implementation ASIBandwidthTests
+
+- (void)tearDown
+{
+	[ASIHTTPRequest setMaxBandwidthPerSecond:0];
+}
+
+- (void)useBandwidth:(id)unused
+{
+	NSAutoreleasePool *pool = [[NSAutoreleasePool alloc] init];
+	for(int i = 0; i < HWBandwidthTestUpdates; i++)
+		[ASIHTTPRequest incrementBandwidthUsedInLastSecond:1000];
+
+	[threadsDone lock];
+	[threadsDone unlockWithCondition:[threadsDone condition] + 1];
+	[pool drain];
+}
+
+- (void)testConcurrentUsageIsAllCounted
+{
+	// Exactly the bucket's worth of bytes, spread over threads racing each other
+	unsigned long limit = HWBandwidthTestThreads * HWBandwidthTestUpdates * 1000;
+	[ASIHTTPRequest setMaxBandwidthPerSecond:limit];
+	STAssertEquals([ASIHTTPRequest maxUploadReadLength], limit / 4, @"A full bucket allows a quarter of the limit per read");
+
+	threadsDone = [[NSConditionLock alloc] initWithCondition:0];
+	for(int i = 0; i < HWBandwidthTestThreads; i++)
+		[NSThread detachNewThreadSelector:@selector(useBandwidth:) toTarget:self withObject:nil];
+	[threadsDone lockWhenCondition:HWBandwidthTestThreads];
+	[threadsDone unlock];
+
+	// Only what refilled while the threads ran is left; a lost update would leave a lot more
+	STAssertTrue([ASIHTTPRequest maxUploadReadLength] < limit / 10, @"%lu bytes left in the bucket", [ASIHTTPRequest maxUploadReadLength]);
+}
+
+- (void)testAverageCoversTheLastFewSeconds
+{
+	// Line up with the start of a second, so the bytes land in one period
+	[ASIHTTPRequest averageBandwidthUsedPerSecond];
+	CFAbsoluteTime now = CFAbsoluteTimeGetCurrent();
+	[NSThread sleepForTimeInterval:ceil(now) - now + 0.01];
+	[ASIHTTPRequest averageBandwidthUsedPerSecond];
+
+	[ASIHTTPRequest incrementBandwidthUsedInLastSecond:400000];
+	[NSThread sleepForTimeInterval:1.0];
+	STAssertTrue([ASIHTTPRequest averageBandwidthUsedPerSecond] >= 200000, @"The latest second carries half the weight");
+
+	// Seconds nobody closed still count, as nothing used
+	[NSThread sleepForTimeInterval:6.0];
+	STAssertEquals([ASIHTTPRequest averageBandwidthUsedPerSecond], (unsigned long)0, nil);
+}
+
+- (void)testThrottledDownloadsShareTheLimit
+{
+	HWMockAPIServer *mockAPI = [[HWMockAPIServer alloc] initWithPort:[HWTrafficRecorder unusedLoopbackPort]];
+	STAssertTrue([mockAPI start], nil);
+
+	NSMutableString *json = [NSMutableString stringWithString:@"{\"data\":\""];
+	while([json length] < 32 * 1024)
+		[json appendString:@"0123456789abcdef"];
+	[json appendString:@"\"}"];
+	[mockAPI setResponse:json forMethod:@"download"];
+
+	// Four 32 KB downloads against 64 KB/s: the full bucket covers half, the rest needs a second of refills
+	[ASIHTTPRequest setMaxBandwidthPerSecond:64 * 1024];
+	NSOperationQueue *queue = [[NSOperationQueue alloc] init];
+	outstanding = 4;
+	failures = 0;
+	for(int i = 0; i < 4; i++)
+	{
+		ASIHTTPRequest *request = [ASIHTTPRequest requestWithURL:[NSURL URLWithString:[NSString stringWithFormat:@"%@?method=download&n=%d", [mockAPI baseURL], i]]];
+		[request setDelegate:self];
+		[request setDidFinishSelector:@selector(requestFinished:)];
+		[request setDidFailSelector:@selector(requestFailed:)];
+		[queue addOperation:request];
+	}
+
+	NSDate *start = [NSDate date];
+	NSDate *deadline = [NSDate dateWithTimeIntervalSinceNow:10.0];
+	while(outstanding > 0 && [deadline timeIntervalSinceNow] > 0)
+		[[NSRunLoop currentRunLoop] runMode:NSDefaultRunLoopMode beforeDate:[NSDate dateWithTimeIntervalSinceNow:0.05]];
+	NSTimeInterval elapsed = -[start timeIntervalSinceNow];
+
+	STAssertEquals(outstanding, 0, @"Throttled downloads never finished");
+	STAssertEquals(failures, 0, nil);
+	STAssertTrue(elapsed > 0.75, @"128 KB at 64 KB/s took only %.2fs", elapsed);
+
+	[queue cancelAllOperations];
+	[mockAPI stop];
+}
+
+- (void)requestFinished:(ASIHTTPRequest *)request
+{
+	outstanding--;
+}
+
+- (void)requestFailed:(ASIHTTPRequest *)request
+{
+	failures++;
+	outstanding--;
+}
+
+@end
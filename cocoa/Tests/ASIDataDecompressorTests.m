@@ -0,0 +1,169 @@
+#import <SenTestingKit/SenTestingKit.h>
+#import "ASIDataDecompressor.h"
+#import "ASIHTTPRequest.h"
+#import "HWMockAPIServer.h"
+#import "HWTrafficRecorder.h"
+
+// Seconds any one download waits before the test fails
+#define HWInflateTestTimeout 10.0
+
+// Inflating gzipped data a piece at a time, directly and as responses arrive
+// from a mock API that gzips what it sends.
+@interface ASIDataDecompressorTests : SenTestCase
+{
+	NSData *original;
+	NSData *compressed;
+	int outstanding;
+	int failures;
+}
+
+- (NSData *)inflate:(NSData *)data inPiecesOf:(NSUInteger)pieceLength intoBuffersOf:(NSUInteger)bufferLength error:(NSError **)err;
+- (void)assertDownloadToFile:(BOOL)toFile waitingToInflate:(BOOL)waitToInflate;
+
+@end
+
+@implementation ASIDataDecompressorTests
+
+- (void)setUp
+{
+	// Large enough to take several reads, and varied enough not to shrink to nothing
+	NSMutableString *json = [NSMutableString stringWithString:@"{\"success\":true,\"machines\":["];
+	for(int i = 0; i < 5000; i++)
+		[json appendFormat:@"%@{\"id\":%d,\"name\":\"machine-%d\"}", i ? @"," : @"", i, i * 7919 % 100000];
+	[json appendString:@"]}"];
+
+	original = [json dataUsingEncoding:NSUTF8StringEncoding];
+	compressed = [ASIHTTPRequest compressData:original];
+}
+
+#pragma mark -
+#pragma mark Helpers
+#pragma mark -
+
+- (NSData *)inflate:(NSData *)data inPiecesOf:(NSUInteger)pieceLength intoBuffersOf:(NSUInteger)bufferLength error:(NSError **)err
+{
+	ASIDataDecompressor *decompressor = [ASIDataDecompressor decompressor];
+	NSMutableData *inflated = [NSMutableData data];
+	NSMutableData *buffer = [NSMutableData dataWithLength:bufferLength];
+
+	for(NSUInteger offset = 0; offset < [data length]; offset += pieceLength)
+	{
+		[decompressor setInput:(const char *)[data bytes] + offset length:MIN(pieceLength, [data length] - offset)];
+		while([decompressor hasPendingOutput])
+		{
+			NSInteger length = [decompressor inflateIntoBuffer:[buffer mutableBytes] length:bufferLength error:err];
+			if(length < 0)
+				return nil;
+			[inflated appendBytes:[buffer bytes] length:length];
+		}
+	}
+	return [decompressor finished] ? inflated : nil;
+}
+
+- (void)assertDownloadToFile:(BOOL)toFile waitingToInflate:(BOOL)waitToInflate
+{
+	HWMockAPIServer *mockAPI = [[HWMockAPIServer alloc] initWithPort:[HWTrafficRecorder unusedLoopbackPort]];
+	mockAPI.compressesResponses = YES;
+	STAssertTrue([mockAPI start], @"The mock API couldn't start");
+	[mockAPI setResponse:[[NSString alloc] initWithData:original encoding:NSUTF8StringEncoding] forMethod:@"inflate"];
+
+	NSString *path = [NSTemporaryDirectory() stringByAppendingPathComponent:[[NSProcessInfo processInfo] globallyUniqueString]];
+	ASIHTTPRequest *request = [ASIHTTPRequest requestWithURL:[NSURL URLWithString:[NSString stringWithFormat:@"%@?method=inflate", [mockAPI baseURL]]]];
+	[request setShouldWaitToInflateCompressedResponses:waitToInflate];
+	if(toFile)
+		[request setDownloadDestinationPath:path];
+	[request setDelegate:self];
+	[request setDidFinishSelector:@selector(requestFinished:)];
+	[request setDidFailSelector:@selector(requestFailed:)];
+
+	outstanding = 1;
+	failures = 0;
+	[request startAsynchronous];
+	NSDate *deadline = [NSDate dateWithTimeIntervalSinceNow:HWInflateTestTimeout];
+	while(outstanding > 0 && [deadline timeIntervalSinceNow] > 0)
+		[[NSRunLoop currentRunLoop] runMode:NSDefaultRunLoopMode beforeDate:[NSDate dateWithTimeIntervalSinceNow:0.05]];
+
+	STAssertEquals(outstanding, 0, @"The download never finished");
+	STAssertEquals(failures, 0, @"%@", [[request error] localizedDescription]);
+	STAssertTrue([request isResponseCompressed], @"The mock API should have gzipped the response");
+	if(toFile)
+		STAssertEqualObjects([NSData dataWithContentsOfFile:path], original, nil);
+	else
+		STAssertEqualObjects([request responseData], original, nil);
+
+	[[NSFileManager defaultManager] removeItemAtPath:path error:NULL];
+	[mockAPI stop];
+}
+
+- (void)requestFinished:(ASIHTTPRequest *)request
+{
+	outstanding--;
+}
+
+- (void)requestFailed:(ASIHTTPRequest *)request
+{
+	failures++;
+	outstanding--;
+}
+
+#pragma mark -
+#pragma mark Decompressor
+#pragma mark -
+
+- (void)testInflatesWholeInput
+{
+	STAssertTrue([compressed length] < [original length], nil);
+	STAssertEqualObjects([self inflate:compressed inPiecesOf:[compressed length] intoBuffersOf:[original length] error:NULL], original, nil);
+}
+
+- (void)testInflatesInSmallPieces
+{
+	// Small input pieces and a small output buffer, so zlib often holds output back between calls
+	STAssertEqualObjects([self inflate:compressed inPiecesOf:7 intoBuffersOf:100 error:NULL], original, nil);
+	STAssertEqualObjects([self inflate:compressed inPiecesOf:1 intoBuffersOf:4096 error:NULL], original, nil);
+	STAssertEqualObjects([self inflate:compressed inPiecesOf:4096 intoBuffersOf:1 error:NULL], original, nil);
+}
+
+- (void)testTruncatedStreamNeverFinishes
+{
+	NSData *truncated = [compressed subdataWithRange:NSMakeRange(0, [compressed length] - 4)];
+	NSError *error = nil;
+	STAssertNil([self inflate:truncated inPiecesOf:512 intoBuffersOf:4096 error:&error], @"A stream without its trailer isn't complete");
+	STAssertNil(error, @"Running out of input isn't corruption");
+}
+
+- (void)testCorruptStreamFails
+{
+	NSMutableData *corrupt = [NSMutableData dataWithData:compressed];
+	memset((char *)[corrupt mutableBytes] + 10, 0xff, 16);
+
+	NSError *error = nil;
+	STAssertNil([self inflate:corrupt inPiecesOf:512 intoBuffersOf:4096 error:&error], nil);
+	STAssertEquals([error code], (NSInteger)ASICompressionError, nil);
+}
+
+#pragma mark -
+#pragma mark Compressed Responses
+#pragma mark -
+
+- (void)testInflatesAsReceivedToMemory
+{
+	[self assertDownloadToFile:NO waitingToInflate:NO];
+}
+
+- (void)testInflatesAsReceivedToFile
+{
+	[self assertDownloadToFile:YES waitingToInflate:NO];
+}
+
+- (void)testInflatesAfterDownloadToMemory
+{
+	[self assertDownloadToFile:NO waitingToInflate:YES];
+}
+
+- (void)testInflatesAfterDownloadToFile
+{
+	[self assertDownloadToFile:YES waitingToInflate:YES];
+}
+
+@end
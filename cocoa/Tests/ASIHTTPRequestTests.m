@@ -0,0 +1,163 @@
+#import <SenTestingKit/SenTestingKit.h>
+#import "ASIHTTPRequest.h"
+#import "HWMockAPIServer.h"
+#import "HWTrafficRecorder.h"
+
+// Seconds any one test waits for its requests before failing
+#define HWRequestTestTimeout 10.0
+
+// Requests against a mock API on a loopback port, driven from the main run
+// loop the way the app drives them.
+@interface ASIHTTPRequestTests : SenTestCase
+{
+	HWMockAPIServer *mockAPI;
+	NSMutableArray *finished;
+	NSMutableArray *failed;
+	BOOL calledOffMainThread;
+}
+
+- (ASIHTTPRequest *)requestForMethod:(NSString *)method;
+- (BOOL)runUntilDone:(NSUInteger)count;
+
+@end
+
+@implementation ASIHTTPRequestTests
+
+- (void)setUp
+{
+	mockAPI = [[HWMockAPIServer alloc] initWithPort:[HWTrafficRecorder unusedLoopbackPort]];
+	STAssertTrue([mockAPI start], @"The mock API couldn't start");
+	finished = [NSMutableArray array];
+	failed = [NSMutableArray array];
+	calledOffMainThread = NO;
+}
+
+- (void)tearDown
+{
+	[mockAPI stop];
+	[ASIHTTPRequest setUsesRequestThreads:NO];
+}
+
+#pragma mark -
+#pragma mark Helpers
+#pragma mark -
+
+- (ASIHTTPRequest *)requestForMethod:(NSString *)method
+{
+	NSURL *url = [NSURL URLWithString:[NSString stringWithFormat:@"%@?method=%@", [mockAPI baseURL], method]];
+	ASIHTTPRequest *request = [ASIHTTPRequest requestWithURL:url];
+	[request setDelegate:self];
+	[request setDidFinishSelector:@selector(requestFinished:)];
+	[request setDidFailSelector:@selector(requestFailed:)];
+	return request;
+}
+
+- (BOOL)runUntilDone:(NSUInteger)count
+{
+	NSDate *deadline = [NSDate dateWithTimeIntervalSinceNow:HWRequestTestTimeout];
+	while([finished count] + [failed count] < count && [deadline timeIntervalSinceNow] > 0)
+		[[NSRunLoop currentRunLoop] runMode:NSDefaultRunLoopMode beforeDate:[NSDate dateWithTimeIntervalSinceNow:0.05]];
+	return [finished count] + [failed count] >= count;
+}
+
+- (void)requestFinished:(ASIHTTPRequest *)request
+{
+	if(![NSThread isMainThread])
+		calledOffMainThread = YES;
+	[finished addObject:request];
+}
+
+- (void)requestFailed:(ASIHTTPRequest *)request
+{
+	if(![NSThread isMainThread])
+		calledOffMainThread = YES;
+	[failed addObject:request];
+}
+
+#pragma mark -
+#pragma mark Shared Network Thread
+#pragma mark -
+
+- (void)testQueuedRequestsAllFinish
+{
+	mockAPI.defaultDelay = 0.05;
+	NSOperationQueue *queue = [[NSOperationQueue alloc] init];
+	[queue setMaxConcurrentOperationCount:4];
+
+	for(int i = 0; i < 20; i++)
+		[queue addOperation:[self requestForMethod:@"list"]];
+
+	STAssertTrue([self runUntilDone:20], @"%lu of 20 requests came back", (unsigned long)([finished count] + [failed count]));
+	STAssertEquals([failed count], (NSUInteger)0, nil);
+	STAssertFalse(calledOffMainThread, @"Delegates must hear back on the main thread");
+
+	for(ASIHTTPRequest *request in finished)
+	{
+		STAssertTrue([request isFinished], nil);
+		STAssertEquals([request responseStatusCode], 200, nil);
+		STAssertEqualObjects([request responseString], @"{\"success\":true}", nil);
+	}
+}
+
+- (void)testStreamsRunOnTheNetworkThread
+{
+	NSThread *networkThread = [ASIHTTPRequest networkThread];
+	STAssertNotNil(networkThread, nil);
+	STAssertFalse(networkThread == [NSThread mainThread], nil);
+	STAssertTrue(networkThread == [ASIHTTPRequest networkThread], @"Every request shares one thread");
+
+	ASIHTTPRequest *request = [self requestForMethod:@"list"];
+	[request startAsynchronous];
+	STAssertTrue([self runUntilDone:1], nil);
+	STAssertEquals([finished count], (NSUInteger)1, nil);
+}
+
+- (void)testTimeoutFailsTheRequest
+{
+	[mockAPI setDelay:5.0 forMethod:@"slow"];
+	ASIHTTPRequest *request = [self requestForMethod:@"slow"];
+	[request setTimeOutSeconds:1.0];
+
+	NSDate *start = [NSDate date];
+	[request startAsynchronous];
+	STAssertTrue([self runUntilDone:1], nil);
+
+	// The timer wheel ticks every quarter of a second, so allow for a tick and a bit either side
+	NSTimeInterval elapsed = -[start timeIntervalSinceNow];
+	STAssertEquals([failed count], (NSUInteger)1, nil);
+	STAssertEquals([[request error] code], (NSInteger)ASIRequestTimedOutErrorType, nil);
+	STAssertTrue(elapsed > 0.9 && elapsed < 2.5, @"Timed out after %.2fs", elapsed);
+	STAssertTrue([request isFinished], nil);
+}
+
+- (void)testCancelFinishesTheRequest
+{
+	[mockAPI setDelay:5.0 forMethod:@"slow"];
+	ASIHTTPRequest *request = [self requestForMethod:@"slow"];
+	[request startAsynchronous];
+	[[NSRunLoop currentRunLoop] runUntilDate:[NSDate dateWithTimeIntervalSinceNow:0.2]];
+
+	[request cancel];
+	STAssertTrue([self runUntilDone:1], nil);
+	STAssertEquals([failed count], (NSUInteger)1, nil);
+	STAssertEquals([[request error] code], (NSInteger)ASIRequestCancelledErrorType, nil);
+
+	NSDate *deadline = [NSDate dateWithTimeIntervalSinceNow:1.0];
+	while(![request isFinished] && [deadline timeIntervalSinceNow] > 0)
+		[[NSRunLoop currentRunLoop] runMode:NSDefaultRunLoopMode beforeDate:[NSDate dateWithTimeIntervalSinceNow:0.05]];
+	STAssertTrue([request isFinished], @"A cancelled request must leave its queue");
+}
+
+- (void)testRequestThreadsStillWork
+{
+	[ASIHTTPRequest setUsesRequestThreads:YES];
+	NSOperationQueue *queue = [[NSOperationQueue alloc] init];
+	for(int i = 0; i < 3; i++)
+		[queue addOperation:[self requestForMethod:@"list"]];
+
+	STAssertTrue([self runUntilDone:3], nil);
+	STAssertEquals([finished count], (NSUInteger)3, nil);
+	[queue waitUntilAllOperationsAreFinished];
+}
+
+@end
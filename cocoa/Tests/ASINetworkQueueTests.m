@@ -0,0 +1,134 @@
+#import <SenTestingKit/SenTestingKit.h>
+#import "ASIFormDataRequest.h"
+#import "ASINetworkQueue.h"
+#import "HWMockAPIServer.h"
+#import "HWTrafficRecorder.h"
+
+// Seconds any one test waits for its queue before failing
+#define HWQueueTestTimeout 20.0
+
+// Progress counted from the threads requests run on and passed on to the
+// progress delegates from the main thread, no more often than
+// ASINetworkQueueProgressUpdateInterval.
+@interface ASINetworkQueueTests : SenTestCase
+{
+	NSProgressIndicator *downloadProgress;
+
+	BOOL queueFinished;
+	int failures;
+	double downloadProgressWhenFinished;
+}
+
+- (void)spinRunLoopFor:(NSTimeInterval)seconds;
+
+@end
+
+@implementation ASINetworkQueueTests
+
+- (void)setUp
+{
+	downloadProgress = [[NSProgressIndicator alloc] init];
+	queueFinished = NO;
+	failures = 0;
+	downloadProgressWhenFinished = 0;
+}
+
+- (void)spinRunLoopFor:(NSTimeInterval)seconds
+{
+	[[NSRunLoop currentRunLoop] runUntilDate:[NSDate dateWithTimeIntervalSinceNow:seconds]];
+}
+
+#pragma mark -
+#pragma mark ASINetworkQueue Delegate
+#pragma mark -
+
+- (void)requestFailed:(ASIHTTPRequest *)request
+{
+	failures++;
+}
+
+- (void)queueFinished:(ASINetworkQueue *)queue
+{
+	downloadProgressWhenFinished = [downloadProgress doubleValue];
+	queueFinished = YES;
+}
+
+#pragma mark -
+#pragma mark Progress
+#pragma mark -
+
+- (void)testProgressDelegatesReachTheEnd
+{
+	HWMockAPIServer *mockAPI = [[HWMockAPIServer alloc] initWithPort:[HWTrafficRecorder unusedLoopbackPort]];
+	STAssertTrue([mockAPI start], @"The mock API couldn't start");
+	[mockAPI setResponse:@"{\"ok\":true}" forMethod:@"progress"];
+
+	ASINetworkQueue *queue = [ASINetworkQueue queue];
+	[queue setMaxConcurrentOperationCount:8];
+	[queue setShouldCancelAllRequestsOnFailure:NO];
+	[queue setDelegate:self];
+	[queue setRequestDidFailSelector:@selector(requestFailed:)];
+	[queue setQueueDidFinishSelector:@selector(queueFinished:)];
+	[queue setDownloadProgressDelegate:downloadProgress];
+	STAssertEquals([downloadProgress maxValue], 1.0, @"The queue reports progress as a fraction");
+
+	for(int i = 0; i < 200; i++)
+	{
+		ASIFormDataRequest *request = [ASIFormDataRequest requestWithURL:[NSURL URLWithString:[NSString stringWithFormat:@"%@?method=progress&n=%d", [mockAPI baseURL], i]]];
+		[request setPostValue:[NSString stringWithFormat:@"%d", i] forKey:@"n"];
+		[queue addOperation:request];
+	}
+
+	NSDate *start = [NSDate date];
+	[queue go];
+	NSDate *deadline = [NSDate dateWithTimeIntervalSinceNow:HWQueueTestTimeout];
+	while(!queueFinished && [deadline timeIntervalSinceNow] > 0)
+		[[NSRunLoop currentRunLoop] runMode:NSDefaultRunLoopMode beforeDate:[NSDate dateWithTimeIntervalSinceNow:0.05]];
+	NSTimeInterval elapsed = -[start timeIntervalSinceNow];
+
+	STAssertTrue(queueFinished, @"The queue never finished");
+	STAssertEquals(failures, 0, nil);
+	STAssertEqualsWithAccuracy(downloadProgressWhenFinished, 1.0, 0.001, @"The last update comes before the queue says it has finished");
+
+	// One update per interval, plus the one pushed out when the queue finishes
+	unsigned int allowed = (unsigned int)(elapsed / ASINetworkQueueProgressUpdateInterval) + 2;
+	STAssertTrue([queue progressUpdateCount] <= allowed, @"%u updates in %.2fs", [queue progressUpdateCount], elapsed);
+
+	[mockAPI stop];
+}
+
+- (void)testIncrementsShareOneUpdate
+{
+	ASINetworkQueue *queue = [ASINetworkQueue queue];
+	[queue setDownloadProgressDelegate:downloadProgress];
+	[queue incrementDownloadSizeBy:1000];
+	for(int i = 0; i < 1000; i++)
+		[queue incrementDownloadProgressBy:1];
+
+	// None of that reaches the delegate until the main thread gets round to it
+	STAssertEquals([queue progressUpdateCount], 0U, nil);
+	[self spinRunLoopFor:3 * ASINetworkQueueProgressUpdateInterval];
+
+	STAssertTrue([queue progressUpdateCount] >= 1 && [queue progressUpdateCount] <= 2, @"%u updates for one burst of increments", [queue progressUpdateCount]);
+	STAssertEqualsWithAccuracy([downloadProgress doubleValue], 1.0, 0.001, nil);
+}
+
+- (void)testUpdatesAreHeldBackForAnInterval
+{
+	ASINetworkQueue *queue = [ASINetworkQueue queue];
+	[queue setDownloadProgressDelegate:downloadProgress];
+	[queue incrementDownloadSizeBy:100];
+	[queue updateProgressDelegates];
+	unsigned int updates = [queue progressUpdateCount];
+
+	// Straight after an update, the next one waits out the rest of the interval
+	[queue incrementDownloadProgressBy:50];
+	[self spinRunLoopFor:ASINetworkQueueProgressUpdateInterval / 4];
+	STAssertEquals([queue progressUpdateCount], updates, @"An update went out inside the interval");
+
+	[self spinRunLoopFor:ASINetworkQueueProgressUpdateInterval * 2];
+	STAssertEquals([queue progressUpdateCount], updates + 1, nil);
+	STAssertEqualsWithAccuracy([downloadProgress doubleValue], 0.5, 0.001, nil);
+}
+
+@end
@@ -0,0 +1,166 @@
+#import <SenTestingKit/SenTestingKit.h>
+#import "HWAPIClient.h"
+#import "HWLatencyHistogram.h"
+#import "HWJSONResponseParser.h"
+#import "HWMockAPIServer.h"
+#import "HWTrafficRecorder.h"
+#import "ASIHTTPRequest.h"
+
+// How long the mock API takes over most answers, and over the slow ones
+#define HWClientTestDelay 0.02
+#define HWClientTestTailDelay 3.0
+
+// Seconds any one request waits before the test fails
+#define HWClientTestTimeout 10.0
+
+// List calls through HWAPIClient against a mock API: coalescing, the timeout and
+// hedge delay it learns from an endpoint's latency, and hedging a slow answer.
+@interface HWAPIClientTests : SenTestCase
+{
+	HWMockAPIServer *mockAPI;
+	HWAPIClient *client;
+
+	int outstanding;
+	int results;
+	int failures;
+}
+
+- (void)sendListRequest:(int)n;
+- (BOOL)runUntilAnswered;
+
+- (void)listAllMachinesResult:(NSDictionary *)dict;
+- (void)listAllMachinesFailed:(id)request;
+
+@end
+
+@implementation HWAPIClientTests
+
+- (void)setUp
+{
+	mockAPI = [[HWMockAPIServer alloc] initWithPort:[HWTrafficRecorder unusedLoopbackPort]];
+	mockAPI.defaultDelay = HWClientTestDelay;
+	STAssertTrue([mockAPI start], @"The mock API couldn't start");
+
+	client = [[HWAPIClient alloc] init];
+	outstanding = 0;
+	results = 0;
+	failures = 0;
+}
+
+- (void)tearDown
+{
+	// Give called off requests time to go before the server does
+	[[client queue] cancelAllOperations];
+	[[NSRunLoop currentRunLoop] runUntilDate:[NSDate dateWithTimeIntervalSinceNow:0.5]];
+	[mockAPI stop];
+}
+
+#pragma mark -
+#pragma mark Helpers
+#pragma mark -
+
+- (void)sendListRequest:(int)n
+{
+	NSURL *url = [NSURL URLWithString:[NSString stringWithFormat:@"%@?method=listAllMachines&n=%d", [mockAPI baseURL], n]];
+	ASIHTTPRequest *request = [ASIHTTPRequest requestWithURL:url];
+	[request setResponseDataConsumer:[HWJSONResponseParser parser]];
+	outstanding++;
+	[client sendIdempotentRequest:request forMethod:@"listAllMachines" from:self didFailSelector:@selector(listAllMachinesFailed:)];
+}
+
+- (BOOL)runUntilAnswered
+{
+	NSDate *deadline = [NSDate dateWithTimeIntervalSinceNow:HWClientTestTimeout];
+	while(outstanding > 0 && [deadline timeIntervalSinceNow] > 0)
+		[[NSRunLoop currentRunLoop] runMode:NSDefaultRunLoopMode beforeDate:[NSDate dateWithTimeIntervalSinceNow:0.05]];
+	return outstanding <= 0;
+}
+
+- (void)listAllMachinesResult:(NSDictionary *)dict
+{
+	results++;
+	outstanding--;
+}
+
+- (void)listAllMachinesFailed:(id)request
+{
+	failures++;
+	outstanding--;
+}
+
+#pragma mark -
+#pragma mark Tests
+#pragma mark -
+
+- (void)testIdenticalRequestsShareOneAnswer
+{
+	[mockAPI setDelay:0.2 forMethod:@"listAllMachines"];
+	[self sendListRequest:1];
+	[self sendListRequest:1];
+	[self sendListRequest:2];
+
+	STAssertTrue([self runUntilAnswered], nil);
+	STAssertEquals(results, 3, @"Every caller hears back");
+	STAssertEquals(failures, 0, nil);
+	STAssertEquals([client sentRequestCount], 2UL, nil);
+	STAssertEquals([client coalescedRequestCount], 1UL, nil);
+	STAssertEquals([mockAPI requestCount], 2UL, nil);
+}
+
+- (void)testTimeoutAndHedgeDelayFollowLatency
+{
+	STAssertEquals([client timeoutForMethod:@"listAllMachines"], HWAPIDefaultTimeout, nil);
+	STAssertEquals([client hedgeDelayForMethod:@"listAllMachines"], 0.0, @"No hedging before the endpoint has a track record");
+
+	for(int i = 0; i < HWAPIMinLatencySamples; i++)
+	{
+		[self sendListRequest:i];
+		STAssertTrue([self runUntilAnswered], nil);
+	}
+	STAssertEquals(failures, 0, nil);
+	STAssertEquals([[client latencyHistogramForMethod:@"listAllMachines"] count], (uint64_t)HWAPIMinLatencySamples, nil);
+
+	// Answers in tens of milliseconds give the shortest timeout allowed and a short hedge delay
+	STAssertEquals([client timeoutForMethod:@"listAllMachines"], HWAPIMinTimeout, nil);
+	NSTimeInterval hedgeDelay = [client hedgeDelayForMethod:@"listAllMachines"];
+	STAssertTrue(hedgeDelay >= HWAPIMinHedgeDelay && hedgeDelay < 0.5, @"Hedge delay of %.3fs", hedgeDelay);
+	STAssertEquals([client hedgedRequestCount], 0UL, @"Nothing was slow enough to hedge");
+}
+
+- (void)testHedgeAnswersASlowRequest
+{
+	// Only the first request after the warm up is slow, so its hedge comes back at the usual speed
+	[mockAPI setTailDelay:HWClientTestTailDelay everyNthRequest:HWAPIMinLatencySamples + 1 forMethod:@"listAllMachines"];
+	for(int i = 0; i < HWAPIMinLatencySamples; i++)
+	{
+		[self sendListRequest:i];
+		STAssertTrue([self runUntilAnswered], nil);
+	}
+
+	NSDate *start = [NSDate date];
+	[self sendListRequest:HWAPIMinLatencySamples];
+	STAssertTrue([self runUntilAnswered], nil);
+	NSTimeInterval elapsed = -[start timeIntervalSinceNow];
+
+	STAssertEquals(failures, 0, nil);
+	STAssertTrue(elapsed < HWClientTestTailDelay / 2, @"Answered after %.2fs, the hedge should have won", elapsed);
+	STAssertEquals([client hedgedRequestCount], 1UL, nil);
+	STAssertEquals([client hedgeWinCount], 1UL, nil);
+}
+
+- (void)testNoHedgingWhenTurnedOff
+{
+	client.hedgesRequests = NO;
+	[mockAPI setTailDelay:1.0 everyNthRequest:HWAPIMinLatencySamples + 1 forMethod:@"listAllMachines"];
+	for(int i = 0; i <= HWAPIMinLatencySamples; i++)
+	{
+		[self sendListRequest:i];
+		STAssertTrue([self runUntilAnswered], nil);
+	}
+
+	STAssertEquals(failures, 0, nil);
+	STAssertEquals([client hedgedRequestCount], 0UL, nil);
+	STAssertTrue([[client latencyHistogramForMethod:@"listAllMachines"] maxValue] >= 1.0, @"The slow answer was waited for");
+}
+
+@end
@@ -0,0 +1,117 @@
+#import <SenTestingKit/SenTestingKit.h>
+#import "HWLatencyHistogram.h"
+
+// Buckets keep a value to within about 6%, so percentiles are checked to that
+#define HWHistogramTolerance 0.07
+
+@interface HWLatencyHistogramTests : SenTestCase
+{
+	HWLatencyHistogram *histogram;
+}
+@end
+
+@implementation HWLatencyHistogramTests
+
+- (void)setUp
+{
+	histogram = [[HWLatencyHistogram alloc] initWithName:@"test"];
+}
+
+- (void)testEmptyHistogram
+{
+	STAssertEquals([histogram count], (uint64_t)0, nil);
+	STAssertEquals([histogram mean], 0.0, nil);
+	STAssertEquals([histogram valueAtPercentile:50], 0.0, nil);
+	STAssertEquals([histogram valueAtPercentile:99], 0.0, nil);
+}
+
+- (void)testPercentilesOfAnEvenSpread
+{
+	// 1 ms to 100 ms in 1 ms steps
+	for(int i = 1; i <= 100; i++)
+		[histogram recordValue:i / 1000.0];
+
+	STAssertEquals([histogram count], (uint64_t)100, nil);
+	STAssertEqualsWithAccuracy([histogram minValue], 0.001, 0.000001, nil);
+	STAssertEqualsWithAccuracy([histogram maxValue], 0.100, 0.000001, nil);
+	STAssertEqualsWithAccuracy([histogram mean], 0.0505, 0.000001, nil);
+	STAssertEqualsWithAccuracy([histogram valueAtPercentile:50], 0.050, 0.050 * HWHistogramTolerance, nil);
+	STAssertEqualsWithAccuracy([histogram valueAtPercentile:95], 0.095, 0.095 * HWHistogramTolerance, nil);
+	STAssertEqualsWithAccuracy([histogram valueAtPercentile:99], 0.099, 0.099 * HWHistogramTolerance, nil);
+	STAssertTrue([histogram valueAtPercentile:100] <= [histogram maxValue], nil);
+}
+
+- (void)testPercentilesStayWithinRecordedValues
+{
+	[histogram recordValue:0.0123];
+	STAssertEquals([histogram valueAtPercentile:0], 0.0123, @"A lone value comes back exactly, not as its bucket's midpoint");
+	STAssertEquals([histogram valueAtPercentile:50], 0.0123, nil);
+	STAssertEquals([histogram valueAtPercentile:100], 0.0123, nil);
+}
+
+- (void)testSlowTailShowsInHighPercentiles
+{
+	for(int i = 0; i < 96; i++)
+		[histogram recordValue:0.020];
+	for(int i = 0; i < 4; i++)
+		[histogram recordValue:2.0];
+
+	STAssertEqualsWithAccuracy([histogram valueAtPercentile:95], 0.020, 0.020 * HWHistogramTolerance, nil);
+	STAssertEqualsWithAccuracy([histogram valueAtPercentile:99], 2.0, 2.0 * HWHistogramTolerance, nil);
+}
+
+- (void)testNegativeValuesCountAsZero
+{
+	[histogram recordValue:-1.0];
+	STAssertEquals([histogram count], (uint64_t)1, nil);
+	STAssertEquals([histogram minValue], 0.0, nil);
+	STAssertEquals([histogram valueAtPercentile:50], 0.0, nil);
+}
+
+- (void)testDecayHalvesCountsAndKeepsTheMean
+{
+	for(int i = 0; i < 100; i++)
+		[histogram recordValue:0.010];
+	for(int i = 0; i < 100; i++)
+		[histogram recordValue:0.030];
+
+	[histogram decay];
+	STAssertEquals([histogram count], (uint64_t)100, nil);
+	STAssertEqualsWithAccuracy([histogram mean], 0.020, 0.000001, nil);
+	STAssertEqualsWithAccuracy([histogram valueAtPercentile:25], 0.010, 0.010 * HWHistogramTolerance, nil);
+
+	// New samples now outweigh the old ones
+	for(int i = 0; i < 200; i++)
+		[histogram recordValue:0.100];
+	STAssertEqualsWithAccuracy([histogram valueAtPercentile:50], 0.100, 0.100 * HWHistogramTolerance, nil);
+}
+
+- (void)testDecayDropsALoneSample
+{
+	[histogram recordValue:0.5];
+	[histogram decay];
+	STAssertEquals([histogram count], (uint64_t)0, nil);
+	STAssertEquals([histogram maxValue], 0.0, nil);
+	STAssertEquals([histogram valueAtPercentile:99], 0.0, nil);
+}
+
+- (void)testReset
+{
+	[histogram recordValue:0.5];
+	[histogram reset];
+	STAssertEquals([histogram count], (uint64_t)0, nil);
+	STAssertEquals([histogram maxValue], 0.0, nil);
+	STAssertEqualObjects([histogram name], @"test", nil);
+}
+
+- (void)testDictionaryRepresentation
+{
+	[histogram recordValue:0.001];
+	[histogram recordValue:0.002];
+	NSDictionary *dict = [histogram dictionaryRepresentation];
+	STAssertEqualObjects([dict objectForKey:@"name"], @"test", nil);
+	STAssertEquals([[dict objectForKey:@"count"] intValue], 2, nil);
+	STAssertEquals([[dict objectForKey:@"buckets"] count], (NSUInteger)2, nil);
+}
+
+@end
@@ -0,0 +1,263 @@
+#import <SenTestingKit/SenTestingKit.h>
+#import "SBJsonStreamParser.h"
+#import "SBJsonStreamParserAdapter.h"
+
+// Responses arrive in whatever pieces the network hands over, so every document
+// here is parsed whole, split in two at every byte, and fed one byte at a time.
+@interface SBJsonStreamParserTests : SenTestCase
+{
+}
+
+- (SBJsonStreamParserStatus)parse:(const char *)json inChunksOf:(NSUInteger)size splitAt:(NSUInteger)split result:(id *)result;
+- (void)assertParses:(const char *)json to:(id)expected;
+- (void)assertRejects:(const char *)json;
+
+@end
+
+static NSDecimalNumber *HWDecimal(NSString *string)
+{
+	return [NSDecimalNumber decimalNumberWithString:string];
+}
+
+@implementation SBJsonStreamParserTests
+
+#pragma mark -
+#pragma mark Helpers
+#pragma mark -
+
+// Feeds json to a fresh parser, first the bytes up to split, then the rest size bytes at a time
+- (SBJsonStreamParserStatus)parse:(const char *)json inChunksOf:(NSUInteger)size splitAt:(NSUInteger)split result:(id *)result
+{
+	SBJsonStreamParserAdapter *adapter = [[SBJsonStreamParserAdapter alloc] init];
+	SBJsonStreamParser *parser = [[SBJsonStreamParser alloc] init];
+	[parser setDelegate:adapter];
+
+	NSUInteger length = strlen(json);
+	SBJsonStreamParserStatus status = [parser parseBytes:json length:split];
+	for(NSUInteger offset = split; offset < length; offset += size)
+		status = [parser parseBytes:json + offset length:MIN(size, length - offset)];
+
+	if(result)
+		*result = (status == SBJsonStreamParserComplete) ? [adapter object] : nil;
+	return status;
+}
+
+- (void)assertParses:(const char *)json to:(id)expected
+{
+	NSUInteger length = strlen(json);
+	for(NSUInteger split = 0; split <= length; split++)
+	{
+		id result = nil;
+		SBJsonStreamParserStatus status = [self parse:json inChunksOf:length splitAt:split result:&result];
+		STAssertTrue(status == SBJsonStreamParserComplete, @"%s split at %lu", json, (unsigned long)split);
+		STAssertEqualObjects(result, expected, @"%s split at %lu", json, (unsigned long)split);
+	}
+
+	id result = nil;
+	SBJsonStreamParserStatus status = [self parse:json inChunksOf:1 splitAt:0 result:&result];
+	STAssertTrue(status == SBJsonStreamParserComplete, @"%s one byte at a time", json);
+	STAssertEqualObjects(result, expected, @"%s one byte at a time", json);
+}
+
+- (void)assertRejects:(const char *)json
+{
+	NSUInteger length = strlen(json);
+	STAssertTrue([self parse:json inChunksOf:length splitAt:0 result:NULL] == SBJsonStreamParserError, @"%s", json);
+	STAssertTrue([self parse:json inChunksOf:1 splitAt:0 result:NULL] == SBJsonStreamParserError, @"%s one byte at a time", json);
+}
+
+#pragma mark -
+#pragma mark Strings
+#pragma mark -
+
+- (void)testStringsSplitAnywhere
+{
+	[self assertParses:"{\"name\":\"machine one\",\"\":\"\"}"
+					to:[NSDictionary dictionaryWithObjectsAndKeys:@"machine one", @"name", @"", @"", nil]];
+}
+
+- (void)testMultibyteCharactersSplitAnywhere
+{
+	// The split lands inside the two and three byte sequences as well as between them
+	[self assertParses:"[\"caf\xc3\xa9 \xe2\x82\xac\"]"
+					to:[NSArray arrayWithObject:[NSString stringWithUTF8String:"caf\xc3\xa9 \xe2\x82\xac"]]];
+}
+
+- (void)testEscapesSplitAnywhere
+{
+	[self assertParses:"[\"\\\"\\\\\\/\\b\\f\\n\\r\\t\"]" to:[NSArray arrayWithObject:@"\"\\/\b\f\n\r\t"]];
+
+	// An escaped backslash right before the closing quote mustn't escape the quote
+	[self assertParses:"[\"a\\\\\",\"b\"]" to:[NSArray arrayWithObjects:@"a\\", @"b", nil]];
+
+	// Escapes in keys go through the same path
+	[self assertParses:"{\"a\\\"b\":1}" to:[NSDictionary dictionaryWithObject:HWDecimal(@"1") forKey:@"a\"b"]];
+}
+
+- (void)testUnicodeEscapesSplitAnywhere
+{
+	unichar chars[] = { 0x00e9, 0x4e2d, 0x0041 };
+	[self assertParses:"[\"\\u00e9\\u4E2D\\u0041\"]" to:[NSArray arrayWithObject:[NSString stringWithCharacters:chars length:3]]];
+}
+
+- (void)testSurrogatePairsSplitAnywhere
+{
+	// U+1D11E, split between and inside both halves of the pair
+	unichar clef[] = { 0xd834, 0xdd1e };
+	NSString *expected = [NSString stringWithCharacters:clef length:2];
+	[self assertParses:"[\"\\ud834\\udd1e\"]" to:[NSArray arrayWithObject:expected]];
+	[self assertParses:"{\"\\ud834\\udd1e\":\"x\\ud834\\udd1ex\"}"
+					to:[NSDictionary dictionaryWithObject:[NSString stringWithFormat:@"x%@x", expected] forKey:expected]];
+}
+
+#pragma mark -
+#pragma mark Numbers and Literals
+#pragma mark -
+
+- (void)testNumbersSplitAnywhere
+{
+	NSArray *expected = [NSArray arrayWithObjects:HWDecimal(@"0"), HWDecimal(@"-0"), HWDecimal(@"7"), HWDecimal(@"-12"),
+						 HWDecimal(@"3.25"), HWDecimal(@"-0.5"), HWDecimal(@"1e3"), HWDecimal(@"1E+3"), HWDecimal(@"25e-2"),
+						 HWDecimal(@"1234567890123456789"), nil];
+	[self assertParses:"[0,-0,7,-12,3.25,-0.5,1e3,1E+3,25e-2,1234567890123456789]" to:expected];
+}
+
+- (void)testNumberAtEndOfChunkWaitsForTheRest
+{
+	SBJsonStreamParserAdapter *adapter = [[SBJsonStreamParserAdapter alloc] init];
+	SBJsonStreamParser *parser = [[SBJsonStreamParser alloc] init];
+	[parser setDelegate:adapter];
+
+	// Nothing says 12 is the whole number until the next byte arrives
+	STAssertTrue([parser parse:[@"[12" dataUsingEncoding:NSUTF8StringEncoding]] == SBJsonStreamParserWaitingForData, nil);
+	STAssertEquals([[adapter object] count], (NSUInteger)0, nil);
+
+	STAssertTrue([parser parse:[@"3.5e1 ]" dataUsingEncoding:NSUTF8StringEncoding]] == SBJsonStreamParserComplete, nil);
+	STAssertEqualObjects([adapter object], [NSArray arrayWithObject:HWDecimal(@"123.5e1")], nil);
+}
+
+- (void)testLiteralsSplitAnywhere
+{
+	NSArray *expected = [NSArray arrayWithObjects:[NSNumber numberWithBool:YES], [NSNumber numberWithBool:NO], [NSNull null], nil];
+	[self assertParses:"[true,false,null]" to:expected];
+	[self assertParses:"[ true , false\n,\tnull ]" to:expected];
+}
+
+#pragma mark -
+#pragma mark Nesting
+#pragma mark -
+
+- (void)testNestingSplitAnywhere
+{
+	NSDictionary *c = [NSDictionary dictionaryWithObject:[NSArray arrayWithObjects:[NSArray array], [NSDictionary dictionary], nil] forKey:@"c"];
+	NSDictionary *b = [NSDictionary dictionaryWithObject:[NSDictionary dictionaryWithObject:c forKey:@"b"] forKey:@"b"];
+	NSArray *numbers = [NSArray arrayWithObjects:HWDecimal(@"1"), [NSArray arrayWithObjects:HWDecimal(@"2"),
+						[NSArray arrayWithObject:HWDecimal(@"3")], nil], nil];
+	NSDictionary *expected = [NSDictionary dictionaryWithObjectsAndKeys:
+							  [NSArray arrayWithObjects:[b objectForKey:@"b"], numbers, nil], @"a",
+							  [NSDictionary dictionary], @"d", nil];
+
+	[self assertParses:"{\"a\":[{\"b\":{\"c\":[[],{}]}},[1,[2,[3]]]],\"d\":{}}" to:expected];
+	[self assertParses:"[]" to:[NSArray array]];
+	[self assertParses:"{}" to:[NSDictionary dictionary]];
+}
+
+- (void)testMaxDepth
+{
+	SBJsonStreamParser *parser = [[SBJsonStreamParser alloc] init];
+	[parser setMaxDepth:2];
+	STAssertTrue([parser parse:[@"[[1]]" dataUsingEncoding:NSUTF8StringEncoding]] == SBJsonStreamParserComplete, nil);
+
+	parser = [[SBJsonStreamParser alloc] init];
+	[parser setMaxDepth:2];
+	STAssertTrue([parser parse:[@"[[[1]]]" dataUsingEncoding:NSUTF8StringEncoding]] == SBJsonStreamParserError, nil);
+	STAssertNotNil([parser errorTrace], nil);
+}
+
+#pragma mark -
+#pragma mark Malformed Input
+#pragma mark -
+
+- (void)testMalformedStructure
+{
+	const char *documents[] = {
+		"]", "}", "[}", "{]", "[1]]", "[1][2]", "[1] x",
+		"[1,]", "[,1]", "[1 2]", "[1:2]",
+		"{\"a\":1,}", "{\"a\" 1}", "{\"a\":}", "{\"a\",1}", "{1:2}", "{\"a\":1 \"b\":2}",
+		"\"fragment\"", "1", "true",
+	};
+	for(int i = 0; i < sizeof(documents) / sizeof(documents[0]); i++)
+		[self assertRejects:documents[i]];
+}
+
+- (void)testMalformedNumbers
+{
+	const char *documents[] = { "[01]", "[-]", "[-a]", "[1.]", "[1.e5]", "[.5]", "[1e]", "[1e+]", "[+1]" };
+	for(int i = 0; i < sizeof(documents) / sizeof(documents[0]); i++)
+		[self assertRejects:documents[i]];
+}
+
+- (void)testMalformedLiterals
+{
+	const char *documents[] = { "[tru]", "[nul]", "[falsey]", "[True]", "[nan]" };
+	for(int i = 0; i < sizeof(documents) / sizeof(documents[0]); i++)
+		[self assertRejects:documents[i]];
+}
+
+- (void)testMalformedStrings
+{
+	const char *documents[] = {
+		"[\"\\x\"]",					// no such escape
+		"[\"\\u12\"]",					// short hex quad
+		"[\"\\u12g4\"]",				// not hex
+		"[\"\\ud834\"]",				// high surrogate on its own
+		"[\"\\ud834\\u0041\"]",			// high surrogate followed by something else
+		"[\"\\udd1e\\ud834\"]",			// halves the wrong way round
+		"[\"a\x01" "b\"]",				// unescaped control character
+		"[\"a\tb\"]",
+		"[\"\xff\"]",					// not UTF-8
+		"[\"\xc3\"]",					// cut off UTF-8 sequence
+		"{\"a\\q\":1}",
+	};
+	for(int i = 0; i < sizeof(documents) / sizeof(documents[0]); i++)
+		[self assertRejects:documents[i]];
+}
+
+- (void)testErrorIsFinal
+{
+	SBJsonStreamParser *parser = [[SBJsonStreamParser alloc] init];
+	STAssertTrue([parser parse:[@"[1,]" dataUsingEncoding:NSUTF8StringEncoding]] == SBJsonStreamParserError, nil);
+	STAssertNotNil([parser errorTrace], nil);
+	STAssertTrue([parser parse:[@"[1]" dataUsingEncoding:NSUTF8StringEncoding]] == SBJsonStreamParserError, nil);
+}
+
+#pragma mark -
+#pragma mark Truncated Input
+#pragma mark -
+
+- (void)testTruncatedDocumentsWait
+{
+	const char *json = "{\"machines\":[{\"id\":1,\"name\":\"caf\xc3\xa9 \\\"x\\\"\",\"load\":-1.5e-3,"
+		"\"up\":true,\"down\":false,\"note\":null,\"clef\":\"\\ud834\\udd1e\"}],\"count\":10}";
+
+	// Every strict prefix is a document still on its way, never an error and never complete
+	NSUInteger length = strlen(json);
+	for(NSUInteger cut = 0; cut < length; cut++)
+	{
+		char *prefix = strndup(json, cut);
+		STAssertTrue([self parse:prefix inChunksOf:cut splitAt:0 result:NULL] == SBJsonStreamParserWaitingForData, @"cut at %lu", (unsigned long)cut);
+		STAssertTrue([self parse:prefix inChunksOf:1 splitAt:0 result:NULL] == SBJsonStreamParserWaitingForData, @"cut at %lu, one byte at a time", (unsigned long)cut);
+		free(prefix);
+	}
+
+	id result = nil;
+	STAssertTrue([self parse:json inChunksOf:length splitAt:0 result:&result] == SBJsonStreamParserComplete, nil);
+	STAssertEqualObjects([result objectForKey:@"count"], HWDecimal(@"10"), nil);
+}
+
+- (void)testTrailingWhitespace
+{
+	[self assertParses:"[1] \n\t" to:[NSArray arrayWithObject:HWDecimal(@"1")]];
+}
+
+@end
@@ -6,7 +6,6 @@
 
 @interface TunnelStatusController : NSObject {
 	IBOutlet NSTableView *theTable;
-	NSMutableDictionary *services;
 	
 	IBOutlet NSMenuItem *menuItemConnect;
 	IBOutlet NSMenuItem *menuItemDisconnect;
@@ -1,5 +1,7 @@
 
 #import "TunnelStatusController.h"
+#import "HWServiceTypeRegistry.h"
+#import "HWProxiedService.h"
 
 
 @implementation TunnelStatusController
@@ -9,12 +11,6 @@
 	[super init];
 	
 	[[NSNotificationCenter defaultCenter] addObserver:self selector:@selector(tunnelStatusDidChange) name:@"TUNNEL_STATUS_DID_CHANGE" object:nil];
-
-	services = [[NSMutableDictionary alloc] init];
-	NSArray *plist = [NSArray arrayWithContentsOfFile:[[NSBundle mainBundle] pathForResource:@"Services" ofType:@"plist"]];
-	for(NSDictionary *dict in plist)
-		[services setValue:[dict valueForKey:@"Name"] forKey:[dict valueForKey:@"Service"]];
-	
 	return self;
 }
 
@@ -29,7 +25,7 @@
 	SSHTunnelManager *tm = [SSHTunnelManager sharedObject];
 	NSDictionary *info = [[[tm tunnels] objectAtIndex:rowIndex + 1] userInfo];
 
-	NSNetService *service = [info valueForKey:@"service"];
+	HWProxiedService *service = [info valueForKey:@"service"];
 
 	if([[aTableColumn identifier] isEqualToString:@"destination"])
 	{
@@ -37,7 +33,7 @@
 	}
 	else if([[aTableColumn identifier] isEqualToString:@"type"])
 	{
-		return [service type];
+		return [[HWServiceTypeRegistry sharedRegistry] nameForType:[service type]];
 	}
 	else if([[aTableColumn identifier] isEqualToString:@"port"])
 	{
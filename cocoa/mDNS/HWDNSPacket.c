@@ -0,0 +1,479 @@
+//
+//  HWDNSPacket.c
+//
+
+#include "HWDNSPacket.h"
+#include <string.h>
+
+static uint16_t HWDNSGet16(const uint8_t *p)
+{
+	return (uint16_t)((p[0] << 8) | p[1]);
+}
+
+static uint32_t HWDNSGet32(const uint8_t *p)
+{
+	return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+}
+
+static void HWDNSPut16(uint8_t *p, uint16_t v)
+{
+	p[0] = v >> 8;
+	p[1] = v & 0xFF;
+}
+
+static void HWDNSPut32(uint8_t *p, uint32_t v)
+{
+	p[0] = v >> 24;
+	p[1] = (v >> 16) & 0xFF;
+	p[2] = (v >> 8) & 0xFF;
+	p[3] = v & 0xFF;
+}
+
+static uint8_t HWDNSLower(uint8_t c)
+{
+	return (c >= 'A' && c <= 'Z') ? c + ('a' - 'A') : c;
+}
+
+// Pulls the next label out of a dotted name. "\." and "\\" escape dots and backslashes inside a label.
+// Returns the label length or -1 if it is too long.
+static int HWDNSNextLabel(const char **cursor, uint8_t *label)
+{
+	const char *c = *cursor;
+	int n = 0;
+	while(*c && *c != '.')
+	{
+		if(*c == '\\' && c[1])
+			c++;
+		if(n >= HWDNSMaxLabelLength)
+			return -1;
+		label[n++] = (uint8_t)*c++;
+	}
+	if(*c == '.')
+		c++;
+	*cursor = c;
+	return n;
+}
+
+// Reading
+
+int HWDNSReaderInit(HWDNSReader *reader, const uint8_t *packet, size_t length)
+{
+	memset(reader, 0, sizeof(*reader));
+	if(!packet || length < HWDNSHeaderLength)
+		return HWDNSMalformed;
+
+	reader->packet = packet;
+	reader->length = length;
+	reader->offset = HWDNSHeaderLength;
+	reader->id = HWDNSGet16(packet);
+	reader->flags = HWDNSGet16(packet + 2);
+	for(int i = 0; i < 4; i++)
+		reader->counts[i] = HWDNSGet16(packet + 4 + i * 2);
+	reader->section = HWDNSSectionQuestion;
+	reader->remaining = reader->counts[0];
+	return HWDNSOk;
+}
+
+int HWDNSReaderNext(HWDNSReader *reader, HWDNSRecord *record)
+{
+	while(reader->remaining == 0)
+	{
+		if(reader->section >= HWDNSSectionAdditional)
+			return HWDNSEnd;
+		reader->section++;
+		reader->remaining = reader->counts[reader->section];
+	}
+
+	memset(record, 0, sizeof(*record));
+	record->section = (HWDNSSection)reader->section;
+	record->nameOffset = reader->offset;
+
+	size_t pos;
+	if(HWDNSReadName(reader->packet, reader->length, reader->offset, NULL, 0, &pos) != HWDNSOk)
+		return HWDNSMalformed;
+
+	size_t fixed = (record->section == HWDNSSectionQuestion) ? 4 : 10;
+	if(pos + fixed > reader->length)
+		return HWDNSMalformed;
+
+	const uint8_t *p = reader->packet + pos;
+	record->type = HWDNSGet16(p);
+	record->rrclass = HWDNSGet16(p + 2) & ~HWDNSClassFlag;
+	record->classFlag = (HWDNSGet16(p + 2) & HWDNSClassFlag) != 0;
+	pos += fixed;
+
+	if(record->section != HWDNSSectionQuestion)
+	{
+		record->ttl = HWDNSGet32(p + 4);
+		record->rdataLength = HWDNSGet16(p + 8);
+		record->rdataOffset = pos;
+		if(pos + record->rdataLength > reader->length)
+			return HWDNSMalformed;
+		pos += record->rdataLength;
+	}
+
+	reader->offset = pos;
+	reader->remaining--;
+	return HWDNSOk;
+}
+
+int HWDNSReadName(const uint8_t *packet, size_t length, size_t offset, char *name, size_t nameSize, size_t *end)
+{
+	size_t out = 0;
+	size_t total = 0;
+	int hops = 0;
+	int jumped = 0;
+
+	for(;;)
+	{
+		if(offset >= length)
+			return HWDNSMalformed;
+
+		uint8_t l = packet[offset];
+		if((l & 0xC0) == 0xC0)
+		{
+			if(offset + 1 >= length)
+				return HWDNSMalformed;
+
+			// Pointers may only go backwards, which together with the hop limit rules out loops
+			size_t target = ((size_t)(l & 0x3F) << 8) | packet[offset + 1];
+			if(target >= offset || ++hops > HWDNSMaxPointerHops)
+				return HWDNSMalformed;
+
+			if(!jumped && end)
+				*end = offset + 2;
+			jumped = 1;
+			offset = target;
+			continue;
+		}
+		if(l & 0xC0)
+			return HWDNSMalformed;
+
+		if(l == 0)
+		{
+			if(!jumped && end)
+				*end = offset + 1;
+			break;
+		}
+
+		if(offset + 1 + l > length)
+			return HWDNSMalformed;
+		total += l + 1;
+		if(total > HWDNSMaxNameLength - 1)
+			return HWDNSMalformed;
+
+		if(name)
+		{
+			for(int i = 0; i < l; i++)
+			{
+				uint8_t c = packet[offset + 1 + i];
+				if(c == '.' || c == '\\')
+				{
+					if(out + 1 >= nameSize) return HWDNSNoSpace;
+					name[out++] = '\\';
+				}
+				if(out + 1 >= nameSize) return HWDNSNoSpace;
+				name[out++] = c;
+			}
+			if(out + 1 >= nameSize) return HWDNSNoSpace;
+			name[out++] = '.';
+		}
+		offset += 1 + l;
+	}
+
+	if(name)
+	{
+		if(out == 0)
+		{
+			if(nameSize < 2) return HWDNSNoSpace;
+			name[out++] = '.';
+		}
+		name[out] = '\0';
+	}
+	return HWDNSOk;
+}
+
+int HWDNSNameEquals(const uint8_t *packet, size_t length, size_t offset, const char *name)
+{
+	uint8_t label[HWDNSMaxLabelLength];
+	const char *cursor = name;
+	int hops = 0;
+
+	for(;;)
+	{
+		if(offset >= length)
+			return 0;
+
+		uint8_t l = packet[offset];
+		if((l & 0xC0) == 0xC0)
+		{
+			if(offset + 1 >= length)
+				return 0;
+			size_t target = ((size_t)(l & 0x3F) << 8) | packet[offset + 1];
+			if(target >= offset || ++hops > HWDNSMaxPointerHops)
+				return 0;
+			offset = target;
+			continue;
+		}
+		if(l & 0xC0)
+			return 0;
+
+		int n = *cursor ? HWDNSNextLabel(&cursor, label) : 0;
+		if(n < 0 || n != l)
+			return 0;
+		if(l == 0)
+			return 1;
+		if(offset + 1 + l > length)
+			return 0;
+
+		for(int i = 0; i < l; i++)
+			if(HWDNSLower(packet[offset + 1 + i]) != HWDNSLower(label[i]))
+				return 0;
+
+		offset += 1 + l;
+	}
+}
+
+int HWDNSReadSRV(const uint8_t *packet, size_t length, const HWDNSRecord *record, uint16_t *priority, uint16_t *weight, uint16_t *port, size_t *targetOffset)
+{
+	if(record->type != HWDNSTypeSRV || record->rdataLength < 7 || record->rdataOffset + record->rdataLength > length)
+		return HWDNSMalformed;
+
+	const uint8_t *p = packet + record->rdataOffset;
+	if(priority) *priority = HWDNSGet16(p);
+	if(weight) *weight = HWDNSGet16(p + 2);
+	if(port) *port = HWDNSGet16(p + 4);
+	if(targetOffset) *targetOffset = record->rdataOffset + 6;
+	return HWDNSOk;
+}
+
+// Writing
+
+void HWDNSWriterInit(HWDNSWriter *writer, uint8_t *buffer, size_t capacity, uint16_t id, uint16_t flags)
+{
+	memset(writer, 0, sizeof(*writer));
+	writer->buffer = buffer;
+	writer->capacity = capacity;
+
+	if(capacity < HWDNSHeaderLength)
+	{
+		writer->truncated = 1;
+		return;
+	}
+
+	memset(buffer, 0, HWDNSHeaderLength);
+	HWDNSPut16(buffer, id);
+	HWDNSPut16(buffer + 2, flags);
+	writer->length = HWDNSHeaderLength;
+}
+
+static int HWDNSWriteName(HWDNSWriter *writer, const char *name)
+{
+	const char *cursor = name;
+	if(*cursor == '.')
+		cursor++;
+
+	while(*cursor)
+	{
+		// Reuse an earlier copy of the rest of this name if we've written one
+		for(int i = 0; i < writer->targetCount; i++)
+		{
+			if(HWDNSNameEquals(writer->buffer, writer->length, writer->targets[i], cursor))
+			{
+				if(writer->length + 2 > writer->capacity)
+					return HWDNSNoSpace;
+				HWDNSPut16(writer->buffer + writer->length, 0xC000 | writer->targets[i]);
+				writer->length += 2;
+				return HWDNSOk;
+			}
+		}
+
+		size_t labelOffset = writer->length;
+		uint8_t label[HWDNSMaxLabelLength];
+		const char *suffix = cursor;
+		int n = HWDNSNextLabel(&cursor, label);
+		if(n <= 0)
+			return HWDNSMalformed;
+		if(writer->length + 1 + n > writer->capacity)
+			return HWDNSNoSpace;
+
+		writer->buffer[writer->length] = (uint8_t)n;
+		memcpy(writer->buffer + writer->length + 1, label, n);
+		writer->length += 1 + n;
+
+		if(labelOffset < 0x3FFF && writer->targetCount < HWDNSMaxCompressionTargets && *suffix)
+			writer->targets[writer->targetCount++] = (uint16_t)labelOffset;
+	}
+
+	if(writer->length + 1 > writer->capacity)
+		return HWDNSNoSpace;
+	writer->buffer[writer->length++] = 0;
+	return HWDNSOk;
+}
+
+// Brackets a single question or record write, rolling the buffer back if it doesn't fit
+typedef struct _HWDNSWriterMark {
+	size_t length;
+	int targetCount;
+} HWDNSWriterMark;
+
+static int HWDNSBeginWrite(HWDNSWriter *writer, HWDNSSection section, HWDNSWriterMark *mark)
+{
+	if(writer->truncated)
+		return HWDNSNoSpace;
+	if((int)section < writer->section)
+		return HWDNSMalformed;
+
+	mark->length = writer->length;
+	mark->targetCount = writer->targetCount;
+	return HWDNSOk;
+}
+
+static int HWDNSEndWrite(HWDNSWriter *writer, HWDNSSection section, HWDNSWriterMark *mark, int result)
+{
+	if(result != HWDNSOk)
+	{
+		writer->length = mark->length;
+		writer->targetCount = mark->targetCount;
+		if(result == HWDNSNoSpace)
+			writer->truncated = 1;
+		return result;
+	}
+
+	writer->section = section;
+	writer->counts[section]++;
+	return HWDNSOk;
+}
+
+int HWDNSWriteQuestion(HWDNSWriter *writer, const char *name, uint16_t type, uint16_t rrclass)
+{
+	HWDNSWriterMark mark;
+	int result = HWDNSBeginWrite(writer, HWDNSSectionQuestion, &mark);
+	if(result != HWDNSOk)
+		return result;
+
+	result = HWDNSWriteName(writer, name);
+	if(result == HWDNSOk)
+	{
+		if(writer->length + 4 > writer->capacity)
+			result = HWDNSNoSpace;
+		else
+		{
+			HWDNSPut16(writer->buffer + writer->length, type);
+			HWDNSPut16(writer->buffer + writer->length + 2, rrclass);
+			writer->length += 4;
+		}
+	}
+	return HWDNSEndWrite(writer, HWDNSSectionQuestion, &mark, result);
+}
+
+// Writes name, type, class, ttl and a zero rdlength, leaving *rdlengthOffset to patch later
+static int HWDNSWriteRecordHeader(HWDNSWriter *writer, const char *name, uint16_t type, uint16_t rrclass, uint32_t ttl, size_t *rdlengthOffset)
+{
+	int result = HWDNSWriteName(writer, name);
+	if(result != HWDNSOk)
+		return result;
+	if(writer->length + 10 > writer->capacity)
+		return HWDNSNoSpace;
+
+	uint8_t *p = writer->buffer + writer->length;
+	HWDNSPut16(p, type);
+	HWDNSPut16(p + 2, rrclass);
+	HWDNSPut32(p + 4, ttl);
+	HWDNSPut16(p + 8, 0);
+	*rdlengthOffset = writer->length + 8;
+	writer->length += 10;
+	return HWDNSOk;
+}
+
+int HWDNSWriteRecord(HWDNSWriter *writer, HWDNSSection section, const char *name, uint16_t type, uint16_t rrclass, uint32_t ttl, const void *rdata, uint16_t rdataLength)
+{
+	if(section == HWDNSSectionQuestion)
+		return HWDNSMalformed;
+
+	HWDNSWriterMark mark;
+	int result = HWDNSBeginWrite(writer, section, &mark);
+	if(result != HWDNSOk)
+		return result;
+
+	size_t rdlengthOffset;
+	result = HWDNSWriteRecordHeader(writer, name, type, rrclass, ttl, &rdlengthOffset);
+	if(result == HWDNSOk)
+	{
+		if(writer->length + rdataLength > writer->capacity)
+			result = HWDNSNoSpace;
+		else
+		{
+			if(rdataLength)
+				memcpy(writer->buffer + writer->length, rdata, rdataLength);
+			writer->length += rdataLength;
+			HWDNSPut16(writer->buffer + rdlengthOffset, rdataLength);
+		}
+	}
+	return HWDNSEndWrite(writer, section, &mark, result);
+}
+
+int HWDNSWritePTR(HWDNSWriter *writer, HWDNSSection section, const char *name, uint16_t rrclass, uint32_t ttl, const char *target)
+{
+	if(section == HWDNSSectionQuestion)
+		return HWDNSMalformed;
+
+	HWDNSWriterMark mark;
+	int result = HWDNSBeginWrite(writer, section, &mark);
+	if(result != HWDNSOk)
+		return result;
+
+	size_t rdlengthOffset;
+	result = HWDNSWriteRecordHeader(writer, name, HWDNSTypePTR, rrclass, ttl, &rdlengthOffset);
+	if(result == HWDNSOk)
+	{
+		size_t start = writer->length;
+		result = HWDNSWriteName(writer, target);
+		if(result == HWDNSOk)
+			HWDNSPut16(writer->buffer + rdlengthOffset, (uint16_t)(writer->length - start));
+	}
+	return HWDNSEndWrite(writer, section, &mark, result);
+}
+
+int HWDNSWriteSRV(HWDNSWriter *writer, HWDNSSection section, const char *name, uint16_t rrclass, uint32_t ttl, uint16_t priority, uint16_t weight, uint16_t port, const char *target)
+{
+	if(section == HWDNSSectionQuestion)
+		return HWDNSMalformed;
+
+	HWDNSWriterMark mark;
+	int result = HWDNSBeginWrite(writer, section, &mark);
+	if(result != HWDNSOk)
+		return result;
+
+	size_t rdlengthOffset;
+	result = HWDNSWriteRecordHeader(writer, name, HWDNSTypeSRV, rrclass, ttl, &rdlengthOffset);
+	if(result == HWDNSOk)
+	{
+		size_t start = writer->length;
+		if(writer->length + 6 > writer->capacity)
+			result = HWDNSNoSpace;
+		else
+		{
+			HWDNSPut16(writer->buffer + writer->length, priority);
+			HWDNSPut16(writer->buffer + writer->length + 2, weight);
+			HWDNSPut16(writer->buffer + writer->length + 4, port);
+			writer->length += 6;
+			result = HWDNSWriteName(writer, target);
+		}
+		if(result == HWDNSOk)
+			HWDNSPut16(writer->buffer + rdlengthOffset, (uint16_t)(writer->length - start));
+	}
+	return HWDNSEndWrite(writer, section, &mark, result);
+}
+
+size_t HWDNSWriterFinish(HWDNSWriter *writer)
+{
+	if(writer->capacity < HWDNSHeaderLength)
+		return 0;
+
+	for(int i = 0; i < 4; i++)
+		HWDNSPut16(writer->buffer + 4 + i * 2, writer->counts[i]);
+	if(writer->truncated && writer->counts[HWDNSSectionQuestion] > 0)
+		HWDNSPut16(writer->buffer + 2, HWDNSGet16(writer->buffer + 2) | HWDNSFlagTruncated);
+	return writer->length;
+}
@@ -0,0 +1,127 @@
+//
+//  HWDNSPacket.h
+//
+//  A DNS / mDNS packet reader and writer that never allocates. The reader walks
+//  records in place inside the caller's buffer and only decodes names on request;
+//  the writer fills a caller supplied buffer and compresses names against what it
+//  has already written. Everything here is plain C so it builds on Linux too.
+//
+
+#ifndef HWDNSPACKET_H
+#define HWDNSPACKET_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define HWDNSHeaderLength 12
+#define HWDNSMaxNameLength 256
+#define HWDNSMaxLabelLength 63
+
+// mDNS packets are limited by the link MTU, 9000 covers jumbo frames
+#define HWDNSMaxPacketLength 9000
+
+// Compression pointers we're willing to follow while decoding one name
+#define HWDNSMaxPointerHops 16
+
+// Names the writer remembers for compression
+#define HWDNSMaxCompressionTargets 32
+
+#define HWDNSTypeA 1
+#define HWDNSTypePTR 12
+#define HWDNSTypeTXT 16
+#define HWDNSTypeAAAA 28
+#define HWDNSTypeSRV 33
+#define HWDNSTypeANY 255
+
+#define HWDNSClassIN 1
+
+// Top bit of the class: unicast-response in questions, cache-flush in records
+#define HWDNSClassFlag 0x8000
+
+#define HWDNSFlagResponse 0x8000
+#define HWDNSFlagAuthoritative 0x0400
+#define HWDNSFlagTruncated 0x0200
+
+typedef enum _HWDNSSection {
+	HWDNSSectionQuestion = 0,
+	HWDNSSectionAnswer = 1,
+	HWDNSSectionAuthority = 2,
+	HWDNSSectionAdditional = 3
+} HWDNSSection;
+
+typedef enum _HWDNSResult {
+	HWDNSOk = 1,
+	HWDNSEnd = 0,
+	HWDNSMalformed = -1,
+	HWDNSNoSpace = -2
+} HWDNSResult;
+
+typedef struct _HWDNSReader {
+	const uint8_t *packet;
+	size_t length;
+	size_t offset;
+	uint16_t id;
+	uint16_t flags;
+	uint16_t counts[4];
+	int section;
+	unsigned int remaining;
+} HWDNSReader;
+
+// A record (or question) still pointing into the packet. Questions leave ttl and rdata zeroed.
+typedef struct _HWDNSRecord {
+	HWDNSSection section;
+	size_t nameOffset;
+	uint16_t type;
+	uint16_t rrclass;
+	int classFlag;
+	uint32_t ttl;
+	size_t rdataOffset;
+	uint16_t rdataLength;
+} HWDNSRecord;
+
+typedef struct _HWDNSWriter {
+	uint8_t *buffer;
+	size_t capacity;
+	size_t length;
+	uint16_t counts[4];
+	int section;
+	int truncated;
+	uint16_t targets[HWDNSMaxCompressionTargets];
+	int targetCount;
+} HWDNSWriter;
+
+// Reading
+
+// Checks the header. Returns HWDNSMalformed for packets shorter than a header.
+int HWDNSReaderInit(HWDNSReader *reader, const uint8_t *packet, size_t length);
+
+// Steps to the next question or record. Returns HWDNSOk, HWDNSEnd or HWDNSMalformed.
+int HWDNSReaderNext(HWDNSReader *reader, HWDNSRecord *record);
+
+// Decodes the (possibly compressed) name at offset as dotted text with a trailing dot.
+// end, when given, receives the offset just past the name in the packet.
+int HWDNSReadName(const uint8_t *packet, size_t length, size_t offset, char *name, size_t nameSize, size_t *end);
+
+// Case-insensitive comparison of the name at offset against a dotted name, without decoding it
+int HWDNSNameEquals(const uint8_t *packet, size_t length, size_t offset, const char *name);
+
+// SRV rdata helpers
+int HWDNSReadSRV(const uint8_t *packet, size_t length, const HWDNSRecord *record, uint16_t *priority, uint16_t *weight, uint16_t *port, size_t *targetOffset);
+
+// Writing
+
+void HWDNSWriterInit(HWDNSWriter *writer, uint8_t *buffer, size_t capacity, uint16_t id, uint16_t flags);
+
+// Sections have to be written in order: questions, answers, authority, additional
+int HWDNSWriteQuestion(HWDNSWriter *writer, const char *name, uint16_t type, uint16_t rrclass);
+int HWDNSWriteRecord(HWDNSWriter *writer, HWDNSSection section, const char *name, uint16_t type, uint16_t rrclass, uint32_t ttl, const void *rdata, uint16_t rdataLength);
+
+// Records whose rdata holds a name (PTR) or starts with fixed fields then a name (SRV), so it can be compressed
+int HWDNSWritePTR(HWDNSWriter *writer, HWDNSSection section, const char *name, uint16_t rrclass, uint32_t ttl, const char *target);
+int HWDNSWriteSRV(HWDNSWriter *writer, HWDNSSection section, const char *name, uint16_t rrclass, uint32_t ttl, uint16_t priority, uint16_t weight, uint16_t port, const char *target);
+
+// Marks the last successful write as the end of the packet and fills in the header counts.
+// Returns the packet length.
+size_t HWDNSWriterFinish(HWDNSWriter *writer);
+
+#endif
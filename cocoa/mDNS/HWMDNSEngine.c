@@ -0,0 +1,874 @@
+//
+//  HWMDNSEngine.c
+//
+
+#include "HWMDNSEngine.h"
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+// Largest packet we send, an Ethernet MTU minus IP and UDP headers
+#define HWMDNSMaxMessageLength 1472
+
+#define HWMDNSServicesMetaQuery "_services._dns-sd._udp.local."
+
+typedef struct _HWMDNSLocalService {
+	int active;
+	char instance[HWDNSMaxNameLength];
+	char type[HWDNSMaxNameLength];
+	uint16_t port;
+	uint8_t txt[HWMDNSMaxTXTLength];
+	uint16_t txtLength;
+} HWMDNSLocalService;
+
+typedef struct _HWMDNSQuestion {
+	int active;
+	int pending;
+	char name[HWDNSMaxNameLength];
+} HWMDNSQuestion;
+
+// PTR and SRV keep their target name decoded, TXT and A keep raw rdata
+typedef struct _HWMDNSCacheEntry {
+	int active;
+	uint16_t type;
+	char name[HWDNSMaxNameLength];
+	char target[HWDNSMaxNameLength];
+	uint16_t port;
+	uint8_t rdata[HWMDNSMaxTXTLength];
+	uint16_t rdataLength;
+	uint32_t ttl;
+	double received;
+} HWMDNSCacheEntry;
+
+typedef struct _HWMDNSPacketSlot {
+	size_t length;
+	uint8_t bytes[HWDNSMaxPacketLength];
+} HWMDNSPacketSlot;
+
+struct _HWMDNSLoopbackBus {
+	HWMDNSEngine *engines[HWMDNSMaxLoopbackPeers];
+	int count;
+};
+
+struct _HWMDNSEngine {
+	HWMDNSTransport transport;
+	HWMDNSLoopbackBus *bus;
+	int socket;
+
+	HWMDNSEventCallBack callBack;
+	void *context;
+
+	char host[HWDNSMaxNameLength];
+	uint32_t ipv4;
+
+	HWMDNSLocalService services[HWMDNSMaxServices];
+	HWMDNSQuestion questions[HWMDNSMaxQuestions];
+	HWMDNSCacheEntry cache[HWMDNSMaxCacheEntries];
+
+	HWMDNSPacketSlot inbox[HWMDNSInboxSlots];
+	int inboxHead;
+	int inboxCount;
+
+	uint8_t outgoing[HWMDNSMaxMessageLength];
+	uint8_t incoming[HWDNSMaxPacketLength];
+
+	HWMDNSStatistics statistics;
+};
+
+// Names
+
+// "_daap._tcp", "_daap._tcp." and "_daap._tcp.local." all become "_daap._tcp.local."
+static int HWMDNSMakeTypeName(const char *type, char *name, size_t nameSize)
+{
+	size_t length = strlen(type);
+	while(length > 0 && type[length - 1] == '.')
+		length--;
+	if(length >= 6 && strncasecmp(type + length - 6, ".local", 6) == 0)
+		length -= 6;
+	if(length == 0 || length + 8 > nameSize)
+		return HWDNSMalformed;
+
+	memcpy(name, type, length);
+	memcpy(name + length, ".local.", 8);
+	return HWDNSOk;
+}
+
+// Instance names are free text, so dots and backslashes inside them have to be escaped
+static int HWMDNSMakeInstanceName(const char *instance, const char *typeName, char *name, size_t nameSize)
+{
+	size_t n = 0;
+	for(const char *c = instance; *c; c++)
+	{
+		if(n + 2 >= nameSize)
+			return HWDNSMalformed;
+		if(*c == '.' || *c == '\\')
+			name[n++] = '\\';
+		name[n++] = *c;
+	}
+	if(n == 0 || n + 1 + strlen(typeName) + 1 > nameSize)
+		return HWDNSMalformed;
+
+	name[n++] = '.';
+	strcpy(name + n, typeName);
+	return HWDNSOk;
+}
+
+// Transport
+
+static int HWMDNSOpenMulticastSocket(void)
+{
+	int s = socket(AF_INET, SOCK_DGRAM, 0);
+	if(s < 0)
+		return -1;
+
+	int yes = 1;
+	setsockopt(s, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes));
+#ifdef SO_REUSEPORT
+	setsockopt(s, SOL_SOCKET, SO_REUSEPORT, &yes, sizeof(yes));
+#endif
+
+	struct sockaddr_in addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_ANY);
+	addr.sin_port = htons(HWMDNSPort);
+	if(bind(s, (struct sockaddr *)&addr, sizeof(addr)) != 0)
+	{
+		close(s);
+		return -1;
+	}
+
+	struct ip_mreq membership;
+	memset(&membership, 0, sizeof(membership));
+	membership.imr_multiaddr.s_addr = inet_addr(HWMDNSGroup);
+	membership.imr_interface.s_addr = htonl(INADDR_ANY);
+	if(setsockopt(s, IPPROTO_IP, IP_ADD_MEMBERSHIP, &membership, sizeof(membership)) != 0)
+	{
+		close(s);
+		return -1;
+	}
+
+	unsigned char ttl = 255;
+	unsigned char loop = 1;
+	setsockopt(s, IPPROTO_IP, IP_MULTICAST_TTL, &ttl, sizeof(ttl));
+	setsockopt(s, IPPROTO_IP, IP_MULTICAST_LOOP, &loop, sizeof(loop));
+
+	fcntl(s, F_SETFL, fcntl(s, F_GETFL, 0) | O_NONBLOCK);
+	return s;
+}
+
+// Loopback delivery copies the packet into every engine on the bus, including the sender,
+// the same way IP_MULTICAST_LOOP hands multicast back to the sending host
+static int HWMDNSSend(HWMDNSEngine *engine, const uint8_t *packet, size_t length)
+{
+	if(length == 0)
+		return HWDNSOk;
+
+	if(engine->transport == HWMDNSTransportLoopback)
+	{
+		for(int i = 0; i < engine->bus->count; i++)
+		{
+			HWMDNSEngine *peer = engine->bus->engines[i];
+			if(peer->inboxCount == HWMDNSInboxSlots)
+				continue;
+
+			HWMDNSPacketSlot *slot = &peer->inbox[(peer->inboxHead + peer->inboxCount) % HWMDNSInboxSlots];
+			memcpy(slot->bytes, packet, length);
+			slot->length = length;
+			peer->inboxCount++;
+		}
+	}
+	else
+	{
+		struct sockaddr_in addr;
+		memset(&addr, 0, sizeof(addr));
+		addr.sin_family = AF_INET;
+		addr.sin_addr.s_addr = inet_addr(HWMDNSGroup);
+		addr.sin_port = htons(HWMDNSPort);
+		if(sendto(engine->socket, packet, length, 0, (struct sockaddr *)&addr, sizeof(addr)) < 0)
+			return HWDNSMalformed;
+	}
+
+	engine->statistics.packetsSent++;
+	return HWDNSOk;
+}
+
+// Cache
+
+static double HWMDNSRemaining(const HWMDNSCacheEntry *entry, double now)
+{
+	return entry->received + entry->ttl - now;
+}
+
+static HWMDNSCacheEntry *HWMDNSFindEntry(HWMDNSEngine *engine, uint16_t type, const char *name, const char *target)
+{
+	for(int i = 0; i < HWMDNSMaxCacheEntries; i++)
+	{
+		HWMDNSCacheEntry *entry = &engine->cache[i];
+		if(!entry->active || entry->type != type || strcasecmp(entry->name, name) != 0)
+			continue;
+		if(target && strcasecmp(entry->target, target) != 0)
+			continue;
+		return entry;
+	}
+	return NULL;
+}
+
+// Free slot, or the entry closest to expiring when the cache is full
+static HWMDNSCacheEntry *HWMDNSNewEntry(HWMDNSEngine *engine, double now)
+{
+	HWMDNSCacheEntry *oldest = NULL;
+	for(int i = 0; i < HWMDNSMaxCacheEntries; i++)
+	{
+		HWMDNSCacheEntry *entry = &engine->cache[i];
+		if(!entry->active)
+			return entry;
+		if(!oldest || HWMDNSRemaining(entry, now) < HWMDNSRemaining(oldest, now))
+			oldest = entry;
+	}
+	return oldest;
+}
+
+static int HWMDNSIsBrowsing(HWMDNSEngine *engine, const char *typeName)
+{
+	for(int i = 0; i < HWMDNSMaxQuestions; i++)
+		if(engine->questions[i].active && strcasecmp(engine->questions[i].name, typeName) == 0)
+			return 1;
+	return 0;
+}
+
+static void HWMDNSSendEvent(HWMDNSEngine *engine, HWMDNSEventKind kind, const HWMDNSCacheEntry *ptr, double now)
+{
+	if(!engine->callBack)
+		return;
+
+	HWMDNSEvent event;
+	memset(&event, 0, sizeof(event));
+	event.kind = kind;
+	event.instance = ptr->target;
+	event.type = ptr->name;
+
+	if(kind == HWMDNSServiceResolved)
+	{
+		HWMDNSCacheEntry *srv = HWMDNSFindEntry(engine, HWDNSTypeSRV, ptr->target, NULL);
+		if(!srv)
+			return;
+		event.host = srv->target;
+		event.port = srv->port;
+
+		HWMDNSCacheEntry *txt = HWMDNSFindEntry(engine, HWDNSTypeTXT, ptr->target, NULL);
+		if(txt)
+		{
+			event.txt = txt->rdata;
+			event.txtLength = txt->rdataLength;
+		}
+
+		HWMDNSCacheEntry *a = HWMDNSFindEntry(engine, HWDNSTypeA, srv->target, NULL);
+		if(a && a->rdataLength == 4)
+			memcpy(&event.ipv4, a->rdata, 4);
+	}
+
+	(void)now;
+	engine->callBack(engine, &event, engine->context);
+}
+
+static void HWMDNSExpire(HWMDNSEngine *engine, double now)
+{
+	for(int i = 0; i < HWMDNSMaxCacheEntries; i++)
+	{
+		HWMDNSCacheEntry *entry = &engine->cache[i];
+		if(!entry->active || HWMDNSRemaining(entry, now) > 0)
+			continue;
+		if(entry->type == HWDNSTypePTR && HWMDNSIsBrowsing(engine, entry->name))
+			HWMDNSSendEvent(engine, HWMDNSServiceLost, entry, now);
+		entry->active = 0;
+	}
+}
+
+// Stores one answer. A TTL of zero is a goodbye and drops the record (RFC 6762 section 10.1).
+static void HWMDNSCacheRecord(HWMDNSEngine *engine, const uint8_t *packet, size_t length, const HWDNSRecord *record, double now)
+{
+	if(record->type != HWDNSTypePTR && record->type != HWDNSTypeSRV && record->type != HWDNSTypeTXT && record->type != HWDNSTypeA)
+		return;
+
+	char name[HWDNSMaxNameLength];
+	char target[HWDNSMaxNameLength];
+	uint16_t port = 0;
+	target[0] = '\0';
+
+	if(HWDNSReadName(packet, length, record->nameOffset, name, sizeof(name), NULL) != HWDNSOk)
+		return;
+
+	if(record->type == HWDNSTypePTR)
+	{
+		if(!HWMDNSIsBrowsing(engine, name))
+			return;
+		if(HWDNSReadName(packet, length, record->rdataOffset, target, sizeof(target), NULL) != HWDNSOk)
+			return;
+	}
+	else if(record->type == HWDNSTypeSRV)
+	{
+		size_t targetOffset;
+		uint16_t priority, weight;
+		if(HWDNSReadSRV(packet, length, record, &priority, &weight, &port, &targetOffset) != HWDNSOk)
+			return;
+		if(HWDNSReadName(packet, length, targetOffset, target, sizeof(target), NULL) != HWDNSOk)
+			return;
+	}
+	else if(record->rdataLength > HWMDNSMaxTXTLength)
+		return;
+
+	// Shared PTR records are told apart by target, the others are unique per name
+	HWMDNSCacheEntry *entry = HWMDNSFindEntry(engine, record->type, name, record->type == HWDNSTypePTR ? target : NULL);
+
+	if(record->ttl == 0)
+	{
+		if(entry)
+		{
+			if(entry->type == HWDNSTypePTR)
+				HWMDNSSendEvent(engine, HWMDNSServiceLost, entry, now);
+			entry->active = 0;
+		}
+		return;
+	}
+
+	int isNew = (entry == NULL);
+	if(!entry)
+		entry = HWMDNSNewEntry(engine, now);
+
+	entry->active = 1;
+	entry->type = record->type;
+	strcpy(entry->name, name);
+	strcpy(entry->target, target);
+	entry->port = port;
+	entry->rdataLength = 0;
+	if(record->type == HWDNSTypeTXT || record->type == HWDNSTypeA)
+	{
+		memcpy(entry->rdata, packet + record->rdataOffset, record->rdataLength);
+		entry->rdataLength = record->rdataLength;
+	}
+	entry->ttl = record->ttl;
+	entry->received = now;
+
+	if(isNew && entry->type == HWDNSTypePTR)
+		HWMDNSSendEvent(engine, HWMDNSServiceFound, entry, now);
+}
+
+// Responder
+
+typedef enum _HWMDNSLocalRecord {
+	HWMDNSLocalPTR = 0,
+	HWMDNSLocalTypePTR = 1,
+	HWMDNSLocalSRV = 2,
+	HWMDNSLocalTXT = 3,
+	HWMDNSLocalA = 4
+} HWMDNSLocalRecord;
+
+// A query that already lists our PTR with at least half its TTL left doesn't need an answer (RFC 6762 section 7.1)
+static int HWMDNSIsKnownAnswer(const uint8_t *packet, size_t length, const char *name, const char *target, uint32_t ttl)
+{
+	HWDNSReader reader;
+	HWDNSRecord record;
+	if(HWDNSReaderInit(&reader, packet, length) != HWDNSOk)
+		return 0;
+
+	while(HWDNSReaderNext(&reader, &record) == HWDNSOk)
+	{
+		if(record.section != HWDNSSectionAnswer || record.type != HWDNSTypePTR)
+			continue;
+		if(record.ttl < ttl / 2)
+			continue;
+		if(HWDNSNameEquals(packet, length, record.nameOffset, name) && HWDNSNameEquals(packet, length, record.rdataOffset, target))
+			return 1;
+	}
+	return 0;
+}
+
+// ttlScale 0 turns the record into a goodbye
+static int HWMDNSWriteLocalRecord(HWMDNSEngine *engine, HWDNSWriter *writer, HWDNSSection section, HWMDNSLocalRecord kind, const HWMDNSLocalService *service, uint32_t ttlScale)
+{
+	// An empty TXT record is a single zero length string (RFC 6763 section 6.1)
+	static const uint8_t emptyTXT[1] = { 0 };
+	uint16_t uniqueClass = HWDNSClassIN | HWDNSClassFlag;
+
+	switch(kind)
+	{
+		case HWMDNSLocalPTR:
+			return HWDNSWritePTR(writer, section, service->type, HWDNSClassIN, HWMDNSServiceRecordTTL * ttlScale, service->instance);
+		case HWMDNSLocalTypePTR:
+			return HWDNSWritePTR(writer, section, HWMDNSServicesMetaQuery, HWDNSClassIN, HWMDNSServiceRecordTTL * ttlScale, service->type);
+		case HWMDNSLocalSRV:
+			return HWDNSWriteSRV(writer, section, service->instance, uniqueClass, HWMDNSHostRecordTTL * ttlScale, 0, 0, service->port, engine->host);
+		case HWMDNSLocalTXT:
+			if(service->txtLength > 0)
+				return HWDNSWriteRecord(writer, section, service->instance, HWDNSTypeTXT, uniqueClass, HWMDNSServiceRecordTTL * ttlScale, service->txt, service->txtLength);
+			return HWDNSWriteRecord(writer, section, service->instance, HWDNSTypeTXT, uniqueClass, HWMDNSServiceRecordTTL * ttlScale, emptyTXT, 1);
+		case HWMDNSLocalA:
+			return HWDNSWriteRecord(writer, section, engine->host, HWDNSTypeA, uniqueClass, HWMDNSHostRecordTTL * ttlScale, &engine->ipv4, 4);
+	}
+	return HWDNSMalformed;
+}
+
+// Writes one record into the response, sending what has been written so far and
+// starting a new packet when it doesn't fit
+static int HWMDNSRespond(HWMDNSEngine *engine, HWDNSWriter *writer, HWDNSSection section, HWMDNSLocalRecord kind, const HWMDNSLocalService *service, uint32_t ttlScale)
+{
+	if(kind == HWMDNSLocalA && engine->ipv4 == 0)
+		return HWDNSEnd;
+
+	int result = HWMDNSWriteLocalRecord(engine, writer, section, kind, service, ttlScale);
+	if(result == HWDNSNoSpace)
+	{
+		HWMDNSSend(engine, engine->outgoing, HWDNSWriterFinish(writer));
+		HWDNSWriterInit(writer, engine->outgoing, sizeof(engine->outgoing), 0, HWDNSFlagResponse | HWDNSFlagAuthoritative);
+		result = HWMDNSWriteLocalRecord(engine, writer, section, kind, service, ttlScale);
+	}
+	if(result == HWDNSOk)
+		engine->statistics.answersSent++;
+	return result;
+}
+
+// Every question in the query is answered together. Records that only help the
+// querier (SRV, TXT and A for PTR answers) follow in the additional section so
+// browsing needs no second round trip to resolve.
+static void HWMDNSAnswerQuery(HWMDNSEngine *engine, const uint8_t *packet, size_t length)
+{
+	HWDNSReader reader;
+	HWDNSRecord record;
+	if(HWDNSReaderInit(&reader, packet, length) != HWDNSOk)
+		return;
+
+	uint8_t answeredPTR[HWMDNSMaxServices];
+	uint8_t answeredSRV[HWMDNSMaxServices];
+	uint8_t answeredType[HWMDNSMaxServices];
+	int answeredHost = 0;
+	int answers = 0;
+	memset(answeredPTR, 0, sizeof(answeredPTR));
+	memset(answeredSRV, 0, sizeof(answeredSRV));
+	memset(answeredType, 0, sizeof(answeredType));
+
+	HWDNSWriter writer;
+	HWDNSWriterInit(&writer, engine->outgoing, sizeof(engine->outgoing), 0, HWDNSFlagResponse | HWDNSFlagAuthoritative);
+
+	while(HWDNSReaderNext(&reader, &record) == HWDNSOk && record.section == HWDNSSectionQuestion)
+	{
+		int wantsPTR = (record.type == HWDNSTypePTR || record.type == HWDNSTypeANY);
+		int wantsSRV = (record.type == HWDNSTypeSRV || record.type == HWDNSTypeTXT || record.type == HWDNSTypeANY);
+		int wantsA = (record.type == HWDNSTypeA || record.type == HWDNSTypeANY);
+
+		if(wantsA && !answeredHost && HWDNSNameEquals(packet, length, record.nameOffset, engine->host))
+		{
+			answeredHost = 1;
+			if(HWMDNSRespond(engine, &writer, HWDNSSectionAnswer, HWMDNSLocalA, NULL, 1) == HWDNSOk)
+				answers++;
+		}
+
+		int meta = wantsPTR && HWDNSNameEquals(packet, length, record.nameOffset, HWMDNSServicesMetaQuery);
+
+		for(int i = 0; i < HWMDNSMaxServices; i++)
+		{
+			HWMDNSLocalService *service = &engine->services[i];
+			if(!service->active)
+				continue;
+
+			if(meta && !answeredType[i])
+			{
+				// One answer per distinct type
+				int duplicate = 0;
+				for(int j = 0; j < i && !duplicate; j++)
+					duplicate = engine->services[j].active && answeredType[j] && strcasecmp(engine->services[j].type, service->type) == 0;
+				answeredType[i] = 1;
+				if(!duplicate && HWMDNSRespond(engine, &writer, HWDNSSectionAnswer, HWMDNSLocalTypePTR, service, 1) == HWDNSOk)
+					answers++;
+			}
+
+			if(wantsPTR && !answeredPTR[i] && HWDNSNameEquals(packet, length, record.nameOffset, service->type))
+			{
+				answeredPTR[i] = 1;
+				if(HWMDNSIsKnownAnswer(packet, length, service->type, service->instance, HWMDNSServiceRecordTTL))
+				{
+					answeredPTR[i] = 2;
+					engine->statistics.answersSuppressed++;
+					continue;
+				}
+				if(HWMDNSRespond(engine, &writer, HWDNSSectionAnswer, HWMDNSLocalPTR, service, 1) == HWDNSOk)
+					answers++;
+			}
+			else if(wantsSRV && !answeredSRV[i] && HWDNSNameEquals(packet, length, record.nameOffset, service->instance))
+			{
+				answeredSRV[i] = 1;
+				if(HWMDNSRespond(engine, &writer, HWDNSSectionAnswer, HWMDNSLocalSRV, service, 1) == HWDNSOk)
+					answers++;
+				if(HWMDNSRespond(engine, &writer, HWDNSSectionAnswer, HWMDNSLocalTXT, service, 1) == HWDNSOk)
+					answers++;
+			}
+		}
+	}
+
+	if(answers == 0)
+		return;
+
+	for(int i = 0; i < HWMDNSMaxServices; i++)
+	{
+		HWMDNSLocalService *service = &engine->services[i];
+		if(!service->active || answeredPTR[i] != 1 || answeredSRV[i])
+			continue;
+		HWMDNSRespond(engine, &writer, HWDNSSectionAdditional, HWMDNSLocalSRV, service, 1);
+		HWMDNSRespond(engine, &writer, HWDNSSectionAdditional, HWMDNSLocalTXT, service, 1);
+		if(!answeredHost)
+		{
+			answeredHost = 1;
+			HWMDNSRespond(engine, &writer, HWDNSSectionAdditional, HWMDNSLocalA, NULL, 1);
+		}
+	}
+
+	HWMDNSSend(engine, engine->outgoing, HWDNSWriterFinish(&writer));
+}
+
+// Unsolicited response for one service. ttlScale 0 turns it into a goodbye.
+static int HWMDNSAnnounce(HWMDNSEngine *engine, const HWMDNSLocalService *service, uint32_t ttlScale)
+{
+	HWDNSWriter writer;
+	HWDNSWriterInit(&writer, engine->outgoing, sizeof(engine->outgoing), 0, HWDNSFlagResponse | HWDNSFlagAuthoritative);
+
+	HWMDNSRespond(engine, &writer, HWDNSSectionAnswer, HWMDNSLocalPTR, service, ttlScale);
+	HWMDNSRespond(engine, &writer, HWDNSSectionAnswer, HWMDNSLocalSRV, service, ttlScale);
+	HWMDNSRespond(engine, &writer, HWDNSSectionAnswer, HWMDNSLocalTXT, service, ttlScale);
+	if(ttlScale > 0)
+		HWMDNSRespond(engine, &writer, HWDNSSectionAdditional, HWMDNSLocalA, service, ttlScale);
+
+	return HWMDNSSend(engine, engine->outgoing, HWDNSWriterFinish(&writer));
+}
+
+// Public
+
+HWMDNSLoopbackBus *HWMDNSLoopbackBusCreate(void)
+{
+	return calloc(1, sizeof(HWMDNSLoopbackBus));
+}
+
+void HWMDNSLoopbackBusDestroy(HWMDNSLoopbackBus *bus)
+{
+	free(bus);
+}
+
+HWMDNSEngine *HWMDNSEngineCreate(HWMDNSTransport transport, HWMDNSLoopbackBus *bus, HWMDNSEventCallBack callBack, void *context)
+{
+	if(transport == HWMDNSTransportLoopback && (!bus || bus->count == HWMDNSMaxLoopbackPeers))
+		return NULL;
+
+	HWMDNSEngine *engine = calloc(1, sizeof(HWMDNSEngine));
+	if(!engine)
+		return NULL;
+
+	engine->transport = transport;
+	engine->callBack = callBack;
+	engine->context = context;
+	engine->socket = -1;
+	strcpy(engine->host, "localhost.local.");
+
+	if(transport == HWMDNSTransportLoopback)
+	{
+		engine->bus = bus;
+		bus->engines[bus->count++] = engine;
+	}
+	else
+	{
+		engine->socket = HWMDNSOpenMulticastSocket();
+		if(engine->socket < 0)
+		{
+			free(engine);
+			return NULL;
+		}
+	}
+
+	return engine;
+}
+
+void HWMDNSEngineDestroy(HWMDNSEngine *engine)
+{
+	if(!engine)
+		return;
+
+	if(engine->bus)
+	{
+		HWMDNSLoopbackBus *bus = engine->bus;
+		for(int i = 0; i < bus->count; i++)
+		{
+			if(bus->engines[i] != engine)
+				continue;
+			bus->engines[i] = bus->engines[--bus->count];
+			break;
+		}
+	}
+	if(engine->socket >= 0)
+		close(engine->socket);
+	free(engine);
+}
+
+int HWMDNSEngineSocket(HWMDNSEngine *engine)
+{
+	return engine->socket;
+}
+
+void HWMDNSEngineSetHost(HWMDNSEngine *engine, const char *host, uint32_t ipv4)
+{
+	size_t length = strlen(host);
+	if(length == 0 || length + 2 > sizeof(engine->host))
+		return;
+
+	strcpy(engine->host, host);
+	if(host[length - 1] != '.')
+		strcat(engine->host, ".");
+	engine->ipv4 = ipv4;
+}
+
+int HWMDNSEngineRegister(HWMDNSEngine *engine, const char *name, const char *type, uint16_t port, const uint8_t *txt, uint16_t txtLength, double now)
+{
+	(void)now;
+	if(txtLength > HWMDNSMaxTXTLength)
+		return HWDNSNoSpace;
+
+	char typeName[HWDNSMaxNameLength];
+	char instance[HWDNSMaxNameLength];
+	if(HWMDNSMakeTypeName(type, typeName, sizeof(typeName)) != HWDNSOk)
+		return HWDNSMalformed;
+	if(HWMDNSMakeInstanceName(name, typeName, instance, sizeof(instance)) != HWDNSOk)
+		return HWDNSMalformed;
+
+	HWMDNSLocalService *service = NULL;
+	for(int i = 0; i < HWMDNSMaxServices && !service; i++)
+		if(engine->services[i].active && strcasecmp(engine->services[i].instance, instance) == 0)
+			service = &engine->services[i];
+	for(int i = 0; i < HWMDNSMaxServices && !service; i++)
+		if(!engine->services[i].active)
+			service = &engine->services[i];
+	if(!service)
+		return HWDNSNoSpace;
+
+	service->active = 1;
+	strcpy(service->instance, instance);
+	strcpy(service->type, typeName);
+	service->port = port;
+	service->txtLength = txtLength;
+	if(txtLength > 0)
+		memcpy(service->txt, txt, txtLength);
+
+	return HWMDNSAnnounce(engine, service, 1);
+}
+
+int HWMDNSEngineUnregister(HWMDNSEngine *engine, const char *name, const char *type, double now)
+{
+	(void)now;
+	char typeName[HWDNSMaxNameLength];
+	char instance[HWDNSMaxNameLength];
+	if(HWMDNSMakeTypeName(type, typeName, sizeof(typeName)) != HWDNSOk)
+		return HWDNSMalformed;
+	if(HWMDNSMakeInstanceName(name, typeName, instance, sizeof(instance)) != HWDNSOk)
+		return HWDNSMalformed;
+
+	for(int i = 0; i < HWMDNSMaxServices; i++)
+	{
+		HWMDNSLocalService *service = &engine->services[i];
+		if(!service->active || strcasecmp(service->instance, instance) != 0)
+			continue;
+		service->active = 0;
+		return HWMDNSAnnounce(engine, service, 0);
+	}
+	return HWDNSEnd;
+}
+
+int HWMDNSEngineBrowse(HWMDNSEngine *engine, const char *type)
+{
+	char typeName[HWDNSMaxNameLength];
+	if(HWMDNSMakeTypeName(type, typeName, sizeof(typeName)) != HWDNSOk)
+		return HWDNSMalformed;
+
+	HWMDNSQuestion *slot = NULL;
+	for(int i = 0; i < HWMDNSMaxQuestions; i++)
+	{
+		HWMDNSQuestion *question = &engine->questions[i];
+		if(question->active && strcasecmp(question->name, typeName) == 0)
+		{
+			question->pending = 1;
+			return HWDNSOk;
+		}
+		if(!question->active && !slot)
+			slot = question;
+	}
+	if(!slot)
+		return HWDNSNoSpace;
+
+	slot->active = 1;
+	slot->pending = 1;
+	strcpy(slot->name, typeName);
+	return HWDNSOk;
+}
+
+// Questions first, then the cached PTRs for them as known answers. When the known
+// answers don't fit, the packet goes out with TC set and the rest follow in
+// answer-only packets (RFC 6762 section 7.2).
+int HWMDNSEngineFlush(HWMDNSEngine *engine, double now)
+{
+	HWDNSWriter writer;
+	HWDNSWriterInit(&writer, engine->outgoing, sizeof(engine->outgoing), 0, 0);
+
+	int questions = 0;
+	for(int i = 0; i < HWMDNSMaxQuestions; i++)
+	{
+		HWMDNSQuestion *question = &engine->questions[i];
+		if(!question->active || !question->pending)
+			continue;
+
+		if(HWDNSWriteQuestion(&writer, question->name, HWDNSTypePTR, HWDNSClassIN) == HWDNSNoSpace)
+		{
+			HWMDNSSend(engine, engine->outgoing, HWDNSWriterFinish(&writer));
+			HWDNSWriterInit(&writer, engine->outgoing, sizeof(engine->outgoing), 0, 0);
+			if(HWDNSWriteQuestion(&writer, question->name, HWDNSTypePTR, HWDNSClassIN) != HWDNSOk)
+				continue;
+		}
+		questions++;
+		engine->statistics.questionsSent++;
+	}
+	if(questions == 0)
+		return HWDNSEnd;
+
+	for(int i = 0; i < HWMDNSMaxCacheEntries; i++)
+	{
+		HWMDNSCacheEntry *entry = &engine->cache[i];
+		if(!entry->active || entry->type != HWDNSTypePTR || HWMDNSRemaining(entry, now) <= entry->ttl / 2.0)
+			continue;
+
+		int pending = 0;
+		for(int j = 0; j < HWMDNSMaxQuestions && !pending; j++)
+			pending = engine->questions[j].active && engine->questions[j].pending && strcasecmp(engine->questions[j].name, entry->name) == 0;
+		if(!pending)
+			continue;
+
+		uint32_t ttl = (uint32_t)HWMDNSRemaining(entry, now);
+		if(HWDNSWritePTR(&writer, HWDNSSectionAnswer, entry->name, HWDNSClassIN, ttl, entry->target) == HWDNSNoSpace)
+		{
+			size_t length = HWDNSWriterFinish(&writer);
+			engine->outgoing[2] |= HWDNSFlagTruncated >> 8;
+			HWMDNSSend(engine, engine->outgoing, length);
+			HWDNSWriterInit(&writer, engine->outgoing, sizeof(engine->outgoing), 0, 0);
+			if(HWDNSWritePTR(&writer, HWDNSSectionAnswer, entry->name, HWDNSClassIN, ttl, entry->target) != HWDNSOk)
+				continue;
+		}
+		engine->statistics.knownAnswersSent++;
+	}
+
+	for(int i = 0; i < HWMDNSMaxQuestions; i++)
+		engine->questions[i].pending = 0;
+
+	return HWMDNSSend(engine, engine->outgoing, HWDNSWriterFinish(&writer));
+}
+
+int HWMDNSEngineProcessPacket(HWMDNSEngine *engine, const uint8_t *packet, size_t length, double now)
+{
+	HWDNSReader reader;
+	HWDNSRecord record;
+	int result;
+
+	if(HWDNSReaderInit(&reader, packet, length) != HWDNSOk)
+	{
+		engine->statistics.malformedPackets++;
+		return HWDNSMalformed;
+	}
+	engine->statistics.packetsReceived++;
+
+	if(!(reader.flags & HWDNSFlagResponse))
+	{
+		// Walk the whole packet first so a malformed query never gets a partial answer
+		while((result = HWDNSReaderNext(&reader, &record)) == HWDNSOk)
+			;
+		if(result == HWDNSMalformed)
+		{
+			engine->statistics.malformedPackets++;
+			return HWDNSMalformed;
+		}
+		HWMDNSAnswerQuery(engine, packet, length);
+		return HWDNSOk;
+	}
+
+	while((result = HWDNSReaderNext(&reader, &record)) == HWDNSOk)
+		if(record.section != HWDNSSectionQuestion)
+			HWMDNSCacheRecord(engine, packet, length, &record, now);
+
+	if(result == HWDNSMalformed)
+	{
+		engine->statistics.malformedPackets++;
+		return HWDNSMalformed;
+	}
+
+	// Second pass once SRV, TXT and A from the same packet are cached
+	HWDNSReaderInit(&reader, packet, length);
+	while(HWDNSReaderNext(&reader, &record) == HWDNSOk)
+	{
+		if(record.type != HWDNSTypeSRV || record.ttl == 0)
+			continue;
+
+		char instance[HWDNSMaxNameLength];
+		if(HWDNSReadName(packet, length, record.nameOffset, instance, sizeof(instance), NULL) != HWDNSOk)
+			continue;
+
+		for(int i = 0; i < HWMDNSMaxCacheEntries; i++)
+		{
+			HWMDNSCacheEntry *entry = &engine->cache[i];
+			if(entry->active && entry->type == HWDNSTypePTR && strcasecmp(entry->target, instance) == 0)
+				HWMDNSSendEvent(engine, HWMDNSServiceResolved, entry, now);
+		}
+	}
+
+	return HWDNSOk;
+}
+
+int HWMDNSEngineProcessPending(HWMDNSEngine *engine, double now)
+{
+	int count = 0;
+
+	if(engine->transport == HWMDNSTransportLoopback)
+	{
+		// Packets sent while handling these land behind them and wait for the next call
+		int waiting = engine->inboxCount;
+		while(waiting-- > 0)
+		{
+			HWMDNSPacketSlot *slot = &engine->inbox[engine->inboxHead];
+			size_t length = slot->length;
+			memcpy(engine->incoming, slot->bytes, length);
+			engine->inboxHead = (engine->inboxHead + 1) % HWMDNSInboxSlots;
+			engine->inboxCount--;
+
+			HWMDNSEngineProcessPacket(engine, engine->incoming, length, now);
+			count++;
+		}
+	}
+	else
+	{
+		for(;;)
+		{
+			ssize_t n = recv(engine->socket, engine->incoming, sizeof(engine->incoming), 0);
+			if(n < 0 && errno == EINTR)
+				continue;
+			if(n <= 0)
+				break;
+
+			HWMDNSEngineProcessPacket(engine, engine->incoming, (size_t)n, now);
+			count++;
+		}
+	}
+
+	HWMDNSExpire(engine, now);
+	return count;
+}
+
+const HWMDNSStatistics *HWMDNSEngineStatistics(HWMDNSEngine *engine)
+{
+	return &engine->statistics;
+}
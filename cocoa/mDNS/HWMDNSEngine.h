@@ -0,0 +1,107 @@
+//
+//  HWMDNSEngine.h
+//
+//  A small portable mDNS / DNS-SD querier and responder built on HWDNSPacket.
+//  It exists so discovery can run where NSNetService can't (a Linux daemon,
+//  unit tests) and so we control query batching:
+//
+//   - every pending browse question goes out in one packet
+//   - queries carry known answers, and the responder drops answers the
+//     querier already has (RFC 6762 section 7.1)
+//   - the loopback transport connects engines in-process, no network needed
+//
+//  The engine allocates its state once in HWMDNSEngineCreate. Packet handling
+//  works on fixed buffers and never touches the heap.
+//
+
+#ifndef HWMDNSENGINE_H
+#define HWMDNSENGINE_H
+
+#include "HWDNSPacket.h"
+
+#define HWMDNSPort 5353
+#define HWMDNSGroup "224.0.0.251"
+
+#define HWMDNSMaxServices 64
+#define HWMDNSMaxQuestions 32
+#define HWMDNSMaxCacheEntries 256
+#define HWMDNSMaxTXTLength 256
+#define HWMDNSMaxLoopbackPeers 8
+#define HWMDNSInboxSlots 32
+
+// TTLs recommended by RFC 6762 section 10
+#define HWMDNSHostRecordTTL 120
+#define HWMDNSServiceRecordTTL 4500
+
+typedef enum _HWMDNSTransport {
+	HWMDNSTransportMulticast = 0,
+	HWMDNSTransportLoopback = 1
+} HWMDNSTransport;
+
+typedef enum _HWMDNSEventKind {
+	HWMDNSServiceFound = 0,
+	HWMDNSServiceLost = 1,
+	HWMDNSServiceResolved = 2
+} HWMDNSEventKind;
+
+typedef struct _HWMDNSEvent {
+	HWMDNSEventKind kind;
+	const char *instance;		// full instance name, eg "Music._daap._tcp.local."
+	const char *type;			// browsed type, eg "_daap._tcp.local."
+	const char *host;			// resolved only
+	uint16_t port;				// resolved only
+	const uint8_t *txt;			// resolved only
+	uint16_t txtLength;
+	uint32_t ipv4;				// resolved only, network byte order, 0 if unknown
+} HWMDNSEvent;
+
+typedef struct _HWMDNSEngine HWMDNSEngine;
+typedef struct _HWMDNSLoopbackBus HWMDNSLoopbackBus;
+
+typedef void (*HWMDNSEventCallBack)(HWMDNSEngine *engine, const HWMDNSEvent *event, void *context);
+
+typedef struct _HWMDNSStatistics {
+	unsigned long packetsSent;
+	unsigned long packetsReceived;
+	unsigned long malformedPackets;
+	unsigned long questionsSent;
+	unsigned long knownAnswersSent;
+	unsigned long answersSent;
+	unsigned long answersSuppressed;
+} HWMDNSStatistics;
+
+// Loopback buses connect engines created with HWMDNSTransportLoopback
+HWMDNSLoopbackBus *HWMDNSLoopbackBusCreate(void);
+void HWMDNSLoopbackBusDestroy(HWMDNSLoopbackBus *bus);
+
+// bus is only used (and required) for the loopback transport. Returns NULL on failure.
+HWMDNSEngine *HWMDNSEngineCreate(HWMDNSTransport transport, HWMDNSLoopbackBus *bus, HWMDNSEventCallBack callBack, void *context);
+void HWMDNSEngineDestroy(HWMDNSEngine *engine);
+
+// Socket to watch for readability with the multicast transport, -1 for loopback
+int HWMDNSEngineSocket(HWMDNSEngine *engine);
+
+// Responder: the host name (eg "mymac.local.") and IPv4 address (network byte order) used in SRV and A records
+void HWMDNSEngineSetHost(HWMDNSEngine *engine, const char *host, uint32_t ipv4);
+
+// Responder: publishes an instance and announces it. type is like "_daap._tcp", the domain is always local.
+int HWMDNSEngineRegister(HWMDNSEngine *engine, const char *name, const char *type, uint16_t port, const uint8_t *txt, uint16_t txtLength, double now);
+
+// Responder: withdraws an instance with a goodbye packet
+int HWMDNSEngineUnregister(HWMDNSEngine *engine, const char *name, const char *type, double now);
+
+// Querier: queues a PTR question for type. Nothing is sent until HWMDNSEngineFlush.
+int HWMDNSEngineBrowse(HWMDNSEngine *engine, const char *type);
+
+// Querier: sends every queued question in as few packets as possible, with known answers
+int HWMDNSEngineFlush(HWMDNSEngine *engine, double now);
+
+// Handles one received packet
+int HWMDNSEngineProcessPacket(HWMDNSEngine *engine, const uint8_t *packet, size_t length, double now);
+
+// Reads and handles whatever is waiting on the socket or the loopback inbox. Returns the packet count.
+int HWMDNSEngineProcessPending(HWMDNSEngine *engine, double now);
+
+const HWMDNSStatistics *HWMDNSEngineStatistics(HWMDNSEngine *engine);
+
+#endif
@@ -0,0 +1,238 @@
+//
+//  mdnsbench.c
+//
+//  Exercises the mDNS engine without a network: parser throughput, a mutation
+//  fuzz pass over valid packets, and a loopback responder / querier run that
+//  checks batching and known-answer suppression. It isn't part of the app target.
+//
+//  cc -std=gnu99 -O2 -o mdnsbench mdnsbench.c HWDNSPacket.c HWMDNSEngine.c
+//  ./mdnsbench [fuzz iterations]
+//
+
+#include "HWMDNSEngine.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/time.h>
+#include <arpa/inet.h>
+
+static double HWBenchNow(void)
+{
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+// A typical browse response: 8 PTRs with SRV, TXT and A in the additional section
+static size_t HWBenchBuildResponse(uint8_t *buffer, size_t capacity)
+{
+	HWDNSWriter writer;
+	HWDNSWriterInit(&writer, buffer, capacity, 0, HWDNSFlagResponse | HWDNSFlagAuthoritative);
+
+	char instance[HWDNSMaxNameLength];
+	static const uint8_t txt[] = "\x0btxtvers=1\x0dName=Library";
+	for(int i = 0; i < 8; i++)
+	{
+		snprintf(instance, sizeof(instance), "Shared Library %d._daap._tcp.local.", i);
+		HWDNSWritePTR(&writer, HWDNSSectionAnswer, "_daap._tcp.local.", HWDNSClassIN, 4500, instance);
+	}
+	for(int i = 0; i < 8; i++)
+	{
+		snprintf(instance, sizeof(instance), "Shared Library %d._daap._tcp.local.", i);
+		HWDNSWriteSRV(&writer, HWDNSSectionAdditional, instance, HWDNSClassIN | HWDNSClassFlag, 120, 0, 0, 3689, "mymac.local.");
+		HWDNSWriteRecord(&writer, HWDNSSectionAdditional, instance, HWDNSTypeTXT, HWDNSClassIN | HWDNSClassFlag, 4500, txt, sizeof(txt) - 1);
+	}
+	uint32_t address = htonl(0xC0A80102);
+	HWDNSWriteRecord(&writer, HWDNSSectionAdditional, "mymac.local.", HWDNSTypeA, HWDNSClassIN | HWDNSClassFlag, 120, &address, 4);
+	return HWDNSWriterFinish(&writer);
+}
+
+// Walks every record and decodes every owner name, the same work the engine does per packet
+static int HWBenchParse(const uint8_t *packet, size_t length)
+{
+	HWDNSReader reader;
+	HWDNSRecord record;
+	char name[HWDNSMaxNameLength];
+	int records = 0;
+	int result;
+
+	if(HWDNSReaderInit(&reader, packet, length) != HWDNSOk)
+		return -1;
+	while((result = HWDNSReaderNext(&reader, &record)) == HWDNSOk)
+	{
+		if(HWDNSReadName(packet, length, record.nameOffset, name, sizeof(name), NULL) != HWDNSOk)
+			return -1;
+		if(record.type == HWDNSTypePTR && HWDNSReadName(packet, length, record.rdataOffset, name, sizeof(name), NULL) != HWDNSOk)
+			return -1;
+		records++;
+	}
+	return result == HWDNSMalformed ? -1 : records;
+}
+
+static int HWBenchThroughput(void)
+{
+	uint8_t packet[HWDNSMaxPacketLength];
+	size_t length = HWBenchBuildResponse(packet, sizeof(packet));
+	int records = HWBenchParse(packet, length);
+	if(records != 25)
+	{
+		printf("FAIL parse: expected 25 records, got %d\n", records);
+		return 1;
+	}
+
+	const int iterations = 200000;
+	double start = HWBenchNow();
+	long total = 0;
+	for(int i = 0; i < iterations; i++)
+		total += HWBenchParse(packet, length);
+	double elapsed = HWBenchNow() - start;
+
+	printf("parse: %zu byte packet, %d records, %.0f packets/s, %.1f MB/s (%ld)\n",
+		   length, records, iterations / elapsed, iterations * length / elapsed / 1e6, total);
+	return 0;
+}
+
+// Mutated packets must never crash the reader or the engine; ASan / UBSan builds catch the rest
+static int HWBenchFuzz(long iterations)
+{
+	uint8_t valid[HWDNSMaxPacketLength];
+	uint8_t packet[HWDNSMaxPacketLength];
+	size_t validLength = HWBenchBuildResponse(valid, sizeof(valid));
+
+	HWMDNSLoopbackBus *bus = HWMDNSLoopbackBusCreate();
+	HWMDNSEngine *engine = HWMDNSEngineCreate(HWMDNSTransportLoopback, bus, NULL, NULL);
+	HWMDNSEngineBrowse(engine, "_daap._tcp");
+	HWMDNSEngineRegister(engine, "Library", "_daap._tcp", 3689, NULL, 0, 0);
+
+	srand(1);
+	long malformed = 0;
+	for(long i = 0; i < iterations; i++)
+	{
+		size_t length = validLength;
+		memcpy(packet, valid, length);
+
+		int mutations = 1 + rand() % 8;
+		for(int m = 0; m < mutations; m++)
+		{
+			switch(rand() % 4)
+			{
+				case 0: packet[rand() % length] = (uint8_t)rand(); break;
+				case 1: packet[rand() % length] ^= 1 << (rand() % 8); break;
+				case 2: length = 1 + rand() % length; break;
+				case 3: packet[rand() % length] = 0xC0; break;
+			}
+		}
+		// Half of them as queries so the responder path sees garbage too
+		if(i & 1)
+			packet[2] &= 0x7F;
+
+		if(HWBenchParse(packet, length) < 0)
+			malformed++;
+		HWMDNSEngineProcessPacket(engine, packet, length, 0);
+		HWMDNSEngineProcessPending(engine, 0);
+	}
+
+	printf("fuzz: %ld mutated packets, %ld rejected as malformed\n", iterations, malformed);
+	HWMDNSEngineDestroy(engine);
+	HWMDNSLoopbackBusDestroy(bus);
+	return 0;
+}
+
+typedef struct _HWBenchBrowser {
+	int found;
+	int resolved;
+	int lost;
+} HWBenchBrowser;
+
+static void HWBenchEvent(HWMDNSEngine *engine, const HWMDNSEvent *event, void *context)
+{
+	(void)engine;
+	HWBenchBrowser *browser = context;
+	if(event->kind == HWMDNSServiceFound)
+		browser->found++;
+	else if(event->kind == HWMDNSServiceLost)
+		browser->lost++;
+	else if(event->port == 3689 && event->ipv4 == (uint32_t)htonl(0x7F000001))
+		browser->resolved++;
+}
+
+static void HWBenchRun(HWMDNSEngine **engines, int count, double now)
+{
+	int busy = 1;
+	while(busy)
+	{
+		busy = 0;
+		for(int i = 0; i < count; i++)
+			busy += HWMDNSEngineProcessPending(engines[i], now);
+	}
+}
+
+#define HWBenchCheck(condition, message) if(!(condition)) { printf("FAIL loopback: %s\n", message); return 1; }
+
+static int HWBenchLoopback(void)
+{
+	HWBenchBrowser browser;
+	memset(&browser, 0, sizeof(browser));
+
+	HWMDNSLoopbackBus *bus = HWMDNSLoopbackBusCreate();
+	HWMDNSEngine *responder = HWMDNSEngineCreate(HWMDNSTransportLoopback, bus, NULL, NULL);
+	HWMDNSEngine *querier = HWMDNSEngineCreate(HWMDNSTransportLoopback, bus, HWBenchEvent, &browser);
+	HWMDNSEngine *engines[2] = { responder, querier };
+	HWMDNSEngineSetHost(responder, "responder.local", htonl(0x7F000001));
+
+	const char *types[] = { "_daap._tcp", "_afpovertcp._tcp", "_http._tcp", "_ssh._tcp" };
+	char name[64];
+	for(int i = 0; i < 40; i++)
+	{
+		snprintf(name, sizeof(name), "Service.%d", i);
+		HWMDNSEngineRegister(responder, name, types[i % 4], 3689, NULL, 0, 0);
+	}
+	HWBenchRun(engines, 2, 0);
+	HWBenchCheck(browser.found == 0, "announcements for unbrowsed types were cached");
+
+	// Four browses, one query packet
+	for(int i = 0; i < 4; i++)
+		HWMDNSEngineBrowse(querier, types[i]);
+	unsigned long sentBefore = HWMDNSEngineStatistics(querier)->packetsSent;
+	HWMDNSEngineFlush(querier, 1);
+	HWBenchCheck(HWMDNSEngineStatistics(querier)->packetsSent - sentBefore == 1, "questions were not batched into one packet");
+	HWBenchRun(engines, 2, 1);
+	HWBenchCheck(browser.found == 40, "not every service was found");
+	HWBenchCheck(browser.resolved >= 40, "not every service was resolved");
+
+	// Requery with a warm cache: every answer is known, so the responder stays quiet
+	unsigned long answersBefore = HWMDNSEngineStatistics(responder)->answersSent;
+	for(int i = 0; i < 4; i++)
+		HWMDNSEngineBrowse(querier, types[i]);
+	HWMDNSEngineFlush(querier, 2);
+	HWBenchRun(engines, 2, 2);
+	HWBenchCheck(HWMDNSEngineStatistics(querier)->knownAnswersSent == 40, "known answers were not sent");
+	HWBenchCheck(HWMDNSEngineStatistics(responder)->answersSuppressed == 40, "known answers were not suppressed");
+	HWBenchCheck(HWMDNSEngineStatistics(responder)->answersSent == answersBefore, "responder answered known records");
+
+	HWMDNSEngineUnregister(responder, "Service.0", types[0], 3);
+	HWBenchRun(engines, 2, 3);
+	HWBenchCheck(browser.lost == 1, "goodbye was not seen");
+
+	// Everything else ages out
+	HWBenchRun(engines, 2, 2 + HWMDNSServiceRecordTTL + 1);
+	HWBenchCheck(browser.lost == 40, "cache entries did not expire");
+
+	printf("loopback: 40 services found and resolved, %lu known answers suppressed\n", HWMDNSEngineStatistics(responder)->answersSuppressed);
+	HWMDNSEngineDestroy(querier);
+	HWMDNSEngineDestroy(responder);
+	HWMDNSLoopbackBusDestroy(bus);
+	return 0;
+}
+
+int main(int argc, char *argv[])
+{
+	long iterations = argc > 1 ? atol(argv[1]) : 200000;
+
+	int failures = 0;
+	failures += HWBenchThroughput();
+	failures += HWBenchFuzz(iterations);
+	failures += HWBenchLoopback();
+	return failures ? 1 : 0;
+}
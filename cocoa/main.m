@@ -1,4 +1,3 @@
-
 #import <Cocoa/Cocoa.h>
 
 int main(int argc, char *argv[])